@@ -0,0 +1,210 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Queued I2C0 master transactions, run from the I2C0 interrupt.
+ *
+ * The LPC43xx I2C controller stops after every bus event with SI set
+ * and a status code in I2C0_STAT saying what happened, so each call of
+ * i2c_queue_event() handles exactly one step. Whatever has to go out
+ * next (STA, STO, a byte in DAT, AA for the next received byte) is set
+ * up through the ops before the interrupt clears SI, which lets the
+ * controller carry on.
+ *
+ * i2c_queue_tick() ends a transaction that takes longer than the
+ * timeout. I2C0 has dedicated open-drain pins which cannot be turned
+ * into GPIOs to clock a stuck slave free, so recovery is a STOP and a
+ * restart of the controller.
+ */
+
+#include <stddef.h>
+
+#include "i2c_queue.h"
+
+static const struct i2c_queue_ops *ops;
+static struct i2c_xfer *head, *tail;
+static bool busy;
+static struct i2c_queue_stats stats;
+static uint32_t timeout_ticks;
+static uint32_t ticks;
+static uint32_t started;
+
+static void i2c_queue_begin(struct i2c_xfer *x)
+{
+	x->pos = 0;
+	x->reading = (x->tx_len == 0);
+	busy = true;
+	started = ticks;
+	/* If a STOP is still pending, START follows it */
+	ops->start();
+}
+
+/* End the transaction at the head of the queue, start the next one. */
+static void i2c_queue_finish(enum i2c_xfer_status status)
+{
+	struct i2c_xfer *x = head;
+
+	busy = false;
+	stats.xfers++;
+	if (status == I2C_XFER_NACK) {
+		stats.nacks++;
+	} else if (status == I2C_XFER_BUS_ERROR) {
+		stats.bus_errors++;
+	} else if (status == I2C_XFER_TIMEOUT) {
+		stats.timeouts++;
+	}
+
+	head = x->next;
+	if (head == NULL) {
+		tail = NULL;
+	}
+	x->status = status;
+	if (x->done != NULL) {
+		x->done(x);
+	}
+
+	/* The callback may have submitted something already */
+	if ((head != NULL) && !busy) {
+		i2c_queue_begin(head);
+	}
+}
+
+/*
+ * i2c_queue_event
+ *
+ * Called from the I2C0 interrupt with the status code, I2C0_STAT & 0xf8.
+ * The interrupt clears SI afterwards, in every case.
+ */
+void i2c_queue_event(uint32_t stat)
+{
+	struct i2c_xfer *x = head;
+
+	if (!busy || (x == NULL)) {
+		/* Nothing of ours, just let the controller go on */
+		return;
+	}
+
+	switch (stat) {
+	case I2C_STAT_START:
+	case I2C_STAT_RESTART:
+		ops->write((x->addr << 1) | (x->reading ? 1 : 0));
+		ops->start_sent();
+		break;
+	case I2C_STAT_SLA_W_ACK:
+	case I2C_STAT_DATA_W_ACK:
+		if (x->pos < x->tx_len) {
+			ops->write(x->tx_buf[x->pos++]);
+		} else if (x->rx_len != 0) {
+			x->pos = 0;
+			x->reading = true;
+			ops->start();
+		} else {
+			ops->stop();
+			i2c_queue_finish(I2C_XFER_OK);
+		}
+		break;
+	case I2C_STAT_SLA_R_ACK:
+		/* ACK every byte but the last */
+		ops->ack(x->rx_len > 1);
+		break;
+	case I2C_STAT_DATA_R_ACK:
+		x->rx_buf[x->pos++] = ops->read();
+		ops->ack(x->rx_len - x->pos > 1);
+		break;
+	case I2C_STAT_DATA_R_NACK:
+		/* The last byte */
+		x->rx_buf[x->pos++] = ops->read();
+		ops->stop();
+		i2c_queue_finish(I2C_XFER_OK);
+		break;
+	case I2C_STAT_SLA_W_NACK:
+	case I2C_STAT_DATA_W_NACK:
+	case I2C_STAT_SLA_R_NACK:
+		ops->stop();
+		i2c_queue_finish(I2C_XFER_NACK);
+		break;
+	case I2C_STAT_ARB_LOST:
+	case I2C_STAT_BUS_ERROR:
+	default:
+		ops->reset();
+		i2c_queue_finish(I2C_XFER_BUS_ERROR);
+		break;
+	}
+}
+
+/*
+ * i2c_queue_tick
+ *
+ * Call at a steady rate; the timeout passed to i2c_queue_init() counts
+ * these calls.
+ */
+void i2c_queue_tick(void)
+{
+	uint32_t old = ops->lock();
+
+	ticks++;
+	if (busy && (ticks - started > timeout_ticks)) {
+		ops->reset();
+		i2c_queue_finish(I2C_XFER_TIMEOUT);
+	}
+	ops->unlock(old);
+}
+
+void i2c_queue_submit(struct i2c_xfer *xfer)
+{
+	uint32_t old = ops->lock();
+
+	xfer->status = I2C_XFER_PENDING;
+	xfer->next = NULL;
+	if (tail != NULL) {
+		tail->next = xfer;
+	} else {
+		head = xfer;
+	}
+	tail = xfer;
+
+	if (!busy) {
+		i2c_queue_begin(head);
+	}
+	ops->unlock(old);
+}
+
+bool i2c_queue_idle(void)
+{
+	return !busy;
+}
+
+void i2c_queue_get_stats(struct i2c_queue_stats *s)
+{
+	uint32_t old = ops->lock();
+
+	*s = stats;
+	ops->unlock(old);
+}
+
+/*
+ * i2c_queue_init
+ *
+ * Call after i2c0_init(), the I2C0 interrupt is enabled by the caller.
+ */
+void i2c_queue_init(const struct i2c_queue_ops *o, uint32_t timeout)
+{
+	ops = o;
+	timeout_ticks = timeout;
+	head = tail = NULL;
+	busy = false;
+}
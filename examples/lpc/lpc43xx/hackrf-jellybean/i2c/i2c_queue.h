@@ -0,0 +1,104 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef I2C_QUEUE_H
+#define I2C_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * I2C0_STAT values in master mode, what i2c_queue_event() is passed.
+ * The controller stops after each of these with SI set.
+ */
+#define I2C_STAT_BUS_ERROR	0x00
+#define I2C_STAT_START		0x08
+#define I2C_STAT_RESTART	0x10
+#define I2C_STAT_SLA_W_ACK	0x18
+#define I2C_STAT_SLA_W_NACK	0x20
+#define I2C_STAT_DATA_W_ACK	0x28
+#define I2C_STAT_DATA_W_NACK	0x30
+#define I2C_STAT_ARB_LOST	0x38
+#define I2C_STAT_SLA_R_ACK	0x40
+#define I2C_STAT_SLA_R_NACK	0x48
+#define I2C_STAT_DATA_R_ACK	0x50
+#define I2C_STAT_DATA_R_NACK	0x58
+
+enum i2c_xfer_status {
+	I2C_XFER_OK,
+	I2C_XFER_PENDING,
+	I2C_XFER_NACK,		/* address or data not acknowledged */
+	I2C_XFER_BUS_ERROR,	/* misplaced start/stop, lost arbitration */
+	I2C_XFER_TIMEOUT,
+};
+
+/*
+ * One I2C0 transaction: tx_len bytes written, then, after a repeated
+ * start, rx_len bytes read. Either length may be zero, but not both.
+ *
+ * The structure belongs to the queue from i2c_queue_submit() until the
+ * done callback, which runs in interrupt context and may submit the
+ * same transaction again.
+ */
+struct i2c_xfer {
+	uint8_t addr;			/* 7-bit */
+	const uint8_t *tx_buf;
+	uint16_t tx_len;
+	uint8_t *rx_buf;
+	uint16_t rx_len;
+	void (*done)(struct i2c_xfer *xfer);	/* may be NULL */
+	void *priv;			/* for the callback */
+	volatile enum i2c_xfer_status status;
+
+	/* Private to i2c_queue.c */
+	struct i2c_xfer *next;
+	uint16_t pos;
+	bool reading;
+};
+
+/*
+ * What the state machine needs from the controller. Keeping it behind
+ * this table keeps i2c_queue.c free of register access, so it can be
+ * run against a scripted bus model on the host.
+ */
+struct i2c_queue_ops {
+	void (*start)(void);		/* set STA, after a pending STOP */
+	void (*start_sent)(void);	/* clear STA */
+	void (*stop)(void);		/* set STO */
+	void (*write)(uint8_t byte);	/* address or data byte to DAT */
+	uint8_t (*read)(void);		/* DAT */
+	void (*ack)(bool on);		/* AA, for the next byte read */
+	void (*reset)(void);		/* STOP and restart the controller */
+	uint32_t (*lock)(void);		/* mask interrupts, old state back */
+	void (*unlock)(uint32_t state);
+};
+
+struct i2c_queue_stats {
+	uint32_t xfers;			/* completed, whatever the outcome */
+	uint32_t nacks;
+	uint32_t bus_errors;
+	uint32_t timeouts;
+};
+
+void i2c_queue_init(const struct i2c_queue_ops *ops, uint32_t timeout);
+void i2c_queue_submit(struct i2c_xfer *xfer);
+void i2c_queue_event(uint32_t stat);
+void i2c_queue_tick(void);
+bool i2c_queue_idle(void);
+void i2c_queue_get_stats(struct i2c_queue_stats *stats);
+
+#endif
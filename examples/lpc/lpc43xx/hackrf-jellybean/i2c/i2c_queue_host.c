@@ -0,0 +1,719 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks i2c_queue.c on the host:
+ *
+ *	cc -o i2c_queue_host i2c_queue_host.c i2c_queue.c
+ *	./i2c_queue_host
+ *
+ * A model of the LPC43xx I2C controller goes through the ops: it acts
+ * on STA, STO, AA and DAT the way the controller does once SI is
+ * cleared, and comes back with the next status code. Slaves on the
+ * scripted bus acknowledge or not, take and give bytes, and the script
+ * can make the bus lose arbitration, see a bus error or hang. Every
+ * transaction leaves a trace of what went over the bus, which is
+ * compared with what should have:
+ *
+ *	S, Sr, P	start, repeated start, stop
+ *	c0		a byte sent, the address byte after a start
+ *	<10		a byte received
+ *	a, n		ack, nack of the byte before
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c_queue.h"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static void check_trace(const char *got, const char *want,
+			const char *what)
+{
+	checks++;
+	if (strcmp(got, want) != 0) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s\n  got: %s\n want: %s\n", what, got,
+			       want);
+		}
+	}
+}
+
+static uint32_t rnd_state = 5;
+
+static uint32_t rnd(uint32_t n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 16) % n;
+}
+
+struct slave {
+	uint8_t addr;
+	uint8_t reg[256];
+	uint8_t ptr;
+	int nack_after;		/* data bytes taken before a NACK, or -1 */
+	int taken;
+};
+
+enum phase {
+	PH_IDLE,		/* bus free, or ours but nothing to do */
+	PH_ADDR,		/* after a start, SLA+R/W goes next */
+	PH_TX,
+	PH_RX,
+	PH_HALT,		/* after a NACK, needs STO or STA */
+};
+
+static struct ctl {
+	int sta, sto, aa;
+	uint8_t dat;
+	int dat_new;
+	int owner;
+	enum phase phase;
+	struct slave *sel;
+	uint32_t events;
+	uint32_t fault_at;	/* event number to fault at, 0 for none */
+	uint32_t fault_stat;
+	uint32_t hang_at;	/* event number the bus hangs at */
+	int violations;
+	char trace[4096];
+	struct slave *slaves[4];
+} ctl;
+
+static void trace(const char *s)
+{
+	if (strlen(ctl.trace) + strlen(s) + 2 < sizeof(ctl.trace)) {
+		if (ctl.trace[0]) {
+			strcat(ctl.trace, " ");
+		}
+		strcat(ctl.trace, s);
+	}
+}
+
+static void trace_byte(const char *fmt, uint8_t b)
+{
+	char buf[8];
+
+	snprintf(buf, sizeof(buf), fmt, b);
+	trace(buf);
+}
+
+static void op_start(void)
+{
+	ctl.sta = 1;
+}
+
+static void op_start_sent(void)
+{
+	ctl.sta = 0;
+}
+
+static void op_stop(void)
+{
+	ctl.sto = 1;
+}
+
+static void op_write(uint8_t byte)
+{
+	ctl.dat = byte;
+	ctl.dat_new = 1;
+}
+
+static uint8_t op_read(void)
+{
+	return ctl.dat;
+}
+
+static void op_ack(bool on)
+{
+	ctl.aa = on;
+}
+
+static void op_reset(void)
+{
+	trace("reset");
+	ctl.sta = ctl.sto = ctl.aa = 0;
+	ctl.owner = 0;
+	ctl.phase = PH_IDLE;
+	ctl.dat_new = 0;
+}
+
+static int locked;
+
+static uint32_t op_lock(void)
+{
+	return locked++;
+}
+
+static void op_unlock(uint32_t state)
+{
+	locked = state;
+}
+
+static const struct i2c_queue_ops ops = {
+	.start = op_start,
+	.start_sent = op_start_sent,
+	.stop = op_stop,
+	.write = op_write,
+	.read = op_read,
+	.ack = op_ack,
+	.reset = op_reset,
+	.lock = op_lock,
+	.unlock = op_unlock,
+};
+
+static struct slave *find(uint8_t addr)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (ctl.slaves[i] && ctl.slaves[i]->addr == addr) {
+			return ctl.slaves[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The controller with SI clear: does what STO, STA, DAT and AA say and
+ * returns 1 with the next status code in *stat, or 0 if it has nothing
+ * to do, or is waiting on a hung bus.
+ */
+static int step(uint32_t *stat)
+{
+	uint8_t b;
+
+	if (ctl.sto) {
+		trace("P");
+		ctl.sto = 0;
+		ctl.owner = 0;
+		ctl.phase = PH_IDLE;
+	}
+	if (!ctl.sta && ctl.phase == PH_IDLE) {
+		return 0;
+	}
+	if (ctl.hang_at && ctl.events + 1 >= ctl.hang_at) {
+		return 0;
+	}
+	ctl.events++;
+	if (ctl.fault_at && ctl.events == ctl.fault_at) {
+		*stat = ctl.fault_stat;
+		trace(ctl.fault_stat ? "lost" : "berr");
+		/* either way the bus is no longer ours */
+		ctl.owner = 0;
+		ctl.phase = PH_HALT;
+		return 1;
+	}
+	if (ctl.sta) {
+		trace(ctl.owner ? "Sr" : "S");
+		*stat = ctl.owner ? I2C_STAT_RESTART : I2C_STAT_START;
+		ctl.owner = 1;
+		ctl.phase = PH_ADDR;
+		ctl.dat_new = 0;
+		return 1;
+	}
+
+	switch (ctl.phase) {
+	case PH_ADDR:
+		if (!ctl.dat_new) {
+			ctl.violations++;
+			return 0;
+		}
+		ctl.dat_new = 0;
+		trace_byte("%02x", ctl.dat);
+		ctl.sel = find(ctl.dat >> 1);
+		if (ctl.sel == NULL) {
+			trace("n");
+			*stat = (ctl.dat & 1) ? I2C_STAT_SLA_R_NACK :
+						I2C_STAT_SLA_W_NACK;
+			ctl.phase = PH_HALT;
+			return 1;
+		}
+		trace("a");
+		ctl.sel->taken = 0;
+		if (ctl.dat & 1) {
+			*stat = I2C_STAT_SLA_R_ACK;
+			ctl.phase = PH_RX;
+		} else {
+			*stat = I2C_STAT_SLA_W_ACK;
+			ctl.phase = PH_TX;
+		}
+		return 1;
+	case PH_TX:
+		if (!ctl.dat_new) {
+			ctl.violations++;
+			return 0;
+		}
+		ctl.dat_new = 0;
+		trace_byte("%02x", ctl.dat);
+		if (ctl.sel->nack_after >= 0 &&
+		    ctl.sel->taken >= ctl.sel->nack_after) {
+			trace("n");
+			*stat = I2C_STAT_DATA_W_NACK;
+			ctl.phase = PH_HALT;
+			return 1;
+		}
+		/* the first byte sets the register pointer */
+		if (ctl.sel->taken++ == 0) {
+			ctl.sel->ptr = ctl.dat;
+		} else {
+			ctl.sel->reg[ctl.sel->ptr++] = ctl.dat;
+		}
+		trace("a");
+		*stat = I2C_STAT_DATA_W_ACK;
+		return 1;
+	case PH_RX:
+		if (ctl.dat_new) {
+			/* a byte written while reading goes nowhere */
+			ctl.violations++;
+		}
+		b = ctl.sel->reg[ctl.sel->ptr++];
+		ctl.dat = b;
+		trace_byte("<%02x", b);
+		trace(ctl.aa ? "a" : "n");
+		if (ctl.aa) {
+			*stat = I2C_STAT_DATA_R_ACK;
+		} else {
+			*stat = I2C_STAT_DATA_R_NACK;
+			ctl.phase = PH_HALT;
+		}
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Run the bus until it stops, each event through the interrupt. No
+ * transaction here takes anything like 200 events, more is a loop.
+ */
+static void run(void)
+{
+	uint32_t stat;
+	int n = 0;
+
+	while (step(&stat)) {
+		if (n++ == 200) {
+			ctl.violations++;
+			break;
+		}
+		i2c_queue_event(stat);
+		/* the interrupt clears SI on the way out */
+	}
+}
+
+static struct slave clock_chip, eeprom;
+static struct i2c_queue_stats base;
+
+static void bus_init(void)
+{
+	uint32_t i;
+
+	memset(&ctl, 0, sizeof(ctl));
+	memset(&clock_chip, 0, sizeof(clock_chip));
+	memset(&eeprom, 0, sizeof(eeprom));
+	clock_chip.addr = 0x60;
+	clock_chip.nack_after = -1;
+	clock_chip.reg[0] = 0x10;
+	eeprom.addr = 0x50;
+	eeprom.nack_after = -1;
+	for (i = 0; i < 256; i++) {
+		eeprom.reg[i] = i ^ 0x5a;
+	}
+	ctl.slaves[0] = &clock_chip;
+	ctl.slaves[1] = &eeprom;
+	i2c_queue_init(&ops, 10);
+	i2c_queue_get_stats(&base);
+}
+
+/* The statistics since bus_init(), they are kept over i2c_queue_init() */
+static void stats(struct i2c_queue_stats *st)
+{
+	i2c_queue_get_stats(st);
+	st->xfers -= base.xfers;
+	st->nacks -= base.nacks;
+	st->bus_errors -= base.bus_errors;
+	st->timeouts -= base.timeouts;
+}
+
+/* What the done callbacks saw */
+static struct i2c_xfer *done_order[16];
+static int done_count;
+
+static void done(struct i2c_xfer *x)
+{
+	if (done_count < 16) {
+		done_order[done_count] = x;
+	}
+	done_count++;
+}
+
+static void xfer_init(struct i2c_xfer *x, uint8_t addr, const uint8_t *tx,
+		      uint16_t tx_len, uint8_t *rx, uint16_t rx_len)
+{
+	memset(x, 0, sizeof(*x));
+	x->addr = addr;
+	x->tx_buf = tx;
+	x->tx_len = tx_len;
+	x->rx_buf = rx;
+	x->rx_len = rx_len;
+	x->done = done;
+}
+
+/* The Si5351C status read of i2cdemo.c */
+static void test_demo_read(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t status = 0;
+	struct i2c_xfer x;
+	struct i2c_queue_stats st;
+
+	bus_init();
+	done_count = 0;
+	xfer_init(&x, 0x60, &reg, 1, &status, 1);
+	i2c_queue_submit(&x);
+	check(!i2c_queue_idle() && x.status == I2C_XFER_PENDING, "pending",
+	      x.status, 0);
+	run();
+	check_trace(ctl.trace, "S c0 a 00 a Sr c1 a <10 n P", "demo read");
+	check(x.status == I2C_XFER_OK && status == 0x10, "demo status",
+	      x.status, status);
+	check(i2c_queue_idle() && done_count == 1, "demo done", done_count,
+	      1);
+	check(ctl.violations == 0 && locked == 0, "demo clean",
+	      ctl.violations, locked);
+	stats(&st);
+	check(st.xfers == 1 && st.nacks == 0 && st.bus_errors == 0 &&
+	      st.timeouts == 0, "demo stats", st.xfers, st.nacks);
+}
+
+/* Every mix of write and read lengths, with guards round the buffer */
+static void test_lengths(void)
+{
+	uint8_t tx[8], rx[10];
+	struct i2c_xfer x;
+	int t, r, i, bad;
+
+	for (t = 0; t <= 4; t++) {
+		for (r = 0; r <= 5; r++) {
+			if (t == 0 && r == 0) {
+				continue;
+			}
+			bus_init();
+			done_count = 0;
+			tx[0] = 0x20;
+			for (i = 1; i < 8; i++) {
+				tx[i] = 0xa0 + i;
+			}
+			memset(rx, 0xee, sizeof(rx));
+			eeprom.ptr = 0x20;
+			xfer_init(&x, 0x50, tx, t, rx + 2, r);
+			i2c_queue_submit(&x);
+			run();
+
+			bad = x.status != I2C_XFER_OK || done_count != 1 ||
+			      ctl.violations != 0;
+			/* what was written, from the register in byte 0 */
+			for (i = 1; i < t; i++) {
+				bad |= eeprom.reg[0x20 + i - 1] != tx[i];
+			}
+			/* read back from where the pointer was left */
+			for (i = 0; i < r; i++) {
+				uint8_t at = 0x20 + (t ? t - 1 : 0) + i;
+				uint8_t want = (t > 1 && at < 0x20 + t - 1) ?
+					tx[at - 0x20 + 1] : (at ^ 0x5a);
+
+				bad |= rx[2 + i] != want;
+			}
+			bad |= rx[0] != 0xee || rx[1] != 0xee ||
+			       rx[2 + r] != 0xee || rx[3 + r] != 0xee;
+			check(!bad, "lengths", t, r);
+		}
+	}
+
+	/* the traces of a two byte write and a three byte read */
+	bus_init();
+	tx[0] = 0x07;
+	tx[1] = 0x99;
+	xfer_init(&x, 0x50, tx, 2, NULL, 0);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(ctl.trace, "S a0 a 07 a 99 a P", "write trace");
+	bus_init();
+	eeprom.ptr = 0x10;
+	xfer_init(&x, 0x50, NULL, 0, rx, 3);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(ctl.trace, "S a1 a <4a a <4b a <48 n P", "read trace");
+}
+
+static void test_nack(void)
+{
+	static const uint8_t tx[3] = { 1, 2, 3 };
+	uint8_t rx[2];
+	struct i2c_xfer x;
+	struct i2c_queue_stats st;
+
+	/* nobody there */
+	bus_init();
+	xfer_init(&x, 0x33, tx, 1, rx, 1);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(ctl.trace, "S 66 n P", "address nack");
+	check(x.status == I2C_XFER_NACK, "address nack status", x.status,
+	      I2C_XFER_NACK);
+
+	/* the slave refuses the third byte */
+	bus_init();
+	eeprom.nack_after = 2;
+	xfer_init(&x, 0x50, tx, 3, NULL, 0);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(ctl.trace, "S a0 a 01 a 02 a 03 n P", "data nack");
+	check(x.status == I2C_XFER_NACK, "data nack status", x.status,
+	      I2C_XFER_NACK);
+
+	/* there for writing, gone for reading */
+	bus_init();
+	xfer_init(&x, 0x50, tx, 1, rx, 2);
+	i2c_queue_submit(&x);
+	ctl.slaves[1] = NULL;
+	ctl.slaves[2] = &eeprom;
+	eeprom.addr = 0x50;
+	run();
+	check(x.status == I2C_XFER_OK, "still there", x.status, 0);
+
+	stats(&st);
+	check(st.xfers == 1 && st.nacks == 0, "nack stats", st.xfers,
+	      st.nacks);
+}
+
+/*
+ * Arbitration lost and a bus error, at every step of a transaction. The
+ * controller is reset, the transaction fails and the one queued behind
+ * it goes through cleanly.
+ */
+static void test_faults(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t rx[3], status;
+	struct i2c_xfer x, y;
+	struct i2c_queue_stats st;
+	uint32_t at;
+	int f, bad;
+
+	for (f = 0; f < 2; f++) {
+		for (at = 1; at <= 7; at++) {
+			bus_init();
+			done_count = 0;
+			ctl.fault_at = at;
+			ctl.fault_stat = f ? I2C_STAT_ARB_LOST :
+					     I2C_STAT_BUS_ERROR;
+			xfer_init(&x, 0x50, &reg, 1, rx, 3);
+			xfer_init(&y, 0x60, &reg, 1, &status, 1);
+			i2c_queue_submit(&x);
+			i2c_queue_submit(&y);
+			run();
+
+			bad = x.status != I2C_XFER_BUS_ERROR ||
+			      y.status != I2C_XFER_OK || status != 0x10 ||
+			      done_count != 2 || done_order[0] != &x ||
+			      done_order[1] != &y || ctl.violations != 0;
+			check(!bad, f ? "arbitration lost" : "bus error", at,
+			      x.status);
+			check(strstr(ctl.trace, "reset S c0 a 00 a Sr c1 a "
+				     "<10 n P") != NULL, "after the fault",
+			      f, at);
+			stats(&st);
+			check(st.bus_errors == 1 && st.xfers == 2,
+			      "fault stats", st.bus_errors, st.xfers);
+		}
+	}
+}
+
+/* A hung bus is given up after the timeout, not before */
+static void test_timeout(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t status;
+	struct i2c_xfer x, y;
+	struct i2c_queue_stats st;
+	int i;
+
+	bus_init();
+	done_count = 0;
+	ctl.hang_at = 3;
+	xfer_init(&x, 0x60, &reg, 1, &status, 1);
+	xfer_init(&y, 0x60, &reg, 1, &status, 1);
+	i2c_queue_submit(&x);
+	i2c_queue_submit(&y);
+	run();
+	for (i = 0; i < 10; i++) {
+		i2c_queue_tick();
+	}
+	check(x.status == I2C_XFER_PENDING, "not yet", x.status, i);
+	i2c_queue_tick();
+	check(x.status == I2C_XFER_TIMEOUT, "timed out", x.status, i);
+	check(strstr(ctl.trace, "reset") != NULL, "timeout reset", 0, 0);
+
+	/* the bus is back, the next one goes through */
+	ctl.hang_at = 0;
+	run();
+	check(y.status == I2C_XFER_OK && status == 0x10, "after timeout",
+	      y.status, status);
+	stats(&st);
+	check(st.timeouts == 1 && st.xfers == 2 && locked == 0,
+	      "timeout stats", st.timeouts, st.xfers);
+
+	/* a transaction that finishes in time is not timed out later */
+	for (i = 0; i < 20; i++) {
+		i2c_queue_tick();
+	}
+	check(y.status == I2C_XFER_OK, "no late timeout", y.status, 0);
+}
+
+/* The done callback submits the same transaction again */
+static int again;
+
+static void resubmit(struct i2c_xfer *x)
+{
+	if (again-- > 0) {
+		i2c_queue_submit(x);
+	}
+}
+
+static void test_queue(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t status[3];
+	struct i2c_xfer x[3];
+	struct i2c_queue_stats st;
+	int i;
+
+	bus_init();
+	done_count = 0;
+	for (i = 0; i < 3; i++) {
+		xfer_init(&x[i], i == 1 ? 0x33 : 0x60, &reg, 1, &status[i],
+			  1);
+		i2c_queue_submit(&x[i]);
+	}
+	run();
+	check(done_count == 3 && done_order[0] == &x[0] &&
+	      done_order[1] == &x[1] && done_order[2] == &x[2],
+	      "in order", done_count, 3);
+	check(x[0].status == I2C_XFER_OK && x[1].status == I2C_XFER_NACK &&
+	      x[2].status == I2C_XFER_OK, "statuses", x[1].status, 0);
+	/* a stop, then straight into the next start */
+	check_trace(ctl.trace, "S c0 a 00 a Sr c1 a <10 n P S 66 n P "
+		    "S c0 a 00 a Sr c1 a <10 n P", "queue trace");
+
+	bus_init();
+	again = 4;
+	xfer_init(&x[0], 0x60, &reg, 1, &status[0], 1);
+	x[0].done = resubmit;
+	i2c_queue_submit(&x[0]);
+	run();
+	stats(&st);
+	check(st.xfers == 5 && i2c_queue_idle() && again == -1,
+	      "resubmitted", st.xfers, again);
+
+	/* stray status codes while idle touch nothing */
+	ctl.trace[0] = 0;
+	i2c_queue_event(I2C_STAT_DATA_R_ACK);
+	i2c_queue_event(I2C_STAT_BUS_ERROR);
+	check(ctl.trace[0] == 0 && !ctl.sta && !ctl.sto && !ctl.dat_new,
+	      "idle", ctl.sta, ctl.sto);
+}
+
+/*
+ * Random transactions on a random bus: missing slaves, refused bytes
+ * and faults. Each must end the way the bus says it should.
+ */
+static void test_random(void)
+{
+	uint8_t tx[6], rx[8];
+	struct i2c_xfer x;
+	int round, bad = 0, t, r, i;
+	enum i2c_xfer_status want;
+	struct i2c_queue_stats st;
+	uint32_t ok = 0, nack = 0, err = 0;
+
+	bus_init();
+	for (round = 0; round < 20000; round++) {
+		ctl.trace[0] = 0;
+		ctl.fault_at = 0;
+		eeprom.nack_after = -1;
+		t = rnd(5);
+		r = t ? rnd(6) : 1 + rnd(5);
+		for (i = 0; i < t; i++) {
+			tx[i] = rnd(256);
+		}
+		memset(rx, 0xee, sizeof(rx));
+		xfer_init(&x, rnd(4) ? 0x50 : 0x51, tx, t, rx + 1, r);
+		want = x.addr == 0x50 ? I2C_XFER_OK : I2C_XFER_NACK;
+		if (t > 1 && rnd(4) == 0) {
+			eeprom.nack_after = rnd(t - 1);
+			want = I2C_XFER_NACK;
+		}
+		if (want == I2C_XFER_OK && rnd(8) == 0) {
+			ctl.fault_at = ctl.events + 1 + rnd(t + r + 2);
+			ctl.fault_stat = rnd(2) ? I2C_STAT_ARB_LOST :
+						  I2C_STAT_BUS_ERROR;
+			want = I2C_XFER_BUS_ERROR;
+		}
+		i2c_queue_submit(&x);
+		run();
+		bad += x.status != want || rx[0] != 0xee ||
+		       rx[1 + r] != 0xee || ctl.violations != 0 ||
+		       !i2c_queue_idle();
+		ok += x.status == I2C_XFER_OK;
+		nack += x.status == I2C_XFER_NACK;
+		err += x.status == I2C_XFER_BUS_ERROR;
+	}
+	stats(&st);
+	check(bad == 0, "random", bad, 0);
+	check(st.xfers == 20000 && st.nacks == nack && st.bus_errors == err,
+	      "random stats", st.nacks, nack);
+	check(ok > 10000 && nack > 1000 && err > 500, "random exercised",
+	      nack, err);
+}
+
+int main(void)
+{
+	test_demo_read();
+	test_lengths();
+	test_nack();
+	test_faults();
+	test_timeout();
+	test_queue();
+	test_random();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
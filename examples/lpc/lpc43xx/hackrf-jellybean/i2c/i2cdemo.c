@@ -20,8 +20,14 @@
 
 #include <libopencm3/lpc43xx/gpio.h>
 #include <libopencm3/lpc43xx/i2c.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
 
 #include "../jellybean_conf.h"
+#include "i2c_queue.h"
+
+/* Main loop passes before a transaction is given up */
+#define I2C_TIMEOUT_LOOPS	100
 
 static void gpio_setup(void)
 {
@@ -52,53 +58,125 @@ static void gpio_setup(void)
 	GPIO3_DIR |= PIN_EN1V8; /* GPIO3[6] on P6_10  as output. */
 }
 
-#define SI5351C_I2C_ADDR (0x60 << 1)
+/*
+ * The i2c_queue controller operations for I2C0.
+ */
+static void i2c_op_start(void)
+{
+	I2C0_CONSET = I2C_CONSET_STA;
+}
+
+static void i2c_op_start_sent(void)
+{
+	I2C0_CONCLR = I2C_CONCLR_STAC;
+}
+
+static void i2c_op_stop(void)
+{
+	I2C0_CONSET = I2C_CONSET_STO;
+}
+
+static void i2c_op_write(uint8_t byte)
+{
+	I2C0_DAT = byte;
+}
+
+static uint8_t i2c_op_read(void)
+{
+	return I2C0_DAT;
+}
 
-/* write to single register */
-/* Not used!
-static void si5351c_write_reg(uint8_t reg, uint8_t val)
+static void i2c_op_ack(bool on)
 {
-	i2c0_tx_start();
-	i2c0_tx_byte(SI5351C_I2C_ADDR | I2C_WRITE);
-	i2c0_tx_byte(reg);
-	i2c0_tx_byte(val);
-	i2c0_stop();
+	if (on)
+		I2C0_CONSET = I2C_CONSET_AA;
+	else
+		I2C0_CONCLR = I2C_CONCLR_AAC;
 }
-*/
 
-/* read single register */
-static uint8_t si5351c_read_reg(uint8_t reg)
+static void i2c_op_reset(void)
 {
-	uint8_t val;
+	I2C0_CONSET = I2C_CONSET_STO;
+	I2C0_CONCLR = I2C_CONCLR_AAC | I2C_CONCLR_SIC | I2C_CONCLR_STAC |
+		      I2C_CONCLR_I2ENC;
+	I2C0_CONSET = I2C_CONSET_I2EN;
+}
 
-	/* set register address with write */
-	i2c0_tx_start();
-	i2c0_tx_byte(SI5351C_I2C_ADDR | I2C_WRITE);
-	i2c0_tx_byte(reg);
+static uint32_t i2c_op_lock(void)
+{
+	return cm_mask_interrupts(1);
+}
 
-	/* read the value */
-	i2c0_tx_start();
-	i2c0_tx_byte(SI5351C_I2C_ADDR | I2C_READ);
-	val = i2c0_rx_byte();
-	i2c0_stop();
+static void i2c_op_unlock(uint32_t state)
+{
+	cm_mask_interrupts(state);
+}
 
-	return val;
+static const struct i2c_queue_ops i2c0_ops = {
+	.start = i2c_op_start,
+	.start_sent = i2c_op_start_sent,
+	.stop = i2c_op_stop,
+	.write = i2c_op_write,
+	.read = i2c_op_read,
+	.ack = i2c_op_ack,
+	.reset = i2c_op_reset,
+	.lock = i2c_op_lock,
+	.unlock = i2c_op_unlock,
+};
+
+/* One step of the transaction per status code, then let the bus go on */
+void i2c0_isr(void)
+{
+	i2c_queue_event(I2C0_STAT & 0xf8);
+	I2C0_CONCLR = I2C_CONCLR_SIC;
 }
 
+#define SI5351C_I2C_ADDR 0x60
+
+/*
+ * Read the device status register: the register number is written,
+ * then the value read after a repeated start. The interrupt fills in
+ * si5351c_status and the main loop only looks at the result.
+ */
+static const uint8_t si5351c_reg = 0;
+static uint8_t si5351c_status;
+
+static struct i2c_xfer si5351c_read = {
+	.addr = SI5351C_I2C_ADDR,
+	.tx_buf = &si5351c_reg, .tx_len = 1,
+	.rx_buf = &si5351c_status, .rx_len = 1,
+};
+
 int main(void)
 {
 	int i;
 
 	gpio_setup();
 	i2c0_init();
+	i2c_queue_init(&i2c0_ops, I2C_TIMEOUT_LOOPS);
+	nvic_enable_irq(NVIC_I2C0_IRQ);
 
 	gpio_set(PORT_EN1V8, PIN_EN1V8); /* 1V8 on */
 
+	i2c_queue_submit(&si5351c_read);
 	while (1) {
-		if (si5351c_read_reg(0) == 0x10)
-			gpio_set(GPIO2, GPIOPIN1); /* LED on */
-		else
-			gpio_clear(GPIO2, GPIOPIN1); /* LED off */
+		i2c_queue_tick();
+
+		if (si5351c_read.status != I2C_XFER_PENDING) {
+			if ((si5351c_read.status == I2C_XFER_OK) &&
+			    (si5351c_status == 0x10))
+				gpio_set(GPIO2, GPIOPIN1); /* LED on */
+			else
+				gpio_clear(GPIO2, GPIOPIN1); /* LED off */
+
+			/* NACK, bus error or timeout on LED2 */
+			if (si5351c_read.status != I2C_XFER_OK)
+				gpio_set(GPIO2, GPIOPIN2);
+			else
+				gpio_clear(GPIO2, GPIOPIN2);
+
+			i2c_queue_submit(&si5351c_read);
+		}
 
 		for (i = 0; i < 1000; i++)    /* Wait a bit. */
 			__asm__("nop");
@@ -18,42 +18,149 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * stdio over USART1 using newlib's fopencookie().
+ *
+ * Both directions go through interrupt driven ring buffers. The FILE is
+ * line buffered, so a whole fprintf() line arrives in the cookie write
+ * function at once and is copied into the transmit ring in one go, the
+ * USART interrupt then drains it while the CPU does something else.
+ *
+ * Once a second the example prints the characters per second that
+ * actually left the USART and the number of CPU cycles the last
+ * fprintf() call took, counted with SysTick.
+ */
+
 #define _GNU_SOURCE
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stddef.h>
 #include <sys/types.h>
 
+/* Ring sizes must be powers of two */
+#define TX_RING_SIZE	256
+#define RX_RING_SIZE	64
+#define STDIO_BUF_SIZE	128
+
+struct usart_cookie {
+	uint32_t dev;
+	uint32_t rx_timeout;	/* ms to wait in read, 0 polls */
+};
+
+static uint8_t tx_ring[TX_RING_SIZE];
+static volatile uint32_t tx_head, tx_tail;
+static uint8_t rx_ring[RX_RING_SIZE];
+static volatile uint32_t rx_head, rx_tail;
+
+/* Benchmark counters */
+static volatile uint32_t tx_count;
+static volatile uint32_t rx_dropped;
+static volatile uint32_t system_millis;
+
+static char stdio_buf[STDIO_BUF_SIZE];
+
 static ssize_t _iord(void *_cookie, char *_buf, size_t _n);
 static ssize_t _iowr(void *_cookie, const char *_buf, size_t _n);
 
+void sys_tick_handler(void)
+{
+	system_millis++;
+}
+
+/*
+ * CPU cycles since boot, SysTick counts down from the reload value and
+ * the millisecond counter tells us how often it wrapped. Read the
+ * counter twice in case it wraps under us.
+ */
+static uint32_t cycles(void)
+{
+	uint32_t ms, val;
+
+	do {
+		ms = system_millis;
+		val = systick_get_value();
+	} while (ms != system_millis);
+
+	return ms * (rcc_ahb_frequency / 1000) +
+		(rcc_ahb_frequency / 1000 - 1 - val);
+}
+
+void usart1_isr(void)
+{
+	uint32_t isr = USART_ISR(USART1);
+
+	if (isr & USART_ISR_ORE) {
+		USART_ICR(USART1) = USART_ICR_ORECF;
+		rx_dropped++;
+	}
+
+	if (isr & USART_ISR_RXNE) {
+		uint8_t c = usart_recv(USART1);
+
+		if (rx_head - rx_tail < RX_RING_SIZE) {
+			rx_ring[rx_head % RX_RING_SIZE] = c;
+			rx_head++;
+		} else {
+			rx_dropped++;
+		}
+	}
+
+	if ((USART_CR1(USART1) & USART_CR1_TXEIE) && (isr & USART_ISR_TXE)) {
+		if (tx_tail != tx_head) {
+			usart_send(USART1, tx_ring[tx_tail % TX_RING_SIZE]);
+			tx_tail++;
+			tx_count++;
+		} else {
+			usart_disable_tx_interrupt(USART1);
+		}
+	}
+}
+
 static ssize_t _iord(void *_cookie, char *_buf, size_t _n)
 {
-	/* dont support reading now */
-	(void)_cookie;
-	(void)_buf;
-	(void)_n;
-	return 0;
+	struct usart_cookie *cookie = _cookie;
+	uint32_t start = system_millis;
+	size_t n = 0;
+
+	/* Wait for the first byte, then take whatever else is there */
+	while (rx_head == rx_tail) {
+		if (system_millis - start >= cookie->rx_timeout) {
+			return 0;
+		}
+	}
+	while ((n < _n) && (rx_head != rx_tail)) {
+		_buf[n++] = rx_ring[rx_tail % RX_RING_SIZE];
+		rx_tail++;
+	}
+	return n;
 }
 
 static ssize_t _iowr(void *_cookie, const char *_buf, size_t _n)
 {
-	uint32_t dev = (uint32_t)_cookie;
-
-	int written = 0;
-	while (_n-- > 0) {
-		usart_send_blocking(dev, *_buf++);
-		written++;
-	};
-	return written;
+	struct usart_cookie *cookie = _cookie;
+	size_t n = 0;
+
+	while (n < _n) {
+		/* Copy as much as fits, only wait if the ring is full */
+		while ((n < _n) && (tx_head - tx_tail < TX_RING_SIZE)) {
+			tx_ring[tx_head % TX_RING_SIZE] = _buf[n++];
+			tx_head++;
+		}
+		usart_enable_tx_interrupt(cookie->dev);
+	}
+	return n;
 }
 
 
-static FILE *usart_setup(uint32_t dev)
+static void usart_setup(struct usart_cookie *cookie, FILE **in, FILE **out)
 {
+	uint32_t dev = cookie->dev;
+
 	/* Setup USART2 parameters. */
 	usart_set_baudrate(dev, 38400);
 	usart_set_databits(dev, 8);
@@ -62,25 +169,41 @@ static FILE *usart_setup(uint32_t dev)
 	usart_set_mode(dev, USART_MODE_TX_RX);
 	usart_set_flow_control(dev, USART_FLOWCONTROL_NONE);
 
+	/* Receive is always on, transmit is enabled when there is data. */
+	nvic_enable_irq(NVIC_USART1_IRQ);
+	usart_enable_rx_interrupt(dev);
+
 	/* Finally enable the USART. */
 	usart_enable(dev);
 
+	/*
+	 * Separate streams for each direction, so writing doesn't throw
+	 * away characters sitting in the read buffer.
+	 */
 	cookie_io_functions_t stub = { _iord, _iowr, NULL, NULL };
-	FILE *fp = fopencookie((void *)dev, "rw+", stub);
-	/* Do not buffer the serial line */
-	setvbuf(fp, NULL, _IONBF, 0);
-	return fp;
+	*in = fopencookie(cookie, "r", stub);
+	*out = fopencookie(cookie, "w", stub);
+	/* Line buffered, each line reaches the ring in one write. */
+	setvbuf(*out, stdio_buf, _IOLBF, STDIO_BUF_SIZE);
 
 }
 
 static void clock_setup(void)
 {
+	rcc_clock_setup_in_hsi_out_48mhz();
+
 	/* Enable GPIOC clock for LED & USARTs. */
 	rcc_periph_clock_enable(RCC_GPIOC);
 	rcc_periph_clock_enable(RCC_GPIOA);
 
 	/* Enable clocks for USART2. */
 	rcc_periph_clock_enable(RCC_USART1);
+
+	/* 1ms SysTick at the core clock, also used to count cycles */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB);
+	systick_set_reload(rcc_ahb_frequency / 1000 - 1);
+	systick_interrupt_enable();
+	systick_counter_enable();
 }
 
 static void gpio_setup(void)
@@ -88,33 +211,52 @@ static void gpio_setup(void)
 	/* Setup GPIO pin GPIO8/9 on GPIO port C for LEDs. */
 	gpio_mode_setup(GPIOC, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE, GPIO8 | GPIO9);
 
-	/* Setup GPIO pins for USART2 transmit. */
-	gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO9);
+	/* Setup GPIO pins for USART1 transmit and receive. */
+	gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO9 | GPIO10);
 
-	/* Setup USART1 TX pin as alternate function. */
-	gpio_set_af(GPIOA, GPIO_AF1, GPIO9);
+	/* Setup USART1 TX and RX pins as alternate function. */
+	gpio_set_af(GPIOA, GPIO_AF1, GPIO9 | GPIO10);
 }
 
 int main(void)
 {
-	int i, c = 0;
-	FILE *fp;
+	struct usart_cookie cookie = { USART1, 0 };
+	uint32_t t0, dt = 0, next_stat, tx_last = 0;
+	int c = 0, ch;
+	FILE *in, *fp;
 
 	clock_setup();
 	gpio_setup();
-	fp = usart_setup(USART1);
+	usart_setup(&cookie, &in, &fp);
+	next_stat = system_millis + 1000;
 
-	/* Blink the LED (PD12) on the board with every transmitted byte. */
+	/* Blink the LED (PC8) on the board with every transmitted line. */
 	while (1) {
 		gpio_toggle(GPIOC, GPIO8);	/* LED on/off */
 
+		t0 = cycles();
 		fprintf(fp, "Pass: %d\n", c);
+		dt = cycles() - t0;
 
 		c = (c == 200) ? 0 : c + 1;	/* Increment c. */
 
-		for (i = 0; i < 1000000; i++) {	/* Wait a bit. */
-			__asm__("NOP");
+		/* Echo anything typed, the read returns at once if not. */
+		while ((ch = fgetc(in)) != EOF) {
+			gpio_toggle(GPIOC, GPIO9);
+			fputc(ch, fp);
 		}
+		clearerr(in);
+
+		if ((int32_t)(system_millis - next_stat) >= 0) {
+			fprintf(fp, "%lu chars/s, %lu cycles/printf, "
+				"%lu rx dropped\n",
+				tx_count - tx_last, dt, rx_dropped);
+			tx_last = tx_count;
+			next_stat += 1000;
+		}
+
+		t0 = system_millis;		/* Wait a bit. */
+		while (system_millis - t0 < 20);
 	}
 
 	return 0;
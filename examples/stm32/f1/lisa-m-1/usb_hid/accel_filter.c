@@ -0,0 +1,89 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "accel_filter.h"
+
+void accel_filter_init(struct accel_filter *f, uint32_t decim,
+		       unsigned shift)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		f->lp[i] = 0;
+		f->sum[i] = 0;
+	}
+	f->count = 0;
+	f->decim = decim;
+	f->shift = shift;
+	f->primed = false;
+}
+
+/*
+ * Feed one sample. Each axis goes through a single pole low pass
+ * (lp += (in - lp) / 2^shift, kept with 8 fractional bits) and the low
+ * pass output is averaged over blocks of decim samples. Returns true and
+ * fills out at the end of each block.
+ *
+ * The first sample loads the low pass directly so it does not have to
+ * settle from zero.
+ */
+bool accel_filter_push(struct accel_filter *f, const int16_t in[3],
+		       int16_t out[3])
+{
+	int32_t x;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		x = (int32_t)in[i] * 256;
+		if (f->primed) {
+			f->lp[i] += (x - f->lp[i]) / (1 << f->shift);
+		} else {
+			f->lp[i] = x;
+		}
+		f->sum[i] += f->lp[i] / 256;
+	}
+	f->primed = true;
+
+	if (++f->count < f->decim) {
+		return false;
+	}
+
+	for (i = 0; i < 3; i++) {
+		out[i] = f->sum[i] / (int32_t)f->decim;
+		f->sum[i] = 0;
+	}
+	f->count = 0;
+	return true;
+}
+
+/*
+ * Fill a report from a filter output. The samples are left aligned, so
+ * the top eight bits of the 16 make +-127 mouse counts per report at
+ * +-1g on the 2g range.
+ */
+void accel_report_pack(uint8_t *r, const int16_t xyz[3], uint16_t t_ms,
+		       uint16_t dropped)
+{
+	r[0] = 0;
+	r[1] = xyz[0] >> 9;
+	r[2] = xyz[1] >> 9;
+	r[3] = 0;
+	r[4] = t_ms;
+	r[5] = t_ms >> 8;
+	r[6] = dropped;
+	r[7] = dropped >> 8;
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ACCEL_FILTER_H
+#define __ACCEL_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Low pass and decimate three axes of raw samples. Only plain C with no
+ * hardware access, so it builds for the host as well and can be fed
+ * recorded data to check the output against the firmware.
+ */
+struct accel_filter {
+	int32_t lp[3];		/* single pole low pass state, Q8 */
+	int32_t sum[3];		/* sum of lp over the current block */
+	uint32_t count;		/* samples in the current block */
+	uint32_t decim;		/* samples per output */
+	unsigned shift;		/* low pass coefficient is 2^-shift */
+	bool primed;
+};
+
+/*
+ * The report: buttons, X, Y, wheel, then the time of the newest sample
+ * in ms and the dropped sample count, both u16 little endian.
+ */
+#define REPORT_SIZE	8
+
+void accel_filter_init(struct accel_filter *f, uint32_t decim,
+		       unsigned shift);
+bool accel_filter_push(struct accel_filter *f, const int16_t in[3],
+		       int16_t out[3]);
+void accel_report_pack(uint8_t *r, const int16_t xyz[3], uint16_t t_ms,
+		       uint16_t dropped);
+
+#endif
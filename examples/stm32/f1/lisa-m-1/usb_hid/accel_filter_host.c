@@ -0,0 +1,213 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks accel_filter.c on the host:
+ *
+ *	cc -o accel_filter_host accel_filter_host.c accel_filter.c
+ *	./accel_filter_host
+ *	./accel_filter_host capture.txt > reports.csv
+ *
+ * The built in checks feed the filter traces shaped like what the
+ * ADXL345 delivers at 800Hz with left aligned samples on the 2g range
+ * (1g is 16384): the board held still, tipped over, sitting on a motor
+ * vibrating at 200Hz, and pinned at full scale. The output has to hold
+ * a level input exactly, settle after a tilt, keep vibration out of the
+ * pointer and never wrap.
+ *
+ * Given a capture, one "x y z" sample per line, it runs that through
+ * the filter the way the firmware does and prints every report as
+ * "t_ms,x,y,dropped", to compare with what the board sent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "accel_filter.h"
+
+#define DECIM		8
+#define LP_SHIFT	2
+#define ONE_G		16384
+#define SAMPLE_US	1250
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static struct accel_filter f;
+
+/* n samples of x, y, z through the filter, the last output back */
+static int run(int n, int16_t x, int16_t y, int16_t z, int16_t out[3])
+{
+	int16_t in[3] = { x, y, z };
+	int i, outputs = 0;
+
+	for (i = 0; i < n; i++) {
+		outputs += accel_filter_push(&f, in, out);
+	}
+	return outputs;
+}
+
+static void test_level(void)
+{
+	int16_t out[3];
+	int n;
+
+	/* flat on the table, z up */
+	accel_filter_init(&f, DECIM, LP_SHIFT);
+	n = run(DECIM * 10, 120, -64, ONE_G, out);
+	check(n == 10, "one output per block", n, 10);
+	check(out[0] == 120 && out[1] == -64 && out[2] == ONE_G,
+	      "level held exactly", out[0], out[2]);
+
+	/* the first block is already right, no settling from zero */
+	accel_filter_init(&f, DECIM, LP_SHIFT);
+	run(DECIM, 8000, -8000, ONE_G, out);
+	check(out[0] == 8000 && out[1] == -8000, "primed", out[0], out[1]);
+}
+
+static void test_tilt(void)
+{
+	int16_t out[3], last = 0;
+	int i, settled = -1;
+
+	/* level, then tipped 30 degrees about y */
+	accel_filter_init(&f, DECIM, LP_SHIFT);
+	run(DECIM * 4, 0, 0, ONE_G, out);
+	for (i = 0; i < 20; i++) {
+		run(DECIM, ONE_G / 2, 0, 14189, out);
+		check(out[0] >= last, "tilt monotonic", out[0], last);
+		last = out[0];
+		if ((settled < 0) && (abs(out[0] - ONE_G / 2) <= 4)) {
+			settled = i;
+		}
+	}
+	/* single pole at 2^-2: within 4 counts after 40 samples, 50ms */
+	check((settled >= 0) && (settled <= 4), "tilt settles", settled, 4);
+	check(abs(out[0] - ONE_G / 2) <= 3, "tilt final", out[0],
+	      ONE_G / 2);
+}
+
+static void test_vibration(void)
+{
+	int16_t in[3], out[3];
+	int i, lo = 32767, hi = -32768;
+
+	/* 200Hz, a quarter g, on top of level */
+	accel_filter_init(&f, DECIM, LP_SHIFT);
+	for (i = 0; i < 800; i++) {
+		in[0] = 4000 * sin(2 * M_PI * 200 * i / 800.0 + 0.3);
+		in[1] = 4000 * cos(2 * M_PI * 200 * i / 800.0);
+		in[2] = ONE_G;
+		if (accel_filter_push(&f, in, out) && (i > 80)) {
+			lo = (out[0] < lo) ? out[0] : lo;
+			hi = (out[0] > hi) ? out[0] : hi;
+			check(abs(out[1]) < 8, "vibration y", out[1], 0);
+		}
+	}
+	/* a block of eight holds two whole periods, nothing gets through */
+	check(hi - lo < 8, "vibration x", lo, hi);
+}
+
+static void test_full_scale(void)
+{
+	int16_t out[3];
+	int i;
+
+	accel_filter_init(&f, DECIM, LP_SHIFT);
+	for (i = 0; i < 50; i++) {
+		run(DECIM, 32767, -32768, (i & 1) ? 32767 : -32768, out);
+		check(out[0] > 32700, "positive full scale", out[0], 32767);
+		check(out[1] < -32700, "negative full scale", out[1], -32768);
+		/* a wrap would flip the sign */
+		check((i & 1) ? (out[2] > 0) : (out[2] < 0), "swinging",
+		      out[2], i & 1);
+	}
+}
+
+static void test_report(void)
+{
+	const int16_t xyz[3] = { ONE_G, -ONE_G, 0 };
+	const int16_t fs[3] = { 32767, -32768, 0 };
+	uint8_t r[REPORT_SIZE];
+
+	accel_report_pack(r, xyz, 0xabcd, 0x1234);
+	check(r[0] == 0 && r[3] == 0, "buttons and wheel", r[0], r[3]);
+	check((int8_t)r[1] == 32 && (int8_t)r[2] == -32, "1g is 32 counts",
+	      (int8_t)r[1], (int8_t)r[2]);
+	check(r[4] == 0xcd && r[5] == 0xab, "time", r[4], r[5]);
+	check(r[6] == 0x34 && r[7] == 0x12, "dropped", r[6], r[7]);
+
+	accel_report_pack(r, fs, 0, 0);
+	check((int8_t)r[1] == 63 && (int8_t)r[2] == -64, "full scale counts",
+	      (int8_t)r[1], (int8_t)r[2]);
+}
+
+/* A capture, the way exti2_isr would have handed it over */
+static int replay(const char *name)
+{
+	FILE *fp = fopen(name, "r");
+	int x, y, z;
+	int16_t in[3], out[3];
+	uint8_t r[REPORT_SIZE];
+	uint32_t t_us = 0;
+
+	if (fp == NULL) {
+		perror(name);
+		return 2;
+	}
+	accel_filter_init(&f, DECIM, LP_SHIFT);
+	while (fscanf(fp, "%d %d %d", &x, &y, &z) == 3) {
+		in[0] = x;
+		in[1] = y;
+		in[2] = z;
+		if (accel_filter_push(&f, in, out)) {
+			accel_report_pack(r, out, t_us / 1000, 0);
+			printf("%u,%d,%d,%u\n", r[4] | (r[5] << 8),
+			       (int8_t)r[1], (int8_t)r[2], r[6] | (r[7] << 8));
+		}
+		t_us += SAMPLE_US;
+	}
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) {
+		return replay(argv[1]);
+	}
+
+	test_level();
+	test_tilt();
+	test_vibration();
+	test_full_scale();
+	test_report();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -22,7 +22,11 @@
 
 /* Register addresses */
 #define ADXL345_DEVID		0x00
+#define ADXL345_BW_RATE		0x2C
 #define ADXL345_POWER_CTL	0x2D
+#define ADXL345_INT_ENABLE	0x2E
+#define ADXL345_INT_MAP		0x2F
+#define ADXL345_INT_SOURCE	0x30
 #define ADXL345_DATA_FORMAT	0x31
 #define ADXL345_DATAX0		0x32
 #define ADXL345_DATAX1		0x33
@@ -30,9 +34,32 @@
 #define ADXL345_DATAY1		0x35
 #define ADXL345_DATAZ0		0x36
 #define ADXL345_DATAZ1		0x37
+#define ADXL345_FIFO_CTL	0x38
+#define ADXL345_FIFO_STATUS	0x39
+
+/* SPI address byte */
+#define ADXL345_READ		(1 << 7)
+#define ADXL345_MULTI		(1 << 6)
+
+#define ADXL345_BW_RATE_800HZ		0x0D
 
 #define ADXL345_POWER_CTL_MEASURE	(1 << 3)
+
+/* INT_ENABLE, INT_MAP and INT_SOURCE */
+#define ADXL345_INT_DATA_READY		(1 << 7)
+#define ADXL345_INT_WATERMARK		(1 << 1)
+#define ADXL345_INT_OVERRUN		(1 << 0)
+
 #define ADXL345_DATA_FORMAT_LALIGN	(1 << 2)
 
+#define ADXL345_FIFO_CTL_BYPASS		(0 << 6)
+#define ADXL345_FIFO_CTL_STREAM		(2 << 6)
+#define ADXL345_FIFO_CTL_SAMPLES_MASK	0x1F
+
+#define ADXL345_FIFO_STATUS_ENTRIES_MASK	0x3F
+
+/* 32 in the FIFO plus the one in the data registers */
+#define ADXL345_FIFO_DEPTH	33
+
 #endif
 
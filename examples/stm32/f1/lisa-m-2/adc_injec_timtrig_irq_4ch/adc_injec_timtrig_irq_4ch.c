@@ -27,10 +27,18 @@
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/cm3/nvic.h>
 
-volatile uint16_t temperature = 0;
-volatile uint16_t v_refint = 0;
-volatile uint16_t lisam_adc1 = 0;
-volatile uint16_t lisam_adc2 = 0;
+#include "telemetry.h"
+
+/*
+ * The interrupt routine queues each set of four samples here (temperature,
+ * Vrefint, ADC1, ADC2) and the main loop packs them into telemetry frames.
+ * Must be a power of two.
+ */
+#define SAMPLE_RING	64
+
+uint16_t sample_ring[SAMPLE_RING][4];
+volatile uint32_t sample_head, sample_tail;
+volatile uint32_t samples_dropped;
 uint8_t channel_array[4]; /* for injected sampling, 4 channels max, for regular, 16 max */
 
 static void usart_setup(void)
@@ -44,7 +52,7 @@ static void usart_setup(void)
 		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
 
 	/* Setup UART parameters. */
-	usart_set_baudrate(USART2, 115200);
+	usart_set_baudrate(USART2, 921600);
 	usart_set_databits(USART2, 8);
 	usart_set_stopbits(USART2, USART_STOPBITS_1);
 	usart_set_mode(USART2, USART_MODE_TX_RX);
@@ -84,8 +92,9 @@ static void timer_setup(void)
     rcc_periph_reset_pulse(RST_TIM2);
     timer_set_mode(timer, TIM_CR1_CKD_CK_INT,
 	    TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
-    timer_set_period(timer, 0xFF);
-    timer_set_prescaler(timer, 0x8);
+    /* 72MHz / 72 / 100 = 10kHz sample rate */
+    timer_set_period(timer, 99);
+    timer_set_prescaler(timer, 71);
     timer_set_clock_division(timer, 0x0);
     /* Generate TRGO on every update. */
     timer_set_master_mode(timer, TIM_CR2_MMS_UPDATE);
@@ -142,29 +151,6 @@ static void adc_setup(void)
 	adc_calibrate(ADC1);
 }
 
-static void my_usart_print_int(uint32_t usart, int value)
-{
-	int8_t i;
-	uint8_t nr_digits = 0;
-	char buffer[25];
-
-	if (value < 0) {
-		usart_send_blocking(usart, '-');
-		value = value * -1;
-	}
-
-	while (value > 0) {
-		buffer[nr_digits++] = "0123456789"[value % 10];
-		value /= 10;
-	}
-
-	for (i = (nr_digits - 1); i >= 0; i--) {
-		usart_send_blocking(usart, buffer[i]);
-	}
-
-	//usart_send_blocking(usart, '\r');
-}
-
 int main(void)
 {
 
@@ -178,35 +164,30 @@ int main(void)
 	gpio_set(GPIOA, GPIO8);	                /* LED1 off */
 	gpio_set(GPIOC, GPIO15);		/* LED5 off */
 
-	/* Send a message on USART1. */
-	usart_send_blocking(USART2, 's');
-	usart_send_blocking(USART2, 't');
-	usart_send_blocking(USART2, 'm');
-	usart_send_blocking(USART2, '\r');
-	usart_send_blocking(USART2, '\n');
+	tlm_setup();
 
 	/* Moved the channel selection and sequence init to adc_setup() */
 
-	/* Continously convert and poll the temperature ADC. */
+	/* Continously pack the samples the interrupt routine queued. */
 	while (1) {
 		/*
-		 * Since sampling is triggered by the timer and copying the values
-		 * out of the data registers is handled by the interrupt routine,
-		 * we just need to print the values and toggle the LED. It may be useful
-		 * to buffer the adc values in some cases.
+		 * Sampling is triggered by the timer and the interrupt routine
+		 * copies the values out of the data registers into the ring,
+		 * so none are lost while we are busy here. The frames go out
+		 * by DMA, all we do is pack bits.
 		 */
-
-		my_usart_print_int(USART2, temperature);
-		usart_send_blocking(USART2, ' ');
-		my_usart_print_int(USART2, v_refint);
-		usart_send_blocking(USART2, ' ');
-		my_usart_print_int(USART2, lisam_adc1);
-		usart_send_blocking(USART2, ' ');
-		my_usart_print_int(USART2, lisam_adc2);
-		usart_send_blocking(USART2, '\r');
-
-		gpio_toggle(GPIOA, GPIO8); /* LED2 on */
-
+		if (sample_tail == sample_head) {
+			continue;
+		}
+
+		tlm_adc12(sample_ring[sample_tail % SAMPLE_RING], 4);
+		sample_tail++;
+
+		/* Roughly once a second, tell the host what got lost. */
+		if ((sample_tail % 10000) == 0) {
+			tlm_stats(samples_dropped);
+			gpio_toggle(GPIOA, GPIO8); /* LED2 on */
+		}
 	}
 
 	return 0;
@@ -216,8 +197,13 @@ void adc1_2_isr(void)
 {
     /* Clear Injected End Of Conversion (JEOC) */
     ADC_SR(ADC1) &= ~ADC_SR_JEOC;
-    temperature = adc_read_injected(ADC1,1);
-    v_refint = adc_read_injected(ADC1,2);
-    lisam_adc1 = adc_read_injected(ADC1,3);
-    lisam_adc2 = adc_read_injected(ADC1,4);
+    if (sample_head - sample_tail >= SAMPLE_RING) {
+	samples_dropped++;
+	return;
+    }
+    sample_ring[sample_head % SAMPLE_RING][0] = adc_read_injected(ADC1,1);
+    sample_ring[sample_head % SAMPLE_RING][1] = adc_read_injected(ADC1,2);
+    sample_ring[sample_head % SAMPLE_RING][2] = adc_read_injected(ADC1,3);
+    sample_ring[sample_head % SAMPLE_RING][3] = adc_read_injected(ADC1,4);
+    sample_head++;
 }
@@ -0,0 +1,209 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Frame building and the double buffering, the DMA is in
+ * telemetry_dma.c behind struct tlm_ops so telemetry_host.c can check
+ * this file on a PC.
+ */
+
+#include "telemetry.h"
+
+/* COBS adds one byte per 254, plus the leading code and the delimiter */
+#define TLM_FRAME_WIRE	(TLM_FRAME_RAW + 2 + TLM_FRAME_RAW / 254 + 2)
+
+/* Frame being filled, the last two bytes are kept free for the CRC */
+static uint8_t raw[TLM_FRAME_RAW];
+static uint32_t raw_len;
+static uint16_t seq;
+
+/*
+ * Two encoded frames, one can be on the wire while the next one waits.
+ * wire_busy counts the buffers handed to the DMA that it hasn't finished.
+ */
+static uint8_t wire[2][TLM_FRAME_WIRE];
+static uint32_t wire_len[2];
+static volatile uint32_t wire_busy;
+static volatile uint32_t wire_next;	/* buffer the DMA sends next */
+static uint32_t wire_fill;		/* buffer we encode into next */
+static uint32_t dropped_frames;
+static const struct tlm_ops *ops;
+
+static const uint16_t crc16_nibble[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+	0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+/* CRC-16/CCITT-FALSE, four bits at a time */
+static uint16_t crc16(const uint8_t *p, uint32_t len)
+{
+	uint16_t crc = 0xffff;
+
+	while (len--) {
+		crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (*p >> 4)];
+		crc = (crc << 4) ^ crc16_nibble[(crc >> 12) ^ (*p & 0x0f)];
+		p++;
+	}
+	return crc;
+}
+
+/* COBS encode src into dst, returns the encoded length */
+static uint32_t cobs_encode(const uint8_t *src, uint32_t len, uint8_t *dst)
+{
+	uint32_t code_pos = 0, out = 1, i;
+	uint8_t code = 1;
+
+	for (i = 0; i < len; i++) {
+		if (src[i] == 0) {
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		} else {
+			dst[out++] = src[i];
+			if (++code == 0xff) {
+				dst[code_pos] = code;
+				code_pos = out++;
+				code = 1;
+			}
+		}
+	}
+	dst[code_pos] = code;
+	return out;
+}
+
+/*
+ * tlm_init
+ *
+ * Start with an empty frame, sequence number zero, both buffers free.
+ */
+void tlm_init(const struct tlm_ops *tlm_ops)
+{
+	ops = tlm_ops;
+	raw_len = 2;
+	seq = 0;
+	wire_busy = wire_next = wire_fill = 0;
+	dropped_frames = 0;
+}
+
+/*
+ * tlm_sent
+ *
+ * Called from the DMA transfer complete interrupt, start on the other
+ * buffer if it is waiting.
+ */
+void tlm_sent(void)
+{
+	wire_busy--;
+	wire_next ^= 1;
+	if (wire_busy != 0) {
+		ops->send(wire[wire_next], wire_len[wire_next]);
+	}
+}
+
+/*
+ * tlm_flush
+ *
+ * Close the current frame and queue it for the DMA. If both buffers are
+ * still in use the frame is dropped and counted, the next stats record
+ * reports it.
+ */
+void tlm_flush(void)
+{
+	uint16_t crc;
+
+	if (raw_len <= 2) {
+		return;
+	}
+
+	if (wire_busy == 2) {
+		dropped_frames++;
+	} else {
+		raw[0] = seq & 0xff;
+		raw[1] = seq >> 8;
+		crc = crc16(raw, raw_len);
+		raw[raw_len++] = crc & 0xff;
+		raw[raw_len++] = crc >> 8;
+
+		wire_len[wire_fill] = cobs_encode(raw, raw_len, wire[wire_fill]);
+		wire[wire_fill][wire_len[wire_fill]++] = 0;
+
+		ops->lock();
+		if (wire_busy++ == 0) {
+			ops->send(wire[wire_fill], wire_len[wire_fill]);
+		}
+		ops->unlock();
+		wire_fill ^= 1;
+	}
+
+	seq++;
+	raw_len = 2;
+}
+
+/* Make room for a record of len bytes, closing the frame if needed */
+static uint8_t *tlm_record(uint32_t len)
+{
+	uint8_t *p;
+
+	if (raw_len + len > TLM_FRAME_RAW - 2) {
+		tlm_flush();
+	}
+	p = &raw[raw_len];
+	raw_len += len;
+	return p;
+}
+
+/*
+ * tlm_adc12
+ *
+ * Add n (1 to 15) 12-bit samples as one record.
+ */
+void tlm_adc12(const uint16_t *samples, uint8_t n)
+{
+	uint8_t *p = tlm_record(1 + (3 * n + 1) / 2);
+	uint8_t i;
+
+	*p++ = TLM_REC_ADC12 | (n & 0x0f);
+	for (i = 0; i + 1 < n; i += 2) {
+		*p++ = samples[i] & 0xff;
+		*p++ = ((samples[i] >> 8) & 0x0f) | (samples[i + 1] << 4);
+		*p++ = samples[i + 1] >> 4;
+	}
+	if (i < n) {
+		*p++ = samples[i] & 0xff;
+		*p++ = (samples[i] >> 8) & 0x0f;
+	}
+}
+
+/*
+ * tlm_stats
+ *
+ * Add a record with the caller's dropped sample count and our own
+ * dropped frame count.
+ */
+void tlm_stats(uint32_t dropped_samples)
+{
+	uint8_t *p = tlm_record(9);
+	int i;
+
+	*p++ = TLM_REC_STATS;
+	for (i = 0; i < 4; i++) {
+		*p++ = dropped_samples >> (8 * i);
+	}
+	for (i = 0; i < 4; i++) {
+		*p++ = dropped_frames >> (8 * i);
+	}
+}
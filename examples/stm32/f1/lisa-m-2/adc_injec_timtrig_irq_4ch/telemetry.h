@@ -0,0 +1,59 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/*
+ * Framed binary telemetry on USART2, sent with DMA1 channel 7.
+ *
+ * A frame, before encoding, is
+ *	seq (u16 LE) | record | record | ... | crc16 (u16 LE)
+ * where the CRC is CRC-16/CCITT-FALSE over everything before it. The
+ * frame is then COBS encoded, so it contains no zero bytes, and
+ * terminated with a single zero byte.
+ *
+ * A record starts with a type byte, the high nibble is the record type
+ * and the low nibble a type specific count:
+ *	TLM_REC_ADC12	n 12-bit samples packed little endian, two samples
+ *			in three bytes, (3 * n + 1) / 2 bytes in total
+ *	TLM_REC_STATS	dropped samples (u32 LE), dropped frames (u32 LE)
+ */
+
+#define TLM_REC_ADC12		0x10
+#define TLM_REC_STATS		0x20
+
+/* Records per frame are limited by the raw frame size */
+#define TLM_FRAME_RAW		240
+
+/* How the frames get out, see telemetry_dma.c */
+struct tlm_ops {
+	void (*send)(const uint8_t *buf, uint32_t len);	/* start sending */
+	void (*lock)(void);		/* keep tlm_sent() out */
+	void (*unlock)(void);
+};
+
+void tlm_setup(void);
+void tlm_init(const struct tlm_ops *tlm_ops);
+void tlm_sent(void);
+void tlm_adc12(const uint16_t *samples, uint8_t n);
+void tlm_stats(uint32_t dropped_samples);
+void tlm_flush(void);
+
+#endif
@@ -0,0 +1,169 @@
+#! /usr/bin/env python
+#
+# This file is part of the libopencm3 project.
+#
+# This library is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this library.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Decoder for the telemetry frames described in telemetry.h. Can be
+# imported (Decoder, cobs_decode, crc16, parse_frame) or run to turn a
+# capture file, stdin or a serial port into CSV on stdout:
+#
+#   telemetry_decode.py -p /dev/ttyUSB0 -b 921600 > samples.csv
+#   telemetry_decode.py capture.bin > samples.csv
+#
+# Each ADC record becomes one line "seq,adc12,s0,s1,...", each stats
+# record a line "seq,stats,dropped_samples,dropped_frames". A summary of
+# frames, CRC errors and sequence gaps goes to stderr at the end.
+
+import optparse
+import sys
+
+REC_ADC12 = 0x10
+REC_STATS = 0x20
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE."""
+    crc = 0xffff
+    for b in bytearray(data):
+        crc ^= b << 8
+        for i in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xffff
+            else:
+                crc = (crc << 1) & 0xffff
+    return crc
+
+def cobs_decode(data):
+    """Decode one COBS block (without the zero delimiter)."""
+    data = bytearray(data)
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError('bad COBS code')
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+def parse_adc12(payload, n):
+    samples = []
+    for i in range(0, n - 1, 2):
+        b0, b1, b2 = payload[3 * i // 2:3 * i // 2 + 3]
+        samples.append(b0 | ((b1 & 0x0f) << 8))
+        samples.append((b1 >> 4) | (b2 << 4))
+    if n % 2:
+        b0, b1 = payload[3 * (n - 1) // 2:3 * (n - 1) // 2 + 2]
+        samples.append(b0 | ((b1 & 0x0f) << 8))
+    return samples
+
+def parse_frame(frame):
+    """Check and split a decoded frame, returns (seq, [(type, values)])."""
+    frame = bytearray(frame)
+    if len(frame) < 4:
+        raise ValueError('short frame')
+    body, crc = frame[:-2], frame[-2] | (frame[-1] << 8)
+    if crc16(body) != crc:
+        raise ValueError('CRC mismatch')
+    seq = body[0] | (body[1] << 8)
+    records = []
+    i = 2
+    while i < len(body):
+        rtype, count = body[i] & 0xf0, body[i] & 0x0f
+        i += 1
+        if rtype == REC_ADC12:
+            size = (3 * count + 1) // 2
+        elif rtype == REC_STATS:
+            size = 8
+        else:
+            raise ValueError('unknown record type 0x%02x' % rtype)
+        # Check before indexing, a short body must not raise IndexError
+        if i + size > len(body):
+            raise ValueError('truncated record')
+        if rtype == REC_ADC12:
+            records.append(('adc12', parse_adc12(body[i:i + size], count)))
+        else:
+            values = [sum(body[i + j + 4 * k] << (8 * j) for j in range(4))
+                      for k in range(2)]
+            records.append(('stats', values))
+        i += size
+    return seq, records
+
+class Decoder(object):
+    """Feed it bytes, get (seq, records) tuples for every good frame."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        self.last_seq = None
+        self.frames = 0
+        self.errors = 0
+        self.lost = 0
+
+    def feed(self, data):
+        self.buf += bytearray(data)
+        while True:
+            end = self.buf.find(b'\x00')
+            if end < 0:
+                return
+            block, self.buf = self.buf[:end], self.buf[end + 1:]
+            if not block:
+                continue
+            try:
+                seq, records = parse_frame(cobs_decode(block))
+            except ValueError:
+                self.errors += 1
+                continue
+            if self.last_seq is not None:
+                self.lost += (seq - self.last_seq - 1) & 0xffff
+            self.last_seq = seq
+            self.frames += 1
+            yield seq, records
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] [capture]')
+    parser.add_option('-p', '--port', help='read from a serial port')
+    parser.add_option('-b', '--baud', type='int', default=921600)
+    opts, args = parser.parse_args()
+
+    if opts.port:
+        import serial
+        src = serial.Serial(opts.port, opts.baud, timeout=1)
+    elif args:
+        src = open(args[0], 'rb')
+    else:
+        src = getattr(sys.stdin, 'buffer', sys.stdin)
+
+    dec = Decoder()
+    try:
+        while True:
+            data = src.read(4096)
+            if not data:
+                if opts.port:
+                    continue
+                break
+            for seq, records in dec.feed(data):
+                for rtype, values in records:
+                    sys.stdout.write('%d,%s,%s\n' % (
+                        seq, rtype, ','.join(str(v) for v in values)))
+    except KeyboardInterrupt:
+        pass
+
+    sys.stderr.write('%d frames, %d bad, %d lost\n' % (
+        dec.frames, dec.errors, dec.lost))
+
+if __name__ == '__main__':
+    main()
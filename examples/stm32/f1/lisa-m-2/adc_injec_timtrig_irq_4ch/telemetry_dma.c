@@ -0,0 +1,79 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The telemetry frames go out on USART2 with DMA1 channel 7, one
+ * buffer at a time.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include "telemetry.h"
+
+static void tlm_dma_send(const uint8_t *buf, uint32_t len)
+{
+	dma_disable_channel(DMA1, DMA_CHANNEL7);
+	dma_set_memory_address(DMA1, DMA_CHANNEL7, (uint32_t)buf);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL7, len);
+	dma_enable_channel(DMA1, DMA_CHANNEL7);
+}
+
+static void tlm_dma_lock(void)
+{
+	nvic_disable_irq(NVIC_DMA1_CHANNEL7_IRQ);
+}
+
+static void tlm_dma_unlock(void)
+{
+	nvic_enable_irq(NVIC_DMA1_CHANNEL7_IRQ);
+}
+
+static const struct tlm_ops tlm_dma_ops = {
+	tlm_dma_send, tlm_dma_lock, tlm_dma_unlock
+};
+
+void dma1_channel7_isr(void)
+{
+	if ((DMA1_ISR & DMA_ISR_TCIF7) != 0) {
+		DMA1_IFCR |= DMA_IFCR_CTCIF7;
+		tlm_sent();
+	}
+}
+
+void tlm_setup(void)
+{
+	tlm_init(&tlm_dma_ops);
+
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	dma_channel_reset(DMA1, DMA_CHANNEL7);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL7, (uint32_t)&USART2_DR);
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL7);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL7);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL7, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL7, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL7, DMA_CCR_PL_HIGH);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL7);
+
+	nvic_set_priority(NVIC_DMA1_CHANNEL7_IRQ, 0x40);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL7_IRQ);
+
+	usart_enable_tx_dma(USART2);
+}
@@ -0,0 +1,403 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks telemetry.c on the host:
+ *
+ *	cc -o telemetry_host telemetry_host.c telemetry.c
+ *	./telemetry_host capture.bin expected.csv
+ *	./telemetry_decode.py capture.bin | diff - expected.csv
+ *
+ * The frames telemetry.c puts on the wire are taken apart again by an
+ * independent COBS decoder and a bitwise CRC, and every record has to
+ * come back as it went in: ADC records of every length with random and
+ * all zero samples, stats records, frames filling up, and frames
+ * dropped while both buffers are on the wire. The arguments are
+ * optional, with them the wire bytes and the CSV telemetry_decode.py
+ * should make of them are written out, followed by one frame with a
+ * good CRC and a truncated record that the decoder has to count as bad.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+#define WIRE_MAX	(1 << 20)
+#define RECS_MAX	8192
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+/******************************************************************************
+ * The wire: a DMA that finishes when told to
+ *****************************************************************************/
+
+static uint8_t wire[WIRE_MAX];
+static uint32_t wire_len;
+static const uint8_t *dma_buf;
+static uint32_t dma_len;
+static int locked;
+
+static void m_send(const uint8_t *buf, uint32_t len)
+{
+	check(dma_buf == NULL, "send while busy", 0, 0);
+	dma_buf = buf;
+	dma_len = len;
+}
+
+static void m_lock(void)
+{
+	locked++;
+}
+
+static void m_unlock(void)
+{
+	locked--;
+}
+
+static const struct tlm_ops ops = { m_send, m_lock, m_unlock };
+
+/* The DMA is done, the bytes are only read now as on the real thing */
+static int complete(void)
+{
+	const uint8_t *buf = dma_buf;
+
+	if (buf == NULL) {
+		return 0;
+	}
+	check(!locked, "complete while locked", locked, 0);
+	memcpy(&wire[wire_len], buf, dma_len);
+	wire_len += dma_len;
+	dma_buf = NULL;
+	tlm_sent();
+	return 1;
+}
+
+static void drain(void)
+{
+	while (complete());
+}
+
+/******************************************************************************
+ * What went in, and what came out
+ *****************************************************************************/
+
+struct rec {
+	int type;
+	int n;
+	uint32_t v[15];
+	int seq;
+};
+
+static struct rec sent[RECS_MAX], got[RECS_MAX];
+static int nsent, ngot, bad_frames;
+
+static void add_adc(int n, int zero)
+{
+	struct rec *r = &sent[nsent++];
+	uint16_t s[15];
+	int i;
+
+	r->type = TLM_REC_ADC12;
+	r->n = n;
+	for (i = 0; i < n; i++) {
+		s[i] = zero ? 0 : rand() & 0xfff;
+		r->v[i] = s[i];
+	}
+	tlm_adc12(s, n);
+}
+
+static void add_stats(uint32_t dropped, uint32_t frames)
+{
+	struct rec *r = &sent[nsent++];
+
+	r->type = TLM_REC_STATS;
+	r->n = 2;
+	r->v[0] = dropped;
+	r->v[1] = frames;
+	tlm_stats(dropped);
+}
+
+/* CRC-16/CCITT-FALSE a bit at a time, not the table telemetry.c uses */
+static uint16_t crc16_bits(const uint8_t *p, int len)
+{
+	uint16_t crc = 0xffff;
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 8;
+		for (i = 0; i < 8; i++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+	return crc;
+}
+
+static int cobs_decode(const uint8_t *in, int len, uint8_t *out)
+{
+	int i = 0, n = 0, code, j;
+
+	while (i < len) {
+		code = in[i];
+		if ((code == 0) || (i + code > len)) {
+			return -1;
+		}
+		for (j = 1; j < code; j++) {
+			out[n++] = in[i + j];
+		}
+		i += code;
+		if ((code != 0xff) && (i < len)) {
+			out[n++] = 0;
+		}
+	}
+	return n;
+}
+
+static void parse(const uint8_t *f, int len)
+{
+	int seq, i, j, size, type, n;
+	struct rec *r;
+
+	if ((len < 4) || (crc16_bits(f, len - 2) !=
+			  (f[len - 2] | (f[len - 1] << 8)))) {
+		bad_frames++;
+		return;
+	}
+	check(len <= TLM_FRAME_RAW, "frame size", len, TLM_FRAME_RAW);
+	seq = f[0] | (f[1] << 8);
+	len -= 2;
+	for (i = 2; i < len; i += size) {
+		type = f[i] & 0xf0;
+		n = f[i++] & 0x0f;
+		size = (type == TLM_REC_ADC12) ? (3 * n + 1) / 2 : 8;
+		if ((i + size > len) || (ngot == RECS_MAX)) {
+			bad_frames++;
+			return;
+		}
+		r = &got[ngot++];
+		r->type = type;
+		r->seq = seq;
+		if (type == TLM_REC_STATS) {
+			r->n = 2;
+			for (j = 0; j < 2; j++) {
+				r->v[j] = f[i + 4 * j] | (f[i + 4 * j + 1] << 8) |
+					  (f[i + 4 * j + 2] << 16) |
+					  ((uint32_t)f[i + 4 * j + 3] << 24);
+			}
+			continue;
+		}
+		r->n = n;
+		for (j = 0; j < n; j++) {
+			const uint8_t *p = &f[i + 3 * (j / 2)];
+
+			r->v[j] = (j & 1) ? (p[1] >> 4) | (p[2] << 4) :
+					    p[0] | ((p[1] & 0x0f) << 8);
+		}
+	}
+}
+
+static void decode(void)
+{
+	static uint8_t frame[TLM_FRAME_RAW * 2];
+	uint32_t start = 0, i;
+	int n;
+
+	ngot = bad_frames = 0;
+	for (i = 0; i < wire_len; i++) {
+		if (wire[i] != 0) {
+			continue;
+		}
+		check(i - start <= TLM_FRAME_RAW + 2, "wire frame",
+		      i - start, 0);
+		n = cobs_decode(&wire[start], i - start, frame);
+		if (n < 0) {
+			bad_frames++;
+		} else {
+			parse(frame, n);
+		}
+		start = i + 1;
+	}
+	check(start == wire_len, "frame delimited", start, wire_len);
+}
+
+static int same(const struct rec *a, const struct rec *b)
+{
+	return (a->type == b->type) && (a->n == b->n) &&
+	       (memcmp(a->v, b->v, a->n * sizeof(a->v[0])) == 0);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+
+static void start(void)
+{
+	wire_len = 0;
+	nsent = 0;
+	dma_buf = NULL;
+	tlm_init(&ops);
+}
+
+/* Everything fits on the wire, all must come back in order */
+static void test_records(void)
+{
+	int n, k, i, last_seq = -1;
+
+	start();
+	for (k = 0; k < 40; k++) {
+		for (n = 1; n <= 15; n++) {
+			add_adc(n, k == 3);
+			drain();
+		}
+		if ((k % 7) == 0) {
+			add_stats(k * 1000003u, 0);
+		}
+	}
+	tlm_flush();
+	drain();
+	/* nothing to flush, no empty frame */
+	n = wire_len;
+	tlm_flush();
+	drain();
+	check(wire_len == (uint32_t)n, "empty flush", wire_len, n);
+
+	decode();
+	check(bad_frames == 0, "bad frames", bad_frames, 0);
+	check(ngot == nsent, "records", ngot, nsent);
+	for (i = 0; (i < ngot) && (i < nsent); i++) {
+		check(same(&got[i], &sent[i]), "record", i, got[i].n);
+		if (got[i].seq != last_seq) {
+			check(got[i].seq == last_seq + 1, "seq", got[i].seq,
+			      last_seq + 1);
+			last_seq = got[i].seq;
+		}
+	}
+	/* 40 * 15 records averaging 13 bytes, a couple of dozen frames */
+	check(last_seq > 20, "frames used", last_seq, 20);
+	for (i = 0; i + 1 < (int)wire_len; i++) {
+		check(wire[i] != 0 || (i > 0 && wire[i - 1] != 0), "zeros",
+		      i, 0);
+	}
+}
+
+/*
+ * Nobody drains the wire: the first frame goes out, the second waits,
+ * the next ones are dropped, counted and skip a sequence number each.
+ */
+static void test_drops(void)
+{
+	int i, frames = 0, seq_gap = 0, last_seq = -1;
+
+	start();
+	for (i = 0; i < 5; i++) {
+		add_adc(15, 0);
+		tlm_flush();
+	}
+	check(dma_buf != NULL, "first frame sent", 0, 0);
+	drain();
+	add_stats(7, 3);
+	tlm_flush();
+	drain();
+
+	decode();
+	check(bad_frames == 0, "drop bad frames", bad_frames, 0);
+	check(ngot == 3, "drop records", ngot, 3);
+	check(same(&got[0], &sent[0]) && same(&got[1], &sent[1]),
+	      "drop kept", 0, 0);
+	check((ngot == 3) && same(&got[2], &sent[5]), "drop stats",
+	      got[2].v[1], 3);
+	for (i = 0; i < ngot; i++) {
+		if (got[i].seq != last_seq) {
+			if (last_seq >= 0) {
+				seq_gap += got[i].seq - last_seq - 1;
+			}
+			last_seq = got[i].seq;
+			frames++;
+		}
+	}
+	check(frames == 3, "drop frames", frames, 3);
+	check(seq_gap == 3, "drop seq gap", seq_gap, 3);
+}
+
+/*
+ * The CSV telemetry_decode.py should make of the wire, and a frame it
+ * has to reject: good CRC, but a stats record cut short.
+ */
+static void write_files(const char *bin, const char *csv)
+{
+	static const uint8_t truncated[] = { 0x34, 0x12, TLM_REC_STATS, 1, 2 };
+	uint8_t raw[sizeof(truncated) + 2], enc[sizeof(raw) + 2];
+	uint16_t crc = crc16_bits(truncated, sizeof(truncated));
+	FILE *f;
+	int i, j;
+
+	f = fopen(csv, "w");
+	for (i = 0; f && (i < ngot); i++) {
+		fprintf(f, "%d,%s", got[i].seq,
+			(got[i].type == TLM_REC_ADC12) ? "adc12" : "stats");
+		for (j = 0; j < got[i].n; j++) {
+			fprintf(f, ",%u", got[i].v[j]);
+		}
+		fprintf(f, "\n");
+	}
+	if (f) {
+		fclose(f);
+	}
+
+	memcpy(raw, truncated, sizeof(truncated));
+	raw[sizeof(truncated)] = crc & 0xff;
+	raw[sizeof(truncated) + 1] = crc >> 8;
+	/* no zero bytes in it, so COBS is one code byte in front */
+	enc[0] = sizeof(raw) + 1;
+	memcpy(&enc[1], raw, sizeof(raw));
+	enc[sizeof(raw) + 1] = 0;
+	for (i = 0; i < (int)sizeof(raw); i++) {
+		check(raw[i] != 0, "truncated frame zero free", i, 0);
+	}
+
+	f = fopen(bin, "wb");
+	if (f) {
+		fwrite(wire, 1, wire_len, f);
+		fwrite(enc, 1, sizeof(enc), f);
+		fclose(f);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	srand(1);
+	test_drops();
+	test_records();
+	if (argc > 2) {
+		write_files(argv[1], argv[2]);
+	}
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "adc_block.h"
+
+/*
+ * adc_pingpong_init
+ *
+ * buf must hold 2 * frames * channels samples.
+ */
+void adc_pingpong_init(struct adc_pingpong *pp, uint16_t *buf,
+		       uint32_t channels, uint32_t frames)
+{
+	pp->buf = buf;
+	pp->channels = channels;
+	pp->frames = frames;
+	pp->filled = 0;
+	pp->done = 0;
+	pp->overruns = 0;
+}
+
+/*
+ * adc_pingpong_filled
+ *
+ * Call from the DMA interrupt, with half 0 for half transfer and 1 for
+ * transfer complete. Block n always lives in half n % 2, so if the
+ * interrupt was held off long enough to miss one, count it anyway to
+ * stay in step.
+ */
+void adc_pingpong_filled(struct adc_pingpong *pp, uint32_t half)
+{
+	uint32_t n = pp->filled;
+
+	if ((n & 1) != half) {
+		n++;
+	}
+	pp->filled = n + 1;
+}
+
+/*
+ * adc_pingpong_irq
+ *
+ * Call from the DMA interrupt once either flag is cleared, with the
+ * number of transfers the DMA still has to do (CNDTR). When the interrupt
+ * was held off until both the half transfer and the transfer complete
+ * flag were set, the flags alone don't say which half was filled last,
+ * but the DMA is always writing the half after it.
+ */
+void adc_pingpong_irq(struct adc_pingpong *pp, uint32_t remaining)
+{
+	uint32_t half = pp->frames * pp->channels;
+
+	adc_pingpong_filled(pp, remaining > half ? 1 : 0);
+}
+
+/*
+ * adc_pingpong_poll
+ *
+ * Call from the main loop. Hands every block filled since the last call
+ * to cb, oldest first, and returns how many were handed off.
+ *
+ * Once block n + 1 is complete the DMA is writing block n + 2 into the
+ * same half as block n. A block found in that state is skipped, and one
+ * that got into it while cb was still working on it was handed off
+ * corrupted. Both count as an overrun.
+ */
+uint32_t adc_pingpong_poll(struct adc_pingpong *pp, adc_block_cb cb,
+			   void *priv)
+{
+	struct adc_block block;
+	uint32_t seq, count = 0;
+
+	while ((seq = pp->done) != pp->filled) {
+		pp->done = seq + 1;
+		if (pp->filled - seq >= 2) {
+			pp->overruns++;
+			continue;
+		}
+
+		block.samples = pp->buf + (seq & 1) * pp->frames * pp->channels;
+		block.frames = pp->frames;
+		block.channels = pp->channels;
+		block.seq = seq;
+		cb(&block, priv);
+		count++;
+
+		if (pp->filled - seq >= 2) {
+			pp->overruns++;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADC_BLOCK_H
+#define ADC_BLOCK_H
+
+#include <stdint.h>
+
+/*
+ * Hand off the two halves of a circular DMA buffer as blocks of samples.
+ *
+ * The DMA interrupt only counts filled halves with adc_pingpong_irq(),
+ * everything else runs from the main loop in adc_pingpong_poll(). Nothing
+ * in here touches the hardware.
+ */
+
+struct adc_block {
+	const uint16_t *samples;	/* frames x channels, interleaved */
+	uint32_t frames;
+	uint32_t channels;
+	uint32_t seq;			/* block number since start */
+};
+
+typedef void (*adc_block_cb)(const struct adc_block *block, void *priv);
+
+struct adc_pingpong {
+	uint16_t *buf;			/* two halves of frames x channels */
+	uint32_t channels;
+	uint32_t frames;		/* per half */
+	volatile uint32_t filled;	/* halves completed by the DMA */
+	uint32_t done;			/* halves handed off */
+	uint32_t overruns;		/* halves the DMA came back to early */
+};
+
+void adc_pingpong_init(struct adc_pingpong *pp, uint16_t *buf,
+		       uint32_t channels, uint32_t frames);
+void adc_pingpong_filled(struct adc_pingpong *pp, uint32_t half);
+void adc_pingpong_irq(struct adc_pingpong *pp, uint32_t remaining);
+uint32_t adc_pingpong_poll(struct adc_pingpong *pp, adc_block_cb cb,
+			   void *priv);
+
+#endif
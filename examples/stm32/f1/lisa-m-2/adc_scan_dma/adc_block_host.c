@@ -0,0 +1,357 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks adc_block.c on the host:
+ *
+ *	cc -o adc_block_host adc_block_host.c adc_block.c
+ *	./adc_block_host
+ *
+ * A model of the circular DMA writes tagged samples into the buffer and
+ * raises the half transfer and transfer complete flags. The interrupt
+ * can be held off, the main loop polls at random times and the block
+ * callback takes random time, during which the DMA keeps going. Every
+ * block handed off must be the right one, in order, and every block that
+ * was skipped or overwritten under the callback must show up as an
+ * overrun.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "adc_block.h"
+
+#define FRAMES		8
+#define CHANNELS	3
+#define TOTAL		(2 * FRAMES * CHANNELS)
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t rnd_state = 12345;
+
+static uint32_t rnd(uint32_t n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 16) % n;
+}
+
+/* What frame f, channel c of block seq holds */
+static uint16_t tag(uint32_t seq, uint32_t f, uint32_t c)
+{
+	return (uint16_t)((seq * FRAMES + f) * CHANNELS + c);
+}
+
+/*
+ * The DMA: pos counts down like CNDTR, frames counts every frame written
+ * since the start, and ht/tc are the interrupt flags.
+ */
+struct dma {
+	uint16_t buf[TOTAL];
+	uint32_t remaining;
+	uint32_t frames;
+	int ht, tc;
+	int holdoff;			/* frames the interrupt stays masked */
+	struct adc_pingpong pp;
+};
+
+static struct dma dma;
+
+static void isr(struct dma *d)
+{
+	if (d->ht || d->tc) {
+		d->ht = d->tc = 0;
+		adc_pingpong_irq(&d->pp, d->remaining);
+	}
+}
+
+static void dma_frame(struct dma *d)
+{
+	uint32_t i = TOTAL - d->remaining;
+	uint32_t c;
+
+	for (c = 0; c < CHANNELS; c++) {
+		d->buf[i + c] = tag(d->frames / FRAMES, d->frames % FRAMES, c);
+	}
+	d->frames++;
+	d->remaining -= CHANNELS;
+	if (d->remaining == TOTAL / 2) {
+		d->ht = 1;
+	}
+	if (d->remaining == 0) {
+		d->remaining = TOTAL;
+		d->tc = 1;
+	}
+
+	/* taken at the end of the frame, unless still masked */
+	if (d->holdoff > 0) {
+		d->holdoff--;
+	}
+	if (d->holdoff == 0) {
+		isr(d);
+	}
+}
+
+static void dma_run(struct dma *d, uint32_t frames)
+{
+	while (frames--) {
+		dma_frame(d);
+	}
+}
+
+static void dma_init(struct dma *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->remaining = TOTAL;
+	adc_pingpong_init(&d->pp, d->buf, CHANNELS, FRAMES);
+}
+
+/* What the callback saw */
+struct seen {
+	uint32_t count;
+	uint32_t next_seq;
+	uint32_t busy;			/* frames the next callback takes */
+	uint32_t busy_rnd;		/* plus up to this many more */
+	uint32_t corrupt;
+	uint32_t unseen;		/* corrupted with no overrun */
+	int pending;
+	uint32_t overruns;
+	uint32_t order;
+	uint32_t place;
+};
+
+/*
+ * A block that was overwritten under the callback must be counted as an
+ * overrun as soon as the callback returns.
+ */
+static void settle(struct seen *s)
+{
+	if (s->pending && dma.pp.overruns == s->overruns) {
+		s->unseen++;
+	}
+	s->pending = 0;
+}
+
+static void cb(const struct adc_block *b, void *priv)
+{
+	struct seen *s = priv;
+	uint32_t f, c, bad = 0;
+	const uint16_t *expect;
+
+	settle(s);
+
+	expect = dma.buf + (b->seq & 1) * FRAMES * CHANNELS;
+	if (b->samples != expect || b->frames != FRAMES ||
+	    b->channels != CHANNELS) {
+		s->place++;
+	}
+	if (b->seq < s->next_seq) {
+		s->order++;
+	}
+	s->next_seq = b->seq + 1;
+	s->count++;
+
+	dma_run(&dma, s->busy + (s->busy_rnd ? rnd(s->busy_rnd) : 0));
+	s->busy = 0;
+
+	for (f = 0; f < FRAMES; f++) {
+		for (c = 0; c < CHANNELS; c++) {
+			if (b->samples[f * CHANNELS + c] != tag(b->seq, f, c)) {
+				bad = 1;
+			}
+		}
+	}
+	s->corrupt += bad;
+	s->pending = bad;
+	s->overruns = dma.pp.overruns;
+}
+
+static uint32_t poll(struct seen *s)
+{
+	uint32_t n = adc_pingpong_poll(&dma.pp, cb, s);
+
+	settle(s);
+	return n;
+}
+
+static void test_scripted(void)
+{
+	struct seen s;
+	uint32_t n;
+
+	dma_init(&dma);
+	memset(&s, 0, sizeof(s));
+
+	/* nothing yet, then one block at a time */
+	n = poll(&s);
+	check(n == 0, "empty poll", n, 0);
+	for (n = 0; n < 6; n++) {
+		dma_run(&dma, FRAMES);
+		check(poll(&s) == 1, "one block",
+		      n, s.count);
+	}
+	check(s.count == 6 && s.next_seq == 6, "six blocks", s.count,
+	      s.next_seq);
+	check(s.place == 0 && s.order == 0 && s.corrupt == 0, "in place",
+	      s.place, s.corrupt);
+	check(dma.pp.overruns == 0, "no overruns", dma.pp.overruns, 0);
+
+	/* two blocks before the poll: the older one is being overwritten */
+	dma_run(&dma, 2 * FRAMES);
+	n = poll(&s);
+	check(n == 1 && s.next_seq == 8, "late poll", n, s.next_seq);
+	check(dma.pp.overruns == 1, "late overrun", dma.pp.overruns, 1);
+
+	/*
+	 * The callback is still busy when the DMA comes back round. The
+	 * block after it is whole, and handed off in the same poll.
+	 */
+	dma_run(&dma, FRAMES);
+	s.busy = FRAMES + 1;
+	n = poll(&s);
+	check(n == 2 && s.corrupt == 1, "slow callback", n, s.corrupt);
+	check(s.unseen == 0, "slow seen", s.unseen, 0);
+	check(dma.pp.overruns == 2, "slow overrun", dma.pp.overruns, 2);
+	check(s.next_seq == 10, "next one kept", s.next_seq, 10);
+	check(dma.pp.filled == dma.frames / FRAMES, "in step",
+	      dma.pp.filled, dma.frames / FRAMES);
+}
+
+/*
+ * The interrupt held off over a half boundary, so that it sees both
+ * flags. Starting from either half, and ending anywhere in the next
+ * block, the count must come out as the blocks the DMA really filled.
+ */
+static void test_holdoff(void)
+{
+	uint32_t start, len;
+
+	for (start = 0; start < 2 * FRAMES; start++) {
+		for (len = FRAMES + 1; len < 2 * FRAMES; len++) {
+			dma_init(&dma);
+			dma_run(&dma, start);
+			dma.holdoff = len;
+			dma_run(&dma, len);
+			check(dma.pp.filled == dma.frames / FRAMES,
+			      "held off", start * 100 + len, dma.pp.filled);
+			dma_run(&dma, 3 * FRAMES);
+			check(dma.pp.filled == dma.frames / FRAMES,
+			      "after hold off", start * 100 + len,
+			      dma.pp.filled);
+		}
+	}
+
+	/* a missed half transfer on its own */
+	dma_init(&dma);
+	adc_pingpong_filled(&dma.pp, 1);
+	check(dma.pp.filled == 2, "missed half", dma.pp.filled, 2);
+	adc_pingpong_filled(&dma.pp, 0);
+	check(dma.pp.filled == 3, "back in step", dma.pp.filled, 3);
+}
+
+/* The free running counters wrapping */
+static void test_wrap(void)
+{
+	struct seen s;
+	uint32_t i;
+
+	dma_init(&dma);
+	memset(&s, 0, sizeof(s));
+	dma.pp.filled = dma.pp.done = 0xfffffffc;
+	dma.frames = 0xfffffffc * FRAMES;
+	s.next_seq = 0xfffffffc;
+
+	for (i = 0; i < 8; i++) {
+		dma_run(&dma, FRAMES);
+		poll(&s);
+	}
+	check(s.count == 8 && s.next_seq == 4, "wrapped", s.count,
+	      s.next_seq);
+	check(s.corrupt == 0 && s.place == 0 && dma.pp.overruns == 0,
+	      "wrapped clean", s.corrupt, dma.pp.overruns);
+}
+
+/*
+ * Random polling, callbacks and interrupt latency. Whatever happens, the
+ * blocks handed off plus the skipped ones must account for every block,
+ * and no corrupted block may go by without an overrun. A callback that
+ * returns just as the DMA finishes the next block is counted as an
+ * overrun even if not a sample was overwritten yet, so there can be more
+ * overruns than blocks lost.
+ */
+static void test_random(void)
+{
+	struct seen s;
+	uint32_t round, skipped;
+
+	dma_init(&dma);
+	memset(&s, 0, sizeof(s));
+	s.busy_rnd = FRAMES + FRAMES / 2;
+
+	for (round = 0; round < 200000; round++) {
+		if (rnd(50) == 0 && dma.holdoff == 0) {
+			dma.holdoff = 1 + rnd(2 * FRAMES - 2);
+		}
+		dma_run(&dma, rnd(2 * FRAMES));
+
+		poll(&s);
+	}
+	/* let the last hold off run out and pick everything up */
+	s.busy_rnd = 0;
+	dma_run(&dma, 2 * FRAMES);
+	poll(&s);
+	skipped = s.next_seq - s.count;
+
+	check(dma.pp.filled == dma.frames / FRAMES, "random in step",
+	      dma.pp.filled, dma.frames / FRAMES);
+	check(dma.pp.done == dma.pp.filled, "random all done",
+	      dma.pp.done, dma.pp.filled);
+	check(s.count + skipped == dma.pp.filled, "random accounted",
+	      s.count + skipped, dma.pp.filled);
+	check(s.order == 0 && s.place == 0, "random order", s.order,
+	      s.place);
+	check(s.unseen == 0, "random corrupt seen", s.unseen, s.corrupt);
+	check(dma.pp.overruns >= skipped + s.corrupt, "random overruns",
+	      dma.pp.overruns, skipped + s.corrupt);
+	check(s.corrupt > 0 && s.count > 1000, "random exercised",
+	      s.corrupt, s.count);
+	printf("%u blocks, %u handed off, %u skipped, %u corrupted, "
+	       "%u overruns\n", (unsigned)dma.pp.filled, (unsigned)s.count,
+	       (unsigned)skipped, (unsigned)s.corrupt,
+	       (unsigned)dma.pp.overruns);
+}
+
+int main(void)
+{
+	test_scripted();
+	test_holdoff();
+	test_wrap();
+	test_random();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
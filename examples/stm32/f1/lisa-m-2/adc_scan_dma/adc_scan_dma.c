@@ -0,0 +1,306 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "adc_block.h"
+
+/*
+ * Frames (one sample of every channel) per second, and per block. The
+ * DMA buffer holds two blocks.
+ */
+#define SAMPLE_RATE	20000
+#define BLOCK_FRAMES	256
+
+/* TIM3 runs from twice the 36MHz APB1 clock */
+#define TIM_CLOCK	72000000
+
+/* 16=temperature_sensor, 17=Vrefint, 13=ADC1, 10=ADC2 */
+static uint8_t channels[] = { 16, 17, 13, 10 };
+#define CHANNELS	(sizeof(channels) / sizeof(channels[0]))
+
+static uint16_t dma_buf[2 * BLOCK_FRAMES * CHANNELS];
+static struct adc_pingpong pp;
+
+/* What the block callback found, per channel, since the last print */
+struct chan_stats {
+	uint32_t sum;
+	uint16_t min, max;
+};
+static struct chan_stats stats[CHANNELS];
+static uint32_t stat_frames;
+
+int _write(int file, char *ptr, int len);
+
+static volatile uint32_t system_millis;
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOC);
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_USART2);
+	rcc_periph_clock_enable(RCC_TIM3);
+	rcc_periph_clock_enable(RCC_ADC1);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	/* 1ms SysTick */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+void sys_tick_handler(void)
+{
+	system_millis++;
+}
+
+static void usart_setup(void)
+{
+	/* Setup GPIO pin GPIO_USART2_TX on GPIO port A for transmit. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+
+	/* Setup UART parameters. */
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_mode(USART2, USART_MODE_TX);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+
+	/* Finally enable the USART. */
+	usart_enable(USART2);
+}
+
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART2, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+static void gpio_setup(void)
+{
+	/* Setup the LEDs. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_2_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO8);
+
+	/* Setup Lisa/M v2 ADC1,2 on ANALOG1 connector */
+	gpio_set_mode(GPIOC, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG,
+		      GPIO3 | GPIO0);
+}
+
+/*
+ * timer_setup
+ *
+ * Make TIM3 overflow (and so trigger a scan through TRGO) as close to
+ * rate times a second as the prescaler and period allow, and return the
+ * rate it actually ended up with.
+ */
+static uint32_t timer_setup(uint32_t rate)
+{
+	uint32_t ticks, psc, arr;
+
+	ticks = TIM_CLOCK / rate;
+	psc = ticks / 65536 + 1;
+	arr = ticks / psc;
+
+	rcc_periph_reset_pulse(RST_TIM3);
+	timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_set_prescaler(TIM3, psc - 1);
+	timer_set_period(TIM3, arr - 1);
+	/* Generate TRGO on every update. */
+	timer_set_master_mode(TIM3, TIM_CR2_MMS_UPDATE);
+
+	return TIM_CLOCK / (psc * arr);
+}
+
+static void dma_setup(void)
+{
+	dma_channel_reset(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1, (uint32_t)&ADC_DR(ADC1));
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, (uint32_t)dma_buf);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1,
+			       sizeof(dma_buf) / sizeof(dma_buf[0]));
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL1, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL1);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+
+	nvic_set_priority(NVIC_DMA1_CHANNEL1_IRQ, 0);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+}
+
+static void adc_setup(void)
+{
+	int i;
+
+	/* Make sure the ADC doesn't run during config. */
+	adc_power_off(ADC1);
+
+	/*
+	 * One scan through all channels for each TIM3 TRGO, with every
+	 * result moved out by DMA as soon as it is converted.
+	 */
+	adc_enable_scan_mode(ADC1);
+	adc_set_single_conversion_mode(ADC1);
+	adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM3_TRGO);
+	adc_set_right_aligned(ADC1);
+	adc_enable_dma(ADC1);
+	/* We want to read the temperature sensor, so we have to enable it. */
+	adc_enable_temperature_sensor();
+	/*
+	 * ADCCLK is 12MHz, so each channel takes (28.5 + 12.5) / 12MHz,
+	 * about 3.4us, and a scan of four 14us. That is the limit for
+	 * SAMPLE_RATE.
+	 */
+	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
+	adc_set_regular_sequence(ADC1, CHANNELS, channels);
+
+	adc_power_on(ADC1);
+
+	/* Wait for ADC starting up. */
+	for (i = 0; i < 800000; i++)    /* Wait a bit. */
+		__asm__("nop");
+
+	adc_reset_calibration(ADC1);
+	adc_calibrate(ADC1);
+}
+
+/*
+ * Both halves, and anything in between they missed, are sorted out by
+ * adc_pingpong_irq() from where the DMA is now.
+ */
+void dma1_channel1_isr(void)
+{
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF) ||
+	    dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1,
+					  DMA_HTIF | DMA_TCIF);
+		adc_pingpong_irq(&pp, DMA_CNDTR(DMA1, DMA_CHANNEL1));
+	}
+}
+
+/* Runs from the main loop for every block */
+static void block_ready(const struct adc_block *block, void *priv)
+{
+	const uint16_t *s = block->samples;
+	uint32_t f, c;
+
+	(void)priv;
+
+	for (f = 0; f < block->frames; f++) {
+		for (c = 0; c < block->channels; c++, s++) {
+			stats[c].sum += *s;
+			if (*s < stats[c].min)
+				stats[c].min = *s;
+			if (*s > stats[c].max)
+				stats[c].max = *s;
+		}
+	}
+	stat_frames += block->frames;
+}
+
+static void stats_reset(void)
+{
+	uint32_t c;
+
+	for (c = 0; c < CHANNELS; c++) {
+		stats[c].sum = 0;
+		stats[c].min = 0xffff;
+		stats[c].max = 0;
+	}
+	stat_frames = 0;
+}
+
+int main(void)
+{
+	uint32_t rate, next, c, last_overruns = 0;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+	adc_setup();
+
+	adc_pingpong_init(&pp, dma_buf, CHANNELS, BLOCK_FRAMES);
+	stats_reset();
+	dma_setup();
+	rate = timer_setup(SAMPLE_RATE);
+
+	printf("ADC scan of %d channels at %lu frames/s, %d frames per "
+	       "block\r\n", (int)CHANNELS, rate, BLOCK_FRAMES);
+
+	timer_enable_counter(TIM3);
+
+	next = system_millis + 1000;
+	while (1) {
+		adc_pingpong_poll(&pp, block_ready, NULL);
+
+		if ((int32_t)(system_millis - next) < 0)
+			continue;
+		next += 1000;
+
+		gpio_toggle(GPIOA, GPIO8);
+
+		/*
+		 * The samples/s we actually saw, the overruns in the last
+		 * second and in total, and the mean, min and max of each
+		 * channel.
+		 */
+		printf("%lu samples/s, %lu overruns (%lu total) |",
+		       stat_frames * CHANNELS, pp.overruns - last_overruns,
+		       pp.overruns);
+		for (c = 0; c < CHANNELS; c++) {
+			printf(" %lu %u..%u",
+			       stat_frames ? stats[c].sum / stat_frames : 0,
+			       stats[c].min, stats[c].max);
+		}
+		printf("\r\n");
+
+		last_overruns = pp.overruns;
+		stats_reset();
+	}
+
+	return 0;
+}
@@ -26,27 +26,30 @@
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/stm32/rcc.h>
 
-struct can_tx_msg {
-	uint32_t std_id;
-	uint32_t ext_id;
-	uint8_t ide;
-	uint8_t rtr;
-	uint8_t dlc;
-	uint8_t data[8];
-};
+#include "can_buf.h"
+#include "can_filter.h"
+
+/* APB1 36MHz / 12 / 8 time quanta */
+#define CAN_BITRATE 375000
+
+static volatile uint32_t system_millis;
 
-struct can_rx_msg {
-	uint32_t std_id;
-	uint32_t ext_id;
-	uint8_t ide;
-	uint8_t rtr;
-	uint8_t dlc;
-	uint8_t data[8];
-	uint8_t fmi;
+/* Refreshed by the main loop, for looking at with a debugger */
+static struct can_buf_stats can_stats;
+static uint32_t can_bus_load;	/* percent, over the last second */
+
+/*
+ * What this node listens to: ID 0 is what the other boards running this
+ * demo send and gets FIFO0 to itself, 0x100-0x13f stands in for less
+ * urgent traffic in FIFO1.
+ */
+static const struct can_filter_rule can_rules[] = {
+	{ .first = 0x000, .last = 0x000, .ext = false, .prio = 0 },
+	{ .first = 0x100, .last = 0x13f, .ext = false, .prio = 1 },
 };
 
-struct can_tx_msg can_tx_msg;
-struct can_rx_msg can_rx_msg;
+/* Unwanted IDs the filters let through anyway */
+static uint32_t can_filter_leak;
 
 static void gpio_setup(void)
 {
@@ -101,6 +104,22 @@ static void systick_setup(void)
 	systick_counter_enable();
 }
 
+static void can_filter_setup(void)
+{
+	struct can_filter_bank banks[CAN_FILTER_BANKS];
+	int i, n;
+
+	n = can_filter_compile(can_rules,
+			       sizeof(can_rules) / sizeof(can_rules[0]),
+			       banks, CAN_FILTER_BANKS, &can_filter_leak);
+
+	for (i = 0; i < n; i++) {
+		can_filter_init(i, banks[i].scale_32bit, banks[i].list_mode,
+				banks[i].fr1, banks[i].fr2, banks[i].fifo,
+				true);
+	}
+}
+
 static void can_setup(void)
 {
 	/* Enable peripheral clocks. */
@@ -119,16 +138,12 @@ static void can_setup(void)
 	gpio_set_mode(GPIO_BANK_CAN1_PB_TX, GPIO_MODE_OUTPUT_50_MHZ,
 		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_CAN1_PB_TX);
 
-	/* NVIC setup. */
-	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
-	nvic_set_priority(NVIC_USB_LP_CAN_RX0_IRQ, 1);
-
 	/* Reset CAN. */
 	can_reset(CAN1);
 
 	/* CAN cell init. */
 	if (can_init(CAN1,
-		     false,           /* TTCM: Time triggered comm mode? */
+		     true,            /* TTCM: Time triggered comm mode? */
 		     true,            /* ABOM: Automatic bus-off management? */
 		     false,           /* AWUM: Automatic wakeup mode? */
 		     false,           /* NART: No automatic retransmission? */
@@ -152,22 +167,22 @@ static void can_setup(void)
 			__asm__("nop");
 	}
 
-	/* CAN filter 0 init. */
-	can_filter_id_mask_32bit_init(
-				0,     /* Filter ID */
-				0,     /* CAN ID */
-				0,     /* CAN ID mask */
-				0,     /* FIFO assignment (here: FIFO0) */
-				true); /* Enable the filter. */
+	/* Acceptance filters, compiled from can_rules. */
+	can_filter_setup();
 
-	/* Enable CAN RX interrupt. */
-	can_enable_irq(CAN1, CAN_IER_FMPIE0);
+	/* Queues, and the interrupts that serve them. */
+	can_buf_init();
 }
 
 void sys_tick_handler(void)
 {
 	static int temp32 = 0;
-	static uint8_t data[8] = {0, 1, 2, 0, 0, 0, 0, 0};
+	static struct can_frame frame = {
+		.id = 0, .ext = false, .rtr = false, .dlc = 8,
+		.data = {0, 1, 2, 0, 0, 0, 0, 0},
+	};
+
+	system_millis++;
 
 	/* We call this handler every 1ms so every 100ms = 0.1s
 	 * resulting in 100Hz message rate.
@@ -178,14 +193,8 @@ void sys_tick_handler(void)
 	temp32 = 0;
 
 	/* Transmit CAN frame. */
-	data[0]++;
-	if (can_transmit(CAN1,
-			 0,     /* (EX/ST)ID: CAN ID */
-			 false, /* IDE: CAN ID extended? */
-			 false, /* RTR: Request transmit? */
-			 8,     /* DLC: Data length */
-			 data) == -1)
-	{
+	frame.data[0]++;
+	if (!can_buf_send(&frame)) {
 		gpio_set(GPIOA, GPIO8);    /* LED1 off */
 		gpio_set(GPIOB, GPIO4);    /* LED2 off */
 		gpio_set(GPIOC, GPIO2);    /* LED3 off */
@@ -194,45 +203,53 @@ void sys_tick_handler(void)
 	}
 }
 
-void usb_lp_can_rx0_isr(void)
+static void show_frame(const struct can_frame *frame)
 {
-	uint32_t id;
-	bool ext, rtr;
-	uint8_t fmi, length, data[8];
+	uint8_t data0 = frame->data[0];
 
-	can_receive(CAN1, 0, false, &id, &ext, &rtr, &fmi, &length, data, NULL);
-
-	if (data[0] & 1)
+	if (data0 & 1)
 		gpio_clear(GPIOA, GPIO8);
 	else
 		gpio_set(GPIOA, GPIO8);
 
-	if (data[0] & 2)
+	if (data0 & 2)
 		gpio_clear(GPIOB, GPIO4);
 	else
 		gpio_set(GPIOB, GPIO4);
 
-	if (data[0] & 4)
+	if (data0 & 4)
 		gpio_clear(GPIOC, GPIO2);
 	else
 		gpio_set(GPIOC, GPIO2);
 
-	if (data[0] & 8)
+	if (data0 & 8)
 		gpio_clear(GPIOC, GPIO5);
 	else
 		gpio_set(GPIOC, GPIO5);
-
-	can_fifo_release(CAN1, 0);
 }
 
 int main(void)
 {
+	struct can_frame frame;
+	uint32_t load_start = 0, load_bits = 0;
+
 	rcc_clock_setup_in_hse_12mhz_out_72mhz();
 	gpio_setup();
 	can_setup();
 	systick_setup();
 
-	while (1); /* Halt. */
+	while (1) {
+		while (can_buf_recv(&frame))
+			show_frame(&frame);
+
+		can_buf_get_stats(&can_stats);
+		if (system_millis - load_start >= 1000) {
+			can_bus_load = (can_stats.bits - load_bits) /
+				       (CAN_BITRATE / 100);
+			load_bits = can_stats.bits;
+			load_start += 1000;
+		}
+	}
 
 	return 0;
 }
@@ -0,0 +1,60 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAN_BUF_H
+#define CAN_BUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Both must be powers of two */
+#define CAN_BUF_TX_LEN		16
+#define CAN_BUF_RX_LEN		32
+
+struct can_frame {
+	uint32_t id;
+	bool ext;
+	bool rtr;
+	uint8_t dlc;
+	uint8_t data[8];
+	uint16_t time;		/* rx: bxCAN timestamp, in bit times */
+	uint8_t fmi;		/* rx: filter match index */
+};
+
+struct can_buf_stats {
+	uint32_t tx_frames;	/* sent and acknowledged */
+	uint32_t tx_dropped;	/* queue full on can_buf_send() */
+	uint32_t tx_aborted;	/* pulled out of a mailbox, sent later */
+	uint32_t rx_frames;
+	uint32_t rx_lost;	/* rx ring full */
+	uint32_t rx_overrun;	/* a hardware FIFO overran */
+	uint32_t bits;		/* on the bus both ways, without stuffing */
+	uint32_t bus_errors;	/* last error code updates */
+	uint32_t warnings;	/* times the error counters reached 96 */
+	uint32_t passive;	/* times we went error passive */
+	uint32_t bus_off;	/* times we went bus off */
+	uint8_t tec;		/* error counters right now */
+	uint8_t rec;
+};
+
+void can_buf_init(void);
+bool can_buf_send(const struct can_frame *frame);
+bool can_buf_recv(struct can_frame *frame);
+uint32_t can_buf_frame_bits(const struct can_frame *frame);
+void can_buf_get_stats(struct can_buf_stats *stats);
+
+#endif
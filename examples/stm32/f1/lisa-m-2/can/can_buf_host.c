@@ -0,0 +1,1026 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks can_buf.c on the host:
+ *
+ *	cc -o can_buf_host can_buf_host.c
+ *	./can_buf_host
+ *
+ * can_buf.c is included below, on top of a model of the bxCAN parts it
+ * uses: three transmit mailboxes with the TSR flags, which the bus
+ * sends lowest identifier first and which can be aborted unless on the
+ * bus already, two three deep receive FIFOs with RFxR and their
+ * overrun flag, and ESR/MSR for the error interrupt. The interrupts
+ * run whenever their flags are up and the driver is not masking them.
+ *
+ * Checked: every frame accepted goes out exactly once, in arbitration
+ * order whenever the bus picks one, frames with the same identifier in
+ * the order they were queued, aborted mailboxes coming back to the
+ * queue, the receive ring keeping the oldest frames when it overflows,
+ * the FIFO overrun and error counters, and a reset through
+ * can_buf_init().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CAN_BUF_HOST
+
+/* The registers and bits can_buf.c uses */
+#define CAN1			0
+
+#define CAN_TSR_RQCP0		(1 << 0)
+#define CAN_TSR_TXOK0		(1 << 1)
+#define CAN_TSR_ALST0		(1 << 2)
+#define CAN_TSR_TERR0		(1 << 3)
+#define CAN_TSR_ABRQ0		(1 << 7)
+#define CAN_TSR_RQCP1		(1 << 8)
+#define CAN_TSR_TXOK1		(1 << 9)
+#define CAN_TSR_ABRQ1		(1 << 15)
+#define CAN_TSR_RQCP2		(1 << 16)
+#define CAN_TSR_TXOK2		(1 << 17)
+#define CAN_TSR_ABRQ2		(1 << 23)
+#define CAN_TSR_TME0		(1 << 26)
+
+#define CAN_RF0R_FMP0_MASK	(3 << 0)
+#define CAN_RF0R_FOVR0		(1 << 4)
+#define CAN_RF1R_FMP1_MASK	(3 << 0)
+#define CAN_RF1R_FOVR1		(1 << 4)
+
+#define CAN_ESR_EWGF		(1 << 0)
+#define CAN_ESR_EPVF		(1 << 1)
+#define CAN_ESR_BOFF		(1 << 2)
+
+#define CAN_MSR_ERRI		(1 << 2)
+
+#define CAN_IER_TMEIE		(1 << 0)
+#define CAN_IER_FMPIE0		(1 << 1)
+#define CAN_IER_FOVIE0		(1 << 3)
+#define CAN_IER_FMPIE1		(1 << 4)
+#define CAN_IER_FOVIE1		(1 << 6)
+#define CAN_IER_EWGIE		(1 << 8)
+#define CAN_IER_EPVIE		(1 << 9)
+#define CAN_IER_BOFIE		(1 << 10)
+#define CAN_IER_LECIE		(1 << 11)
+#define CAN_IER_ERRIE		(1 << 15)
+
+#define NVIC_USB_HP_CAN_TX_IRQ	19
+#define NVIC_USB_LP_CAN_RX0_IRQ	20
+#define NVIC_CAN_RX1_IRQ	21
+#define NVIC_CAN_SCE_IRQ	22
+
+enum reg { R_TSR, R_RF0R, R_RF1R, R_ESR, R_MSR };
+
+static volatile uint32_t *reg(enum reg r);
+
+#define CAN_TSR(port)		(*reg(R_TSR))
+#define CAN_RF0R(port)		(*reg(R_RF0R))
+#define CAN_RF1R(port)		(*reg(R_RF1R))
+#define CAN_ESR(port)		(*reg(R_ESR))
+#define CAN_MSR(port)		(*reg(R_MSR))
+
+static int can_transmit(uint32_t port, uint32_t id, bool ext, bool rtr,
+			uint8_t length, uint8_t *data);
+static void can_receive(uint32_t port, uint8_t fifo, bool release,
+			uint32_t *id, bool *ext, bool *rtr, uint8_t *fmi,
+			uint8_t *length, uint8_t *data, uint16_t *timestamp);
+static void can_fifo_release(uint32_t port, uint8_t fifo);
+static void can_enable_irq(uint32_t port, uint32_t irq);
+static uint32_t cm_mask_interrupts(uint32_t mask);
+static void nvic_set_priority(uint8_t irqn, uint8_t priority);
+static void nvic_enable_irq(uint8_t irqn);
+
+#include "can_buf.c"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/* The model */
+
+struct mailbox {
+	struct can_frame f;
+	bool pending;		/* waiting for the bus */
+	bool on_bus;
+	bool abort;		/* requested while on the bus */
+	bool rqcp, txok;
+};
+
+static struct {
+	struct mailbox mb[3];
+	struct can_frame fifo[2][3];
+	int fmp[2];
+	bool fovr[2];
+	uint32_t esr;
+	bool erri;
+	uint32_t ier;
+	uint32_t masked;
+	int aborts;		/* frames taken out of a mailbox */
+	int bad_writes;		/* bits written that mean nothing */
+	int left_masked;	/* can_buf_send() left interrupts masked */
+	int storms;		/* an interrupt that would not go away */
+	uint16_t time;
+} hw;
+
+/*
+ * Register accesses go through a cell that shows the value with a
+ * reserved bit set. The driver never writes that bit, so a cell without
+ * it has been written, and the write is applied on the next access, or
+ * when the model or the test looks.
+ */
+#define RESERVED_BIT(r)	((r) == R_TSR ? (1 << 4) : \
+			 (r) == R_ESR ? (1 << 3) : (1 << 5))
+
+static struct {
+	bool open;
+	enum reg r;
+	uint32_t cell;
+} acc;
+
+static uint32_t reg_value(enum reg r)
+{
+	uint32_t v = 0;
+	int i;
+
+	switch (r) {
+	case R_TSR:
+		for (i = 0; i < 3; i++) {
+			v |= (hw.mb[i].rqcp ? CAN_TSR_RQCP0 : 0) << (8 * i);
+			v |= (hw.mb[i].txok ? CAN_TSR_TXOK0 : 0) << (8 * i);
+			v |= (hw.mb[i].pending ? 0 : CAN_TSR_TME0) << i;
+		}
+		break;
+	case R_RF0R:
+	case R_RF1R:
+		i = r - R_RF0R;
+		v = hw.fmp[i] | (hw.fmp[i] == 3 ? (1 << 3) : 0) |
+		    (hw.fovr[i] ? CAN_RF0R_FOVR0 : 0);
+		break;
+	case R_ESR:
+		v = hw.esr;
+		break;
+	case R_MSR:
+		v = hw.erri ? CAN_MSR_ERRI : 0;
+		break;
+	}
+	return v;
+}
+
+static void reg_write(enum reg r, uint32_t w)
+{
+	struct mailbox *m;
+	int i;
+
+	switch (r) {
+	case R_TSR:
+		for (i = 0; i < 3; i++) {
+			m = &hw.mb[i];
+			if (w & (CAN_TSR_RQCP0 << (8 * i))) {
+				m->rqcp = m->txok = false;
+			}
+			if (!(w & (CAN_TSR_ABRQ0 << (8 * i))) || !m->pending) {
+				continue;
+			}
+			if (m->on_bus) {
+				m->abort = true;
+			} else {
+				m->pending = false;
+				m->rqcp = true;
+				m->txok = false;
+				hw.aborts++;
+			}
+		}
+		if (w & ~0x00838383) {
+			hw.bad_writes++;
+		}
+		break;
+	case R_RF0R:
+	case R_RF1R:
+		if (w & CAN_RF0R_FOVR0) {
+			hw.fovr[r - R_RF0R] = false;
+		}
+		if (w & ~CAN_RF0R_FOVR0) {
+			hw.bad_writes++;
+		}
+		break;
+	case R_ESR:
+		/* Only the last error code can be written */
+		hw.esr = (hw.esr & ~0x70) | (w & 0x70);
+		if (w & ~0x70) {
+			hw.bad_writes++;
+		}
+		break;
+	case R_MSR:
+		if (w & CAN_MSR_ERRI) {
+			hw.erri = false;
+		}
+		if (w & ~CAN_MSR_ERRI) {
+			hw.bad_writes++;
+		}
+		break;
+	}
+}
+
+/* Apply a pending write, and show the register as it is now */
+static void reg_sync(void)
+{
+	if (acc.open) {
+		if (!(acc.cell & RESERVED_BIT(acc.r))) {
+			reg_write(acc.r, acc.cell);
+		}
+		acc.cell = reg_value(acc.r) | RESERVED_BIT(acc.r);
+	}
+}
+
+static volatile uint32_t *reg(enum reg r)
+{
+	reg_sync();
+	acc.open = true;
+	acc.r = r;
+	acc.cell = reg_value(r) | RESERVED_BIT(r);
+	return &acc.cell;
+}
+
+static int can_transmit(uint32_t port, uint32_t id, bool ext, bool rtr,
+			uint8_t length, uint8_t *data)
+{
+	struct mailbox *m;
+	int i;
+
+	(void)port;
+	reg_sync();
+	for (i = 0; i < 3; i++) {
+		m = &hw.mb[i];
+		if (!m->pending) {
+			memset(&m->f, 0, sizeof(m->f));
+			m->f.id = id;
+			m->f.ext = ext;
+			m->f.rtr = rtr;
+			m->f.dlc = length;
+			memcpy(m->f.data, data, length);
+			m->pending = true;
+			m->on_bus = m->abort = false;
+			reg_sync();
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void fifo_pop(int fifo)
+{
+	reg_sync();
+	if (hw.fmp[fifo] == 0) {
+		hw.bad_writes++;
+		return;
+	}
+	memmove(&hw.fifo[fifo][0], &hw.fifo[fifo][1],
+		2 * sizeof(hw.fifo[fifo][0]));
+	hw.fmp[fifo]--;
+	reg_sync();
+}
+
+static void can_receive(uint32_t port, uint8_t fifo, bool release,
+			uint32_t *id, bool *ext, bool *rtr, uint8_t *fmi,
+			uint8_t *length, uint8_t *data, uint16_t *timestamp)
+{
+	struct can_frame *f = &hw.fifo[fifo][0];
+
+	(void)port;
+	*id = f->id;
+	*ext = f->ext;
+	*rtr = f->rtr;
+	*fmi = f->fmi;
+	*length = f->dlc;
+	memcpy(data, f->data, 8);
+	*timestamp = f->time;
+	if (release) {
+		fifo_pop(fifo);
+	}
+}
+
+static void can_fifo_release(uint32_t port, uint8_t fifo)
+{
+	(void)port;
+	fifo_pop(fifo);
+}
+
+static void can_enable_irq(uint32_t port, uint32_t irq)
+{
+	(void)port;
+	hw.ier |= irq;
+}
+
+static uint32_t cm_mask_interrupts(uint32_t mask)
+{
+	uint32_t old = hw.masked;
+
+	hw.masked = mask;
+	return old;
+}
+
+static void nvic_set_priority(uint8_t irqn, uint8_t priority)
+{
+	(void)irqn;
+	(void)priority;
+}
+
+static void nvic_enable_irq(uint8_t irqn)
+{
+	(void)irqn;
+}
+
+/*
+ * Arbitration, worked out bit by bit as on the bus: the base
+ * identifier, RTR or SRR, IDE, then for extended frames the rest of the
+ * identifier and RTR. A dominant 0 wins.
+ */
+static uint64_t arbitration(const struct can_frame *f)
+{
+	if (f->ext) {
+		return ((uint64_t)(f->id >> 18) << 21) | (1 << 20) |
+		       (1 << 19) | ((f->id & 0x3ffff) << 1) | f->rtr;
+	}
+	return ((uint64_t)f->id << 21) | ((uint64_t)f->rtr << 20);
+}
+
+/* Run the interrupts until none is pending. */
+static void run_isrs(void)
+{
+	bool any = true;
+	int n = 0;
+
+	while (any && n++ < 100) {
+		reg_sync();
+		any = false;
+		if (hw.masked) {
+			return;
+		}
+		if ((hw.ier & CAN_IER_TMEIE) && (hw.mb[0].rqcp ||
+		    hw.mb[1].rqcp || hw.mb[2].rqcp)) {
+			usb_hp_can_tx_isr();
+			any = true;
+		}
+		if (((hw.ier & CAN_IER_FMPIE0) && hw.fmp[0]) ||
+		    ((hw.ier & CAN_IER_FOVIE0) && hw.fovr[0])) {
+			usb_lp_can_rx0_isr();
+			any = true;
+		}
+		if (((hw.ier & CAN_IER_FMPIE1) && hw.fmp[1]) ||
+		    ((hw.ier & CAN_IER_FOVIE1) && hw.fovr[1])) {
+			can_rx1_isr();
+			any = true;
+		}
+		if ((hw.ier & CAN_IER_ERRIE) && hw.erri) {
+			can_sce_isr();
+			any = true;
+		}
+	}
+	reg_sync();
+	hw.storms += n >= 100;
+}
+
+/* What the bus saw, and what has been queued and not seen yet */
+static struct can_frame wire[4096];
+static int wire_len;
+static int inversions;		/* started while something better waits */
+
+#define MAX_OUT	64
+static struct can_frame out[MAX_OUT];
+static int out_len;
+
+static bool send(const struct can_frame *f)
+{
+	bool ok;
+
+	ok = can_buf_send(f);
+	if (ok && out_len < MAX_OUT) {
+		out[out_len++] = *f;
+	}
+	hw.left_masked += hw.masked != 0;
+	run_isrs();
+	return ok;
+}
+
+/* The bus starts the best pending mailbox, lowest number on a tie */
+static bool bus_start(void)
+{
+	struct mailbox *m, *best = NULL;
+	uint64_t key, min;
+	int i;
+
+	reg_sync();
+	for (i = 0; i < 3; i++) {
+		m = &hw.mb[i];
+		if (m->on_bus) {
+			return true;
+		}
+		if (m->pending && (best == NULL ||
+		    arbitration(&m->f) < arbitration(&best->f))) {
+			best = m;
+		}
+	}
+	if (best == NULL) {
+		return false;
+	}
+	best->on_bus = true;
+
+	/*
+	 * Nothing queued may be more urgent. With the queue full there is
+	 * no room to take a frame out of a mailbox, so that is allowed.
+	 */
+	if (txq_len == CAN_BUF_TX_LEN) {
+		return true;
+	}
+	key = arbitration(&best->f);
+	min = key;
+	for (i = 0; i < out_len; i++) {
+		if (arbitration(&out[i]) < min) {
+			min = arbitration(&out[i]);
+		}
+	}
+	inversions += min < key;
+	return true;
+}
+
+static void bus_finish(void)
+{
+	struct mailbox *m;
+	int i, j;
+
+	reg_sync();
+	for (i = 0; i < 3; i++) {
+		m = &hw.mb[i];
+		if (!m->on_bus) {
+			continue;
+		}
+		m->on_bus = m->abort = m->pending = false;
+		m->rqcp = m->txok = true;
+		if (wire_len < 4096) {
+			wire[wire_len++] = m->f;
+		}
+		for (j = 0; j < out_len; j++) {
+			if (memcmp(&out[j], &m->f, sizeof(m->f)) == 0) {
+				out[j] = out[--out_len];
+				break;
+			}
+		}
+	}
+	run_isrs();
+}
+
+/*
+ * The frame on the bus loses arbitration. The hardware tries again,
+ * unless an abort was asked for meanwhile.
+ */
+static void bus_lose(void)
+{
+	struct mailbox *m;
+	int i;
+
+	reg_sync();
+	for (i = 0; i < 3; i++) {
+		m = &hw.mb[i];
+		if (!m->on_bus) {
+			continue;
+		}
+		m->on_bus = false;
+		if (m->abort) {
+			m->abort = m->pending = false;
+			m->rqcp = true;
+			m->txok = false;
+			hw.aborts++;
+		}
+	}
+	run_isrs();
+}
+
+static void bus_frame(void)
+{
+	if (bus_start()) {
+		bus_finish();
+	}
+}
+
+static void bus_drain(void)
+{
+	int n = 0;
+
+	while (bus_start() && n++ < 1000) {
+		bus_finish();
+	}
+}
+
+/* A frame comes in to a FIFO, the last one is overwritten if full */
+static void bus_receive(int fifo, const struct can_frame *f)
+{
+	reg_sync();
+	if (hw.fmp[fifo] == 3) {
+		hw.fovr[fifo] = true;
+		hw.fifo[fifo][2] = *f;
+	} else {
+		hw.fifo[fifo][hw.fmp[fifo]++] = *f;
+	}
+	run_isrs();
+}
+
+static void model_reset(void)
+{
+	memset(&hw, 0, sizeof(hw));
+	memset(&acc, 0, sizeof(acc));
+	wire_len = out_len = inversions = 0;
+	can_buf_init();
+	memset(&stats, 0, sizeof(stats));
+}
+
+static struct can_frame frame(uint32_t id, bool ext, uint8_t seq)
+{
+	struct can_frame f;
+
+	memset(&f, 0, sizeof(f));
+	f.id = id;
+	f.ext = ext;
+	f.dlc = 2;
+	f.data[0] = seq;
+	f.data[1] = id;
+	return f;
+}
+
+static bool send_frame(uint32_t id, bool ext, uint8_t seq)
+{
+	struct can_frame f = frame(id, ext, seq);
+
+	return send(&f);
+}
+
+static void receive_frame(int fifo, uint32_t id, bool ext, uint8_t seq)
+{
+	struct can_frame f = frame(id, ext, seq);
+
+	bus_receive(fifo, &f);
+}
+
+/* The tests */
+
+static void test_bits(void)
+{
+	struct can_frame f;
+	int dlc;
+
+	memset(&f, 0, sizeof(f));
+	for (dlc = 0; dlc <= 8; dlc++) {
+		f.dlc = dlc;
+		f.ext = false;
+		f.rtr = false;
+		check(can_buf_frame_bits(&f) == 47u + 8 * dlc, "std bits",
+		      dlc, can_buf_frame_bits(&f));
+		f.ext = true;
+		check(can_buf_frame_bits(&f) == 67u + 8 * dlc, "ext bits",
+		      dlc, can_buf_frame_bits(&f));
+		f.rtr = true;
+		check(can_buf_frame_bits(&f) == 67, "ext rtr bits", dlc,
+		      can_buf_frame_bits(&f));
+	}
+}
+
+/* The queue's order is the bus's, on random pairs with close IDs */
+static void test_key(void)
+{
+	struct can_frame a, b;
+	int i, bad = 0;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	for (i = 0; i < 100000; i++) {
+		a.ext = lcg() & 1;
+		b.ext = lcg() & 1;
+		a.rtr = lcg() & 1;
+		b.rtr = lcg() & 1;
+		a.id = (lcg() & 3) << 18 | (lcg() & 3);
+		b.id = (lcg() & 3) << 18 | (lcg() & 3);
+		if (!a.ext) {
+			a.id >>= 18;
+		}
+		if (!b.ext) {
+			b.id >>= 18;
+		}
+		bad += (can_buf_key(&a) < can_buf_key(&b)) !=
+		       (arbitration(&a) < arbitration(&b));
+		bad += (can_buf_key(&a) == can_buf_key(&b)) !=
+		       (arbitration(&a) == arbitration(&b));
+	}
+	check(bad == 0, "key", bad, 0);
+}
+
+/*
+ * Frames queued while the bus is held up leave in arbitration order,
+ * standard before extended with the same base, data before remote.
+ */
+static void test_priority(void)
+{
+	static const uint32_t ids[8] = {
+		0x7ff, 0x123, 0x400, 0x001, 0x555, 0x0ff, 0x124, 0x2aa,
+	};
+	struct can_frame f, a, b;
+	struct can_buf_stats st;
+	int i, sorted = 1;
+
+	model_reset();
+	for (i = 0; i < 8; i++) {
+		send_frame(ids[i], false, i);
+	}
+	/* 0x123 std, then with the same base: remote, extended */
+	f = frame(0x123 << 18, true, 8);
+	send(&f);
+	f = frame(0x123, false, 9);
+	f.rtr = true;
+	send(&f);
+	bus_drain();
+
+	check(wire_len == 10 && inversions == 0, "priority sent", wire_len,
+	      inversions);
+	for (i = 1; i < wire_len; i++) {
+		a = wire[i - 1];
+		b = wire[i];
+		sorted &= arbitration(&a) < arbitration(&b);
+	}
+	check(sorted, "priority order", 0, 0);
+	check(wire[1].id == 0x0ff && wire[2].id == 0x123 && !wire[2].rtr &&
+	      wire[3].rtr && wire[4].ext, "std, rtr, ext", wire[3].rtr,
+	      wire[4].ext);
+	can_buf_get_stats(&st);
+	check(st.tx_frames == 10 && st.tx_aborted == (uint32_t)hw.aborts &&
+	      hw.aborts > 0 && st.tx_dropped == 0, "priority stats",
+	      st.tx_frames, st.tx_aborted);
+	check(st.bits == 9 * (47 + 16) + 67 + 16 - 16, "priority bits",
+	      st.bits, 0);
+}
+
+/* Same identifier: queued order, whatever overtakes them */
+static void test_same_id(void)
+{
+	int i, seq[2] = { 0, 0 }, ok = 1;
+
+	model_reset();
+	for (i = 0; i < 12; i++) {
+		send_frame(0x300 + (i & 1), false, i);
+		if (i % 3 == 2) {
+			send_frame(0x010 + i, false, 0);
+		}
+		if (i % 4 == 3) {
+			bus_frame();
+		}
+	}
+	bus_drain();
+	for (i = 0; i < wire_len; i++) {
+		if ((wire[i].id & ~1) == 0x300) {
+			ok &= wire[i].data[0] / 2 == seq[wire[i].id & 1]++;
+		}
+	}
+	check(ok && seq[0] == 6 && seq[1] == 6, "same id order", seq[0],
+	      seq[1]);
+	check(wire_len == 16 && out_len == 0, "same id all sent", wire_len,
+	      out_len);
+}
+
+/*
+ * A mailbox aborted while on the bus still goes out. It must be counted
+ * as sent and not come back from the queue.
+ */
+static void test_abort_on_bus(void)
+{
+	struct can_buf_stats st;
+	int i, n300 = 0;
+
+	model_reset();
+	send_frame(0x300, false, 0);
+	send_frame(0x400, false, 0);
+	send_frame(0x500, false, 0);
+	bus_start();		/* 0x300 goes out, slowly */
+	send_frame(0x100, false, 0);
+	send_frame(0x101, false, 0);
+	send_frame(0x102, false, 0);
+	check(hw.mb[0].abort, "abort while on the bus", hw.mb[0].on_bus,
+	      hw.aborts);
+	bus_finish();
+	bus_drain();
+
+	for (i = 0; i < wire_len; i++) {
+		n300 += wire[i].id == 0x300;
+	}
+	can_buf_get_stats(&st);
+	check(n300 == 1 && wire_len == 6 && out_len == 0, "abort on bus",
+	      n300, wire_len);
+	check(wire[0].id == 0x300 && wire[1].id == 0x100 &&
+	      wire[5].id == 0x500, "abort order", wire[1].id, wire[5].id);
+	check(st.tx_frames == 6 && st.tx_aborted == 2, "abort stats",
+	      st.tx_frames, st.tx_aborted);
+}
+
+/*
+ * The same, but the frame loses arbitration and is aborted after all.
+ * can_buf_send() must have kept room for it in the queue.
+ */
+static void test_abort_lost(void)
+{
+	struct can_buf_stats st;
+	int i, refused = 0;
+
+	model_reset();
+	send_frame(0x300, false, 0);
+	send_frame(0x400, false, 0);
+	send_frame(0x500, false, 0);
+	bus_start();
+	send_frame(0x100, false, 0);
+	send_frame(0x101, false, 0);
+	send_frame(0x102, false, 0);
+	for (i = 0; i < CAN_BUF_TX_LEN; i++) {
+		refused += !send_frame(0x600 + i, false, 0);
+	}
+	bus_lose();
+	bus_drain();
+
+	can_buf_get_stats(&st);
+	/* three queued, one place kept for the aborted frame */
+	check(refused == 4 && st.tx_dropped == 4, "abort lost refused",
+	      refused, st.tx_dropped);
+	check(wire_len == 6 + CAN_BUF_TX_LEN - 4 && out_len == 0,
+	      "abort lost sent", wire_len, out_len);
+	check(wire[0].id == 0x100 && wire[3].id == 0x300, "abort lost order",
+	      wire[0].id, wire[3].id);
+	check(st.tx_aborted == 3, "abort lost stats", st.tx_aborted, 0);
+}
+
+/*
+ * A full queue refuses frames, and never throws away one it took, not
+ * even one coming back from an aborted mailbox.
+ */
+static void test_full(void)
+{
+	struct can_buf_stats st;
+	int i, refused = 0;
+
+	model_reset();
+	for (i = 0; i < 3 + CAN_BUF_TX_LEN - 1; i++) {
+		send_frame(0x700 - i, false, 0);
+	}
+	/* the last place in the queue, more urgent than every mailbox */
+	refused += !send_frame(0x001, false, 0);
+	refused += !send_frame(0x002, false, 0);
+	refused += !send_frame(0x003, false, 0);
+	bus_drain();
+	can_buf_get_stats(&st);
+	check(refused == 2 && st.tx_dropped == 2, "full refused", refused,
+	      st.tx_dropped);
+	check(wire_len == 3 + CAN_BUF_TX_LEN && out_len == 0, "full sent",
+	      wire_len, out_len);
+	check(st.tx_frames == 3 + CAN_BUF_TX_LEN, "full stats",
+	      st.tx_frames, st.tx_aborted);
+}
+
+/* The ring keeps the oldest frames, the FIFOs report overruns */
+static void test_rx(void)
+{
+	struct can_frame f, g;
+	struct can_buf_stats st;
+	int i, ok = 1;
+
+	model_reset();
+	for (i = 0; i < 40; i++) {
+		f = frame(0x200 + i, i & 1, i);
+		f.time = i * 100;
+		f.fmi = i & 3;
+		bus_receive(i % 3 == 0, &f);
+	}
+	for (i = 0; can_buf_recv(&g); i++) {
+		ok &= g.data[0] == i && g.id == 0x200u + i &&
+		      g.ext == (i & 1) && g.time == i * 100 && g.fmi == (i & 3);
+	}
+	can_buf_get_stats(&st);
+	check(ok && i == CAN_BUF_RX_LEN, "rx ring", i, ok);
+	check(st.rx_frames == CAN_BUF_RX_LEN && st.rx_lost == 8 &&
+	      st.rx_overrun == 0, "rx stats", st.rx_frames, st.rx_lost);
+	check(hw.fmp[0] == 0 && hw.fmp[1] == 0, "fifos drained", hw.fmp[0],
+	      hw.fmp[1]);
+
+	/* five frames while the interrupts are masked */
+	cm_mask_interrupts(1);
+	for (i = 0; i < 5; i++) {
+		receive_frame(1, 0x10 + i, false, i);
+	}
+	cm_mask_interrupts(0);
+	run_isrs();
+	for (i = 0; can_buf_recv(&g); i++) {
+		ok &= g.id == (i < 2 ? 0x10u + i : 0x14u);
+	}
+	can_buf_get_stats(&st);
+	check(ok && i == 3, "overrun kept", i, ok);
+	check(st.rx_overrun == 1 && !hw.fovr[1] && hw.bad_writes == 0,
+	      "overrun flag", st.rx_overrun, hw.fovr[1]);
+}
+
+static void test_errors(void)
+{
+	struct can_buf_stats st;
+
+	model_reset();
+	hw.esr = (5 << 4) | (100 << 16) | CAN_ESR_EWGF;
+	hw.erri = true;
+	run_isrs();
+	check(((hw.esr >> 4) & 7) == 7, "lec reset", hw.esr, 0);
+	hw.esr |= (130 << 16) | CAN_ESR_EPVF;
+	hw.esr = (hw.esr & ~0xff0000) | (130 << 16);
+	hw.erri = true;
+	run_isrs();
+	hw.esr = (2 << 4) | (3 << 16) | (7 << 24) | CAN_ESR_BOFF |
+		 CAN_ESR_EPVF | CAN_ESR_EWGF;
+	hw.erri = true;
+	run_isrs();
+	can_buf_get_stats(&st);
+	check(st.bus_errors == 2 && st.warnings == 1 && st.passive == 1 &&
+	      st.bus_off == 1, "error counts", st.bus_errors, st.warnings);
+	check(st.tec == 3 && st.rec == 7 && !hw.erri && hw.bad_writes == 0,
+	      "error counters", st.tec, st.rec);
+}
+
+/* After a can_reset() and can_buf_init() nothing old comes back */
+static void test_init(void)
+{
+	struct can_frame f;
+	int i, old = 0;
+
+	model_reset();
+	for (i = 0; i < 10; i++) {
+		send_frame(0x100 + i, false, 1);
+	}
+	receive_frame(0, 0x42, false, 1);
+
+	memset(&hw, 0, sizeof(hw));
+	out_len = wire_len = 0;
+	can_buf_init();
+	check(!can_buf_recv(&f), "rx empty after init", 0, 0);
+	for (i = 0; i < 5; i++) {
+		send_frame(0x200 + i, false, 2);
+	}
+	bus_drain();
+	for (i = 0; i < wire_len; i++) {
+		old += wire[i].data[0] != 2;
+	}
+	check(wire_len == 5 && old == 0, "init", wire_len, old);
+}
+
+/*
+ * Random traffic both ways, with lost arbitration and sends from nested
+ * interrupts: every frame taken goes out once, no frame starts while a
+ * better one waits, same identifiers stay in order, and the counters
+ * agree.
+ */
+static void test_random(void)
+{
+	struct can_frame f;
+	struct can_buf_stats st;
+	uint8_t seq[16], seen[16];
+	uint32_t sent = 0, refused = 0, rx = 0, got = 0;
+	int round, i, nested, order = 0, bad = 0;
+
+	model_reset();
+	memset(seq, 0, sizeof(seq));
+	memset(seen, 0, sizeof(seen));
+	for (round = 0; round < 200000; round++) {
+		switch (lcg() % 10) {
+		case 0:
+		case 1:
+			i = lcg() % 16;
+			f = frame(i < 8 ? 0x100 + i : (0x100 + i) << 18,
+				  i >= 8, seq[i]);
+			f.rtr = (i % 8) == 7;
+			if (out_len < MAX_OUT && send(&f)) {
+				seq[i]++;
+				sent++;
+			} else if (out_len < MAX_OUT) {
+				refused++;
+			}
+			break;
+		case 2:
+			/*
+			 * Sometimes from an interrupt that preempts the
+			 * send before, ahead of the CAN interrupts
+			 */
+			nested = lcg() & 1;
+			for (i = 0; i <= nested && out_len < MAX_OUT; i++) {
+				f = frame(lcg() % 0x7ff, false, 0);
+				f.data[1] = 0xee;
+				if (!can_buf_send(&f)) {
+					refused++;
+					continue;
+				}
+				out[out_len++] = f;
+				sent++;
+			}
+			run_isrs();
+			break;
+		case 3:
+		case 4:
+		case 5:
+			if (bus_start()) {
+				bus_finish();
+			}
+			break;
+		case 6:
+			if (bus_start()) {
+				bus_lose();
+			}
+			break;
+		case 7:
+			receive_frame(lcg() & 1, rx, false, rx);
+			rx++;
+			break;
+		default:
+			while (can_buf_recv(&f)) {
+				bad += f.data[0] != (uint8_t)got;
+				got++;
+			}
+			break;
+		}
+		/* same identifier order, checked as they go out */
+		for (; order < wire_len; order++) {
+			f = wire[order];
+			if (f.data[1] == 0xee) {
+				continue;
+			}
+			i = f.ext ? (f.id >> 18) - 0x100 : f.id - 0x100;
+			bad += f.data[0] != seen[i]++;
+		}
+		if (wire_len > 4000) {
+			wire_len = order = 0;
+		}
+	}
+	bus_drain();
+	while (can_buf_recv(&f)) {
+		bad += f.data[0] != (uint8_t)got;
+		got++;
+	}
+	can_buf_get_stats(&st);
+	check(bad == 0 && inversions == 0, "random order", bad, inversions);
+	check(hw.left_masked == 0 && hw.storms == 0, "random interrupts",
+	      hw.left_masked, hw.storms);
+	check(out_len == 0 && st.tx_frames == sent && st.tx_dropped ==
+	      refused, "random sent once", st.tx_frames, sent);
+	check(refused > 10, "random queue full", refused, 0);
+	check(st.rx_frames + st.rx_lost == rx && got == st.rx_frames,
+	      "random rx", st.rx_frames, rx);
+	check(st.tx_aborted == (uint32_t)hw.aborts && hw.aborts > 100 &&
+	      hw.bad_writes == 0, "random aborts", st.tx_aborted, hw.aborts);
+}
+
+int main(void)
+{
+	test_bits();
+	test_key();
+	test_priority();
+	test_same_id();
+	test_abort_on_bus();
+	test_abort_lost();
+	test_full();
+	test_rx();
+	test_errors();
+	test_init();
+	test_random();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks can_filter.c on the host:
+ *
+ *	cc -o can_filter_host can_filter_host.c can_filter.c
+ *	./can_filter_host
+ *
+ * The banks can_filter_compile() fills in are matched against frames
+ * the way bxCAN does it, from the register values alone: list filters
+ * compare every bit, mask filters the bits their mask has set, in the
+ * 16 or 32 bit layout. Every standard identifier is tried, and every
+ * extended one around the extended rules, which are kept to one small
+ * window so that can be done. Each wanted identifier has to get
+ * through, into the FIFO of its most urgent rule, and the identifiers
+ * that get through without being wanted have to be exactly the leak
+ * reported.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "can_filter.h"
+
+/* Extended rules stay inside [EXT_BASE, EXT_BASE + EXT_WINDOW) */
+#define EXT_BASE	0x12340000UL
+#define EXT_WINDOW	0x4000
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/* A data frame in the 32 and 16 bit filter layouts */
+static uint32_t frame32(uint32_t id, bool ext)
+{
+	return ext ? ((id << 3) | (1 << 2)) : (id << 21);
+}
+
+static uint16_t frame16(uint32_t id, bool ext)
+{
+	if (ext) {
+		return ((id >> 18) << 5) | (1 << 3) | ((id >> 15) & 7);
+	}
+	return id << 5;
+}
+
+/* The FIFO the frame goes to, -1 if no filter takes it */
+static int match(const struct can_filter_bank *banks, int n, uint32_t id,
+		 bool ext, int *fifos)
+{
+	uint32_t v32 = frame32(id, ext);
+	uint16_t v16 = frame16(id, ext), f[4];
+	int i, k, fifo = -1, hit;
+
+	*fifos = 0;
+	for (i = 0; i < n; i++) {
+		const struct can_filter_bank *b = &banks[i];
+
+		if (b->scale_32bit && b->list_mode) {
+			hit = (v32 == b->fr1) || (v32 == b->fr2);
+		} else if (b->scale_32bit) {
+			hit = ((v32 ^ b->fr1) & b->fr2) == 0;
+		} else {
+			f[0] = b->fr1;
+			f[1] = b->fr1 >> 16;
+			f[2] = b->fr2;
+			f[3] = b->fr2 >> 16;
+			hit = 0;
+			for (k = 0; k < 4; k++) {
+				if (b->list_mode) {
+					hit |= v16 == f[k];
+				} else if (k % 2 == 0) {
+					hit |= ((v16 ^ f[k]) & f[k + 1]) == 0;
+				}
+			}
+		}
+		if (hit) {
+			*fifos |= 1 << b->fifo;
+			fifo = b->fifo;
+		}
+	}
+	return fifo;
+}
+
+/* The FIFO the rules want the identifier in, -1 for none */
+static int wanted(const struct can_filter_rule *rules, int n, uint32_t id,
+		  bool ext)
+{
+	int i, fifo = -1;
+
+	for (i = 0; i < n; i++) {
+		if ((rules[i].ext == ext) && (rules[i].first <= id) &&
+		    (id <= rules[i].last)) {
+			if (rules[i].prio == 0) {
+				return 0;
+			}
+			fifo = 1;
+		}
+	}
+	return fifo;
+}
+
+/*
+ * Compile, then try every standard identifier and every extended one in
+ * the window. Returns the number of mistakes, and the leak found.
+ *
+ * Priority 0 identifiers always go to FIFO0. The others go to FIFO1,
+ * unless the rules needed more banks than there are and a block of
+ * theirs was merged with a FIFO0 one.
+ */
+static int try_rules(const struct can_filter_rule *rules, int n_rules,
+		     int max_banks, uint32_t *leak, uint32_t *found, int *used)
+{
+	struct can_filter_bank banks[CAN_FILTER_BANKS];
+	uint32_t id, lo, hi, unsqueezed;
+	int n, want, got, fifos, bad = 0;
+	bool ext, exact;
+
+	/* Without the squeeze, as many banks as it takes */
+	n = can_filter_compile(rules, n_rules, NULL, 1000, &unsqueezed);
+	exact = (n <= max_banks) && (unsqueezed == 0);
+
+	memset(banks, 0xa5, sizeof(banks));
+	n = can_filter_compile(rules, n_rules, banks, max_banks, leak);
+	*used = n;
+	*found = 0;
+	if ((n < 0) || (n > max_banks)) {
+		return 1;
+	}
+	for (ext = false; ; ext = true) {
+		lo = ext ? EXT_BASE : 0;
+		hi = ext ? EXT_BASE + EXT_WINDOW : 0x800;
+		for (id = lo; id < hi; id++) {
+			want = wanted(rules, n_rules, id, ext);
+			got = match(banks, n, id, ext, &fifos);
+			if ((want == 0) || ((want == 1) && exact)) {
+				bad += (got != want) || (fifos != 1 << want);
+			} else if (want == 1) {
+				bad += (fifos != 1) && (fifos != 2);
+			} else if (got >= 0) {
+				(*found)++;
+				bad += fifos != 1 && fifos != 2;
+			}
+		}
+		if (ext) {
+			break;
+		}
+	}
+
+	/* Nothing outside the window, the extended blocks sit inside it */
+	for (id = 0; id < 64; id++) {
+		bad += match(banks, n, EXT_BASE - 1 - id, true, &got) >= 0;
+		bad += match(banks, n, EXT_BASE + EXT_WINDOW + id, true,
+			     &got) >= 0;
+	}
+	return bad;
+}
+
+/* The case from review: 100 identifiers five apart, 14 banks */
+static void test_every_fifth(void)
+{
+	struct can_filter_rule rules[100];
+	uint32_t leak, found;
+	int i, bad, used;
+
+	for (i = 0; i < 100; i++) {
+		rules[i].first = rules[i].last = 5 * i;
+		rules[i].ext = false;
+		rules[i].prio = 1;
+	}
+	bad = try_rules(rules, 100, CAN_FILTER_BANKS, &leak, &found, &used);
+	check(bad == 0 && used <= CAN_FILTER_BANKS, "every fifth", bad, used);
+	check(leak == found && leak == 305, "every fifth leak", leak, found);
+
+	/* Plenty of room: lists only, nothing leaks */
+	bad = try_rules(rules, 20, CAN_FILTER_BANKS, &leak, &found, &used);
+	check(bad == 0 && leak == 0 && found == 0 && used == 5,
+	      "every fifth, 20", leak, used);
+}
+
+/* Ranges, overlaps, both kinds and FIFOs, and the example's rules */
+static void test_fixed(void)
+{
+	static const struct can_filter_rule overlap[] = {
+		{ 0x100, 0x1ff, false, 1 },
+		{ 0x180, 0x27f, false, 0 },
+		{ 0x180, 0x180, false, 1 },
+		{ 0x7ff, 0x7ff, false, 1 },
+		{ 0x400, 0x3ff, false, 0 },	/* empty */
+		{ EXT_BASE + 3, EXT_BASE + 0x1002, true, 1 },
+		{ EXT_BASE + 0x800, EXT_BASE + 0x900, true, 0 },
+	};
+	static const struct can_filter_rule example[] = {
+		{ 0x000, 0x000, false, 0 },
+		{ 0x010, 0x01f, false, 1 },
+		{ 0x123, 0x123, false, 1 },
+		{ EXT_BASE, EXT_BASE + 0xff, true, 1 },
+	};
+	uint32_t leak, found;
+	int bad, used, banks;
+
+	for (banks = 2; banks <= CAN_FILTER_BANKS; banks++) {
+		bad = try_rules(overlap, 7, banks, &leak, &found, &used);
+		check(bad == 0 && leak == found, "overlap", banks, leak);
+		bad = try_rules(example, 4, banks, &leak, &found, &used);
+		check(bad == 0 && leak == found, "example", banks, leak);
+	}
+	try_rules(overlap, 7, CAN_FILTER_BANKS, &leak, &found, &used);
+	check(leak == 0, "overlap exact", leak, used);
+}
+
+/*
+ * Random rule sets of every size, squeezed into fewer and fewer banks:
+ * never a wanted frame lost, the leak always what gets through.
+ */
+static void test_random(void)
+{
+	struct can_filter_rule rules[40];
+	uint32_t leak, found, len;
+	int round, i, n, banks, bad = 0, wrong = 0, used, leaky = 0;
+
+	for (round = 0; round < 300; round++) {
+		n = 1 + lcg() % 40;
+		for (i = 0; i < n; i++) {
+			rules[i].ext = lcg() % 4 == 0;
+			rules[i].prio = lcg() % 3 == 0 ? 0 : 1;
+			len = (lcg() % 3 == 0) ? lcg() % 200 : 0;
+			if (rules[i].ext) {
+				rules[i].first = EXT_BASE +
+						 lcg() % (EXT_WINDOW - 200);
+			} else {
+				rules[i].first = lcg() % (0x800 - 200);
+			}
+			rules[i].last = rules[i].first + len;
+		}
+		banks = 2 + lcg() % (CAN_FILTER_BANKS - 1);
+		bad += try_rules(rules, n, banks, &leak, &found, &used);
+		wrong += leak != found;
+		leaky += leak != 0;
+	}
+	check(bad == 0, "random", bad, 0);
+	check(wrong == 0, "random leak", wrong, 0);
+	check(leaky > 100, "random squeezed", leaky, 0);
+}
+
+int main(void)
+{
+	test_every_fifth();
+	test_fixed();
+	test_random();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,380 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAN benchmark: a traffic generator, with latency and loss statistics,
+ * on top of the can_buf driver from the can example.
+ *
+ * On a single board run it in loopback (frames also go out on the bus,
+ * but no acknowledge is needed) or silent loopback (nothing leaves the
+ * chip). In normal mode a second board running the 'e' command sends
+ * every frame straight back, and the latency becomes a round trip.
+ *
+ * Commands are lines of ASCII on USART2, 115200 baud:
+ *	b<kbit>		bit rate: 125, 250, 500 or 1000
+ *	m<n|l|s>	normal, loopback or silent loopback mode
+ *	r<rate>		frames per second, 0 for as many as fit
+ *	i<min> <max> <f|u|s>	IDs, fixed (min), uniform or sweep
+ *	l<min> <max> <f|u|s>	DLCs, likewise, at least 2
+ *	x<0|1>		standard or extended IDs
+ *	t<ms>		run a test
+ *	e<ms>		echo whatever comes in
+ * Settings reply "ok". A test replies
+ *	"r <sent> <blocked> <received> <lost> <reordered>
+ *	   <lat min> <lat avg> <lat p50> <lat p99> <lat max> <load %>
+ *	   <bus errors>"
+ * with latencies in microseconds, p50 and p99 rounded up to a power of
+ * two, and the load being what we offered the bus. Echo replies
+ * "r <echoed> <dropped>".
+ *
+ * Time stamps come from the DWT cycle counter when a frame goes to the
+ * driver and when it comes out of the receive ring. The bxCAN's own
+ * time stamp is taken at the start of frame both ways, so it only ever
+ * sees the time on the wire.
+ */
+
+#include <stdlib.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/can.h>
+
+#include "can_buf.h"
+#include "can_gen.h"
+
+#define CPU_HZ		72000000
+
+/* Longest test, the cycle counter wraps after 59 seconds */
+#define MAX_MS		50000
+
+/* Stragglers still in the driver after the test */
+#define GRACE_MS	100
+
+static struct can_gen gen;
+static struct can_gen_cfg cfg = {
+	.rate = 1000, .tick_hz = CPU_HZ,
+	.id_min = 0x100, .id_max = 0x100, .id_dist = CAN_GEN_FIXED,
+	.dlc_min = 8, .dlc_max = 8, .dlc_dist = CAN_GEN_FIXED,
+};
+static uint32_t kbit = 500;
+static bool loopback = true, silent = true;
+static uint32_t seed = 1;
+
+/******************************************************************************
+ * Command line, polled
+ *****************************************************************************/
+
+static void puts2(const char *s)
+{
+	while (*s != '\0') {
+		usart_send_blocking(USART2, *s++);
+	}
+}
+
+static void putu2(uint32_t n)
+{
+	char buf[11];
+	int i = 0;
+
+	do {
+		buf[i++] = (n % 10) + '0';
+		n /= 10;
+	} while (n != 0);
+	while (i > 0) {
+		usart_send_blocking(USART2, buf[--i]);
+	}
+}
+
+static int gets2(char *s, int len)
+{
+	int i = 0;
+	char c;
+
+	while ((c = usart_recv_blocking(USART2)) != '\n') {
+		if ((c != '\r') && (i < len - 1)) {
+			s[i++] = c;
+		}
+	}
+	s[i] = '\0';
+	return i;
+}
+
+static void reply(const uint32_t *v, int n)
+{
+	int i;
+
+	puts2("r");
+	for (i = 0; i < n; i++) {
+		puts2(" ");
+		putu2(v[i]);
+	}
+	puts2("\r\n");
+}
+
+/* "<min> <max> <f|u|s>" */
+static void parse_range(const char *s, uint32_t *min, uint32_t *max,
+			uint8_t *dist)
+{
+	char *end;
+
+	*min = *max = strtoul(s, &end, 0);
+	if (*end == ' ') {
+		*max = strtoul(end, &end, 0);
+	}
+	while (*end == ' ') {
+		end++;
+	}
+	switch (*end) {
+	case 'u':
+		*dist = CAN_GEN_UNIFORM;
+		break;
+	case 's':
+		*dist = CAN_GEN_SWEEP;
+		break;
+	default:
+		*dist = CAN_GEN_FIXED;
+		break;
+	}
+}
+
+/******************************************************************************
+ * Setup
+ *****************************************************************************/
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_USART2);
+	rcc_periph_clock_enable(RCC_CAN1);
+
+	dwt_enable_cycle_counter();
+}
+
+static void usart_setup(void)
+{
+	gpio_set_mode(GPIO_BANK_USART2_TX, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+	gpio_set_mode(GPIO_BANK_USART2_RX, GPIO_MODE_INPUT,
+		      GPIO_CNF_INPUT_FLOAT, GPIO_USART2_RX);
+
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+	usart_set_mode(USART2, USART_MODE_TX_RX);
+	usart_enable(USART2);
+}
+
+static void gpio_setup(void)
+{
+	/* LED1 */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_2_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO8);
+
+	/* CAN1 on PB8 (RX, pulled up) and PB9 (TX) */
+	AFIO_MAPR |= AFIO_MAPR_CAN1_REMAP_PORTB;
+	gpio_set_mode(GPIO_BANK_CAN1_PB_RX, GPIO_MODE_INPUT,
+		      GPIO_CNF_INPUT_PULL_UPDOWN, GPIO_CAN1_PB_RX);
+	gpio_set(GPIO_BANK_CAN1_PB_RX, GPIO_CAN1_PB_RX);
+	gpio_set_mode(GPIO_BANK_CAN1_PB_TX, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_CAN1_PB_TX);
+}
+
+/*
+ * (Re)start CAN1 with the current bit rate and mode. 36MHz APB1 / BRP,
+ * 9 time quanta per bit sampled at 7.
+ */
+static bool can_setup(void)
+{
+	can_reset(CAN1);
+
+	if (can_init(CAN1,
+		     true,		/* TTCM: time stamps for the rx ring */
+		     true,		/* ABOM */
+		     false,		/* AWUM */
+		     false,		/* NART */
+		     false,		/* RFLM */
+		     false,		/* TXFP: by identifier */
+		     CAN_BTR_SJW_1TQ,
+		     CAN_BTR_TS1_6TQ,
+		     CAN_BTR_TS2_2TQ,
+		     36000 / 9 / kbit,
+		     loopback,
+		     silent)) {
+		return false;
+	}
+
+	/* Everything, into FIFO0 */
+	can_filter_id_mask_32bit_init(0, 0, 0, 0, true);
+
+	can_buf_init();
+	return true;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+
+static void run_test(uint32_t ms)
+{
+	const struct can_frame *tx;
+	struct can_frame rx;
+	struct can_buf_stats before, after;
+	struct can_gen_stats *s = &gen.stats;
+	uint32_t start, end, now, res[12];
+	uint64_t tx_bits = 0;
+
+	if (ms > MAX_MS) {
+		ms = MAX_MS;
+	}
+
+	can_buf_get_stats(&before);
+	start = dwt_read_cycle_counter();
+	end = start + ms * (CPU_HZ / 1000);
+	can_gen_init(&gen, &cfg, seed++, start);
+
+	while (1) {
+		now = dwt_read_cycle_counter();
+		if ((int32_t)(now - end) < 0) {
+			tx = can_gen_poll(&gen, now);
+			if (tx != NULL) {
+				if (can_buf_send(tx)) {
+					tx_bits += can_buf_frame_bits(tx);
+					can_gen_sent(&gen, true, now);
+				} else {
+					can_gen_sent(&gen, false, now);
+				}
+			}
+		} else if ((int32_t)(now - end) >
+			   GRACE_MS * (CPU_HZ / 1000)) {
+			break;
+		}
+		while (can_buf_recv(&rx)) {
+			can_gen_rx(&gen, &rx, dwt_read_cycle_counter());
+		}
+	}
+	can_gen_finish(&gen);
+	can_buf_get_stats(&after);
+
+	res[0] = s->sent;
+	res[1] = s->blocked;
+	res[2] = s->received;
+	res[3] = s->lost;
+	res[4] = s->reordered;
+	res[5] = s->lat_n ? s->lat_min / (CPU_HZ / 1000000) : 0;
+	res[6] = s->lat_n ? s->lat_sum / s->lat_n / (CPU_HZ / 1000000) : 0;
+	res[7] = can_gen_latency_pct(&gen, 50) / (CPU_HZ / 1000000);
+	res[8] = can_gen_latency_pct(&gen, 99) / (CPU_HZ / 1000000);
+	res[9] = s->lat_max / (CPU_HZ / 1000000);
+	res[10] = tx_bits * 100 / ((uint64_t)kbit * ms);
+	res[11] = after.bus_errors - before.bus_errors;
+	reply(res, 12);
+}
+
+static void run_echo(uint32_t ms)
+{
+	struct can_frame frame;
+	uint32_t end, res[2] = { 0, 0 };
+
+	if (ms > MAX_MS) {
+		ms = MAX_MS;
+	}
+
+	end = dwt_read_cycle_counter() + ms * (CPU_HZ / 1000);
+	while ((int32_t)(dwt_read_cycle_counter() - end) < 0) {
+		while (can_buf_recv(&frame)) {
+			res[can_buf_send(&frame) ? 0 : 1]++;
+		}
+	}
+	reply(res, 2);
+}
+
+int main(void)
+{
+	char line[40];
+	uint32_t arg, min, max;
+	uint8_t dist;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+	can_setup();
+
+	while (1) {
+		if (gets2(line, sizeof(line)) == 0) {
+			continue;
+		}
+		gpio_toggle(GPIOA, GPIO8);
+		arg = strtoul(&line[1], NULL, 0);
+
+		switch (line[0]) {
+		case 'b':
+			if ((arg != 125) && (arg != 250) &&
+			    (arg != 500) && (arg != 1000)) {
+				puts2("?\r\n");
+				continue;
+			}
+			kbit = arg;
+			break;
+		case 'm':
+			loopback = (line[1] != 'n');
+			silent = (line[1] == 's');
+			break;
+		case 'r':
+			cfg.rate = arg;
+			break;
+		case 'i':
+			parse_range(&line[1], &cfg.id_min, &cfg.id_max,
+				    &cfg.id_dist);
+			break;
+		case 'l':
+			parse_range(&line[1], &min, &max, &dist);
+			cfg.dlc_min = min;
+			cfg.dlc_max = max;
+			cfg.dlc_dist = dist;
+			break;
+		case 'x':
+			cfg.ext = (arg != 0);
+			break;
+		case 't':
+			run_test(arg);
+			continue;
+		case 'e':
+			run_echo(arg);
+			continue;
+		default:
+			puts2("?\r\n");
+			continue;
+		}
+
+		if ((line[0] == 'b') || (line[0] == 'm')) {
+			if (!can_setup()) {
+				puts2("can init failed\r\n");
+				continue;
+			}
+		}
+		puts2("ok\r\n");
+	}
+
+	return 0;
+}
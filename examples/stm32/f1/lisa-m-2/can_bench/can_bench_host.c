@@ -0,0 +1,163 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host build of the can_bench generator and statistics, on a SocketCAN
+ * interface instead of bxCAN. A virtual one does for trying it out:
+ *
+ *	ip link add dev vcan0 type vcan && ip link set up vcan0
+ *	cc -O2 -o can_bench_host can_bench_host.c can_gen.c host_vcan.c
+ *	./can_bench_host -i vcan0 -r 2000 -t 5000 -I 256,511,u -L 2,8,s
+ *
+ * Options follow the target's commands, see README.md.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "can_gen.h"
+#include "host_vcan.h"
+
+static uint32_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static uint8_t parse_dist(const char *s)
+{
+	switch (s ? *s : 'f') {
+	case 'u':
+		return CAN_GEN_UNIFORM;
+	case 's':
+		return CAN_GEN_SWEEP;
+	default:
+		return CAN_GEN_FIXED;
+	}
+}
+
+/* "min,max,dist" */
+static void parse_range(char *arg, uint32_t *min, uint32_t *max,
+			uint8_t *dist)
+{
+	char *end;
+
+	*min = *max = strtoul(arg, &end, 0);
+	if (*end == ',') {
+		*max = strtoul(end + 1, &end, 0);
+	}
+	*dist = parse_dist((*end == ',') ? end + 1 : NULL);
+}
+
+int main(int argc, char **argv)
+{
+	struct can_gen_cfg cfg = {
+		.rate = 1000, .tick_hz = 1000000,
+		.id_min = 0x100, .id_max = 0x100, .id_dist = CAN_GEN_FIXED,
+		.dlc_min = 8, .dlc_max = 8, .dlc_dist = CAN_GEN_FIXED,
+	};
+	static struct can_gen gen;
+	const struct can_frame *tx;
+	struct can_frame rx;
+	const char *ifname = "vcan0";
+	uint32_t ms = 1000, seed = 1, start, min, max, end;
+	int fd, opt, r;
+
+	while ((opt = getopt(argc, argv, "i:r:t:I:L:xs:")) != -1) {
+		switch (opt) {
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'r':
+			cfg.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'I':
+			parse_range(optarg, &cfg.id_min, &cfg.id_max,
+				    &cfg.id_dist);
+			break;
+		case 'L':
+			parse_range(optarg, &min, &max, &cfg.dlc_dist);
+			cfg.dlc_min = min;
+			cfg.dlc_max = max;
+			break;
+		case 'x':
+			cfg.ext = true;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i if] [-r rate] [-t ms] "
+				"[-I min,max,f|u|s] [-L min,max,f|u|s] [-x] "
+				"[-s seed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	fd = vcan_open(ifname);
+	if (fd < 0) {
+		perror(ifname);
+		return 1;
+	}
+
+	start = now_us();
+	can_gen_init(&gen, &cfg, seed, start);
+
+	/* Send for the given time, then give stragglers 100ms to arrive */
+	end = start + ms * 1000;
+	while ((int32_t)(now_us() - (end + 100000)) < 0) {
+		if ((int32_t)(now_us() - end) < 0) {
+			tx = can_gen_poll(&gen, now_us());
+			if (tx != NULL) {
+				r = vcan_send(fd, tx->id, tx->ext, tx->rtr,
+					      tx->dlc, tx->data);
+				if (r < 0) {
+					perror("send");
+					return 1;
+				}
+				can_gen_sent(&gen, r == 1, now_us());
+			}
+		}
+		while (vcan_recv(fd, &rx.id, &rx.ext, &rx.rtr, &rx.dlc,
+				 rx.data) == 1) {
+			can_gen_rx(&gen, &rx, now_us());
+		}
+	}
+	can_gen_finish(&gen);
+
+	printf("sent %u blocked %u received %u lost %u reordered %u "
+	       "duplicates %u\n",
+	       gen.stats.sent, gen.stats.blocked, gen.stats.received,
+	       gen.stats.lost, gen.stats.reordered, gen.stats.duplicates);
+	if (gen.stats.lat_n != 0) {
+		printf("latency us: min %u avg %u p50 <%u p99 <%u max %u\n",
+		       gen.stats.lat_min,
+		       (uint32_t)(gen.stats.lat_sum / gen.stats.lat_n),
+		       can_gen_latency_pct(&gen, 50),
+		       can_gen_latency_pct(&gen, 99), gen.stats.lat_max);
+	}
+	close(fd);
+	return 0;
+}
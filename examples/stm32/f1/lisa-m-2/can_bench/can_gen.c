@@ -0,0 +1,282 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAN traffic generator and receive statistics, for can_bench.
+ *
+ * Frames carry a 16 bit sequence number in their first two data bytes.
+ * The sender remembers when each of the last CAN_GEN_INFLIGHT went to the
+ * driver, so when one of its own frames comes back (loopback, or echoed
+ * by a second board) the difference is its latency. Losses are found
+ * with a window of the last 64 sequence numbers: one that slides out of
+ * the window unseen is lost, one that arrives after a later one but
+ * still inside the window was reordered, which priority arbitration
+ * does all the time.
+ *
+ * Times are whatever counter the caller passes as 'now', ticking at
+ * cfg.tick_hz. Nothing here touches the hardware, the host build runs it
+ * on SocketCAN.
+ */
+
+#include <stddef.h>
+
+#include "can_gen.h"
+
+static uint32_t xorshift(struct can_gen *g)
+{
+	g->rng ^= g->rng << 13;
+	g->rng ^= g->rng >> 17;
+	g->rng ^= g->rng << 5;
+	return g->rng;
+}
+
+static uint32_t pick(struct can_gen *g, uint8_t dist, uint32_t min,
+		     uint32_t max, uint32_t *next)
+{
+	uint32_t v;
+
+	switch (dist) {
+	case CAN_GEN_UNIFORM:
+		return min + xorshift(g) % (max - min + 1);
+	case CAN_GEN_SWEEP:
+		v = *next;
+		*next = (v >= max) ? min : v + 1;
+		return v;
+	default:
+		return min;
+	}
+}
+
+void can_gen_init(struct can_gen *g, const struct can_gen_cfg *cfg,
+		  uint32_t seed, uint32_t now)
+{
+	int i;
+
+	g->cfg = *cfg;
+	if (g->cfg.dlc_min < 2) {
+		g->cfg.dlc_min = 2;
+	}
+	if (g->cfg.dlc_max > 8) {
+		g->cfg.dlc_max = 8;
+	}
+	if (g->cfg.dlc_max < g->cfg.dlc_min) {
+		g->cfg.dlc_max = g->cfg.dlc_min;
+	}
+	if (g->cfg.id_max < g->cfg.id_min) {
+		g->cfg.id_max = g->cfg.id_min;
+	}
+
+	g->rng = seed ? seed : 1;
+	g->due = now;
+	g->rem = 0;
+	g->id_next = g->cfg.id_min;
+	g->dlc_next = g->cfg.dlc_min;
+	g->seq = 0;
+	g->pending = false;
+	for (i = 0; i < CAN_GEN_INFLIGHT; i++) {
+		g->sent_valid[i] = false;
+	}
+	/* Every test starts at sequence number 0, so -1 was the last one */
+	g->rx_top = UINT16_MAX;
+	g->rx_seen = UINT64_MAX;
+
+	g->stats = (struct can_gen_stats) { .lat_min = UINT32_MAX };
+}
+
+/*
+ * can_gen_poll
+ *
+ * The next frame if one is due, else NULL. Hand it to the driver and
+ * report with can_gen_sent() whether it took it; a frame it didn't take
+ * comes back on the next poll.
+ */
+const struct can_frame *can_gen_poll(struct can_gen *g, uint32_t now)
+{
+	int i;
+
+	if (g->pending) {
+		return &g->frame;
+	}
+
+	if (g->cfg.rate != 0) {
+		if ((int32_t)(now - g->due) < 0) {
+			return NULL;
+		}
+		/* Don't make up for more than a tenth of a second */
+		if ((int32_t)(now - g->due) > (int32_t)(g->cfg.tick_hz / 10)) {
+			g->due = now;
+		}
+		g->due += g->cfg.tick_hz / g->cfg.rate;
+		g->rem += g->cfg.tick_hz % g->cfg.rate;
+		if (g->rem >= g->cfg.rate) {
+			g->rem -= g->cfg.rate;
+			g->due++;
+		}
+	}
+
+	g->frame.id = pick(g, g->cfg.id_dist, g->cfg.id_min, g->cfg.id_max,
+			   &g->id_next);
+	g->frame.ext = g->cfg.ext;
+	g->frame.rtr = false;
+	g->frame.dlc = pick(g, g->cfg.dlc_dist, g->cfg.dlc_min,
+			    g->cfg.dlc_max, &g->dlc_next);
+	g->frame.data[0] = g->seq & 0xff;
+	g->frame.data[1] = g->seq >> 8;
+	for (i = 2; i < 8; i++) {
+		g->frame.data[i] = xorshift(g);
+	}
+	g->pending = true;
+	return &g->frame;
+}
+
+void can_gen_sent(struct can_gen *g, bool accepted, uint32_t now)
+{
+	unsigned int slot = g->seq % CAN_GEN_INFLIGHT;
+
+	if (!accepted) {
+		g->stats.blocked++;
+		return;
+	}
+	g->sent_at[slot] = now;
+	g->sent_seq[slot] = g->seq;
+	g->sent_valid[slot] = true;
+	g->seq++;
+	g->pending = false;
+	g->stats.sent++;
+}
+
+static unsigned int zeros(uint64_t v, unsigned int bits)
+{
+	unsigned int n = 0;
+
+	while (bits-- > 0) {
+		n += !(v & 1);
+		v >>= 1;
+	}
+	return n;
+}
+
+static void latency(struct can_gen *g, uint16_t seq, uint32_t now)
+{
+	unsigned int slot = seq % CAN_GEN_INFLIGHT;
+	struct can_gen_stats *s = &g->stats;
+	uint32_t lat;
+	int b;
+
+	if (!g->sent_valid[slot] || (g->sent_seq[slot] != seq)) {
+		return;
+	}
+	g->sent_valid[slot] = false;
+
+	lat = now - g->sent_at[slot];
+	s->lat_n++;
+	s->lat_sum += lat;
+	if (lat < s->lat_min) {
+		s->lat_min = lat;
+	}
+	if (lat > s->lat_max) {
+		s->lat_max = lat;
+	}
+	for (b = 0; (b < CAN_GEN_HIST - 1) && (lat >= (1UL << b)); b++);
+	s->lat_hist[b]++;
+}
+
+void can_gen_rx(struct can_gen *g, const struct can_frame *frame,
+		uint32_t now)
+{
+	struct can_gen_stats *s = &g->stats;
+	uint16_t seq;
+	int16_t d;
+
+	s->received++;
+	if (frame->rtr || (frame->dlc < 2)) {
+		s->foreign++;
+		return;
+	}
+	seq = frame->data[0] | (frame->data[1] << 8);
+
+	d = (int16_t)(seq - g->rx_top);
+	if (d > 0) {
+		if (d >= 64) {
+			s->lost += zeros(g->rx_seen, 64) + (d - 64);
+			g->rx_seen = 0;
+		} else {
+			s->lost += zeros(g->rx_seen >> (64 - d), d);
+			g->rx_seen <<= d;
+		}
+		g->rx_seen |= 1;
+		g->rx_top = seq;
+	} else if (-d < 64) {
+		if (g->rx_seen & (1ULL << -d)) {
+			s->duplicates++;
+			return;
+		}
+		g->rx_seen |= 1ULL << -d;
+		s->reordered++;
+	} else {
+		/* Already counted as lost, and too late to matter */
+		s->reordered++;
+		return;
+	}
+
+	latency(g, seq, now);
+}
+
+/*
+ * Call when the test is over: whatever the window still misses is lost,
+ * and if we were sending what we receive, so is everything we sent after
+ * the last one that came back.
+ */
+void can_gen_finish(struct can_gen *g)
+{
+	int16_t d;
+
+	g->stats.lost += zeros(g->rx_seen, 64);
+	g->rx_seen = UINT64_MAX;
+	if (g->stats.sent != 0) {
+		d = (int16_t)(g->seq - 1 - g->rx_top);
+		if (d > 0) {
+			g->stats.lost += d;
+			g->rx_top += d;
+		}
+	}
+}
+
+/*
+ * can_gen_latency_pct
+ *
+ * Upper bound, in ticks, of the latency pct percent of the frames
+ * stayed under. The histogram only has powers of two.
+ */
+uint32_t can_gen_latency_pct(const struct can_gen *g, unsigned int pct)
+{
+	const struct can_gen_stats *s = &g->stats;
+	uint64_t want, n = 0;
+	int b;
+
+	if (s->lat_n == 0) {
+		return 0;
+	}
+	want = ((uint64_t)s->lat_n * pct + 99) / 100;
+	for (b = 0; b < CAN_GEN_HIST - 1; b++) {
+		n += s->lat_hist[b];
+		if (n >= want) {
+			break;
+		}
+	}
+	return (b == CAN_GEN_HIST - 1) ? s->lat_max : (1UL << b);
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAN_GEN_H
+#define CAN_GEN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "can_buf.h"
+
+/* How IDs and DLCs are picked between min and max */
+#define CAN_GEN_FIXED		0	/* always min */
+#define CAN_GEN_UNIFORM		1	/* random */
+#define CAN_GEN_SWEEP		2	/* min, min + 1, ... max, min, ... */
+
+/* Send times kept for latency, more than can ever be in flight */
+#define CAN_GEN_INFLIGHT	256
+
+/* Latency histogram, bucket n counts latencies below 2^n ticks */
+#define CAN_GEN_HIST		32
+
+struct can_gen_cfg {
+	uint32_t rate;		/* frames per second, 0 = as fast as possible */
+	uint32_t tick_hz;	/* of the 'now' arguments */
+	uint32_t id_min, id_max;
+	uint8_t id_dist;
+	bool ext;
+	uint8_t dlc_min, dlc_max; /* at least 2, for the sequence number */
+	uint8_t dlc_dist;
+};
+
+struct can_gen_stats {
+	uint32_t sent;
+	uint32_t blocked;	/* tries the driver had no room for */
+	uint32_t received;
+	uint32_t lost;		/* sequence numbers never seen */
+	uint32_t reordered;	/* arrived after a later one */
+	uint32_t duplicates;
+	uint32_t foreign;	/* no sequence number */
+	uint32_t lat_n;		/* frames with a latency, our own */
+	uint32_t lat_min, lat_max;
+	uint64_t lat_sum;
+	uint32_t lat_hist[CAN_GEN_HIST];
+};
+
+struct can_gen {
+	struct can_gen_cfg cfg;
+	uint32_t rng;
+	uint32_t due, rem;
+	uint32_t id_next;
+	uint32_t dlc_next;
+	uint16_t seq;
+	bool pending;
+	struct can_frame frame;
+
+	uint32_t sent_at[CAN_GEN_INFLIGHT];
+	uint16_t sent_seq[CAN_GEN_INFLIGHT];
+	bool sent_valid[CAN_GEN_INFLIGHT];
+
+	uint16_t rx_top;	/* highest sequence number seen */
+	uint64_t rx_seen;	/* bit n: rx_top - n was seen */
+
+	struct can_gen_stats stats;
+};
+
+void can_gen_init(struct can_gen *g, const struct can_gen_cfg *cfg,
+		  uint32_t seed, uint32_t now);
+const struct can_frame *can_gen_poll(struct can_gen *g, uint32_t now);
+void can_gen_sent(struct can_gen *g, bool accepted, uint32_t now);
+void can_gen_rx(struct can_gen *g, const struct can_frame *frame,
+		uint32_t now);
+void can_gen_finish(struct can_gen *g);
+uint32_t can_gen_latency_pct(const struct can_gen *g, unsigned int pct);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "host_vcan.h"
+
+/*
+ * A non blocking raw socket on ifname that also receives what it sends
+ * itself, which is what loopback mode does on the target. Returns the
+ * socket, or -1.
+ */
+int vcan_open(const char *ifname)
+{
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+	int fd, on = 1;
+
+	fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (fd < 0) {
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	setsockopt(fd, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	addr.can_ifindex = ifr.ifr_ifindex;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+/* 1 if sent, 0 if the socket has no room right now, -1 on errors */
+int vcan_send(int fd, uint32_t id, bool ext, bool rtr, uint8_t dlc,
+	      const uint8_t *data)
+{
+	struct can_frame f;
+
+	memset(&f, 0, sizeof(f));
+	f.can_id = ext ? ((id & CAN_EFF_MASK) | CAN_EFF_FLAG) :
+			 (id & CAN_SFF_MASK);
+	if (rtr) {
+		f.can_id |= CAN_RTR_FLAG;
+	}
+	f.can_dlc = dlc;
+	memcpy(f.data, data, dlc);
+
+	if (write(fd, &f, sizeof(f)) == sizeof(f)) {
+		return 1;
+	}
+	return ((errno == EAGAIN) || (errno == ENOBUFS)) ? 0 : -1;
+}
+
+/* 1 if a frame came in, 0 if there is none, -1 on errors */
+int vcan_recv(int fd, uint32_t *id, bool *ext, bool *rtr, uint8_t *dlc,
+	      uint8_t *data)
+{
+	struct can_frame f;
+
+	if (read(fd, &f, sizeof(f)) != sizeof(f)) {
+		return (errno == EAGAIN) ? 0 : -1;
+	}
+	*ext = (f.can_id & CAN_EFF_FLAG) != 0;
+	*rtr = (f.can_id & CAN_RTR_FLAG) != 0;
+	*id = f.can_id & (*ext ? CAN_EFF_MASK : CAN_SFF_MASK);
+	*dlc = (f.can_dlc > 8) ? 8 : f.can_dlc;
+	memcpy(data, f.data, *dlc);
+	return 1;
+}
@@ -0,0 +1,34 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HOST_VCAN_H
+#define HOST_VCAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Thin SocketCAN wrapper for the host build. It lives in its own file
+ * because <linux/can.h> has a struct can_frame of its own.
+ */
+int vcan_open(const char *ifname);
+int vcan_send(int fd, uint32_t id, bool ext, bool rtr, uint8_t dlc,
+	      const uint8_t *data);
+int vcan_recv(int fd, uint32_t *id, bool *ext, bool *rtr, uint8_t *dlc,
+	      uint8_t *data);
+
+#endif
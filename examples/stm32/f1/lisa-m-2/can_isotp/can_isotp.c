@@ -0,0 +1,360 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ISO-TP on top of the buffered CAN driver.
+ *
+ * Two echo servers listen on 0x7e0 and 0x7e1 and send every message
+ * they get back on 0x7e8 and 0x7e9, straight from the buffer it was
+ * received into. In loopback mode two clients on the other ends of
+ * those IDs keep sending messages of all lengths up to 4095 bytes and
+ * check what comes back; the second server asks for blocks of 8 frames
+ * at least 200us apart, to have flow control doing something. Once a
+ * second USART2 shows what got through.
+ *
+ * With CAN_LOOPBACK false the clients stay quiet and the servers answer
+ * whoever is on the bus, isotpsend and isotprecv from can-utils on a
+ * Linux box for instance.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/can.h>
+
+#include "can_buf.h"
+#include "isotp.h"
+
+#define CAN_LOOPBACK	true
+
+/* APB1 36MHz / 12 / 8 time quanta */
+#define CAN_BITRATE	375000
+
+#define SESSIONS	2
+
+int _write(int file, char *ptr, int len);
+
+struct server {
+	struct isotp_link link;
+	uint8_t buf[ISOTP_MAX_LEN];
+};
+
+struct client {
+	struct isotp_link link;
+	uint8_t tx[ISOTP_MAX_LEN];
+	uint8_t rx[ISOTP_MAX_LEN];
+	uint16_t len;
+	bool waiting;		/* for the echo */
+	uint32_t msgs, bytes, errors;
+};
+
+static struct server servers[SESSIONS];
+static struct client clients[SESSIONS];
+
+/******************************************************************************
+ * Time
+ *****************************************************************************/
+
+/*
+ * Microseconds, from the cycle counter. Called all the time from the
+ * main loop, so the counter never wraps between two calls.
+ */
+static uint32_t micros(void)
+{
+	static uint32_t last, us, frac;
+	uint32_t now = dwt_read_cycle_counter();
+
+	frac += now - last;
+	last = now;
+	us += frac / 72;
+	frac %= 72;
+	return us;
+}
+
+/******************************************************************************
+ * ISO-TP glue
+ *****************************************************************************/
+
+static bool link_send(struct isotp_link *link, const uint8_t *data,
+		      uint8_t dlc)
+{
+	struct can_frame frame;
+	int i;
+
+	frame.id = link->tx_id;
+	frame.ext = link->ext;
+	frame.rtr = false;
+	frame.dlc = dlc;
+	for (i = 0; i < dlc; i++) {
+		frame.data[i] = data[i];
+	}
+	return can_buf_send(&frame);
+}
+
+/* Take a message only while the last echo is out of the buffer */
+static uint8_t *server_rx_buffer(struct isotp_link *link, uint16_t len)
+{
+	struct server *srv = link->priv;
+
+	(void)len;
+	return isotp_tx_busy(link) ? NULL : srv->buf;
+}
+
+static void server_rx_done(struct isotp_link *link, uint8_t *buf,
+			   uint16_t len, enum isotp_status status)
+{
+	if (status == ISOTP_OK) {
+		isotp_send(link, buf, len, micros());
+	}
+}
+
+static const struct isotp_ops server_ops = {
+	.send = link_send,
+	.rx_buffer = server_rx_buffer,
+	.rx_done = server_rx_done,
+	.tx_done = NULL,
+};
+
+static uint8_t *client_rx_buffer(struct isotp_link *link, uint16_t len)
+{
+	struct client *cl = link->priv;
+
+	return (len == cl->len) ? cl->rx : NULL;
+}
+
+static void client_rx_done(struct isotp_link *link, uint8_t *buf,
+			   uint16_t len, enum isotp_status status)
+{
+	struct client *cl = link->priv;
+	int i;
+
+	cl->waiting = false;
+	if ((status != ISOTP_OK) || (len != cl->len)) {
+		cl->errors++;
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		if (buf[i] != cl->tx[i]) {
+			cl->errors++;
+			return;
+		}
+	}
+	cl->msgs++;
+	cl->bytes += len;
+}
+
+static void client_tx_done(struct isotp_link *link, enum isotp_status status)
+{
+	struct client *cl = link->priv;
+
+	if (status != ISOTP_OK) {
+		cl->waiting = false;
+		cl->errors++;
+	}
+}
+
+static const struct isotp_ops client_ops = {
+	.send = link_send,
+	.rx_buffer = client_rx_buffer,
+	.rx_done = client_rx_done,
+	.tx_done = client_tx_done,
+};
+
+/* Next message: lengths step through 1..4095 in a scattered order */
+static void client_start(struct client *cl, uint32_t now)
+{
+	int i;
+
+	cl->len = (cl->len + 389) % ISOTP_MAX_LEN + 1;
+	for (i = 0; i < cl->len; i++) {
+		cl->tx[i] = cl->len + i;
+	}
+	if (isotp_send(&cl->link, cl->tx, cl->len, now) == ISOTP_OK) {
+		cl->waiting = true;
+	}
+}
+
+static void isotp_setup(void)
+{
+	int i;
+
+	for (i = 0; i < SESSIONS; i++) {
+		isotp_init(&servers[i].link, &server_ops,
+			   0x7e8 + i, 0x7e0 + i, false);
+		servers[i].link.priv = &servers[i];
+		isotp_init(&clients[i].link, &client_ops,
+			   0x7e0 + i, 0x7e8 + i, false);
+		clients[i].link.priv = &clients[i];
+	}
+
+	/* 8 frames at a time, 200us apart: STmin 0xf2 */
+	servers[1].link.bs = 8;
+	servers[1].link.stmin = 0xf2;
+}
+
+/******************************************************************************
+ * Setup
+ *****************************************************************************/
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_USART2);
+	rcc_periph_clock_enable(RCC_CAN1);
+
+	dwt_enable_cycle_counter();
+}
+
+static void usart_setup(void)
+{
+	gpio_set_mode(GPIO_BANK_USART2_TX, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_mode(USART2, USART_MODE_TX);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+	usart_enable(USART2);
+}
+
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART2, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+static void gpio_setup(void)
+{
+	/* LED1 */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_2_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO8);
+
+	/* CAN1 on PB8 (RX, pulled up) and PB9 (TX) */
+	AFIO_MAPR |= AFIO_MAPR_CAN1_REMAP_PORTB;
+	gpio_set_mode(GPIO_BANK_CAN1_PB_RX, GPIO_MODE_INPUT,
+		      GPIO_CNF_INPUT_PULL_UPDOWN, GPIO_CAN1_PB_RX);
+	gpio_set(GPIO_BANK_CAN1_PB_RX, GPIO_CAN1_PB_RX);
+	gpio_set_mode(GPIO_BANK_CAN1_PB_TX, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_CAN1_PB_TX);
+}
+
+static void can_setup(void)
+{
+	can_reset(CAN1);
+
+	if (can_init(CAN1,
+		     false,           /* TTCM: Time triggered comm mode? */
+		     true,            /* ABOM: Automatic bus-off management? */
+		     false,           /* AWUM: Automatic wakeup mode? */
+		     false,           /* NART: No automatic retransmission? */
+		     false,           /* RFLM: Receive FIFO locked mode? */
+		     false,           /* TXFP: Transmit FIFO priority? */
+		     CAN_BTR_SJW_1TQ,
+		     CAN_BTR_TS1_3TQ,
+		     CAN_BTR_TS2_4TQ,
+		     12,              /* BRP+1: Baud rate prescaler */
+		     CAN_LOOPBACK,
+		     false)) {
+		/* Die because we failed to initialize. */
+		while (1)
+			__asm__("nop");
+	}
+
+	/* Everything, into FIFO0 */
+	can_filter_id_mask_32bit_init(0, 0, 0, 0, true);
+
+	can_buf_init();
+}
+
+int main(void)
+{
+	struct can_buf_stats stats;
+	struct can_frame frame;
+	uint32_t now, next, last_bits = 0;
+	int i;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+	can_setup();
+	isotp_setup();
+
+	printf("ISO-TP echo%s\r\n", CAN_LOOPBACK ? ", loopback test" : "");
+
+	next = micros() + 1000000;
+	while (1) {
+		now = micros();
+
+		while (can_buf_recv(&frame)) {
+			for (i = 0; i < SESSIONS; i++) {
+				if (isotp_input(&servers[i].link, frame.id,
+						frame.ext, frame.data,
+						frame.dlc, now) ||
+				    isotp_input(&clients[i].link, frame.id,
+						frame.ext, frame.data,
+						frame.dlc, now)) {
+					break;
+				}
+			}
+		}
+
+		for (i = 0; i < SESSIONS; i++) {
+			isotp_poll(&servers[i].link, now);
+			isotp_poll(&clients[i].link, now);
+			if (CAN_LOOPBACK && !clients[i].waiting &&
+			    !isotp_tx_busy(&clients[i].link)) {
+				client_start(&clients[i], now);
+			}
+		}
+
+		if ((int32_t)(now - next) < 0) {
+			continue;
+		}
+		next += 1000000;
+		gpio_toggle(GPIOA, GPIO8);
+
+		can_buf_get_stats(&stats);
+		for (i = 0; i < SESSIONS; i++) {
+			printf("%d: %lu msgs %lu bytes %lu errors, ", i,
+			       clients[i].msgs, clients[i].bytes,
+			       clients[i].errors);
+			clients[i].msgs = clients[i].bytes = 0;
+		}
+		printf("bus %lu%%\r\n",
+		       (stats.bits - last_bits) / (CAN_BITRATE / 100));
+		last_bits = stats.bits;
+	}
+
+	return 0;
+}
@@ -0,0 +1,382 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ISO 15765-2 transport over classic CAN, normal addressing.
+ *
+ * A message of up to 7 bytes goes as a single frame. Anything longer
+ * starts with a first frame, after which the receiver answers with a
+ * flow control frame giving a block size and the minimum separation
+ * time, and the rest follows in consecutive frames of 7 bytes, with a
+ * new flow control after each block.
+ *
+ * Nothing is copied on the way: the sender's buffer is read frame by
+ * frame as they go out, and incoming data goes straight into the buffer
+ * the rx_buffer callback hands out. A frame the driver has no room for
+ * is simply tried again on the next isotp_poll(), so with a block size
+ * and separation time of 0 the sender keeps the driver's queue full.
+ *
+ * Times are in microseconds, from whatever counter the caller has.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "isotp.h"
+
+/* Protocol control information, the top nibble of the first byte */
+#define PCI_SF		0x0
+#define PCI_FF		0x1
+#define PCI_CF		0x2
+#define PCI_FC		0x3
+
+/* Flow status */
+#define FS_CTS		0
+#define FS_WAIT		1
+#define FS_OVFLW	2
+#define FS_NONE		0xff
+
+enum {
+	TX_IDLE,
+	TX_SF,		/* single frame to send */
+	TX_FF,		/* first frame to send */
+	TX_WAIT_FC,
+	TX_CF,		/* consecutive frames to send */
+};
+
+enum {
+	RX_IDLE,
+	RX_CF,		/* receiving consecutive frames */
+};
+
+void isotp_init(struct isotp_link *link, const struct isotp_ops *ops,
+		uint32_t tx_id, uint32_t rx_id, bool ext)
+{
+	link->ops = ops;
+	link->tx_id = tx_id;
+	link->rx_id = rx_id;
+	link->ext = ext;
+	link->pad = true;
+	link->bs = 0;
+	link->stmin = 0;
+	link->tx_state = TX_IDLE;
+	link->rx_state = RX_IDLE;
+	link->rx_fc = FS_NONE;
+}
+
+static bool put(struct isotp_link *link, uint8_t *frame, uint8_t len)
+{
+	if (link->pad) {
+		memset(&frame[len], 0xcc, 8 - len);
+		len = 8;
+	}
+	return link->ops->send(link, frame, len);
+}
+
+/* STmin as coded in a flow control frame, to microseconds */
+static uint32_t stmin_us(uint8_t st)
+{
+	if (st <= 0x7f) {
+		return st * 1000;
+	}
+	if ((st >= 0xf1) && (st <= 0xf9)) {
+		return (st - 0xf0) * 100;
+	}
+	/* Reserved, the standard says to use the longest */
+	return 127000;
+}
+
+static void tx_end(struct isotp_link *link, enum isotp_status status)
+{
+	link->tx_state = TX_IDLE;
+	if (link->ops->tx_done != NULL) {
+		link->ops->tx_done(link, status);
+	}
+}
+
+static void rx_end(struct isotp_link *link, enum isotp_status status)
+{
+	link->rx_state = RX_IDLE;
+	link->ops->rx_done(link, link->rx_buf, link->rx_pos, status);
+}
+
+bool isotp_tx_busy(const struct isotp_link *link)
+{
+	return link->tx_state != TX_IDLE;
+}
+
+/*
+ * isotp_send
+ *
+ * Start sending len bytes from buf, which has to stay untouched until
+ * tx_done. ISOTP_PENDING if the last message is still going out,
+ * ISOTP_OVERFLOW if this one is too long for the first frame.
+ */
+enum isotp_status isotp_send(struct isotp_link *link, const uint8_t *buf,
+			     uint16_t len, uint32_t now)
+{
+	if (link->tx_state != TX_IDLE) {
+		return ISOTP_PENDING;
+	}
+	if ((len == 0) || (len > ISOTP_MAX_LEN)) {
+		return ISOTP_OVERFLOW;
+	}
+
+	link->tx_buf = buf;
+	link->tx_len = len;
+	link->tx_state = (len <= 7) ? TX_SF : TX_FF;
+	isotp_poll(link, now);
+	return ISOTP_OK;
+}
+
+static void tx_poll(struct isotp_link *link, uint32_t now)
+{
+	uint8_t frame[8];
+	uint16_t n;
+
+	switch (link->tx_state) {
+	case TX_SF:
+		frame[0] = (PCI_SF << 4) | link->tx_len;
+		memcpy(&frame[1], link->tx_buf, link->tx_len);
+		if (put(link, frame, 1 + link->tx_len)) {
+			tx_end(link, ISOTP_OK);
+		}
+		break;
+
+	case TX_FF:
+		frame[0] = (PCI_FF << 4) | (link->tx_len >> 8);
+		frame[1] = link->tx_len & 0xff;
+		memcpy(&frame[2], link->tx_buf, 6);
+		if (put(link, frame, 8)) {
+			link->tx_pos = 6;
+			link->tx_sn = 1;
+			link->tx_waits = 0;
+			link->tx_deadline = now + ISOTP_TIMEOUT_US;
+			link->tx_state = TX_WAIT_FC;
+		}
+		break;
+
+	case TX_WAIT_FC:
+		if ((int32_t)(now - link->tx_deadline) >= 0) {
+			tx_end(link, ISOTP_TIMEOUT);
+		}
+		break;
+
+	case TX_CF:
+		while ((int32_t)(now - link->tx_next) >= 0) {
+			n = link->tx_len - link->tx_pos;
+			if (n > 7) {
+				n = 7;
+			}
+			frame[0] = (PCI_CF << 4) | link->tx_sn;
+			memcpy(&frame[1], &link->tx_buf[link->tx_pos], n);
+			if (!put(link, frame, 1 + n)) {
+				break;
+			}
+			link->tx_pos += n;
+			link->tx_sn = (link->tx_sn + 1) & 0xf;
+
+			if (link->tx_pos == link->tx_len) {
+				tx_end(link, ISOTP_OK);
+				break;
+			}
+			if ((link->tx_bs != 0) && (--link->tx_left == 0)) {
+				link->tx_deadline = now + ISOTP_TIMEOUT_US;
+				link->tx_state = TX_WAIT_FC;
+				break;
+			}
+			link->tx_next = now + link->tx_gap;
+		}
+		break;
+	}
+}
+
+static void rx_poll(struct isotp_link *link, uint32_t now)
+{
+	uint8_t frame[8];
+
+	if (link->rx_fc != FS_NONE) {
+		frame[0] = (PCI_FC << 4) | link->rx_fc;
+		frame[1] = link->bs;
+		frame[2] = link->stmin;
+		if (put(link, frame, 3)) {
+			link->rx_fc = FS_NONE;
+		}
+	}
+
+	if ((link->rx_state == RX_CF) &&
+	    ((int32_t)(now - link->rx_deadline) >= 0)) {
+		rx_end(link, ISOTP_TIMEOUT);
+	}
+}
+
+/*
+ * isotp_poll
+ *
+ * Send whatever is due and check the timeouts. Call it often, as often
+ * as the separation time asks for.
+ */
+void isotp_poll(struct isotp_link *link, uint32_t now)
+{
+	/* Flow control first, the other side is waiting for it */
+	rx_poll(link, now);
+	tx_poll(link, now);
+}
+
+static void flow_control(struct isotp_link *link, const uint8_t *data,
+			 uint8_t dlc, uint32_t now)
+{
+	if ((link->tx_state != TX_WAIT_FC) || (dlc < 3)) {
+		return;
+	}
+
+	switch (data[0] & 0xf) {
+	case FS_CTS:
+		link->tx_bs = data[1];
+		link->tx_left = data[1];
+		link->tx_gap = stmin_us(data[2]);
+		link->tx_waits = 0;
+		link->tx_next = now;
+		link->tx_state = TX_CF;
+		break;
+	case FS_WAIT:
+		if (++link->tx_waits > ISOTP_MAX_WAIT) {
+			tx_end(link, ISOTP_BAD_FRAME);
+		} else {
+			link->tx_deadline = now + ISOTP_TIMEOUT_US;
+		}
+		break;
+	case FS_OVFLW:
+		tx_end(link, ISOTP_OVERFLOW);
+		break;
+	default:
+		tx_end(link, ISOTP_BAD_FRAME);
+		break;
+	}
+}
+
+static void first_frame(struct isotp_link *link, const uint8_t *data,
+			uint8_t dlc, uint32_t now)
+{
+	uint16_t len;
+
+	len = ((data[0] & 0xf) << 8) | data[1];
+	if ((dlc < 8) || (len < 8)) {
+		return;
+	}
+	if (link->rx_state != RX_IDLE) {
+		rx_end(link, ISOTP_ABORTED);
+	}
+
+	link->rx_buf = link->ops->rx_buffer(link, len);
+	if (link->rx_buf == NULL) {
+		link->rx_fc = FS_OVFLW;
+		return;
+	}
+	memcpy(link->rx_buf, &data[2], 6);
+	link->rx_len = len;
+	link->rx_pos = 6;
+	link->rx_sn = 1;
+	link->rx_left = link->bs;
+	link->rx_deadline = now + ISOTP_TIMEOUT_US;
+	link->rx_state = RX_CF;
+	link->rx_fc = FS_CTS;
+}
+
+static void consecutive_frame(struct isotp_link *link, const uint8_t *data,
+			      uint8_t dlc, uint32_t now)
+{
+	uint16_t n;
+
+	if (link->rx_state != RX_CF) {
+		return;
+	}
+	if ((data[0] & 0xf) != link->rx_sn) {
+		rx_end(link, ISOTP_WRONG_SN);
+		return;
+	}
+
+	n = link->rx_len - link->rx_pos;
+	if (n > 7) {
+		n = 7;
+	}
+	if (n > dlc - 1) {
+		n = dlc - 1;
+	}
+	memcpy(&link->rx_buf[link->rx_pos], &data[1], n);
+	link->rx_pos += n;
+	link->rx_sn = (link->rx_sn + 1) & 0xf;
+
+	if (link->rx_pos == link->rx_len) {
+		rx_end(link, ISOTP_OK);
+		return;
+	}
+	link->rx_deadline = now + ISOTP_TIMEOUT_US;
+	if ((link->bs != 0) && (--link->rx_left == 0)) {
+		link->rx_left = link->bs;
+		link->rx_fc = FS_CTS;
+	}
+}
+
+/*
+ * isotp_input
+ *
+ * Offer a received CAN frame to the link. False if it isn't for this
+ * link, so the caller can try the next one.
+ */
+bool isotp_input(struct isotp_link *link, uint32_t id, bool ext,
+		 const uint8_t *data, uint8_t dlc, uint32_t now)
+{
+	uint8_t len;
+
+	if ((id != link->rx_id) || (ext != link->ext)) {
+		return false;
+	}
+	if (dlc == 0) {
+		return true;
+	}
+
+	switch (data[0] >> 4) {
+	case PCI_SF:
+		len = data[0] & 0xf;
+		if ((len == 0) || (len > dlc - 1)) {
+			break;
+		}
+		if (link->rx_state != RX_IDLE) {
+			rx_end(link, ISOTP_ABORTED);
+		}
+		link->rx_buf = link->ops->rx_buffer(link, len);
+		if (link->rx_buf != NULL) {
+			memcpy(link->rx_buf, &data[1], len);
+			link->rx_pos = len;
+			rx_end(link, ISOTP_OK);
+		}
+		break;
+	case PCI_FF:
+		first_frame(link, data, dlc, now);
+		break;
+	case PCI_CF:
+		consecutive_frame(link, data, dlc, now);
+		break;
+	case PCI_FC:
+		flow_control(link, data, dlc, now);
+		break;
+	}
+
+	isotp_poll(link, now);
+	return true;
+}
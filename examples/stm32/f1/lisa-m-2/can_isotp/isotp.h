@@ -0,0 +1,100 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ISOTP_H
+#define ISOTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Largest message with the 12 bit first frame length */
+#define ISOTP_MAX_LEN		4095
+
+/* How long to wait for a flow control or the next consecutive frame */
+#define ISOTP_TIMEOUT_US	1000000
+
+/* Flow control WAITs accepted in a row before giving up */
+#define ISOTP_MAX_WAIT		10
+
+enum isotp_status {
+	ISOTP_OK,
+	ISOTP_PENDING,
+	ISOTP_TIMEOUT,		/* N_Bs or N_Cr ran out */
+	ISOTP_OVERFLOW,		/* receiver had no room, or we had none */
+	ISOTP_WRONG_SN,		/* consecutive frame out of sequence */
+	ISOTP_ABORTED,		/* a new message started over this one */
+	ISOTP_BAD_FRAME,	/* unknown flow status, too many WAITs... */
+};
+
+struct isotp_link;
+
+/*
+ * What a link needs from the application. All of it is called from
+ * isotp_input() and isotp_poll(), never from anywhere else.
+ */
+struct isotp_ops {
+	/* Queue one CAN frame on the link's tx_id, false if no room */
+	bool (*send)(struct isotp_link *link, const uint8_t *data,
+		     uint8_t dlc);
+	/*
+	 * Where to put an incoming message of len bytes, or NULL to
+	 * refuse it. The buffer belongs to the link until rx_done.
+	 */
+	uint8_t *(*rx_buffer)(struct isotp_link *link, uint16_t len);
+	void (*rx_done)(struct isotp_link *link, uint8_t *buf, uint16_t len,
+			enum isotp_status status);
+	void (*tx_done)(struct isotp_link *link, enum isotp_status status);
+};
+
+/*
+ * One pair of CAN IDs, a message each way at a time. Several links run
+ * side by side without knowing of each other.
+ */
+struct isotp_link {
+	const struct isotp_ops *ops;
+	uint32_t tx_id, rx_id;
+	bool ext;
+	bool pad;		/* fill frames up to 8 bytes with 0xcc */
+	uint8_t bs;		/* block size we ask for, 0 = no limit */
+	uint8_t stmin;		/* separation time we ask for, as coded */
+	void *priv;		/* for the callbacks */
+
+	/* Private to isotp.c */
+	uint8_t tx_state;
+	const uint8_t *tx_buf;
+	uint16_t tx_len, tx_pos;
+	uint8_t tx_sn, tx_bs, tx_left, tx_waits;
+	uint32_t tx_gap, tx_next, tx_deadline;
+
+	uint8_t rx_state;
+	uint8_t *rx_buf;
+	uint16_t rx_len, rx_pos;
+	uint8_t rx_sn, rx_left;
+	uint8_t rx_fc;		/* flow status still to send */
+	uint32_t rx_deadline;
+};
+
+void isotp_init(struct isotp_link *link, const struct isotp_ops *ops,
+		uint32_t tx_id, uint32_t rx_id, bool ext);
+enum isotp_status isotp_send(struct isotp_link *link, const uint8_t *buf,
+			     uint16_t len, uint32_t now);
+bool isotp_input(struct isotp_link *link, uint32_t id, bool ext,
+		 const uint8_t *data, uint8_t dlc, uint32_t now);
+void isotp_poll(struct isotp_link *link, uint32_t now);
+bool isotp_tx_busy(const struct isotp_link *link);
+
+#endif
@@ -0,0 +1,825 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks isotp.c on the host:
+ *
+ *	cc -o isotp_host isotp_host.c isotp.c
+ *	./isotp_host
+ *
+ * Two nodes share a simulated bus. Each has a queue of frames for the
+ * driver, which isotp_send() fills and the bus empties lowest identifier
+ * first, one frame every FRAME_US, into the links of the other node.
+ * Some tests leave the bus off and play the other side by hand.
+ *
+ * Checked: every length from 1 to 4095 bytes, several links both ways
+ * at once, the block size and separation time the receiver asks for,
+ * flow control WAIT and overflow, the N_Bs and N_Cr timeouts, and lost,
+ * repeated and interrupted consecutive frames.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "isotp.h"
+
+#define NODES		2
+#define LINKS		4
+#define QUEUE		32
+#define STEP_US		10	/* how often the links are polled */
+#define FRAME_US	125	/* one frame on the bus */
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/* The bus */
+
+struct frame {
+	uint32_t id;
+	bool ext;
+	uint8_t data[8];
+	uint8_t dlc;
+};
+
+struct node;
+
+/* One end of a link, and what the test knows of it */
+struct end {
+	struct node *node;
+	struct isotp_link *link;
+	struct end *peer;
+	int who;
+
+	/* Sending */
+	uint8_t tx[ISOTP_MAX_LEN];
+	uint16_t lens[64];	/* by sequence number */
+	uint32_t tx_seq;
+	int tx_status;		/* -1 while busy */
+	uint32_t tx_at;
+
+	/* What the last flow control allows, and how it is kept */
+	int fc_bs;
+	uint32_t fc_gap;
+	int in_block;
+	bool cf_sent;
+	uint32_t last_cf;
+	int violations;
+
+	/* Receiving */
+	uint8_t rx[ISOTP_MAX_LEN];
+	bool refuse;
+	bool verify;		/* against what the peer sent */
+	uint32_t next_seq;
+	int mismatch;
+	int log_status[8];
+	uint16_t log_len[8];
+	int n_log;
+	uint32_t rx_at;
+};
+
+struct node {
+	struct frame q[QUEUE];
+	int head, len;
+	int room;		/* how many the driver takes */
+	struct isotp_link links[LINKS];
+	struct end ends[LINKS];
+};
+
+static struct node nodes[NODES];
+static int n_links;
+static uint32_t now, bus_free;
+static bool bus_on;
+static bool (*lose)(const struct frame *f);
+
+static uint8_t pattern(int who, uint32_t seq, int i)
+{
+	uint32_t x = ((who * 7919) + seq) * 2654435761u + i * 40503;
+
+	x ^= x >> 13;
+	x *= 0x5bd1e995;
+	x ^= x >> 15;
+	return x;
+}
+
+/* STmin as the standard has it, to check isotp.c against */
+static uint32_t gap_us(uint8_t st)
+{
+	if (st <= 0x7f) {
+		return st * 1000;
+	}
+	if ((st >= 0xf1) && (st <= 0xf9)) {
+		return (st - 0xf0) * 100;
+	}
+	return 127000;
+}
+
+static bool send(struct isotp_link *link, const uint8_t *data, uint8_t dlc)
+{
+	struct end *e = link->priv;
+	struct node *n = e->node;
+	struct frame *f;
+
+	if (n->len >= n->room) {
+		return false;
+	}
+
+	if ((dlc > 0) && ((data[0] >> 4) == 2)) {
+		if ((e->fc_bs != 0) && (++e->in_block > e->fc_bs)) {
+			e->violations++;
+		}
+		if (e->cf_sent && (now - e->last_cf < e->fc_gap)) {
+			e->violations++;
+		}
+		e->cf_sent = true;
+		e->last_cf = now;
+	}
+
+	f = &n->q[(n->head + n->len++) % QUEUE];
+	f->id = link->tx_id;
+	f->ext = link->ext;
+	memcpy(f->data, data, dlc);
+	f->dlc = dlc;
+	return true;
+}
+
+static uint8_t *rx_buffer(struct isotp_link *link, uint16_t len)
+{
+	struct end *e = link->priv;
+
+	if (e->refuse || (len > ISOTP_MAX_LEN)) {
+		return NULL;
+	}
+	return e->rx;
+}
+
+static void rx_done(struct isotp_link *link, uint8_t *buf, uint16_t len,
+		    enum isotp_status status)
+{
+	struct end *e = link->priv;
+	struct end *p = e->peer;
+	uint32_t seq = e->next_seq++;
+	int i;
+
+	if (e->n_log < 8) {
+		e->log_status[e->n_log] = status;
+		e->log_len[e->n_log] = len;
+	}
+	e->n_log++;
+	e->rx_at = now;
+
+	if (buf != e->rx) {
+		e->mismatch++;
+	}
+	if (!e->verify || (status != ISOTP_OK)) {
+		return;
+	}
+	if (len != p->lens[seq % 64]) {
+		e->mismatch++;
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		if (buf[i] != pattern(p->who, seq, i)) {
+			e->mismatch++;
+			return;
+		}
+	}
+}
+
+static void tx_done(struct isotp_link *link, enum isotp_status status)
+{
+	struct end *e = link->priv;
+
+	e->tx_status = status;
+	e->tx_at = now;
+}
+
+static const struct isotp_ops ops = {
+	.send = send,
+	.rx_buffer = rx_buffer,
+	.rx_done = rx_done,
+	.tx_done = tx_done,
+};
+
+/*
+ * Link k joins end k of node 0 and end k of node 1, on a pair of
+ * identifiers of its own, extended ones on the odd links.
+ */
+static void setup(int links)
+{
+	struct end *e;
+	uint32_t a, b;
+	int n, k;
+
+	memset(nodes, 0, sizeof(nodes));
+	n_links = links;
+	lose = NULL;
+	bus_on = true;
+	/* Near the wrap of the counter, to check the deadlines over it */
+	now = 0xfff80000;
+	bus_free = now;
+
+	for (n = 0; n < NODES; n++) {
+		nodes[n].room = QUEUE;
+		for (k = 0; k < links; k++) {
+			a = (k & 1) ? 0x18da0000 + (k << 8) : 0x700 + (k << 4);
+			b = a + 8;
+			e = &nodes[n].ends[k];
+			isotp_init(&nodes[n].links[k], &ops, n ? b : a,
+				   n ? a : b, k & 1);
+			nodes[n].links[k].priv = e;
+			e->node = &nodes[n];
+			e->link = &nodes[n].links[k];
+			e->peer = &nodes[!n].ends[k];
+			e->who = n * LINKS + k;
+			e->tx_status = ISOTP_OK;
+			e->verify = true;
+		}
+	}
+}
+
+static void deliver(struct node *to, const struct frame *f)
+{
+	struct end *e;
+	int k;
+
+	for (k = 0; k < n_links; k++) {
+		e = &to->ends[k];
+		if ((e->link->rx_id != f->id) || (e->link->ext != f->ext)) {
+			continue;
+		}
+		/* A clear to send starts a new block for the sender */
+		if ((f->dlc >= 3) && (f->data[0] == 0x30)) {
+			e->fc_bs = f->data[1];
+			e->fc_gap = gap_us(f->data[2]);
+			e->in_block = 0;
+			e->cf_sent = false;
+		}
+		break;
+	}
+	for (k = 0; k < n_links; k++) {
+		if (isotp_input(&to->links[k], f->id, f->ext, f->data,
+				f->dlc, now)) {
+			break;
+		}
+	}
+}
+
+/* The lowest identifier waiting in either node wins the bus */
+static void bus_step(void)
+{
+	struct frame f;
+	struct node *n;
+	int i, best = -1;
+
+	for (i = 0; i < NODES; i++) {
+		n = &nodes[i];
+		if ((n->len > 0) && ((best < 0) || (n->q[n->head].id <
+		     nodes[best].q[nodes[best].head].id))) {
+			best = i;
+		}
+	}
+	if (best < 0) {
+		return;
+	}
+
+	n = &nodes[best];
+	f = n->q[n->head];
+	n->head = (n->head + 1) % QUEUE;
+	n->len--;
+	bus_free = now + FRAME_US;
+	if ((lose == NULL) || !lose(&f)) {
+		deliver(&nodes[!best], &f);
+	}
+}
+
+static void step(void)
+{
+	int n, k;
+
+	now += STEP_US;
+	for (n = 0; n < NODES; n++) {
+		for (k = 0; k < n_links; k++) {
+			isotp_poll(&nodes[n].links[k], now);
+		}
+	}
+	if (bus_on && ((int32_t)(now - bus_free) >= 0)) {
+		bus_step();
+	}
+}
+
+static void wait_us(uint32_t us)
+{
+	uint32_t t0 = now;
+
+	while (now - t0 < us) {
+		step();
+	}
+}
+
+static void start(struct end *e, uint16_t len)
+{
+	uint32_t seq = e->tx_seq++;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		e->tx[i] = pattern(e->who, seq, i);
+	}
+	e->lens[seq % 64] = len;
+	e->tx_status = -1;
+	if (isotp_send(e->link, e->tx, len, now) != ISOTP_OK) {
+		e->tx_status = ISOTP_BAD_FRAME;
+	}
+}
+
+/*
+ * One message from e to its peer, until both ends are done with it or
+ * the timeouts must have run out.
+ */
+static void send_one(struct end *e, uint16_t len)
+{
+	struct end *p = e->peer;
+	uint32_t t0 = now;
+	int logged = p->n_log;
+
+	p->next_seq = e->tx_seq;
+	start(e, len);
+	while ((e->tx_status < 0) || ((p->n_log == logged) &&
+	       (now - t0 < 3 * ISOTP_TIMEOUT_US))) {
+		step();
+	}
+	/* Let the last frames and any stray flow control through */
+	wait_us(2 * FRAME_US);
+}
+
+/* What the bus-less tests send to, and take from, end 0 of node 0 */
+static void feed(const uint8_t *data, uint8_t dlc)
+{
+	struct isotp_link *l = &nodes[0].links[0];
+
+	isotp_input(l, l->rx_id, l->ext, data, dlc, now);
+}
+
+static bool take(struct frame *f)
+{
+	struct node *n = &nodes[0];
+
+	if (n->len == 0) {
+		return false;
+	}
+	*f = n->q[n->head];
+	n->head = (n->head + 1) % QUEUE;
+	n->len--;
+	return true;
+}
+
+static int queued(void)
+{
+	return nodes[0].len;
+}
+
+/* The tests */
+
+static void test_lengths(void)
+{
+	struct end *a, *b;
+	int len, bad = 0, slow = 0;
+	uint32_t t0;
+
+	setup(1);
+	a = &nodes[0].ends[0];
+	b = &nodes[1].ends[0];
+	for (len = 1; len <= ISOTP_MAX_LEN; len++) {
+		/* The receiver asks for blocks of 0 to 3 frames */
+		b->link->bs = len % 4;
+		b->n_log = 0;
+		t0 = now;
+		send_one(a, len);
+		if ((a->tx_status != ISOTP_OK) || (b->n_log != 1) ||
+		    (b->log_status[0] != ISOTP_OK) ||
+		    (b->log_len[0] != len)) {
+			bad++;
+		}
+		/* No frame lost to a full queue, and no time wasted */
+		if (b->rx_at - t0 > (uint32_t)(len / 7 + 2) *
+		    (len % 4 ? 4 : 2) * FRAME_US) {
+			slow++;
+		}
+	}
+	check(bad == 0 && b->mismatch == 0, "lengths", bad, b->mismatch);
+	check(slow == 0, "lengths speed", slow, 0);
+	check(a->violations == 0, "lengths block size", a->violations, 0);
+
+	/* Nothing to send, or too much for a first frame */
+	check(isotp_send(a->link, a->tx, 0, now) == ISOTP_OVERFLOW &&
+	      isotp_send(a->link, a->tx, ISOTP_MAX_LEN + 1, now) ==
+	      ISOTP_OVERFLOW && !isotp_tx_busy(a->link), "lengths limits",
+	      0, 0);
+	start(a, 100);
+	check(isotp_send(a->link, a->tx, 1, now) == ISOTP_PENDING &&
+	      isotp_tx_busy(a->link), "lengths pending", 0, 0);
+}
+
+/* The time from the first frame to the last consecutive one */
+static uint32_t timed(struct end *a, uint8_t bs, uint8_t stmin,
+		      uint16_t len)
+{
+	struct end *b = a->peer;
+	uint32_t t0 = now;
+
+	b->link->bs = bs;
+	b->link->stmin = stmin;
+	b->n_log = 0;
+	send_one(a, len);
+	if ((a->tx_status != ISOTP_OK) || (b->n_log != 1) ||
+	    (b->log_status[0] != ISOTP_OK)) {
+		return 0;
+	}
+	return b->rx_at - t0;
+}
+
+static void test_bs_stmin(void)
+{
+	static const uint8_t bss[] = { 0, 1, 3, 8, 255 };
+	static const uint8_t sts[] = {
+		0, 1, 5, 0x7f, 0x80, 0xf0, 0xf1, 0xf5, 0xf9, 0xfa, 0xff,
+	};
+	struct end *a;
+	uint32_t t, gap, least, most;
+	int i, j, cfs, blocks;
+
+	setup(1);
+	a = &nodes[0].ends[0];
+	/* A first frame and 14 consecutive ones */
+	cfs = 14;
+	for (i = 0; i < (int)sizeof(bss); i++) {
+		for (j = 0; j < (int)sizeof(sts); j++) {
+			t = timed(a, bss[i], sts[j], 100);
+			gap = gap_us(sts[j]);
+			blocks = bss[i] ? (cfs + bss[i] - 1) / bss[i] : 1;
+			/* The first of each block goes on flow control */
+			least = (cfs - blocks) * gap;
+			most = (cfs - blocks) * (gap + STEP_US) +
+			       (cfs + 2 * blocks + 1) * (FRAME_US + STEP_US);
+			check(t >= least && t <= most, "bs stmin time",
+			      bss[i] * 1000 + sts[j], t);
+		}
+	}
+	check(a->violations == 0, "bs stmin kept", a->violations, 0);
+	check(a->peer->mismatch == 0, "bs stmin data", a->peer->mismatch, 0);
+}
+
+/*
+ * Four links, each sending both ways at once, with their own block
+ * sizes, separation times and padding, through a queue of random depth.
+ */
+static void test_concurrent(void)
+{
+	static const uint8_t sts[] = { 0, 0, 0, 1, 2, 0xf1, 0xf5, 0xf9 };
+	struct end *e;
+	uint32_t t0, next[NODES][LINKS];
+	int round, n, k, todo, bad, late;
+	const int msgs = 20;
+
+	for (round = 0; round < 10; round++) {
+		setup(LINKS);
+		for (n = 0; n < NODES; n++) {
+			nodes[n].room = 1 + lcg() % QUEUE;
+			for (k = 0; k < LINKS; k++) {
+				e = &nodes[n].ends[k];
+				e->link->bs = (lcg() % 3) ? lcg() % 9 : 0;
+				e->link->stmin = sts[lcg() % sizeof(sts)];
+				e->link->pad = lcg() % 2;
+				next[n][k] = now + lcg() % 5000;
+			}
+		}
+
+		t0 = now;
+		do {
+			todo = 0;
+			for (n = 0; n < NODES; n++) {
+				for (k = 0; k < LINKS; k++) {
+					e = &nodes[n].ends[k];
+					todo += msgs - e->peer->n_log;
+					if ((e->tx_seq == (uint32_t)msgs) ||
+					    isotp_tx_busy(e->link) ||
+					    ((int32_t)(now - next[n][k]) < 0)) {
+						continue;
+					}
+					start(e, (lcg() % 4) ?
+					      1 + lcg() % 40 :
+					      1 + lcg() % ISOTP_MAX_LEN);
+					next[n][k] = now + lcg() % 2000;
+				}
+			}
+			step();
+		} while ((todo > 0) && (now - t0 < 200 * ISOTP_TIMEOUT_US));
+
+		bad = 0;
+		late = 0;
+		for (n = 0; n < NODES; n++) {
+			for (k = 0; k < LINKS; k++) {
+				e = &nodes[n].ends[k];
+				bad += e->mismatch + e->violations;
+				bad += e->tx_status != ISOTP_OK;
+				late += e->n_log != msgs;
+				for (todo = 0; todo < 8; todo++) {
+					bad += e->log_status[todo] !=
+					       ISOTP_OK;
+				}
+			}
+		}
+		check(bad == 0 && late == 0, "concurrent", bad, late);
+	}
+}
+
+static void test_wait(void)
+{
+	static const uint8_t wait[] = { 0x31, 0, 0 };
+	static const uint8_t cts[] = { 0x30, 0, 0 };
+	static const uint8_t odd[] = { 0x33, 0, 0 };
+	struct end *a;
+	struct frame f = { 0 };
+	int i, cfs;
+
+	setup(1);
+	bus_on = false;
+	a = &nodes[0].ends[0];
+
+	/* Ten WAITs, each just short of the timeout, then go on */
+	start(a, 100);
+	check(take(&f) && f.data[0] == 0x10 && f.data[1] == 100,
+	      "wait first frame", f.data[0], f.data[1]);
+	for (i = 0; i < ISOTP_MAX_WAIT; i++) {
+		wait_us(ISOTP_TIMEOUT_US - 1000);
+		feed(wait, 3);
+	}
+	wait_us(ISOTP_TIMEOUT_US - 1000);
+	check(a->tx_status < 0 && queued() == 0, "wait pending",
+	      a->tx_status, queued());
+	feed(cts, 3);
+	for (cfs = 0; take(&f); cfs++) {
+		if (f.data[0] != 0x20 + ((cfs + 1) & 0xf)) {
+			break;
+		}
+	}
+	check(cfs == 14 && a->tx_status == ISOTP_OK, "wait done", cfs,
+	      a->tx_status);
+
+	/* One WAIT too many */
+	start(a, 100);
+	take(&f);
+	for (i = 0; i <= ISOTP_MAX_WAIT; i++) {
+		feed(wait, 3);
+	}
+	check(a->tx_status == ISOTP_BAD_FRAME && queued() == 0,
+	      "wait too many", a->tx_status, queued());
+
+	/* The timeout starts again from the last WAIT */
+	start(a, 100);
+	take(&f);
+	wait_us(ISOTP_TIMEOUT_US / 2);
+	feed(wait, 3);
+	wait_us(ISOTP_TIMEOUT_US - 2 * STEP_US);
+	check(a->tx_status < 0, "wait deadline", a->tx_status, 0);
+	wait_us(3 * STEP_US);
+	check(a->tx_status == ISOTP_TIMEOUT, "wait timeout", a->tx_status,
+	      0);
+
+	/* A flow status that doesn't exist */
+	start(a, 100);
+	take(&f);
+	feed(odd, 3);
+	check(a->tx_status == ISOTP_BAD_FRAME && queued() == 0,
+	      "wait bad status", a->tx_status, queued());
+}
+
+static void test_overflow(void)
+{
+	struct end *a, *b;
+
+	setup(1);
+	a = &nodes[0].ends[0];
+	b = &nodes[1].ends[0];
+
+	/* No room for a long one, the sender hears of it */
+	b->refuse = true;
+	send_one(a, 100);
+	check(a->tx_status == ISOTP_OVERFLOW && b->n_log == 0,
+	      "overflow refused", a->tx_status, b->n_log);
+
+	/* A single frame just isn't taken */
+	send_one(a, 7);
+	check(a->tx_status == ISOTP_OK && b->n_log == 0,
+	      "overflow single frame", a->tx_status, b->n_log);
+
+	/* And nothing is left over for the next one */
+	b->refuse = false;
+	send_one(a, 100);
+	check(a->tx_status == ISOTP_OK && b->n_log == 1 &&
+	      b->log_status[0] == ISOTP_OK && b->log_len[0] == 100 &&
+	      b->mismatch == 0, "overflow after", a->tx_status,
+	      b->log_status[0]);
+}
+
+static int cf_seen, cf_lost_from, cf_lost_to;
+static uint32_t cf_in;		/* when the last one got through */
+
+/* Consecutive frames numbered from 1, some of them don't arrive */
+static bool lose_cfs(const struct frame *f)
+{
+	if ((f->data[0] >> 4) != 2) {
+		return false;
+	}
+	cf_seen++;
+	if ((cf_seen >= cf_lost_from) && (cf_seen <= cf_lost_to)) {
+		return true;
+	}
+	cf_in = now;
+	return false;
+}
+
+static bool lose_fc(const struct frame *f)
+{
+	return (f->data[0] >> 4) == 3;
+}
+
+static void test_timeouts(void)
+{
+	struct end *a, *b;
+	uint32_t t0;
+
+	setup(1);
+	a = &nodes[0].ends[0];
+	b = &nodes[1].ends[0];
+
+	/* N_Bs: the flow control never arrives */
+	lose = lose_fc;
+	t0 = now;
+	send_one(a, 100);
+	check(a->tx_status == ISOTP_TIMEOUT, "N_Bs", a->tx_status, 0);
+	check(a->tx_at - t0 >= ISOTP_TIMEOUT_US &&
+	      a->tx_at - t0 <= ISOTP_TIMEOUT_US + FRAME_US + 2 * STEP_US,
+	      "N_Bs time", a->tx_at - t0, 0);
+	/* And the receiver waited for frames that never came */
+	wait_us(ISOTP_TIMEOUT_US);
+	check(b->n_log == 1 && b->log_status[0] == ISOTP_TIMEOUT &&
+	      b->log_len[0] == 6, "N_Bs receiver", b->log_status[0],
+	      b->log_len[0]);
+
+	/* N_Cr: the sender is done after the third frame, as it thinks */
+	lose = lose_cfs;
+	cf_seen = 0;
+	cf_lost_from = 4;
+	cf_lost_to = 1000;
+	b->n_log = 0;
+	send_one(a, 100);
+	check(a->tx_status == ISOTP_OK && b->n_log == 1 &&
+	      b->log_status[0] == ISOTP_TIMEOUT && b->log_len[0] == 27,
+	      "N_Cr", b->log_status[0], b->log_len[0]);
+	/* Counted from the last frame in */
+	check(b->rx_at - cf_in >= ISOTP_TIMEOUT_US &&
+	      b->rx_at - cf_in <= ISOTP_TIMEOUT_US + STEP_US,
+	      "N_Cr time", b->rx_at - cf_in, 0);
+
+	/* With blocks, the sender then waits in vain for flow control */
+	cf_seen = 0;
+	cf_lost_from = 2;
+	cf_lost_to = 2;
+	b->link->bs = 2;
+	b->n_log = 0;
+	send_one(a, 100);
+	wait_us(ISOTP_TIMEOUT_US);
+	check(a->tx_status == ISOTP_TIMEOUT && b->n_log == 1 &&
+	      b->log_status[0] == ISOTP_TIMEOUT && b->log_len[0] == 13,
+	      "N_Cr blocks", a->tx_status, b->log_status[0]);
+
+	/* Back to normal */
+	lose = NULL;
+	b->n_log = 0;
+	send_one(a, 100);
+	check(a->tx_status == ISOTP_OK && b->n_log == 1 &&
+	      b->log_status[0] == ISOTP_OK && b->mismatch == 0,
+	      "timeouts after", a->tx_status, b->log_status[0]);
+}
+
+static void test_wrong_sn(void)
+{
+	static const uint8_t ff[] = { 0x10, 20, 1, 2, 3, 4, 5, 6 };
+	static const uint8_t cf1[] = { 0x21, 7, 8, 9, 10, 11, 12, 13 };
+	static const uint8_t cf2[] = { 0x22, 14, 15, 16, 17, 18, 19, 20 };
+	static const uint8_t sf[] = { 0x03, 1, 2, 3 };
+	struct end *a, *b;
+	struct frame f = { 0 };
+
+	setup(1);
+	a = &nodes[0].ends[0];
+	b = &nodes[1].ends[0];
+
+	/* A lost frame: the next one is out of sequence */
+	lose = lose_cfs;
+	cf_seen = 0;
+	cf_lost_from = 3;
+	cf_lost_to = 3;
+	send_one(a, 100);
+	check(a->tx_status == ISOTP_OK && b->n_log == 1 &&
+	      b->log_status[0] == ISOTP_WRONG_SN && b->log_len[0] == 20,
+	      "wrong sn lost", b->log_status[0], b->log_len[0]);
+
+	/* Past 15 the sequence number goes round to 0 */
+	lose = NULL;
+	b->n_log = 0;
+	send_one(a, ISOTP_MAX_LEN);
+	check(a->tx_status == ISOTP_OK && b->n_log == 1 &&
+	      b->log_status[0] == ISOTP_OK && b->mismatch == 0,
+	      "wrong sn wrap", b->log_status[0], b->mismatch);
+
+	/* The same frame twice, by hand */
+	setup(1);
+	bus_on = false;
+	b = &nodes[0].ends[0];
+	b->verify = false;
+	feed(ff, 8);
+	check(take(&f) && f.data[0] == 0x30, "wrong sn flow control",
+	      f.data[0], 0);
+	feed(cf1, 8);
+	feed(cf1, 8);
+	check(b->n_log == 1 && b->log_status[0] == ISOTP_WRONG_SN &&
+	      b->log_len[0] == 13, "wrong sn repeated", b->log_status[0],
+	      b->log_len[0]);
+	/* The rest of that message is not taken for a new one */
+	feed(cf2, 8);
+	check(b->n_log == 1, "wrong sn rest", b->n_log, 0);
+
+	/* New messages over ones not finished yet */
+	feed(ff, 8);
+	take(&f);
+	feed(cf1, 8);
+	feed(sf, 4);
+	check(b->n_log == 3 && b->log_status[1] == ISOTP_ABORTED &&
+	      b->log_len[1] == 13 && b->log_status[2] == ISOTP_OK &&
+	      b->log_len[2] == 3 && memcmp(b->rx, &sf[1], 3) == 0,
+	      "wrong sn aborted", b->log_status[1], b->log_status[2]);
+	feed(ff, 8);
+	take(&f);
+	feed(ff, 8);
+	take(&f);
+	check(b->n_log == 4 && b->log_status[3] == ISOTP_ABORTED &&
+	      b->log_len[3] == 6, "wrong sn first frame again",
+	      b->log_status[3], b->log_len[3]);
+
+	/* A short frame gives what it has, the rest never comes */
+	feed(cf1, 4);
+	wait_us(ISOTP_TIMEOUT_US);
+	check(b->n_log == 5 && b->log_status[4] == ISOTP_TIMEOUT &&
+	      b->log_len[4] == 9, "wrong sn short frame", b->log_status[4],
+	      b->log_len[4]);
+	check(queued() == 0, "wrong sn quiet", queued(), 0);
+}
+
+int main(void)
+{
+	test_lengths();
+	test_bs_stmin();
+	test_concurrent();
+	test_wait();
+	test_overflow();
+	test_timeouts();
+	test_wrong_sn();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
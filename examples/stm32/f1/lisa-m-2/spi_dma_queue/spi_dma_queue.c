@@ -0,0 +1,362 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "spi_queue.h"
+
+/* SPI1 runs from the 72MHz APB2 clock */
+#define SPI_BITRATE	(72000000 / 16)
+
+int _write(int file, char *ptr, int len);
+
+static volatile uint32_t system_millis;
+
+/*
+ * Three made up devices sharing the bus, each transaction resubmits
+ * itself from its done callback so the bus never goes idle:
+ *  - "accel" on PA4, 8-bit, one register address out and a six byte
+ *    burst back (seven words clocked, rx longer than tx)
+ *  - "adc" on PB1, 16-bit, four words each way
+ *  - "dac", no chip select, 8-bit, three bytes out and nothing kept
+ * With MISO and MOSI looped back, what comes in is what went out, which
+ * lets us check the 16-bit device.
+ */
+static uint8_t accel_tx[1] = { 0x80 | 0x28 };
+static uint8_t accel_rx[7];
+static uint16_t adc_tx[4] = { 0x1234, 0x5678, 0x9abc, 0xdef0 };
+static uint16_t adc_rx[4];
+static uint8_t dac_tx[3] = { 0x30, 0x0f, 0xff };
+static volatile uint32_t adc_errors;
+
+static void resubmit(struct spi_xfer *x)
+{
+	spi_queue_submit(x);
+}
+
+static void adc_done(struct spi_xfer *x)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (adc_rx[i] != adc_tx[i]) {
+			adc_errors++;
+		}
+		adc_tx[i] += 1;
+	}
+	spi_queue_submit(x);
+}
+
+static struct spi_xfer accel = {
+	.cs_port = GPIOA, .cs_pin = GPIO4, .word16 = false,
+	.tx_buf = accel_tx, .tx_len = 1,
+	.rx_buf = accel_rx, .rx_len = 7,
+	.done = resubmit,
+};
+
+static struct spi_xfer adc = {
+	.cs_port = GPIOB, .cs_pin = GPIO1, .word16 = true,
+	.tx_buf = adc_tx, .tx_len = 4,
+	.rx_buf = adc_rx, .rx_len = 4,
+	.done = adc_done,
+};
+
+static struct spi_xfer dac = {
+	.cs_port = 0, .word16 = false,
+	.tx_buf = dac_tx, .tx_len = 3,
+	.rx_buf = NULL, .rx_len = 0,
+	.done = resubmit,
+};
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+
+	/* Enable GPIOA, GPIOB, GPIOC clock. */
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_GPIOC);
+
+	/* Enable clocks for GPIO port A (for GPIO_USART2_TX) and USART2. */
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_USART2);
+
+	/* Enable SPI1 Periph and gpio clocks */
+	rcc_periph_clock_enable(RCC_SPI1);
+
+	/* Enable DMA1 clock */
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	/* 1ms SysTick */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+void sys_tick_handler(void)
+{
+	system_millis++;
+}
+
+static void spi_setup(void)
+{
+	/* Configure GPIOs: SCK=PA5, MISO=PA6 and MOSI=PA7 */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO5 | GPIO7);
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, GPIO6);
+
+	/* Chip selects, idle high */
+	gpio_set(GPIOA, GPIO4);
+	gpio_set(GPIOB, GPIO1);
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO4);
+	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO1);
+
+	/* Reset SPI, SPI_CR1 register cleared, SPI is disabled */
+	spi_reset(SPI1);
+
+	/* Explicitly disable I2S in favour of SPI operation */
+	SPI1_I2SCFGR = 0;
+
+	/*
+	 * Master mode, 1/16 of the peripheral clock, idle high, data valid
+	 * on the 2nd edge, MSB first. The frame size is set per transaction.
+	 */
+	spi_init_master(SPI1, SPI_CR1_BAUDRATE_FPCLK_DIV_16,
+			SPI_CR1_CPOL_CLK_TO_1_WHEN_IDLE,
+			SPI_CR1_CPHA_CLK_TRANSITION_2, SPI_CR1_DFF_8BIT,
+			SPI_CR1_MSBFIRST);
+
+	/* NSS must be high or the master sends nothing, see spi_dma_adv */
+	spi_enable_software_slave_management(SPI1);
+	spi_set_nss_high(SPI1);
+
+	spi_enable(SPI1);
+}
+
+/******************************************************************************
+ * spi_queue on SPI1, DMA1 channel 2 (rx) and 3 (tx)
+ *****************************************************************************/
+
+static void spi_op_cs(uint32_t port, uint16_t pin, bool active)
+{
+	if (active) {
+		gpio_clear(port, pin);
+	} else {
+		gpio_set(port, pin);
+	}
+}
+
+/*
+ * The frame format can only change with the SPI disabled and idle. The
+ * previous transaction has been fully received when this is called, so
+ * BSY is about to drop if it hasn't already.
+ */
+static void spi_op_frame(bool word16)
+{
+	while (SPI_SR(SPI1) & SPI_SR_BSY);
+	spi_disable(SPI1);
+	if (word16) {
+		spi_set_dff_16bit(SPI1);
+	} else {
+		spi_set_dff_8bit(SPI1);
+	}
+	spi_enable(SPI1);
+}
+
+static void spi_op_channel(uint8_t channel, uint32_t buf, bool inc,
+			   uint16_t len, bool word16)
+{
+	dma_disable_channel(DMA1, channel);
+	dma_set_memory_address(DMA1, channel, buf);
+	dma_set_number_of_data(DMA1, channel, len);
+	if (inc) {
+		dma_enable_memory_increment_mode(DMA1, channel);
+	} else {
+		dma_disable_memory_increment_mode(DMA1, channel);
+	}
+	if (word16) {
+		dma_set_peripheral_size(DMA1, channel, DMA_CCR_PSIZE_16BIT);
+		dma_set_memory_size(DMA1, channel, DMA_CCR_MSIZE_16BIT);
+	} else {
+		dma_set_peripheral_size(DMA1, channel, DMA_CCR_PSIZE_8BIT);
+		dma_set_memory_size(DMA1, channel, DMA_CCR_MSIZE_8BIT);
+	}
+}
+
+static void spi_op_rx(void *buf, bool inc, uint16_t len, bool word16)
+{
+	spi_op_channel(DMA_CHANNEL2, (uint32_t)buf, inc, len, word16);
+}
+
+static void spi_op_tx(const void *buf, bool inc, uint16_t len, bool word16)
+{
+	spi_op_channel(DMA_CHANNEL3, (uint32_t)buf, inc, len, word16);
+}
+
+static void spi_op_go(void)
+{
+	/* rx first, so it is ready before the first word goes out */
+	dma_enable_channel(DMA1, DMA_CHANNEL2);
+	dma_enable_channel(DMA1, DMA_CHANNEL3);
+}
+
+static void spi_op_lock(void)
+{
+	nvic_disable_irq(NVIC_DMA1_CHANNEL2_IRQ);
+}
+
+static void spi_op_unlock(void)
+{
+	nvic_enable_irq(NVIC_DMA1_CHANNEL2_IRQ);
+}
+
+static const struct spi_queue_ops spi1_ops = {
+	.cs = spi_op_cs,
+	.frame = spi_op_frame,
+	.rx = spi_op_rx,
+	.tx = spi_op_tx,
+	.go = spi_op_go,
+	.lock = spi_op_lock,
+	.unlock = spi_op_unlock,
+};
+
+/* SPI receive completed with DMA, end of a phase */
+void dma1_channel2_isr(void)
+{
+	if ((DMA1_ISR & DMA_ISR_TCIF2) == 0) {
+		return;
+	}
+	/* The tx channel finished before us, clear its flag as well */
+	DMA1_IFCR |= DMA_IFCR_CTCIF2 | DMA_IFCR_CTCIF3;
+	spi_queue_rx_done();
+}
+
+static void spi_queue_setup(void)
+{
+	dma_channel_reset(DMA1, DMA_CHANNEL2);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL2, (uint32_t)&SPI1_DR);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL2);
+	dma_set_priority(DMA1, DMA_CHANNEL2, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL2);
+
+	dma_channel_reset(DMA1, DMA_CHANNEL3);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL3, (uint32_t)&SPI1_DR);
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL3);
+	dma_set_priority(DMA1, DMA_CHANNEL3, DMA_CCR_PL_HIGH);
+
+	spi_queue_init(&spi1_ops, (SPI_CR1(SPI1) & SPI_CR1_DFF) != 0);
+	spi_enable_rx_dma(SPI1);
+	spi_enable_tx_dma(SPI1);
+
+	nvic_set_priority(NVIC_DMA1_CHANNEL2_IRQ, 0);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL2_IRQ);
+}
+
+static void usart_setup(void)
+{
+	/* Setup GPIO pin GPIO_USART2_TX and GPIO_USART2_RX. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT,
+		      GPIO_CNF_INPUT_FLOAT, GPIO_USART2_RX);
+
+	/* Setup UART parameters. */
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_mode(USART2, USART_MODE_TX_RX);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+
+	/* Finally enable the USART. */
+	usart_enable(USART2);
+}
+
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART2, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+static void gpio_setup(void)
+{
+	/* Set GPIO8 (in GPIO port A) to 'output push-pull'. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_2_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO8);
+}
+
+int main(void)
+{
+	struct spi_queue_stats now, last = { 0, 0 };
+	uint32_t next, xfers, bits, accel_bits, adc_bits, dac_bits;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+	spi_setup();
+	spi_queue_setup();
+
+	printf("SPI DMA transaction queue (use loopback)\r\n\r\n");
+
+	spi_queue_submit(&accel);
+	spi_queue_submit(&adc);
+	spi_queue_submit(&dac);
+
+	/* Bits each device clocks per transaction */
+	accel_bits = 7 * 8;
+	adc_bits = 4 * 16;
+	dac_bits = 3 * 8;
+
+	next = system_millis + 1000;
+	while (1) {
+		while ((int32_t)(system_millis - next) < 0);
+		next += 1000;
+
+		gpio_toggle(GPIOA, GPIO8);
+
+		spi_queue_get_stats(&now);
+		xfers = now.xfers - last.xfers;
+		/* The three devices take turns, so they share xfers evenly */
+		bits = xfers / 3 * (accel_bits + adc_bits + dac_bits);
+		printf("%lu xfers/s, %lu words/s, bus %lu%% busy, "
+		       "%lu loopback errors\r\n",
+		       xfers, now.words - last.words,
+		       bits / (SPI_BITRATE / 100), adc_errors);
+		last = now;
+	}
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Queued SPI transactions on a pair of DMA channels. The hardware is
+ * behind struct spi_queue_ops so spi_queue_host.c can run this against
+ * a model of the bus.
+ *
+ * Every transaction runs in at most two phases, each of which has a
+ * fixed setup on both channels:
+ *	1. min(tx_len, rx_len) words, real buffers on both sides
+ *	2. the rest, a real buffer on the longer side and a dummy word,
+ *	   without memory increment, on the other
+ * The receive channel always runs, even into the dummy, so its transfer
+ * complete interrupt is the one place where a phase ends: every word
+ * has been clocked in by then. That interrupt sets up the next phase,
+ * or ends the transaction and starts the next one in the queue, so the
+ * main loop is never involved.
+ */
+
+#include <stddef.h>
+
+#include "spi_queue.h"
+
+static const struct spi_queue_ops *ops;
+static struct spi_xfer *head, *tail;
+static bool busy;
+static struct spi_queue_stats stats;
+static bool cur_word16;
+static uint16_t dummy_tx = 0xffff;
+static uint16_t dummy_rx;
+
+static uint16_t spi_queue_total(const struct spi_xfer *x)
+{
+	return (x->tx_len > x->rx_len) ? x->tx_len : x->rx_len;
+}
+
+/*
+ * Where phase 1 ends: the point where the shorter side runs out of real
+ * data. If the shorter side is all dummy anyway there is only one phase.
+ */
+static uint16_t spi_queue_boundary(const struct spi_xfer *x)
+{
+	uint16_t total = spi_queue_total(x);
+
+	if ((x->tx_buf != NULL) && (x->tx_len != 0) && (x->tx_len < total)) {
+		return x->tx_len;
+	}
+	if ((x->rx_buf != NULL) && (x->rx_len != 0) && (x->rx_len < total)) {
+		return x->rx_len;
+	}
+	return total;
+}
+
+/* Program and start the next phase of a transaction. */
+static void spi_queue_phase(struct spi_xfer *x)
+{
+	uint16_t size = x->word16 ? 2 : 1;
+	uint16_t boundary = spi_queue_boundary(x);
+	uint16_t end = (x->pos < boundary) ? boundary : spi_queue_total(x);
+	bool tx_real = (x->tx_buf != NULL) && (x->pos < x->tx_len);
+	bool rx_real = (x->rx_buf != NULL) && (x->pos < x->rx_len);
+	const void *tx = &dummy_tx;
+	void *rx = &dummy_rx;
+
+	if (tx_real) {
+		tx = (const uint8_t *)x->tx_buf + x->pos * size;
+	}
+	if (rx_real) {
+		rx = (uint8_t *)x->rx_buf + x->pos * size;
+	}
+	x->phase_len = end - x->pos;
+
+	ops->rx(rx, rx_real, x->phase_len, x->word16);
+	ops->tx(tx, tx_real, x->phase_len, x->word16);
+	ops->go();
+}
+
+/* Start the transaction at the head of the queue. */
+static void spi_queue_start(struct spi_xfer *x)
+{
+	/* The previous transaction has been fully received by now */
+	if (x->word16 != cur_word16) {
+		ops->frame(x->word16);
+		cur_word16 = x->word16;
+	}
+
+	if (x->cs_port != 0) {
+		ops->cs(x->cs_port, x->cs_pin, true);
+	}
+	x->pos = 0;
+	spi_queue_phase(x);
+}
+
+/*
+ * spi_queue_rx_done
+ *
+ * Called from the receive DMA transfer complete interrupt, end of a
+ * phase.
+ */
+void spi_queue_rx_done(void)
+{
+	struct spi_xfer *x = head;
+
+	stats.words += x->phase_len;
+	x->pos += x->phase_len;
+	if (x->pos < spi_queue_total(x)) {
+		spi_queue_phase(x);
+		return;
+	}
+
+	if (x->cs_port != 0) {
+		ops->cs(x->cs_port, x->cs_pin, false);
+	}
+	stats.xfers++;
+
+	/* Get the bus going again before the callback spends any time */
+	head = x->next;
+	if (head != NULL) {
+		spi_queue_start(head);
+	} else {
+		tail = NULL;
+		busy = false;
+	}
+
+	if (x->done != NULL) {
+		x->done(x);
+	}
+}
+
+/*
+ * spi_queue_init
+ *
+ * word16 is the frame format the SPI is set up for right now.
+ */
+void spi_queue_init(const struct spi_queue_ops *spi_ops, bool word16)
+{
+	ops = spi_ops;
+	head = tail = NULL;
+	busy = false;
+	cur_word16 = word16;
+	stats.xfers = stats.words = 0;
+}
+
+/*
+ * spi_queue_submit
+ *
+ * Add a transaction to the end of the queue, starting it right away if
+ * the bus is idle. Can be called from the done callback.
+ */
+void spi_queue_submit(struct spi_xfer *xfer)
+{
+	if ((xfer->tx_len == 0) && (xfer->rx_len == 0)) {
+		return;
+	}
+	xfer->next = NULL;
+
+	ops->lock();
+	if (tail != NULL) {
+		tail->next = xfer;
+	} else {
+		head = xfer;
+	}
+	tail = xfer;
+	if (!busy) {
+		busy = true;
+		spi_queue_start(xfer);
+	}
+	ops->unlock();
+}
+
+bool spi_queue_idle(void)
+{
+	return !busy;
+}
+
+void spi_queue_get_stats(struct spi_queue_stats *out)
+{
+	ops->lock();
+	*out = stats;
+	ops->unlock();
+}
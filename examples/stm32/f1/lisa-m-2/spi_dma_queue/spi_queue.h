@@ -0,0 +1,77 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPI_QUEUE_H
+#define SPI_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * One SPI1 transaction. The bus clocks max(tx_len, rx_len) words with
+ * the chip select held low. Missing tx words are sent as dummies, rx
+ * words beyond rx_len are thrown away. Lengths are in words of 8 or 16
+ * bits, and the buffers must be 16-bit aligned for 16-bit words.
+ *
+ * The structure belongs to the queue from spi_queue_submit() until the
+ * done callback, which runs in interrupt context and may submit the
+ * same transaction again.
+ */
+struct spi_xfer {
+	uint32_t cs_port;		/* 0 if there is no chip select */
+	uint16_t cs_pin;
+	bool word16;
+	const void *tx_buf;		/* NULL sends dummy words only */
+	uint16_t tx_len;
+	void *rx_buf;			/* NULL discards everything */
+	uint16_t rx_len;
+	void (*done)(struct spi_xfer *xfer);
+	void *priv;			/* for the callback */
+
+	/* Private to spi_queue.c */
+	struct spi_xfer *next;
+	uint16_t pos;			/* words clocked so far */
+	uint16_t phase_len;
+};
+
+struct spi_queue_stats {
+	uint32_t xfers;			/* completed transactions */
+	uint32_t words;			/* words clocked */
+};
+
+/*
+ * The hardware, for SPI1 with DMA1 channels 2 and 3 see spi_dma_queue.c.
+ * A channel is set up with a buffer, whether to step through it, and a
+ * length in words. go() starts both, rx first.
+ */
+struct spi_queue_ops {
+	void (*cs)(uint32_t port, uint16_t pin, bool active);
+	void (*frame)(bool word16);	/* wait for idle, set DFF */
+	void (*rx)(void *buf, bool inc, uint16_t len, bool word16);
+	void (*tx)(const void *buf, bool inc, uint16_t len, bool word16);
+	void (*go)(void);
+	void (*lock)(void);		/* keep spi_queue_rx_done() out */
+	void (*unlock)(void);
+};
+
+void spi_queue_init(const struct spi_queue_ops *ops, bool word16);
+void spi_queue_rx_done(void);
+void spi_queue_submit(struct spi_xfer *xfer);
+bool spi_queue_idle(void);
+void spi_queue_get_stats(struct spi_queue_stats *stats);
+
+#endif
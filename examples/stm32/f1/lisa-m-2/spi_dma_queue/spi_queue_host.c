@@ -0,0 +1,411 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks spi_queue.c on the host:
+ *
+ *	cc -o spi_queue_host spi_queue_host.c spi_queue.c
+ *	./spi_queue_host
+ *
+ * A mock of the two DMA channels and the SPI runs every phase spi_queue
+ * programs, word by word, against a slave that answers with a counter,
+ * and logs what happened on the bus. Random transactions, with every
+ * mix of lengths, missing buffers, chip selects and frame sizes, are
+ * queued a few at a time and from done callbacks, and each one has to
+ * clock the right number of words under its own chip select, send its
+ * data then dummies, and fill exactly rx_len words of its buffer with
+ * what the slave said.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spi_queue.h"
+
+#define MAX_LEN		24
+#define GUARD		0xa5
+#define NXFER		3000
+#define DEPTH		6
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+/******************************************************************************
+ * DMA and SPI
+ *****************************************************************************/
+
+struct channel {
+	uint8_t *buf;
+	bool inc;
+	uint16_t len;
+	bool word16;
+};
+
+struct job;
+
+static struct {
+	struct channel rx, tx;
+	bool dff16;
+	bool running;		/* a phase is on the bus */
+	int locked;
+	uint32_t cs_port;	/* selected, 0 if none */
+	uint16_t cs_pin;
+	int cs_low;
+	uint32_t released_port;	/* last chip select released */
+	uint16_t released_pin;
+	uint16_t miso;		/* the slave's counter */
+} bus;
+
+/* Submitted transactions in order, that is the order they must run */
+static struct job *order[NXFER * 4];
+static int order_head, order_tail;
+
+static struct job *on_bus(void);
+
+static void m_cs(uint32_t port, uint16_t pin, bool active)
+{
+	check(!bus.running, "cs during a phase", port, pin);
+	if (active) {
+		check(bus.cs_low == 0, "two chip selects", port, pin);
+		bus.cs_low++;
+		bus.cs_port = port;
+		bus.cs_pin = pin;
+	} else {
+		check((bus.cs_port == port) && (bus.cs_pin == pin),
+		      "wrong chip select released", port, pin);
+		bus.cs_low--;
+		bus.released_port = port;
+		bus.released_pin = pin;
+	}
+}
+
+static void m_frame(bool word16)
+{
+	check(!bus.running, "frame change during a phase", word16, 0);
+	bus.dff16 = word16;
+}
+
+static void m_rx(void *buf, bool inc, uint16_t len, bool word16)
+{
+	check(!bus.running, "rx set up while running", 0, 0);
+	bus.rx.buf = buf;
+	bus.rx.inc = inc;
+	bus.rx.len = len;
+	bus.rx.word16 = word16;
+}
+
+static void m_tx(const void *buf, bool inc, uint16_t len, bool word16)
+{
+	check(!bus.running, "tx set up while running", 0, 0);
+	bus.tx.buf = (uint8_t *)buf;
+	bus.tx.inc = inc;
+	bus.tx.len = len;
+	bus.tx.word16 = word16;
+}
+
+static uint16_t load(const struct channel *c, int i)
+{
+	const uint8_t *p = c->buf + (c->inc ? i * (c->word16 ? 2 : 1) : 0);
+
+	return c->word16 ? *(const uint16_t *)p : *p;
+}
+
+static void store(struct channel *c, int i, uint16_t w)
+{
+	uint8_t *p = c->buf + (c->inc ? i * (c->word16 ? 2 : 1) : 0);
+
+	if (c->word16) {
+		*(uint16_t *)p = w;
+	} else {
+		*p = w;
+	}
+}
+
+static void log_word(struct job *j, uint16_t mosi);
+
+/* Both channels are set up, clock the whole phase */
+static void m_go(void)
+{
+	uint16_t mask = bus.dff16 ? 0xffff : 0xff;
+	int i;
+
+	check(!bus.running, "go while running", 0, 0);
+	check(bus.rx.len == bus.tx.len, "channel lengths", bus.rx.len,
+	      bus.tx.len);
+	check((bus.rx.word16 == bus.dff16) && (bus.tx.word16 == bus.dff16),
+	      "channel size vs DFF", bus.rx.word16, bus.dff16);
+	check(bus.rx.len != 0, "empty phase", 0, 0);
+	for (i = 0; i < bus.tx.len; i++) {
+		log_word(on_bus(), load(&bus.tx, i) & mask);
+		store(&bus.rx, i, bus.miso++ & mask);
+	}
+	bus.running = true;
+}
+
+static void m_lock(void)
+{
+	bus.locked++;
+}
+
+static void m_unlock(void)
+{
+	bus.locked--;
+}
+
+static const struct spi_queue_ops ops = {
+	.cs = m_cs,
+	.frame = m_frame,
+	.rx = m_rx,
+	.tx = m_tx,
+	.go = m_go,
+	.lock = m_lock,
+	.unlock = m_unlock,
+};
+
+/* The receive channel's transfer complete interrupt */
+static bool interrupt(void)
+{
+	if (!bus.running || bus.locked) {
+		return false;
+	}
+	bus.running = false;
+	spi_queue_rx_done();
+	return true;
+}
+
+/******************************************************************************
+ * Transactions
+ *****************************************************************************/
+
+struct job {
+	struct spi_xfer x;
+	uint16_t tx[MAX_LEN + 1];
+	uint16_t rx[MAX_LEN + 1];
+	uint16_t mosi[MAX_LEN * 2];	/* what went out on the bus */
+	int nlog;
+	uint16_t first_miso;	/* slave counter at the first word */
+	int resubmits;
+	bool queued;
+	bool cs;		/* chip select low at the first word */
+};
+
+static struct job jobs[DEPTH];
+static int completed, words;
+
+static int job_total(const struct job *j)
+{
+	return (j->x.tx_len > j->x.rx_len) ? j->x.tx_len : j->x.rx_len;
+}
+
+/*
+ * The next transaction starts before the done callback of the last one
+ * runs, so words belong to the oldest one that still misses some.
+ */
+static struct job *on_bus(void)
+{
+	int i;
+
+	for (i = order_head; i != order_tail; i++) {
+		if (order[i]->nlog < job_total(order[i])) {
+			return order[i];
+		}
+	}
+	check(0, "words without a transaction", 0, 0);
+	return NULL;
+}
+
+static void log_word(struct job *j, uint16_t mosi)
+{
+	if (j == NULL) {
+		return;
+	}
+	if (j->nlog == 0) {
+		j->first_miso = bus.miso;
+		j->cs = (j->x.cs_port == 0) || ((bus.cs_low == 1) &&
+			(bus.cs_port == j->x.cs_port) &&
+			(bus.cs_pin == j->x.cs_pin));
+	}
+	j->mosi[j->nlog++] = mosi;
+}
+
+static void submit(struct job *j)
+{
+	j->nlog = 0;
+	j->queued = true;
+	order[order_tail++] = j;
+	spi_queue_submit(&j->x);
+}
+
+static void job_done(struct spi_xfer *x);
+
+static void job_new(struct job *j)
+{
+	int i;
+
+	memset(j, 0, sizeof(*j));
+	j->x.word16 = rand() & 1;
+	j->x.tx_len = rand() % (MAX_LEN + 1);
+	j->x.rx_len = rand() % (MAX_LEN + 1);
+	if ((j->x.tx_len == 0) && (j->x.rx_len == 0)) {
+		j->x.rx_len = 1;
+	}
+	if (rand() % 4) {
+		j->x.cs_port = 0x40010800 + 0x400 * (rand() % 3);
+		j->x.cs_pin = 1 << (rand() % 16);
+	}
+	for (i = 0; i <= MAX_LEN; i++) {
+		j->tx[i] = rand();
+	}
+	memset(j->rx, GUARD, sizeof(j->rx));
+	j->x.tx_buf = (rand() % 8) ? j->tx : NULL;
+	j->x.rx_buf = (rand() % 8) ? j->rx : NULL;
+	j->x.done = job_done;
+	j->x.priv = j;
+	j->resubmits = rand() % 3;
+}
+
+/* Everything the transaction did, checked once it is done */
+static void job_check(struct job *j)
+{
+	const struct spi_xfer *x = &j->x;
+	uint16_t mask = x->word16 ? 0xffff : 0xff;
+	int total = (x->tx_len > x->rx_len) ? x->tx_len : x->rx_len;
+	const uint8_t *rx8 = (const uint8_t *)j->rx;
+	int i, bad = 0;
+
+	check(order[order_head] == j, "completion order", 0, 0);
+	order_head++;
+	check(j->nlog == total, "words clocked", j->nlog, total);
+	check(j->cs, "chip select", x->cs_port, x->cs_pin);
+	for (i = 0; (i < total) && (i < j->nlog); i++) {
+		uint16_t want = ((x->tx_buf != NULL) && (i < x->tx_len)) ?
+			(x->word16 ? j->tx[i] : ((uint8_t *)j->tx)[i]) :
+			0xffff;
+
+		bad += j->mosi[i] != (want & mask);
+	}
+	check(bad == 0, "mosi", bad, 0);
+
+	for (bad = 0, i = 0; i <= MAX_LEN; i++) {
+		bool filled = (x->rx_buf != NULL) && (i < x->rx_len);
+		uint16_t miso = (j->first_miso + i) & mask;
+
+		if (x->word16) {
+			bad += filled ? j->rx[i] != miso :
+					j->rx[i] != GUARD * 0x101;
+		} else {
+			bad += filled ? rx8[i] != miso : rx8[i] != GUARD;
+		}
+	}
+	check(bad == 0, "rx buffer", bad, 0);
+	/* the next one may have selected its device already */
+	if (x->cs_port != 0) {
+		check((bus.released_port == x->cs_port) &&
+		      (bus.released_pin == x->cs_pin), "cs released",
+		      bus.released_port, x->cs_port);
+		bus.released_port = 0;
+	}
+	words += total;
+}
+
+static void job_done(struct spi_xfer *x)
+{
+	struct job *j = x->priv;
+
+	job_check(j);
+	completed++;
+	j->queued = false;
+	if (j->resubmits != 0) {
+		j->resubmits--;
+		memset(j->rx, GUARD, sizeof(j->rx));
+		submit(j);
+	}
+}
+
+static void run(void)
+{
+	struct spi_queue_stats st;
+	int submitted = 0, i, n, spins;
+
+	spi_queue_init(&ops, false);
+	memset(&bus, 0, sizeof(bus));
+	memset(jobs, 0, sizeof(jobs));
+	order_head = order_tail = 0;
+	completed = words = 0;
+
+	while (submitted < NXFER) {
+		/* refill free slots, often with the bus running */
+		for (i = 0; i < DEPTH; i++) {
+			if (!jobs[i].queued && (submitted < NXFER) &&
+			    (rand() & 1)) {
+				job_new(&jobs[i]);
+				submitted++;
+				submit(&jobs[i]);
+			}
+		}
+		/* a few interrupts, or a few inside a locked section */
+		n = rand() % 6;
+		if (rand() % 4 == 0) {
+			m_lock();
+			for (i = 0; i < n; i++) {
+				check(!interrupt(), "interrupt while locked",
+				      0, 0);
+			}
+			m_unlock();
+		}
+		for (i = 0; i < n; i++) {
+			interrupt();
+		}
+	}
+	for (spins = 0; !spi_queue_idle() && (spins < 100000); spins++) {
+		interrupt();
+	}
+	check(spi_queue_idle(), "queue drains", spins, 0);
+	check(order_head == order_tail, "all done", order_head, order_tail);
+
+	spi_queue_get_stats(&st);
+	check(st.xfers == (uint32_t)completed, "stats xfers", st.xfers,
+	      completed);
+	check(st.words == (uint32_t)words, "stats words", st.words, words);
+	check(bus.locked == 0, "lock balance", bus.locked, 0);
+	check(completed >= NXFER, "completed", completed, NXFER);
+
+	/* nothing to clock, nothing queued */
+	jobs[0].x.tx_len = jobs[0].x.rx_len = 0;
+	spi_queue_submit(&jobs[0].x);
+	check(spi_queue_idle() && !bus.running, "empty transaction", 0, 0);
+}
+
+int main(void)
+{
+	srand(1);
+	run();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
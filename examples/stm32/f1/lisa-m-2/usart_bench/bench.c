@@ -0,0 +1,183 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Test loops and command line of usart_bench, with the hardware behind
+ * struct bench_ops and struct driver so usart_bench_host.c can run them
+ * against a model of the USART on a pty.
+ *
+ * Commands are lines of ASCII, always handled by the polled driver:
+ *	b<baud>	reply "ok", then switch to the new baud rate
+ *	d<p|i|d>	select polled, irq or dma driver
+ *	s<n>	stream n bytes (0, 1, 2, ... 255, 0, ...) to the host
+ *	e<n>	echo n bytes back to the host
+ * After a test the reply is "r <bytes> <cycles> <idle cycles>".
+ */
+
+#include <stdlib.h>
+
+#include "bench.h"
+
+static void idle(struct bench *b, struct bench_result *res)
+{
+	b->ops->idle();
+	res->idle += b->idle_cycles;
+}
+
+void bench_stream(struct bench *b, uint32_t n, struct bench_result *res)
+{
+	const struct driver *drv = b->drv;
+	uint8_t chunk[32];
+	uint32_t sent = 0, t0;
+	int i, len, put;
+
+	drv->start();
+	t0 = b->ops->cycles();
+	while (sent < n) {
+		len = (n - sent < sizeof(chunk)) ? n - sent : sizeof(chunk);
+		for (i = 0; i < len; i++) {
+			chunk[i] = (sent + i) & 0xff;
+		}
+		put = drv->write(chunk, len);
+		if (put == 0) {
+			idle(b, res);
+		}
+		sent += put;
+	}
+	while (!drv->tx_done()) {
+		idle(b, res);
+	}
+	res->cycles = b->ops->cycles() - t0;
+	res->bytes = sent;
+	drv->stop();
+}
+
+void bench_echo(struct bench *b, uint32_t n, struct bench_result *res)
+{
+	const struct driver *drv = b->drv;
+	uint32_t done = 0, t0;
+	uint8_t c;
+	int r;
+
+	drv->start();
+	t0 = b->ops->cycles();
+	while (done < n) {
+		r = drv->getc();
+		if (r < 0) {
+			idle(b, res);
+			continue;
+		}
+		c = r;
+		while (drv->write(&c, 1) == 0) {
+			idle(b, res);
+		}
+		done++;
+	}
+	while (!drv->tx_done()) {
+		idle(b, res);
+	}
+	res->cycles = b->ops->cycles() - t0;
+	res->bytes = done;
+	drv->stop();
+}
+
+static void puts2(struct bench *b, const char *s)
+{
+	while (*s != '\0') {
+		b->ops->send(*s++);
+	}
+}
+
+static void putu2(struct bench *b, uint32_t n)
+{
+	char buf[11];
+	int i = 0;
+
+	do {
+		buf[i++] = (n % 10) + '0';
+		n /= 10;
+	} while (n != 0);
+	while (i > 0) {
+		b->ops->send(buf[--i]);
+	}
+}
+
+static int gets2(struct bench *b, char *s, int len)
+{
+	int i = 0;
+	char c;
+
+	while ((c = b->ops->recv()) != '\n') {
+		if ((c != '\r') && (i < len - 1)) {
+			s[i++] = c;
+		}
+	}
+	s[i] = '\0';
+	return i;
+}
+
+/*
+ * bench_command
+ *
+ * Wait for one command line and run it.
+ */
+void bench_command(struct bench *b)
+{
+	struct bench_result res;
+	char line[32];
+	uint32_t arg;
+
+	if (gets2(b, line, sizeof(line)) == 0) {
+		return;
+	}
+	arg = strtoul(&line[1], NULL, 10);
+	res.bytes = res.cycles = res.idle = 0;
+
+	switch (line[0]) {
+	case 'b':
+		puts2(b, "ok\r\n");
+		b->ops->set_baud(arg);
+		return;
+	case 'd':
+		if (line[1] == 'i') {
+			b->drv = &b->drivers[1];
+		} else if (line[1] == 'd') {
+			b->drv = &b->drivers[2];
+		} else {
+			b->drv = &b->drivers[0];
+		}
+		puts2(b, "ok\r\n");
+		return;
+	case 's':
+		bench_stream(b, arg, &res);
+		break;
+	case 'e':
+		bench_echo(b, arg, &res);
+		break;
+	default:
+		puts2(b, "?\r\n");
+		return;
+	}
+
+	puts2(b, "r ");
+	putu2(b, res.bytes);
+	puts2(b, " ");
+	putu2(b, res.cycles);
+	puts2(b, " ");
+	putu2(b, res.idle);
+	puts2(b, "\r\n");
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct driver {
+	void (*start)(void);
+	void (*stop)(void);
+	int (*getc)(void);				/* -1 if none */
+	int (*write)(const uint8_t *buf, int len);	/* bytes taken */
+	bool (*tx_done)(void);
+};
+
+/* What the test loops and the command line need from the target */
+struct bench_ops {
+	uint32_t (*cycles)(void);	/* free running cycle counter */
+	void (*idle)(void);		/* one idle_spin() */
+	int (*recv)(void);		/* polled, waits for a byte */
+	void (*send)(uint8_t c);	/* polled, waits for room */
+	void (*set_baud)(uint32_t baud);	/* once the reply is out */
+};
+
+struct bench {
+	const struct bench_ops *ops;
+	const struct driver *drivers;	/* polled, irq, dma */
+	const struct driver *drv;	/* selected driver */
+	uint32_t idle_cycles;		/* one ops->idle() */
+};
+
+struct bench_result {
+	uint32_t bytes;
+	uint32_t cycles;
+	uint32_t idle;
+};
+
+void bench_stream(struct bench *b, uint32_t n, struct bench_result *res);
+void bench_echo(struct bench *b, uint32_t n, struct bench_result *res);
+void bench_command(struct bench *b);
+
+#endif
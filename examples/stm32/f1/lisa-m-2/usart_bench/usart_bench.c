@@ -0,0 +1,297 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * USART2 benchmark target, driven by usart_bench.py on the host.
+ *
+ * The same stream and echo tests run on top of three drivers: polled
+ * (what the usart example does), interrupt driven rings (usart_irq) and
+ * DMA (usart_dma). While a test runs, whenever the test loop has
+ * nothing to do it calls idle_spin(), a loop of known length in cycles.
+ * Comparing the cycles spent spinning to the total cycles of the test,
+ * both from the DWT cycle counter, gives the fraction of the CPU the
+ * driver left free.
+ *
+ * The test loops and the command line are in bench.c, the drivers in
+ * usart_drv.c, this file has the hardware they go through.
+ */
+
+#include <stdbool.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/cortex.h>
+
+#include "bench.h"
+#include "usart_drv.h"
+
+/* Iterations of one idle_spin() call */
+#define IDLE_SPIN	16
+
+/*
+ * idle_spin
+ *
+ * Burn a fixed number of cycles, the volatile counter keeps the compiler
+ * from throwing the loop away.
+ */
+static void idle_spin(void)
+{
+	volatile int i;
+
+	for (i = 0; i < IDLE_SPIN; i++);
+}
+
+/*
+ * Measure idle_spin() with interrupts off, so it is known how many
+ * cycles one call takes when nothing interrupts it.
+ */
+static uint32_t idle_calibrate(void)
+{
+	uint32_t t0, cycles;
+
+	cm_disable_interrupts();
+	t0 = dwt_read_cycle_counter();
+	idle_spin();
+	cycles = dwt_read_cycle_counter() - t0;
+	cm_enable_interrupts();
+	return cycles;
+}
+
+/******************************************************************************
+ * What usart_drv.c needs from USART2 and DMA1
+ *****************************************************************************/
+
+static bool u2_rx_ready(void)
+{
+	return (USART_SR(USART2) & USART_SR_RXNE) != 0;
+}
+
+static bool u2_tx_empty(void)
+{
+	return (USART_SR(USART2) & USART_SR_TXE) != 0;
+}
+
+static bool u2_tx_complete(void)
+{
+	return (USART_SR(USART2) & USART_SR_TC) != 0;
+}
+
+static uint8_t u2_recv(void)
+{
+	return usart_recv(USART2);
+}
+
+static void u2_send(uint8_t c)
+{
+	usart_send(USART2, c);
+}
+
+static void u2_rx_irq(bool on)
+{
+	if (on) {
+		usart_enable_rx_interrupt(USART2);
+	} else {
+		usart_disable_rx_interrupt(USART2);
+	}
+}
+
+static void u2_tx_irq(bool on)
+{
+	if (on) {
+		usart_enable_tx_interrupt(USART2);
+	} else {
+		usart_disable_tx_interrupt(USART2);
+	}
+}
+
+static bool u2_tx_irq_on(void)
+{
+	return (USART_CR1(USART2) & USART_CR1_TXEIE) != 0;
+}
+
+static void dma_channels_start(uint8_t *rx, uint32_t rx_len)
+{
+	dma_channel_reset(DMA1, DMA_CHANNEL7);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL7, (uint32_t)&USART2_DR);
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL7);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL7);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL7, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL7, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL7, DMA_CCR_PL_HIGH);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL7);
+
+	dma_channel_reset(DMA1, DMA_CHANNEL6);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL6, (uint32_t)&USART2_DR);
+	dma_set_memory_address(DMA1, DMA_CHANNEL6, (uint32_t)rx);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL6, rx_len);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL6);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL6);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL6);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL6, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL6, DMA_CCR_MSIZE_8BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL6, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_channel(DMA1, DMA_CHANNEL6);
+
+	usart_enable_rx_dma(USART2);
+	usart_enable_tx_dma(USART2);
+}
+
+static void dma_channels_stop(void)
+{
+	usart_disable_rx_dma(USART2);
+	usart_disable_tx_dma(USART2);
+	dma_disable_channel(DMA1, DMA_CHANNEL6);
+	dma_disable_channel(DMA1, DMA_CHANNEL7);
+}
+
+static void dma_send(const uint8_t *buf, uint32_t len)
+{
+	dma_disable_channel(DMA1, DMA_CHANNEL7);
+	dma_set_memory_address(DMA1, DMA_CHANNEL7, (uint32_t)buf);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL7, len);
+	dma_enable_channel(DMA1, DMA_CHANNEL7);
+}
+
+static uint32_t dma_rx_left(void)
+{
+	return DMA_CNDTR(DMA1, DMA_CHANNEL6);
+}
+
+static void dma_tx_lock(bool lock)
+{
+	if (lock) {
+		nvic_disable_irq(NVIC_DMA1_CHANNEL7_IRQ);
+	} else {
+		nvic_enable_irq(NVIC_DMA1_CHANNEL7_IRQ);
+	}
+}
+
+static const struct usart_drv_ops drv_ops = {
+	u2_rx_ready, u2_tx_empty, u2_tx_complete, u2_recv, u2_send,
+	u2_rx_irq, u2_tx_irq, u2_tx_irq_on, dma_channels_start,
+	dma_channels_stop, dma_send, dma_rx_left, dma_tx_lock
+};
+
+void usart2_isr(void)
+{
+	usart_drv_isr();
+}
+
+void dma1_channel7_isr(void)
+{
+	if ((DMA1_ISR & DMA_ISR_TCIF7) != 0) {
+		DMA1_IFCR |= DMA_IFCR_CTCIF7;
+		usart_drv_dma_tx_isr();
+	}
+}
+
+/******************************************************************************
+ * Command line, always polled
+ *****************************************************************************/
+
+static uint32_t cycles(void)
+{
+	return dwt_read_cycle_counter();
+}
+
+static int recv_polled(void)
+{
+	int c = usart_recv_blocking(USART2);
+
+	if (c == '\n') {
+		gpio_toggle(GPIOA, GPIO8);
+	}
+	return c;
+}
+
+static void send_polled(uint8_t c)
+{
+	usart_send_blocking(USART2, c);
+}
+
+static void set_baud(uint32_t baud)
+{
+	while (!u2_tx_complete());
+	usart_disable(USART2);
+	usart_set_baudrate(USART2, baud);
+	usart_enable(USART2);
+}
+
+static const struct bench_ops ops = {
+	cycles, idle_spin, recv_polled, send_polled, set_baud
+};
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_12mhz_out_72mhz();
+
+	/* Enable GPIOA clock (for LED and USART2 GPIOs). */
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_USART2);
+
+	/* Enable DMA1 clock */
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	dwt_enable_cycle_counter();
+}
+
+static void usart_setup(uint32_t baud)
+{
+	gpio_set_mode(GPIO_BANK_USART2_TX, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+	gpio_set_mode(GPIO_BANK_USART2_RX, GPIO_MODE_INPUT,
+		      GPIO_CNF_INPUT_FLOAT, GPIO_USART2_RX);
+
+	usart_set_baudrate(USART2, baud);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+	usart_set_mode(USART2, USART_MODE_TX_RX);
+	usart_enable(USART2);
+
+	nvic_enable_irq(NVIC_USART2_IRQ);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL7_IRQ);
+}
+
+static void gpio_setup(void)
+{
+	/* Set GPIO8 (in GPIO port A) to 'output push-pull'. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_2_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO8);
+}
+
+int main(void)
+{
+	struct bench b = { &ops, usart_drivers, &usart_drivers[0], 0 };
+
+	clock_setup();
+	gpio_setup();
+	usart_setup(115200);
+	usart_drv_init(&drv_ops);
+	b.idle_cycles = idle_calibrate();
+
+	while (1) {
+		bench_command(&b);
+	}
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+#! /usr/bin/env python
+#
+# This file is part of the libopencm3 project.
+#
+# This library is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this library.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+# Host side of the usart_bench example. For every baud rate and driver it
+# runs a stream test, a bulk echo test and a single byte round trip test,
+# then prints one line of results per combination.
+#
+# usage: usart_bench.py [-p port] [-b baud,baud,...] [-n bytes] [-r trips]
+
+import optparse
+import threading
+import time
+
+import serial
+
+CPU_HZ = 72000000
+DRIVERS = [('p', 'polled'), ('i', 'irq'), ('d', 'dma')]
+
+def command(ser, cmd):
+    ser.reset_input_buffer()
+    ser.write((cmd + '\n').encode())
+    # Give the target time to get its driver going before data follows.
+    time.sleep(0.01)
+
+def result(ser):
+    line = ser.readline().decode().split()
+    if len(line) != 4 or line[0] != 'r':
+        raise IOError('bad reply %r' % line)
+    nbytes, cycles, idle = [int(x) for x in line[1:]]
+    return nbytes, cycles, float(idle) / cycles
+
+def set_baud(ser, baud):
+    command(ser, 'b%d' % baud)
+    if ser.readline().strip() != b'ok':
+        raise IOError('target did not accept baud rate %d' % baud)
+    ser.baudrate = baud
+    time.sleep(0.01)
+
+def stream(ser, n):
+    command(ser, 's%d' % n)
+    t0 = time.time()
+    data = ser.read(n)
+    dt = time.time() - t0
+    expect = bytes(bytearray(i & 0xff for i in range(n)))
+    errors = sum(1 for a, b in zip(data, expect) if a != b)
+    errors += n - len(data)
+    nbytes, cycles, idle = result(ser)
+    return n / dt, float(nbytes) * CPU_HZ / cycles, idle, errors
+
+def echo(ser, n):
+    payload = bytes(bytearray((i * 7) & 0xff for i in range(n)))
+    command(ser, 'e%d' % n)
+    writer = threading.Thread(target=ser.write, args=(payload,))
+    t0 = time.time()
+    writer.start()
+    data = ser.read(n)
+    dt = time.time() - t0
+    writer.join()
+    errors = sum(1 for a, b in zip(data, payload) if a != b)
+    errors += n - len(data)
+    nbytes, cycles, idle = result(ser)
+    return n / dt, idle, errors
+
+def round_trips(ser, n):
+    command(ser, 'e%d' % n)
+    rtt = []
+    for i in range(n):
+        t0 = time.time()
+        ser.write(b'x')
+        if ser.read(1) != b'x':
+            raise IOError('round trip %d lost' % i)
+        rtt.append(time.time() - t0)
+    result(ser)
+    rtt.sort()
+    return [rtt[int(p * (n - 1))] * 1e6 for p in (0.5, 0.9, 0.99, 1.0)]
+
+def main():
+    parser = optparse.OptionParser()
+    parser.add_option('-p', '--port', default='/dev/ttyUSB0')
+    parser.add_option('-b', '--bauds', default='9600,115200,460800,921600')
+    parser.add_option('-n', '--bytes', type='int', default=16384)
+    parser.add_option('-r', '--trips', type='int', default=200)
+    opts, args = parser.parse_args()
+
+    ser = serial.Serial(opts.port, 115200, timeout=2)
+
+    print('%8s %6s | %9s %9s %5s | %9s %5s | %7s %7s %7s %7s | %s' % (
+        'baud', 'driver', 'stream/s', 'target/s', 'idle',
+        'echo/s', 'idle', 'p50 us', 'p90 us', 'p99 us', 'max us',
+        'errors'))
+    for baud in [int(b) for b in opts.bauds.split(',')]:
+        set_baud(ser, baud)
+        for key, name in DRIVERS:
+            command(ser, 'd' + key)
+            ser.readline()
+            s_rate, s_target, s_idle, s_err = stream(ser, opts.bytes)
+            e_rate, e_idle, e_err = echo(ser, opts.bytes)
+            lat = round_trips(ser, opts.trips)
+            print('%8d %6s | %9.0f %9.0f %4.0f%% | %9.0f %4.0f%% | '
+                  '%7.0f %7.0f %7.0f %7.0f | %d' % (
+                      baud, name, s_rate, s_target, s_idle * 100,
+                      e_rate, e_idle * 100, lat[0], lat[1], lat[2], lat[3],
+                      s_err + e_err))
+    set_baud(ser, 115200)
+    ser.close()
+
+if __name__ == '__main__':
+    main()
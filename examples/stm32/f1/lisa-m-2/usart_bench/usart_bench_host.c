@@ -0,0 +1,732 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs bench.c and the drivers in usart_drv.c on the host, against a
+ * model of USART2 and its two DMA channels on a pty:
+ *
+ *	cc -o usart_bench_host usart_bench_host.c bench.c usart_drv.c -lpthread
+ *	./usart_bench_host
+ *	./usart_bench_host -p
+ *
+ * Without arguments it checks itself: a second thread plays
+ * usart_bench.py on the other side of the pty, running every test on
+ * every driver at two baud rates, and checks the data, the byte counts
+ * and that the cycles and idle fractions come out where the model says
+ * they should. With -p it prints the name of the pty and serves it, so
+ * usart_bench.py itself can be pointed at it:
+ *
+ *	./usart_bench.py -p /dev/pts/N -b 115200,921600
+ *
+ * The model keeps its own 72MHz cycle count and works at register
+ * level: RXNE, TXE, TC and the two interrupt enables of USART2, channel
+ * 6 filling the receive ring in circular mode and channel 7 feeding the
+ * holding register, with its transfer complete interrupt. A byte takes
+ * ten bit times on the line, the transmitter has one holding register in
+ * front of the shift register, and a byte that comes in before DR was
+ * read overruns. Every register access costs REG_CYCLES, every
+ * interrupt IRQ_CYCLES or DMA_IRQ_CYCLES on top. Writing DR without TXE
+ * and setting up channel 7 while it is busy are counted as errors. Time
+ * the target spends waiting for the host with nothing else to do is not
+ * counted, so round trips measure the target and the line, not the
+ * scheduler of the PC.
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "usart_drv.h"
+
+#define CPU_HZ		72000000
+#define IDLE_CYCLES	100	/* one idle_spin() */
+#define CALL_CYCLES	20	/* one driver call, per byte */
+#define REG_CYCLES	2	/* one register access */
+#define IRQ_CYCLES	60	/* into and out of usart2_isr() */
+#define DMA_IRQ_CYCLES	80	/* into and out of dma1_channel7_isr() */
+
+#define LINE		4096	/* bytes read from the pty, not yet in */
+
+static int fd;			/* the target's end of the pty */
+static uint64_t now;		/* target cycles */
+static uint32_t byte_cycles;	/* ten bits at the current baud rate */
+static uint64_t next_pull;
+
+/* Received bytes, stamped with the time their stop bit is in */
+static uint8_t rx_data[LINE];
+static uint64_t rx_at[LINE];
+static uint64_t rx_last;
+static uint32_t rx_head;	/* read from the pty */
+static uint32_t rx_next;	/* next one into the USART */
+
+/* USART2 */
+static struct {
+	uint8_t rdr, tdr;
+	bool rxne, txe;
+	bool rxneie, txeie;
+	uint64_t line_free;	/* shift register empty */
+	bool dmar, dmat;
+	uint32_t overruns;	/* byte in before DR was read */
+	uint32_t clobbered;	/* DR written without TXE */
+} u;
+
+/* DMA1 channel 6 receiving in circular mode, channel 7 sending */
+static struct {
+	uint8_t *rx;
+	uint32_t rx_len, rx_left;
+	const uint8_t *tx;
+	uint32_t tx_left;
+	bool tcif7;
+	bool masked;		/* channel 7 interrupt off in the NVIC */
+	uint32_t restarted;	/* channel 7 set up while still busy */
+} dma;
+
+static bool in_isr;
+
+static void line_send(uint8_t c)
+{
+	if (write(fd, &c, 1) != 1) {
+		u.overruns++;
+	}
+}
+
+/* Move what the host has sent onto the modelled line. */
+static void pull(int wait)
+{
+	struct pollfd p = { fd, POLLIN, 0 };
+	uint8_t buf[64];
+	ssize_t n, i;
+	uint64_t at;
+
+	next_pull = now + byte_cycles;
+	if (LINE - (rx_head - rx_next) < sizeof(buf)) {
+		return;
+	}
+	if (poll(&p, 1, wait ? -1 : 0) <= 0) {
+		return;
+	}
+	n = read(fd, buf, sizeof(buf));
+	if (n <= 0) {
+		/* nobody on the other end of the pty */
+		usleep(100000);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		at = rx_last + byte_cycles;
+		if (at < now) {
+			at = now;
+		}
+		rx_data[rx_head % LINE] = buf[i];
+		rx_at[rx_head % LINE] = at;
+		rx_head++;
+		rx_last = at;
+	}
+}
+
+/* A byte has its stop bit in */
+static void receive(uint8_t c)
+{
+	if (u.rxne) {
+		u.overruns++;
+		return;
+	}
+	u.rdr = c;
+	u.rxne = true;
+}
+
+static void run_isr(void (*isr)(void), uint32_t cost, uint64_t *end)
+{
+	uint64_t t0 = now;
+
+	in_isr = true;
+	now += cost;
+	isr();
+	in_isr = false;
+	*end += now - t0;
+}
+
+/*
+ * Let dt cycles of target code run, with the line, the DMA and the
+ * interrupts that fall into them. Interrupts push the end out by what
+ * they take.
+ */
+static void advance(uint32_t dt)
+{
+	uint64_t end = now + dt;
+	uint64_t rx, tx;
+
+	while (1) {
+		if (now >= next_pull) {
+			pull(0);
+		}
+
+		/* What happens at once */
+		if (u.rxne && u.dmar && (dma.rx != NULL)) {
+			dma.rx[dma.rx_len - dma.rx_left] = u.rdr;
+			u.rxne = false;
+			if (--dma.rx_left == 0) {
+				dma.rx_left = dma.rx_len;
+			}
+		}
+		if (u.txe && u.dmat && (dma.tx_left > 0)) {
+			u.tdr = *dma.tx++;
+			u.txe = false;
+			if (--dma.tx_left == 0) {
+				dma.tcif7 = true;
+			}
+		}
+		if (!u.txe && (u.line_free <= now)) {
+			line_send(u.tdr);
+			u.line_free = now + byte_cycles;
+			u.txe = true;
+			continue;
+		}
+		if (!in_isr && ((u.rxneie && u.rxne) || (u.txeie && u.txe))) {
+			run_isr(usart_drv_isr, IRQ_CYCLES, &end);
+			continue;
+		}
+		if (!in_isr && dma.tcif7 && !dma.masked) {
+			dma.tcif7 = false;
+			run_isr(usart_drv_dma_tx_isr, DMA_IRQ_CYCLES, &end);
+			continue;
+		}
+
+		/* And what comes later */
+		rx = (rx_next != rx_head) ? rx_at[rx_next % LINE] : UINT64_MAX;
+		tx = !u.txe ? u.line_free : UINT64_MAX;
+		if ((rx > end) && (tx > end)) {
+			break;
+		}
+		if (rx <= tx) {
+			if (rx > now) {
+				now = rx;
+			}
+			receive(rx_data[rx_next % LINE]);
+			rx_next++;
+		} else if (tx > now) {
+			now = tx;
+		}
+	}
+	now = end;
+}
+
+/* Nothing will happen on the line until the host sends something */
+static bool line_quiet(void)
+{
+	return (rx_next == rx_head) && !u.rxne && u.txe &&
+	       (dma.tx_left == 0) && !u.txeie && !dma.tcif7;
+}
+
+/******************************************************************************
+ * The registers, for usart_drv.c
+ *****************************************************************************/
+
+static bool rx_ready(void)
+{
+	advance(REG_CYCLES);
+	return u.rxne;
+}
+
+static bool tx_empty(void)
+{
+	advance(REG_CYCLES);
+	return u.txe;
+}
+
+static bool tx_complete(void)
+{
+	advance(REG_CYCLES);
+	return u.txe && (u.line_free <= now);
+}
+
+static uint8_t recv(void)
+{
+	advance(REG_CYCLES);
+	u.rxne = false;
+	return u.rdr;
+}
+
+static void send(uint8_t c)
+{
+	advance(REG_CYCLES);
+	if (!u.txe) {
+		u.clobbered++;
+	}
+	u.tdr = c;
+	u.txe = false;
+}
+
+static void rx_irq(bool on)
+{
+	advance(REG_CYCLES);
+	u.rxneie = on;
+}
+
+static void tx_irq(bool on)
+{
+	advance(REG_CYCLES);
+	u.txeie = on;
+}
+
+static bool tx_irq_on(void)
+{
+	advance(REG_CYCLES);
+	return u.txeie;
+}
+
+static void dma_start(uint8_t *rx, uint32_t rx_len)
+{
+	advance(20 * REG_CYCLES);
+	dma.rx = rx;
+	dma.rx_len = dma.rx_left = rx_len;
+	dma.tx_left = 0;
+	dma.tcif7 = false;
+	u.dmar = u.dmat = true;
+}
+
+static void dma_stop(void)
+{
+	advance(4 * REG_CYCLES);
+	u.dmar = u.dmat = false;
+	dma.rx = NULL;
+	dma.tx_left = 0;
+}
+
+static void dma_tx(const uint8_t *buf, uint32_t len)
+{
+	advance(4 * REG_CYCLES);
+	if (dma.tx_left != 0) {
+		dma.restarted++;
+	}
+	dma.tx = buf;
+	dma.tx_left = len;
+}
+
+static uint32_t dma_rx_left(void)
+{
+	advance(REG_CYCLES);
+	return dma.rx_left;
+}
+
+static void dma_tx_lock(bool lock)
+{
+	advance(REG_CYCLES);
+	dma.masked = lock;
+}
+
+static const struct usart_drv_ops drv_ops = {
+	rx_ready, tx_empty, tx_complete, recv, send, rx_irq, tx_irq,
+	tx_irq_on, dma_start, dma_stop, dma_tx, dma_rx_left, dma_tx_lock
+};
+
+/******************************************************************************
+ * bench_ops, the command line on the polled USART
+ *****************************************************************************/
+
+static uint32_t cycles(void)
+{
+	return now;
+}
+
+static void idle(void)
+{
+	advance(IDLE_CYCLES);
+}
+
+static int recv_polled(void)
+{
+	while (!rx_ready()) {
+		if (line_quiet()) {
+			pull(1);
+		}
+	}
+	return recv();
+}
+
+static void send_polled(uint8_t c)
+{
+	while (!tx_empty());
+	send(c);
+}
+
+static void set_baud(uint32_t baud)
+{
+	while (!tx_complete());
+	if (baud != 0) {
+		byte_cycles = (uint64_t)CPU_HZ * 10 / baud;
+	}
+}
+
+static const struct bench_ops ops = {
+	cycles, idle, recv_polled, send_polled, set_baud
+};
+
+/******************************************************************************
+ * The drivers of usart_drv.c, with what a call costs. Time the target
+ * spends waiting for the host with nothing else to do is not counted.
+ *****************************************************************************/
+
+static const struct driver *drv = &usart_drivers[0];
+
+static void polled_start(void)
+{
+	drv = &usart_drivers[0];
+	drv->start();
+}
+
+static void irq_start(void)
+{
+	drv = &usart_drivers[1];
+	drv->start();
+}
+
+static void dma_start_drv(void)
+{
+	drv = &usart_drivers[2];
+	drv->start();
+}
+
+static void stop(void)
+{
+	drv->stop();
+}
+
+static int drv_getc(void)
+{
+	int c;
+
+	advance(CALL_CYCLES);
+	c = drv->getc();
+	if ((c < 0) && line_quiet()) {
+		pull(1);
+	}
+	return c;
+}
+
+static int drv_write(const uint8_t *buf, int len)
+{
+	int n = drv->write(buf, len);
+
+	advance(CALL_CYCLES * (n + 1));
+	return n;
+}
+
+static bool drv_tx_done(void)
+{
+	return drv->tx_done();
+}
+
+static const struct driver drivers[] = {
+	{ polled_start, stop, drv_getc, drv_write, drv_tx_done },
+	{ irq_start, stop, drv_getc, drv_write, drv_tx_done },
+	{ dma_start_drv, stop, drv_getc, drv_write, drv_tx_done },
+};
+
+static struct bench bench = { &ops, drivers, &drivers[0], IDLE_CYCLES };
+
+static void *target(void *arg)
+{
+	(void)arg;
+	while (1) {
+		bench_command(&bench);
+	}
+	return NULL;
+}
+
+/******************************************************************************
+ * The host side, what usart_bench.py does
+ *****************************************************************************/
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static int host;
+
+static int host_read(uint8_t *buf, int len)
+{
+	struct pollfd p = { host, POLLIN, 0 };
+	int got = 0, n;
+
+	while (got < len) {
+		if (poll(&p, 1, 5000) <= 0) {
+			break;
+		}
+		n = read(host, buf + got, len - got);
+		if (n <= 0) {
+			break;
+		}
+		got += n;
+	}
+	return got;
+}
+
+static void host_line(char *line, int len)
+{
+	int i = 0;
+	uint8_t c;
+
+	while ((i < len - 1) && (host_read(&c, 1) == 1) && (c != '\n')) {
+		if (c != '\r') {
+			line[i++] = c;
+		}
+	}
+	line[i] = '\0';
+}
+
+static void host_send(const char *s)
+{
+	if (write(host, s, strlen(s)) != (ssize_t)strlen(s)) {
+		check(0, "host write", 0, 0);
+	}
+}
+
+static void host_ok(const char *cmd)
+{
+	char line[32];
+
+	host_send(cmd);
+	host_line(line, sizeof(line));
+	check(strcmp(line, "ok") == 0, "ok", line[0], 0);
+}
+
+static void host_result(uint32_t n, uint32_t *cycles, double *idle)
+{
+	char line[64];
+	unsigned long bytes, c, i;
+
+	host_line(line, sizeof(line));
+	if (sscanf(line, "r %lu %lu %lu", &bytes, &c, &i) != 3) {
+		check(0, "result line", line[0], 0);
+		*cycles = 1;
+		*idle = 0;
+		return;
+	}
+	check(bytes == n, "result bytes", bytes, n);
+	*cycles = c;
+	*idle = (double)i / c;
+}
+
+/* Within 2% of n bytes on the line, plus the last one shifting out */
+static void check_cycles(const char *what, uint32_t cycles, uint32_t n,
+			 uint32_t baud)
+{
+	uint64_t line = (uint64_t)CPU_HZ * 10 / baud * n;
+
+	check((cycles > line * 98 / 100) && (cycles < line * 102 / 100 +
+	      CPU_HZ * 10 / baud), what, cycles, line);
+}
+
+static void host_stream(uint32_t n, uint32_t baud, double *idle)
+{
+	uint8_t *data = malloc(n);
+	char cmd[32];
+	uint32_t i, bad = 0, cycles;
+
+	snprintf(cmd, sizeof(cmd), "s%u\n", n);
+	host_send(cmd);
+	check(host_read(data, n) == (int)n, "stream length", n, 0);
+	for (i = 0; i < n; i++) {
+		bad += data[i] != (i & 0xff);
+	}
+	check(bad == 0, "stream data", bad, 0);
+	host_result(n, &cycles, idle);
+	check_cycles("stream cycles", cycles, n, baud);
+	free(data);
+}
+
+static void host_echo(uint32_t n, uint32_t baud, double *idle)
+{
+	uint8_t *out = malloc(n), *in = malloc(n);
+	char cmd[32];
+	uint32_t i, cycles;
+
+	for (i = 0; i < n; i++) {
+		out[i] = i * 7;
+	}
+	snprintf(cmd, sizeof(cmd), "e%u\n", n);
+	host_send(cmd);
+	if (write(host, out, n) != (ssize_t)n) {
+		check(0, "echo write", 0, 0);
+	}
+	check(host_read(in, n) == (int)n, "echo length", n, 0);
+	check(memcmp(in, out, n) == 0, "echo data", 0, 0);
+	host_result(n, &cycles, idle);
+	check_cycles("echo cycles", cycles, n, baud);
+	free(out);
+	free(in);
+}
+
+/* One byte at a time, the host waits for each one to come back */
+static void host_round_trips(int n)
+{
+	uint8_t c;
+	uint32_t cycles;
+	double idle;
+	char cmd[32];
+	int i, ok = 0;
+
+	snprintf(cmd, sizeof(cmd), "e%d\n", n);
+	host_send(cmd);
+	for (i = 0; i < n; i++) {
+		host_send("x");
+		ok += (host_read(&c, 1) == 1) && (c == 'x');
+	}
+	check(ok == n, "round trips", ok, n);
+	host_result(n, &cycles, &idle);
+}
+
+/*
+ * Writes of odd sizes straight into a driver, so the transmit ring wraps
+ * in the middle of what is queued; bench_stream() only writes 32 bytes
+ * at a time. Runs before the target thread starts.
+ */
+static void check_odd_writes(const struct driver *d, const char *what)
+{
+	uint8_t out[1500], in[sizeof(out)];
+	uint32_t i, n, sent = 0, len = 1;
+
+	for (i = 0; i < sizeof(out); i++) {
+		/* not periodic in the ring size, overwrites show */
+		out[i] = i * 13 + i / 251;
+	}
+	set_baud(921600);
+	d->start();
+	while (sent < sizeof(out)) {
+		n = (sizeof(out) - sent < len) ? sizeof(out) - sent : len;
+		sent += d->write(&out[sent], n);
+		len = len % 37 + 3;
+	}
+	while (!d->tx_done()) {
+		idle();
+	}
+	d->stop();
+	set_baud(115200);
+	check(host_read(in, sizeof(in)) == sizeof(in), what, sizeof(in), 0);
+	check(memcmp(in, out, sizeof(out)) == 0, what, 0, 0);
+}
+
+static void run_checks(void)
+{
+	static const uint32_t bauds[] = { 115200, 921600 };
+	static const char *const keys[] = { "dp\n", "di\n", "dd\n" };
+	/* a test loop pass that finds nothing to do: a call, then a spin */
+	const double spin = (double)IDLE_CYCLES / (IDLE_CYCLES + CALL_CYCLES);
+	double stream_idle[3], echo_idle[3], irq;
+	char line[32];
+	unsigned b, d;
+
+	/* empty lines are ignored, unknown commands answered */
+	host_send("\r\n\nx\n");
+	host_line(line, sizeof(line));
+	check(strcmp(line, "?") == 0, "unknown command", line[0], 0);
+
+	for (b = 0; b < 2; b++) {
+		char cmd[32];
+
+		snprintf(cmd, sizeof(cmd), "b%u\n", bauds[b]);
+		host_ok(cmd);
+		for (d = 0; d < 3; d++) {
+			host_ok(keys[d]);
+			host_stream(4000, bauds[b], &stream_idle[d]);
+			host_echo(1000, bauds[b], &echo_idle[d]);
+			host_round_trips(20);
+		}
+
+		/*
+		 * Polled leaves nothing while streaming, DMA all of it,
+		 * and the interrupt driver pays for every byte.
+		 */
+		irq = spin * (1 - (double)IRQ_CYCLES * bauds[b] / CPU_HZ /
+			      10);
+		check(stream_idle[0] < 0.01, "polled stream idle",
+		      stream_idle[0] * 1000, 0);
+		check(stream_idle[1] > irq * 0.9, "irq stream idle",
+		      stream_idle[1] * 1000, irq * 1000);
+		check(stream_idle[2] > spin * 0.9, "dma stream idle",
+		      stream_idle[2] * 1000, spin * 1000);
+		check(stream_idle[1] < stream_idle[2], "irq below dma",
+		      stream_idle[1] * 1000, stream_idle[2] * 1000);
+		check(echo_idle[1] < echo_idle[2], "irq echo below dma",
+		      echo_idle[1] * 1000, echo_idle[2] * 1000);
+		printf("%7u baud idle: stream %.3f %.3f %.3f, "
+		       "echo %.3f %.3f %.3f\n", bauds[b],
+		       stream_idle[0], stream_idle[1], stream_idle[2],
+		       echo_idle[0], echo_idle[1], echo_idle[2]);
+	}
+	check(u.overruns == 0, "overruns", u.overruns, 0);
+	check(u.clobbered == 0 && dma.restarted == 0, "registers",
+	      u.clobbered, dma.restarted);
+}
+
+int main(int argc, char **argv)
+{
+	struct termios t;
+	pthread_t thread;
+	int slave;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0)) {
+		perror("pty");
+		return 2;
+	}
+	/* keep the slave open, the pty goes away with its last user */
+	slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror(ptsname(fd));
+		return 2;
+	}
+	tcgetattr(slave, &t);
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+	usart_drv_init(&drv_ops);
+	u.txe = true;
+	set_baud(115200);
+
+	if ((argc > 1) && (strcmp(argv[1], "-p") == 0)) {
+		printf("%s\n", ptsname(fd));
+		fflush(stdout);
+		target(NULL);
+	}
+
+	host = slave;
+	check_odd_writes(&drivers[1], "irq odd writes");
+	check_odd_writes(&drivers[2], "dma odd writes");
+	pthread_create(&thread, NULL, target, NULL);
+	run_checks();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The three USART2 drivers usart_bench compares, without any hardware
+ * access: registers go through struct usart_drv_ops, so the same code
+ * runs against the model in usart_bench_host.c.
+ */
+
+#include "usart_drv.h"
+
+/* Sizes must be powers of two */
+#define TX_SIZE		256
+#define RX_SIZE		256
+
+static const struct usart_drv_ops *ops;
+
+static uint8_t tx_buf[TX_SIZE];
+static volatile uint32_t tx_head, tx_tail;
+static uint8_t rx_buf[RX_SIZE];
+static volatile uint32_t rx_head, rx_tail;
+
+/* DMA transmit in progress, and its length */
+static volatile uint32_t tx_dma_len;
+
+void usart_drv_init(const struct usart_drv_ops *o)
+{
+	ops = o;
+}
+
+/******************************************************************************
+ * Polled driver, waits for every byte
+ *****************************************************************************/
+
+static void polled_start(void)
+{
+}
+
+static void polled_stop(void)
+{
+}
+
+static int polled_getc(void)
+{
+	if (!ops->rx_ready()) {
+		return -1;
+	}
+	return ops->recv();
+}
+
+static int polled_write(const uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		while (!ops->tx_empty());
+		ops->send(buf[i]);
+	}
+	return len;
+}
+
+static bool polled_tx_done(void)
+{
+	return ops->tx_complete();
+}
+
+/******************************************************************************
+ * Interrupt driven ring buffers
+ *****************************************************************************/
+
+static bool irq_mode;
+
+/*
+ * usart_drv_isr
+ *
+ * The USART2 interrupt, for the irq driver. The others leave it off.
+ */
+void usart_drv_isr(void)
+{
+	if (!irq_mode) {
+		return;
+	}
+
+	if (ops->rx_ready()) {
+		uint8_t c = ops->recv();
+
+		if (rx_head - rx_tail < RX_SIZE) {
+			rx_buf[rx_head % RX_SIZE] = c;
+			rx_head++;
+		}
+	}
+
+	if (ops->tx_irq_on() && ops->tx_empty()) {
+		if (tx_tail != tx_head) {
+			ops->send(tx_buf[tx_tail % TX_SIZE]);
+			tx_tail++;
+		} else {
+			ops->tx_irq(false);
+		}
+	}
+}
+
+static void irq_start(void)
+{
+	tx_head = tx_tail = rx_head = rx_tail = 0;
+	irq_mode = true;
+	ops->rx_irq(true);
+}
+
+static void irq_stop(void)
+{
+	ops->rx_irq(false);
+	ops->tx_irq(false);
+	irq_mode = false;
+}
+
+static int ring_getc(void)
+{
+	int c;
+
+	if (rx_head == rx_tail) {
+		return -1;
+	}
+	c = rx_buf[rx_tail % RX_SIZE];
+	rx_tail++;
+	return c;
+}
+
+static int ring_put(const uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; (i < len) && (tx_head - tx_tail < TX_SIZE); i++) {
+		tx_buf[tx_head % TX_SIZE] = buf[i];
+		tx_head++;
+	}
+	return i;
+}
+
+static int irq_write(const uint8_t *buf, int len)
+{
+	int n = ring_put(buf, len);
+
+	if (n != 0) {
+		ops->tx_irq(true);
+	}
+	return n;
+}
+
+static bool irq_tx_done(void)
+{
+	return (tx_head == tx_tail) && polled_tx_done();
+}
+
+/******************************************************************************
+ * DMA, channel 7 sends contiguous pieces of the transmit ring, channel 6
+ * receives into the receive ring in circular mode
+ *****************************************************************************/
+
+/* Start sending the next contiguous piece of the ring, if any. */
+static void dma_tx_kick(void)
+{
+	uint32_t len = tx_head - tx_tail;
+	uint32_t off = tx_tail % TX_SIZE;
+
+	if ((tx_dma_len != 0) || (len == 0)) {
+		return;
+	}
+	if (off + len > TX_SIZE) {
+		len = TX_SIZE - off;
+	}
+	tx_dma_len = len;
+	ops->dma_tx(&tx_buf[off], len);
+}
+
+/*
+ * usart_drv_dma_tx_isr
+ *
+ * Channel 7 transfer complete, with the flag already cleared.
+ */
+void usart_drv_dma_tx_isr(void)
+{
+	tx_tail += tx_dma_len;
+	tx_dma_len = 0;
+	dma_tx_kick();
+}
+
+static void dma_start(void)
+{
+	tx_head = tx_tail = rx_head = rx_tail = 0;
+	tx_dma_len = 0;
+	ops->dma_start(rx_buf, RX_SIZE);
+}
+
+static void dma_stop(void)
+{
+	ops->dma_stop();
+}
+
+static int dma_getc(void)
+{
+	/* The DMA write position follows from the remaining count. */
+	uint32_t pos = RX_SIZE - ops->dma_rx_left();
+	int c;
+
+	if ((rx_tail % RX_SIZE) == pos) {
+		return -1;
+	}
+	c = rx_buf[rx_tail % RX_SIZE];
+	rx_tail++;
+	return c;
+}
+
+static int dma_write(const uint8_t *buf, int len)
+{
+	int n = ring_put(buf, len);
+
+	/* A full ring has a transfer going, its end starts the next one. */
+	if (n == 0) {
+		return 0;
+	}
+	ops->dma_tx_lock(true);
+	dma_tx_kick();
+	ops->dma_tx_lock(false);
+	return n;
+}
+
+static bool dma_tx_done(void)
+{
+	return (tx_head == tx_tail) && polled_tx_done();
+}
+
+const struct driver usart_drivers[3] = {
+	{ polled_start, polled_stop, polled_getc, polled_write,
+	  polled_tx_done },
+	{ irq_start, irq_stop, ring_getc, irq_write, irq_tx_done },
+	{ dma_start, dma_stop, dma_getc, dma_write, dma_tx_done },
+};
@@ -0,0 +1,54 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef USART_DRV_H
+#define USART_DRV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bench.h"
+
+/*
+ * The USART2, DMA1 and NVIC accesses the drivers make, see usart_bench.c
+ * for the real ones. DMA channel 6 receives into a ring in circular
+ * mode, channel 7 sends one buffer at a time.
+ */
+struct usart_drv_ops {
+	bool (*rx_ready)(void);		/* RXNE */
+	bool (*tx_empty)(void);		/* TXE */
+	bool (*tx_complete)(void);	/* TC */
+	uint8_t (*recv)(void);		/* read DR */
+	void (*send)(uint8_t c);	/* write DR */
+	void (*rx_irq)(bool on);	/* RXNEIE */
+	void (*tx_irq)(bool on);	/* TXEIE */
+	bool (*tx_irq_on)(void);
+	void (*dma_start)(uint8_t *rx, uint32_t rx_len);
+	void (*dma_stop)(void);
+	void (*dma_tx)(const uint8_t *buf, uint32_t len);
+	uint32_t (*dma_rx_left)(void);	/* channel 6 CNDTR */
+	void (*dma_tx_lock)(bool lock);	/* keep usart_drv_dma_tx_isr() out */
+};
+
+/* Polled, irq and dma, for struct bench */
+extern const struct driver usart_drivers[3];
+
+void usart_drv_init(const struct usart_drv_ops *ops);
+void usart_drv_isr(void);
+void usart_drv_dma_tx_isr(void);
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Buffered CAN1, run from the bxCAN interrupts.
+ *
+ * Transmit: frames wait in a queue sorted by arbitration priority, and
+ * the mailbox empty interrupt moves the best ones into the three
+ * mailboxes. The hardware picks the mailbox with the lowest identifier,
+ * so two frames with the same identifier are never in the mailboxes at
+ * once, which keeps them in order. If something more urgent than all
+ * three mailboxes gets queued, the least urgent mailbox is aborted and
+ * its frame goes back into the queue.
+ *
+ * Receive: both FIFO interrupts drain their FIFO completely into one
+ * ring, which the main loop empties with can_buf_recv(). The two
+ * interrupts have the same priority, so the ring has a single producer
+ * and a single consumer and needs no locking.
+ *
+ * Only the libopencm3 CAN functions and a few CAN1 registers are used,
+ * so a model of those is enough to run this on the host: can_buf_host.c
+ * defines CAN_BUF_HOST and its model, then includes this file.
+ */
+
+#ifndef CAN_BUF_HOST
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/stm32/can.h>
+#endif
+
+#include "can_buf.h"
+
+#define MAILBOXES	3
+
+static struct can_frame txq[CAN_BUF_TX_LEN];	/* sorted, best first */
+static unsigned int txq_len;
+
+static struct can_frame mbox[MAILBOXES];	/* what each one holds */
+static bool mbox_busy[MAILBOXES];
+static bool mbox_abort[MAILBOXES];
+
+static struct can_frame rxq[CAN_BUF_RX_LEN];
+static volatile uint32_t rx_head, rx_tail;
+
+static struct can_buf_stats stats;
+static uint32_t last_esr;
+
+static const uint32_t tsr_rqcp[MAILBOXES] = {
+	CAN_TSR_RQCP0, CAN_TSR_RQCP1, CAN_TSR_RQCP2,
+};
+static const uint32_t tsr_txok[MAILBOXES] = {
+	CAN_TSR_TXOK0, CAN_TSR_TXOK1, CAN_TSR_TXOK2,
+};
+static const uint32_t tsr_abrq[MAILBOXES] = {
+	CAN_TSR_ABRQ0, CAN_TSR_ABRQ1, CAN_TSR_ABRQ2,
+};
+
+/*
+ * Lower wins arbitration. Standard identifiers line up with the top 11
+ * bits of extended ones, and on a tie a standard frame wins, as does a
+ * data frame over a remote frame.
+ */
+static uint32_t can_buf_key(const struct can_frame *f)
+{
+	uint32_t base = f->ext ? f->id : (f->id << 18);
+
+	return (base << 2) | (f->ext ? 2 : 0) | (f->rtr ? 1 : 0);
+}
+
+/*
+ * Start of frame to end of frame, plus the 3 bit intermission, before
+ * bit stuffing.
+ */
+uint32_t can_buf_frame_bits(const struct can_frame *f)
+{
+	uint32_t bits = f->ext ? 67 : 47;
+
+	if (!f->rtr) {
+		bits += 8 * f->dlc;
+	}
+	return bits;
+}
+
+/*
+ * Insert behind the frames of the same priority, or in front of them
+ * for a frame that was queued before them and is coming back from an
+ * aborted mailbox.
+ */
+static bool txq_insert(const struct can_frame *f, bool front)
+{
+	uint32_t key = can_buf_key(f);
+	unsigned int i;
+
+	if (txq_len == CAN_BUF_TX_LEN) {
+		return false;
+	}
+	for (i = txq_len; i > 0; i--) {
+		uint32_t k = can_buf_key(&txq[i - 1]);
+
+		if ((k < key) || (!front && (k == key))) {
+			break;
+		}
+		txq[i] = txq[i - 1];
+	}
+	txq[i] = *f;
+	txq_len++;
+	return true;
+}
+
+static void txq_pop(void)
+{
+	unsigned int i;
+
+	txq_len--;
+	for (i = 0; i < txq_len; i++) {
+		txq[i] = txq[i + 1];
+	}
+}
+
+/* Fill free mailboxes from the front of the queue. */
+static void can_buf_refill(void)
+{
+	uint32_t key;
+	int mb, i;
+
+	while (txq_len > 0) {
+		key = can_buf_key(&txq[0]);
+		for (i = 0; i < MAILBOXES; i++) {
+			if (mbox_busy[i] && (can_buf_key(&mbox[i]) == key)) {
+				/* Would be allowed to overtake that one */
+				return;
+			}
+		}
+
+		mb = can_transmit(CAN1, txq[0].id, txq[0].ext, txq[0].rtr,
+				  txq[0].dlc, txq[0].data);
+		if (mb < 0) {
+			return;
+		}
+		mbox[mb] = txq[0];
+		mbox_busy[mb] = true;
+		mbox_abort[mb] = false;
+		txq_pop();
+	}
+}
+
+/*
+ * All mailboxes busy and the front of the queue more urgent than one of
+ * them? Abort the least urgent, the mailbox empty interrupt brings its
+ * frame back into the queue. Only with room in the queue for it, which
+ * can_buf_send() keeps free until the abort is done.
+ */
+static void can_buf_preempt(void)
+{
+	uint32_t key, worst_key = 0;
+	int i, worst = -1;
+
+	if ((txq_len == 0) || (txq_len == CAN_BUF_TX_LEN)) {
+		return;
+	}
+	for (i = 0; i < MAILBOXES; i++) {
+		if (!mbox_busy[i]) {
+			return;
+		}
+		if (mbox_abort[i]) {
+			/* Already making room */
+			return;
+		}
+		key = can_buf_key(&mbox[i]);
+		if ((worst < 0) || (key > worst_key)) {
+			worst = i;
+			worst_key = key;
+		}
+	}
+	if (can_buf_key(&txq[0]) < worst_key) {
+		mbox_abort[worst] = true;
+		CAN_TSR(CAN1) = tsr_abrq[worst];
+	}
+}
+
+/*
+ * Mailboxes that went empty: the frame went out, or was aborted and goes
+ * back into the queue. This has to happen before a mailbox is filled
+ * again, or what it held would be forgotten.
+ */
+static void can_buf_tx_done(void)
+{
+	uint32_t tsr = CAN_TSR(CAN1);
+	int i;
+
+	for (i = 0; i < MAILBOXES; i++) {
+		if (!(tsr & tsr_rqcp[i])) {
+			continue;
+		}
+		/* Clears TXOK, ALST and TERR along with RQCP */
+		CAN_TSR(CAN1) = tsr_rqcp[i];
+
+		if (!mbox_busy[i]) {
+			continue;
+		}
+		mbox_busy[i] = false;
+		if (tsr & tsr_txok[i]) {
+			stats.tx_frames++;
+			stats.bits += can_buf_frame_bits(&mbox[i]);
+		} else if (txq_insert(&mbox[i], true)) {
+			stats.tx_aborted++;
+		} else {
+			stats.tx_dropped++;
+		}
+	}
+}
+
+/*
+ * can_buf_send
+ *
+ * Queue a frame, false if the queue is full. Callable from anywhere,
+ * including interrupts, even one that came in between an abort and the
+ * mailbox empty interrupt.
+ */
+bool can_buf_send(const struct can_frame *frame)
+{
+	uint32_t old = cm_mask_interrupts(1);
+	unsigned int reserved = 0;
+	bool ok;
+	int i;
+
+	can_buf_tx_done();
+	for (i = 0; i < MAILBOXES; i++) {
+		if (mbox_busy[i] && mbox_abort[i]) {
+			reserved++;
+		}
+	}
+	ok = (txq_len + reserved < CAN_BUF_TX_LEN) && txq_insert(frame, false);
+	if (ok) {
+		can_buf_refill();
+		can_buf_preempt();
+	} else {
+		stats.tx_dropped++;
+	}
+	cm_mask_interrupts(old);
+	return ok;
+}
+
+/* Mailbox empty: a frame went out, or was aborted. */
+void usb_hp_can_tx_isr(void)
+{
+	can_buf_tx_done();
+	can_buf_refill();
+	can_buf_preempt();
+}
+
+static void can_buf_rx(uint8_t fifo)
+{
+	volatile uint32_t *rfr = fifo ? &CAN_RF1R(CAN1) : &CAN_RF0R(CAN1);
+	uint32_t fmp = fifo ? CAN_RF1R_FMP1_MASK : CAN_RF0R_FMP0_MASK;
+	uint32_t fovr = fifo ? CAN_RF1R_FOVR1 : CAN_RF0R_FOVR0;
+	struct can_frame *f;
+	uint32_t id;
+	bool ext, rtr;
+	uint8_t fmi, length;
+
+	while (*rfr & fmp) {
+		if (rx_head - rx_tail >= CAN_BUF_RX_LEN) {
+			stats.rx_lost++;
+			can_fifo_release(CAN1, fifo);
+			continue;
+		}
+		f = &rxq[rx_head % CAN_BUF_RX_LEN];
+		can_receive(CAN1, fifo, true, &id, &ext, &rtr, &fmi, &length,
+			    f->data, &f->time);
+		f->id = id;
+		f->ext = ext;
+		f->rtr = rtr;
+		f->fmi = fmi;
+		f->dlc = length;
+		rx_head++;
+
+		stats.rx_frames++;
+		stats.bits += can_buf_frame_bits(f);
+	}
+
+	if (*rfr & fovr) {
+		/* A frame was lost before we got here */
+		stats.rx_overrun++;
+		*rfr = fovr;
+	}
+}
+
+void usb_lp_can_rx0_isr(void)
+{
+	can_buf_rx(0);
+}
+
+void can_rx1_isr(void)
+{
+	can_buf_rx(1);
+}
+
+/* Error counters crossed a threshold, or a bus error was seen. */
+void can_sce_isr(void)
+{
+	uint32_t esr = CAN_ESR(CAN1);
+	uint32_t rose = esr & ~last_esr;
+	uint32_t lec = (esr >> 4) & 7;
+
+	/* 7 is never set by hardware, so writing it shows the next error */
+	if ((lec != 0) && (lec != 7)) {
+		stats.bus_errors++;
+		CAN_ESR(CAN1) = 7 << 4;
+	}
+	if (rose & CAN_ESR_EWGF) {
+		stats.warnings++;
+	}
+	if (rose & CAN_ESR_EPVF) {
+		stats.passive++;
+	}
+	if (rose & CAN_ESR_BOFF) {
+		stats.bus_off++;
+	}
+	last_esr = esr;
+
+	CAN_MSR(CAN1) = CAN_MSR_ERRI;
+}
+
+/*
+ * can_buf_recv
+ *
+ * Take the oldest received frame, false if there is none. Only one
+ * caller, outside the CAN interrupts.
+ */
+bool can_buf_recv(struct can_frame *frame)
+{
+	if (rx_tail == rx_head) {
+		return false;
+	}
+	*frame = rxq[rx_tail % CAN_BUF_RX_LEN];
+	rx_tail++;
+	return true;
+}
+
+void can_buf_get_stats(struct can_buf_stats *s)
+{
+	uint32_t old = cm_mask_interrupts(1);
+	uint32_t esr = CAN_ESR(CAN1);
+
+	*s = stats;
+	s->tec = (esr >> 16) & 0xff;
+	s->rec = (esr >> 24) & 0xff;
+	cm_mask_interrupts(old);
+}
+
+/*
+ * can_buf_init
+ *
+ * Call with CAN1 initialised and its filters set up.
+ */
+void can_buf_init(void)
+{
+	int i;
+
+	/* After a can_reset() the mailboxes are empty, whatever we thought */
+	txq_len = 0;
+	for (i = 0; i < MAILBOXES; i++) {
+		mbox_busy[i] = mbox_abort[i] = false;
+	}
+	rx_head = rx_tail = 0;
+
+	can_enable_irq(CAN1, CAN_IER_TMEIE |
+		       CAN_IER_FMPIE0 | CAN_IER_FOVIE0 |
+		       CAN_IER_FMPIE1 | CAN_IER_FOVIE1 |
+		       CAN_IER_EWGIE | CAN_IER_EPVIE | CAN_IER_BOFIE |
+		       CAN_IER_LECIE | CAN_IER_ERRIE);
+
+	/* Same priority for all four, none preempts another */
+	nvic_set_priority(NVIC_USB_HP_CAN_TX_IRQ, 1 << 4);
+	nvic_set_priority(NVIC_USB_LP_CAN_RX0_IRQ, 1 << 4);
+	nvic_set_priority(NVIC_CAN_RX1_IRQ, 1 << 4);
+	nvic_set_priority(NVIC_CAN_SCE_IRQ, 1 << 4);
+	nvic_enable_irq(NVIC_USB_HP_CAN_TX_IRQ);
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	nvic_enable_irq(NVIC_CAN_RX1_IRQ);
+	nvic_enable_irq(NVIC_CAN_SCE_IRQ);
+}
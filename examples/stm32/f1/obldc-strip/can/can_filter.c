@@ -0,0 +1,432 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * bxCAN acceptance filter compiler.
+ *
+ * Every rule is cut into aligned blocks of 2^n identifiers, which is
+ * exactly what one identifier/mask filter matches. Blocks of one
+ * identifier can go into list mode filters instead. The filters come
+ * four to a bank for standard identifiers in list mode, two in 16 bit
+ * mask mode, two for extended ones in 32 bit list mode and one in 32
+ * bit mask mode. A bank serves one FIFO.
+ *
+ * If that takes more banks than there are, the two blocks whose
+ * smallest common block lets in the fewest unwanted identifiers are
+ * merged, until it fits. Aligned blocks either nest or don't overlap,
+ * so counting what leaks through is simple arithmetic.
+ *
+ * Nothing here touches the hardware.
+ */
+
+#include <stddef.h>
+
+#include "can_filter.h"
+
+#define MAX_BLOCKS	64
+
+/* id has its low 'bits' bits clear and stands for 2^bits identifiers */
+struct block {
+	uint32_t id;
+	uint8_t bits;
+	bool ext;
+	uint8_t fifo;
+};
+
+static uint64_t block_size(const struct block *b)
+{
+	return (uint64_t)1 << b->bits;
+}
+
+static bool block_contains(const struct block *outer, const struct block *b)
+{
+	return (outer->ext == b->ext) && (outer->bits >= b->bits) &&
+	       ((b->id >> outer->bits) == (outer->id >> outer->bits));
+}
+
+/* The smallest block holding both */
+static struct block block_join(const struct block *a, const struct block *b)
+{
+	struct block j = *a;
+
+	j.bits = (a->bits > b->bits) ? a->bits : b->bits;
+	while ((a->id >> j.bits) != (b->id >> j.bits)) {
+		j.bits++;
+	}
+	j.id = (a->id >> j.bits) << j.bits;
+	j.fifo = (a->fifo < b->fifo) ? a->fifo : b->fifo;
+	return j;
+}
+
+/*
+ * Add a block, folding it into a block that holds it, or folding any
+ * it holds into it. Overlapping wishes go to the more urgent FIFO.
+ */
+static int block_add(struct block *set, int n, const struct block *b)
+{
+	struct block nb = *b;
+	int i, out;
+
+	for (i = 0; i < n; i++) {
+		if (block_contains(&set[i], &nb)) {
+			if (nb.fifo < set[i].fifo) {
+				set[i].fifo = nb.fifo;
+			}
+			return n;
+		}
+	}
+	for (i = 0, out = 0; i < n; i++) {
+		if (block_contains(&nb, &set[i])) {
+			if (set[i].fifo < nb.fifo) {
+				nb.fifo = set[i].fifo;
+			}
+		} else {
+			set[out++] = set[i];
+		}
+	}
+	set[out++] = nb;
+	return out;
+}
+
+/* Unwanted identifiers let in by joining a and b */
+static uint64_t join_cost(const struct block *set, int n,
+			  const struct block *j)
+{
+	uint64_t inside = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (block_contains(j, &set[i])) {
+			inside += block_size(&set[i]);
+		}
+	}
+	return block_size(j) - inside;
+}
+
+/* Merge the cheapest pair, false if there is nothing left to merge */
+static bool merge_cheapest(struct block *set, int *n)
+{
+	struct block j, best_j;
+	uint64_t cost, best = 0;
+	bool found = false;
+	int a, b;
+
+	for (a = 0; a < *n; a++) {
+		for (b = a + 1; b < *n; b++) {
+			if (set[a].ext != set[b].ext) {
+				continue;
+			}
+			j = block_join(&set[a], &set[b]);
+			/* Rather keep the FIFOs apart, at the same cost */
+			cost = join_cost(set, *n, &j) * 2 +
+			       (set[a].fifo != set[b].fifo);
+			if (!found || (cost < best)) {
+				found = true;
+				best = cost;
+				best_j = j;
+			}
+		}
+	}
+	if (found) {
+		*n = block_add(set, *n, &best_j);
+	}
+	return found;
+}
+
+/* Cut [first, last] into the fewest aligned blocks. */
+static int add_range(struct block *set, int n,
+		     const struct can_filter_rule *r)
+{
+	uint32_t id = r->first;
+	struct block b;
+
+	b.ext = r->ext;
+	b.fifo = (r->prio == 0) ? 0 : 1;
+
+	while (1) {
+		b.bits = 0;
+		while ((b.bits < (r->ext ? 29 : 11)) &&
+		       ((id & ((2UL << b.bits) - 1)) == 0) &&
+		       (id + (2UL << b.bits) - 1 <= r->last)) {
+			b.bits++;
+		}
+		b.id = id;
+
+		/* Running out of room: give up some precision early */
+		if ((n == MAX_BLOCKS) && !merge_cheapest(set, &n)) {
+			return n;
+		}
+		n = block_add(set, n, &b);
+
+		if ((uint64_t)id + block_size(&b) > r->last) {
+			break;
+		}
+		id += block_size(&b);
+	}
+	return n;
+}
+
+/*
+ * Add a FIFO1 rule without what the FIFO0 rules want, so no block
+ * straddles the two FIFOs unless merged later for lack of banks.
+ */
+static int add_fifo1_range(struct block *set, int n,
+			   const struct can_filter_rule *rules, int n_rules,
+			   const struct can_filter_rule *r)
+{
+	struct can_filter_rule piece = *r;
+	uint32_t id = r->first, end;
+	bool covered;
+	int i;
+
+	while (1) {
+		end = r->last;
+		covered = false;
+		for (i = 0; i < n_rules; i++) {
+			if ((rules[i].prio != 0) || (rules[i].ext != r->ext) ||
+			    (rules[i].first > rules[i].last)) {
+				continue;
+			}
+			if ((rules[i].first <= id) && (rules[i].last >= id)) {
+				covered = true;
+				end = rules[i].last;
+				break;
+			}
+			if ((rules[i].first > id) && (rules[i].first - 1 < end)) {
+				end = rules[i].first - 1;
+			}
+		}
+		if (!covered) {
+			piece.first = id;
+			piece.last = end;
+			n = add_range(set, n, &piece);
+		}
+		if (end >= r->last) {
+			return n;
+		}
+		id = end + 1;
+	}
+}
+
+/*
+ * How many identifiers of one kind the rules ask for, overlaps counted
+ * once: walk up through the runs of wanted identifiers.
+ */
+static uint64_t rules_size(const struct can_filter_rule *rules, int n_rules,
+			   bool ext)
+{
+	uint64_t next = 0, start, end, size = 0;
+	bool found, grew;
+	int i;
+
+	while (1) {
+		/* Where the next run starts */
+		found = false;
+		start = 0;
+		for (i = 0; i < n_rules; i++) {
+			if ((rules[i].ext != ext) ||
+			    (rules[i].first > rules[i].last) ||
+			    (rules[i].last < next)) {
+				continue;
+			}
+			end = (rules[i].first > next) ? rules[i].first : next;
+			if (!found || (end < start)) {
+				found = true;
+				start = end;
+			}
+		}
+		if (!found) {
+			return size;
+		}
+
+		/* And where it ends */
+		end = start;
+		do {
+			grew = false;
+			for (i = 0; i < n_rules; i++) {
+				if ((rules[i].ext == ext) &&
+				    (rules[i].first <= end) &&
+				    (rules[i].last >= end)) {
+					end = (uint64_t)rules[i].last + 1;
+					grew = true;
+				}
+			}
+		} while (grew);
+
+		size += end - start;
+		next = end;
+	}
+}
+
+static uint32_t enc32(uint32_t id, bool ext)
+{
+	return ext ? ((id << 3) | (1 << 2)) : (id << 21);
+}
+
+/* IDE always has to match, RTR never */
+static uint32_t enc32_mask(uint8_t bits, bool ext)
+{
+	if (ext) {
+		return (((0x1fffffffUL << bits) & 0x1fffffff) << 3) | (1 << 2);
+	}
+	return (((0x7ffUL << bits) & 0x7ff) << 21) | (1 << 2);
+}
+
+static uint16_t enc16(uint32_t id)
+{
+	return id << 5;
+}
+
+static uint16_t enc16_mask(uint8_t bits)
+{
+	return (((0x7ffUL << bits) & 0x7ff) << 5) | (1 << 3);
+}
+
+static void emit(struct can_filter_bank *banks, int nb, int max_banks,
+		 bool scale_32bit, bool list_mode, uint8_t fifo,
+		 uint32_t fr1, uint32_t fr2)
+{
+	if ((banks == NULL) || (nb >= max_banks)) {
+		return;
+	}
+	banks[nb].scale_32bit = scale_32bit;
+	banks[nb].list_mode = list_mode;
+	banks[nb].fifo = fifo;
+	banks[nb].fr1 = fr1;
+	banks[nb].fr2 = fr2;
+}
+
+/*
+ * Lay the blocks out in banks, returns how many it takes. With banks
+ * NULL it only counts. Unused filters in a bank repeat a used one.
+ */
+static int pack(const struct block *set, int n, struct can_filter_bank *banks,
+		int max_banks)
+{
+	const struct block *single[MAX_BLOCKS], *multi[MAX_BLOCKS];
+	int ns, nm, i, k, nb = 0;
+	uint8_t fifo;
+	bool ext;
+	uint16_t id16[4];
+
+	for (fifo = 0; fifo < 2; fifo++) {
+		for (ext = false; ; ext = true) {
+			ns = nm = 0;
+			for (i = 0; i < n; i++) {
+				if ((set[i].fifo != fifo) ||
+				    (set[i].ext != ext)) {
+					continue;
+				}
+				if (set[i].bits == 0) {
+					single[ns++] = &set[i];
+				} else {
+					multi[nm++] = &set[i];
+				}
+			}
+
+			if (ext) {
+				for (i = 0; i < ns; i += 2) {
+					k = (i + 1 < ns) ? i + 1 : i;
+					emit(banks, nb++, max_banks, true, true,
+					     fifo, enc32(single[i]->id, true),
+					     enc32(single[k]->id, true));
+				}
+				for (i = 0; i < nm; i++) {
+					emit(banks, nb++, max_banks, true,
+					     false, fifo,
+					     enc32(multi[i]->id, true),
+					     enc32_mask(multi[i]->bits, true));
+				}
+				break;
+			}
+
+			/*
+			 * A single left over from the list banks fills the
+			 * empty half of a mask bank if there is one.
+			 */
+			if ((nm % 2 == 1) && (ns % 4 == 1)) {
+				multi[nm++] = single[--ns];
+			}
+			for (i = 0; i < ns; i += 4) {
+				for (k = 0; k < 4; k++) {
+					id16[k] = enc16(single[(i + k < ns) ?
+							       i + k : i]->id);
+				}
+				emit(banks, nb++, max_banks, false, true, fifo,
+				     id16[0] | ((uint32_t)id16[1] << 16),
+				     id16[2] | ((uint32_t)id16[3] << 16));
+			}
+			for (i = 0; i < nm; i += 2) {
+				k = (i + 1 < nm) ? i + 1 : i;
+				emit(banks, nb++, max_banks, false, false, fifo,
+				     enc16(multi[i]->id) |
+				     ((uint32_t)enc16_mask(multi[i]->bits) << 16),
+				     enc16(multi[k]->id) |
+				     ((uint32_t)enc16_mask(multi[k]->bits) << 16));
+			}
+		}
+	}
+	return nb;
+}
+
+/*
+ * can_filter_compile
+ *
+ * Fill banks[] for the rules, returns the number of banks used, or -1
+ * if even accepting everything of each kind doesn't fit (max_banks
+ * below 2). The number of unwanted identifiers that get through goes
+ * to *leak.
+ */
+int can_filter_compile(const struct can_filter_rule *rules, int n_rules,
+		       struct can_filter_bank *banks, int max_banks,
+		       uint32_t *leak)
+{
+	struct block set[MAX_BLOCKS];
+	uint64_t wanted = 0, accepted = 0;
+	int n = 0, i;
+
+	/*
+	 * From the rules, not the blocks: add_range() may have merged some
+	 * already, and what that let in is leak as well.
+	 */
+	wanted = rules_size(rules, n_rules, false) +
+		 rules_size(rules, n_rules, true);
+	for (i = 0; i < n_rules; i++) {
+		if ((rules[i].first <= rules[i].last) && (rules[i].prio == 0)) {
+			n = add_range(set, n, &rules[i]);
+		}
+	}
+	for (i = 0; i < n_rules; i++) {
+		if ((rules[i].first <= rules[i].last) && (rules[i].prio != 0)) {
+			n = add_fifo1_range(set, n, rules, n_rules, &rules[i]);
+		}
+	}
+
+	while (pack(set, n, NULL, 0) > max_banks) {
+		if (!merge_cheapest(set, &n)) {
+			return -1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		accepted += block_size(&set[i]);
+	}
+	if (leak != NULL) {
+		*leak = accepted - wanted;
+	}
+	return pack(set, n, banks, max_banks);
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAN_FILTER_H
+#define CAN_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Filter banks of CAN1 on everything but the connectivity line */
+#define CAN_FILTER_BANKS	14
+
+/*
+ * Wanted identifiers, first to last inclusive. Priority 0 goes to FIFO0,
+ * anything else to FIFO1, so urgent traffic has a FIFO to itself.
+ */
+struct can_filter_rule {
+	uint32_t first;
+	uint32_t last;
+	bool ext;
+	uint8_t prio;
+};
+
+/* One bank, ready for can_filter_init() */
+struct can_filter_bank {
+	bool scale_32bit;
+	bool list_mode;
+	uint8_t fifo;
+	uint32_t fr1;
+	uint32_t fr2;
+};
+
+int can_filter_compile(const struct can_filter_rule *rules, int n_rules,
+		       struct can_filter_bank *banks, int max_banks,
+		       uint32_t *leak);
+
+#endif
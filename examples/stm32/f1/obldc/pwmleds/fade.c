@@ -0,0 +1,136 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * LED fades, without any hardware access so fade_host.c can check them
+ * on a PC.
+ *
+ * Each channel moves from where it is to a target level over a number
+ * of frames, along one of a few easing curves. fade_frame() runs once
+ * per frame and gives the compare values for all channels, through the
+ * channel's gamma table with linear interpolation between its 256
+ * steps, so slow fades near black still move a little every frame.
+ */
+
+#include "fade.h"
+
+void fade_init(struct fade *f, const uint16_t *gamma)
+{
+	int i;
+
+	for (i = 0; i < FADE_CHANNELS; i++) {
+		f->ch[i].gamma = gamma;
+		f->ch[i].level = 0;
+		f->ch[i].from = 0;
+		f->ch[i].to = 0;
+		f->ch[i].frame = 0;
+		f->ch[i].frames = 0;
+		f->ch[i].ease = FADE_LINEAR;
+	}
+}
+
+void fade_set_gamma(struct fade *f, int ch, const uint16_t *gamma)
+{
+	f->ch[ch].gamma = gamma;
+}
+
+/*
+ * fade_to
+ *
+ * Start moving channel ch from its current level, even halfway through
+ * another fade, to level over the given number of frames. With no frames
+ * it gets there on the next fade_frame().
+ */
+void fade_to(struct fade *f, int ch, uint16_t level, uint16_t frames,
+	     enum fade_ease ease)
+{
+	struct fade_chan *c = &f->ch[ch];
+
+	c->from = c->level;
+	c->to = level;
+	c->frame = 0;
+	c->frames = frames;
+	c->ease = ease;
+	if (frames == 0) {
+		c->level = level;
+	}
+}
+
+bool fade_busy(const struct fade *f, int ch)
+{
+	return f->ch[ch].frame < f->ch[ch].frames;
+}
+
+/* From 0 to 65535 over t from 0 to 65535, both ends exact */
+uint16_t fade_ease(enum fade_ease ease, uint16_t t)
+{
+	uint32_t s;
+
+	switch (ease) {
+	case FADE_IN:
+		return (uint32_t)t * t / 65535;
+	case FADE_OUT:
+		s = 65535 - t;
+		return 65535 - s * s / 65535;
+	case FADE_IN_OUT:
+		/* 3t^2 - 2t^3, rounded so it is as symmetric as it can be */
+		s = 3 * 65535 - 2 * (uint32_t)t;
+		return ((uint64_t)t * t * s + 65535ULL * 65535 / 2) /
+		       (65535ULL * 65535);
+	default:
+		return t;
+	}
+}
+
+/* Compare value for a level, between the table entries either side */
+uint16_t fade_gamma(const uint16_t *gamma, uint16_t level)
+{
+	uint32_t x = (uint32_t)level * 65536 / 65535;
+	uint32_t i = x >> 8;
+	uint32_t frac = x & 0xff;
+
+	if (i >= FADE_GAMMA_SIZE - 1) {
+		return gamma[FADE_GAMMA_SIZE - 1];
+	}
+	return gamma[i] + (gamma[i + 1] - gamma[i]) * frac / 256;
+}
+
+/*
+ * fade_frame
+ *
+ * One frame on: move every channel along, and put its compare value in
+ * out[].
+ */
+void fade_frame(struct fade *f, uint16_t *out)
+{
+	struct fade_chan *c;
+	uint16_t e;
+	int i;
+
+	for (i = 0; i < FADE_CHANNELS; i++) {
+		c = &f->ch[i];
+		if (c->frame < c->frames) {
+			c->frame++;
+			e = fade_ease(c->ease,
+				      (uint32_t)c->frame * 65535 / c->frames);
+			c->level = c->from +
+				   (int64_t)((int32_t)c->to - c->from) * e /
+				   65535;
+		}
+		out[i] = fade_gamma(c->gamma, c->level);
+	}
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FADE_H
+#define FADE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FADE_CHANNELS		4
+
+/* Gamma tables from gamma.awk, 256 steps and the end point */
+#define FADE_GAMMA_SIZE		257
+
+enum fade_ease {
+	FADE_LINEAR,
+	FADE_IN,		/* starts slow, quadratic */
+	FADE_OUT,		/* ends slow, quadratic */
+	FADE_IN_OUT,		/* both, smoothstep */
+};
+
+/* Levels are perceived brightness, 0 to 65535, before gamma correction */
+struct fade_chan {
+	const uint16_t *gamma;
+	uint16_t level;
+	uint16_t from, to;
+	uint16_t frame, frames;
+	enum fade_ease ease;
+};
+
+struct fade {
+	struct fade_chan ch[FADE_CHANNELS];
+};
+
+void fade_init(struct fade *f, const uint16_t *gamma);
+void fade_set_gamma(struct fade *f, int ch, const uint16_t *gamma);
+void fade_to(struct fade *f, int ch, uint16_t level, uint16_t frames,
+	     enum fade_ease ease);
+bool fade_busy(const struct fade *f, int ch);
+void fade_frame(struct fade *f, uint16_t *out);
+
+uint16_t fade_ease(enum fade_ease ease, uint16_t t);
+uint16_t fade_gamma(const uint16_t *gamma, uint16_t level);
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks fade.c and the generated gamma tables on the host:
+ *
+ *	awk -v gammas="1.0 2.2 3.0" -f gamma.awk > generated.gamma.h
+ *	cc -o fade_host fade_host.c fade.c -lm
+ *	./fade_host
+ *
+ * The easing curves have to hit both ends, never go backwards and stay
+ * on their side of linear; the interpolated gamma has to stay close to
+ * the real curve; and fades have to land on their targets exactly, and
+ * not jump when a new target comes in halfway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "generated.gamma.h"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static void test_ease(void)
+{
+	static const char *name[] = { "linear", "in", "out", "in-out" };
+	uint32_t t;
+	int e, v, prev, lin;
+
+	for (e = FADE_LINEAR; e <= FADE_IN_OUT; e++) {
+		check(fade_ease(e, 0) == 0, name[e], 0, fade_ease(e, 0));
+		check(fade_ease(e, 65535) == 65535, name[e], 65535,
+		      fade_ease(e, 65535));
+		prev = 0;
+		for (t = 0; t <= 65535; t++) {
+			v = fade_ease(e, t);
+			lin = t;
+			check(v >= prev, "monotonic", t, v);
+			if (e == FADE_IN) {
+				check(v <= lin, "in below linear", t, v);
+			} else if (e == FADE_OUT) {
+				check(v >= lin, "out above linear", t, v);
+			} else if (e == FADE_IN_OUT) {
+				check(abs(v + fade_ease(e, 65535 - t) - 65535)
+				      <= 2, "in-out symmetric", t, v);
+			}
+			prev = v;
+		}
+	}
+}
+
+static void test_gamma(const uint16_t *table, double gamma)
+{
+	uint32_t level;
+	int v, prev = 0;
+	double want, worst = 0;
+
+	check(fade_gamma(table, 0) == 0, "gamma 0", 0, fade_gamma(table, 0));
+	check(fade_gamma(table, 65535) == 65535, "gamma full", 65535,
+	      fade_gamma(table, 65535));
+	for (level = 0; level <= 65535; level++) {
+		v = fade_gamma(table, level);
+		check(v >= prev, "gamma monotonic", level, v);
+		want = 65535 * pow(level / 65535.0, gamma);
+		if (fabs(v - want) > worst) {
+			worst = fabs(v - want);
+		}
+		prev = v;
+	}
+	/*
+	 * One level's worth of the slope at the top, how far the 256 chords
+	 * are off the curve, and the rounding
+	 */
+	check(worst < gamma + 65535 * gamma * (gamma - 1) / 8 / 256 / 256 + 2,
+	      "gamma error", gamma * 10, worst);
+	printf("gamma %.1f: worst error %.1f counts\n", gamma, worst);
+}
+
+static void test_fade(void)
+{
+	struct fade f;
+	uint16_t out[FADE_CHANNELS];
+	int i, e, step, worst;
+
+	fade_init(&f, gamma_table_1_0);
+
+	/* Each curve lands on its target on the last frame, not before */
+	for (e = FADE_LINEAR; e <= FADE_IN_OUT; e++) {
+		fade_to(&f, 0, 0, 0, FADE_LINEAR);
+		fade_frame(&f, out);
+		fade_to(&f, 0, 50000, 100, e);
+		for (i = 0; i < 99; i++) {
+			fade_frame(&f, out);
+			check(fade_busy(&f, 0), "busy", e, i);
+			check(f.ch[0].level < 50000, "early", e, f.ch[0].level);
+		}
+		fade_frame(&f, out);
+		check(!fade_busy(&f, 0), "done", e, f.ch[0].level);
+		check(f.ch[0].level == 50000, "target", e, f.ch[0].level);
+		check(out[0] == fade_gamma(gamma_table_1_0, 50000), "output",
+		      e, out[0]);
+	}
+
+	/* Down as well as up, and a fade of one frame */
+	fade_to(&f, 1, 65535, 1, FADE_OUT);
+	fade_frame(&f, out);
+	check(f.ch[1].level == 65535, "one frame", 1, f.ch[1].level);
+	fade_to(&f, 1, 10, 300, FADE_IN_OUT);
+	for (i = 0; i < 300; i++) {
+		fade_frame(&f, out);
+	}
+	check(f.ch[1].level == 10, "down", 10, f.ch[1].level);
+
+	/*
+	 * A new target halfway through carries on from where the old fade
+	 * was, with no step bigger than the two fades' steepest
+	 */
+	fade_to(&f, 2, 0, 0, FADE_LINEAR);
+	fade_frame(&f, out);
+	fade_to(&f, 2, 60000, 200, FADE_LINEAR);
+	worst = 0;
+	for (i = 0; i < 400; i++) {
+		if (i == 100) {
+			fade_to(&f, 2, 1000, 200, FADE_LINEAR);
+		}
+		step = f.ch[2].level;
+		fade_frame(&f, out);
+		step = abs(f.ch[2].level - step);
+		if (step > worst) {
+			worst = step;
+		}
+	}
+	check(worst <= 60000 / 200 + 1, "retarget jump", 301, worst);
+	check(f.ch[2].level == 1000, "retarget", 1000, f.ch[2].level);
+
+	/* The other channels never moved */
+	check(f.ch[3].level == 0 && out[3] == 0, "idle", f.ch[3].level,
+	      out[3]);
+}
+
+int main(void)
+{
+	test_ease();
+	test_gamma(gamma_table_1_0, 1.0);
+	test_gamma(gamma_table_2_2, 2.2);
+	test_gamma(gamma_table_3_0, 3.0);
+	test_fade();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,49 @@
+#
+# This file is part of the libopencm3 project.
+#
+# This library is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this library.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+#
+# Gamma correction tables, Iout = Iin ** gamma, for each exponent in
+# "gammas", e.g.
+#
+#	awk -v gammas="2.2 2.5" -f gamma.awk > generated.gamma.h
+#
+# makes gamma_table_2_2 and gamma_table_2_5. Each has FADE_GAMMA_SIZE
+# entries from 0 to 65535, the last one for the top end of the
+# interpolation in fade.c.
+#
+
+BEGIN {
+	n = split(gammas, g, " ");
+	print "/* Generated by gamma.awk, do not edit */";
+	print "";
+	print "#include \"fade.h\"";
+	for (k = 1; k <= n; k++) {
+		name = g[k];
+		gsub(/\./, "_", name);
+		print "";
+		printf("static const uint16_t gamma_table_%s[FADE_GAMMA_SIZE] = {",
+		       name);
+		for (i = 0; i <= 256; i++) {
+			if (i % 8 == 0)
+				printf("\n\t");
+			else
+				printf(" ");
+			printf("%d,", int(65535 * (i / 256) ^ g[k] + 0.5));
+		}
+		print "\n};";
+	}
+}
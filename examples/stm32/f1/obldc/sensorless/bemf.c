@@ -0,0 +1,314 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sensorless six step commutation on the back EMF zero crossings,
+ * without any hardware access so the same code runs against the
+ * synthetic waveforms in bemf_sim.c.
+ *
+ * bemf_start() parks the rotor on step 0 for align_time, then the steps
+ * follow each other on time, from ramp_start to ramp_end steps per
+ * second at ramp_accel. Once lock_steps steps in a row have shown a zero
+ * crossing, commutation is handed over to the crossings.
+ *
+ * bemf_sample() takes the floating phase and the supply once per PWM
+ * period, in the middle of the on time, when the star point sits at half
+ * the supply. For the first quarter of a step the floating phase is
+ * still clamped by the diodes while the current in it decays, so it is
+ * not looked at. After that zc_filter samples in a row on the far side
+ * of half the supply make a crossing, timed by interpolating between
+ * the last sample on the near side and the first on the far side.
+ *
+ * The crossing to crossing time goes through a first order filter, and
+ * the next commutation is half a step, 30 degrees, after the crossing;
+ * bemf_sample() hands that time back for a timer to hit. A step that
+ * runs for two filtered steps without a crossing is a miss, and is
+ * forced; miss_limit misses in a row starts again from the alignment.
+ */
+
+#include "bemf.h"
+
+/*
+ * PWM on the high side of the phase going up, and on the low side of
+ * the one going down, as in the stm32-h103 pwm_6step example:
+ *
+ *  | 1| 2| 3| 4| 5| 6|
+ * -+--+--+--+--+--+--+
+ * A|p+|++|  |p-|--|  |
+ * B|  |p-|--|  |p+|++|
+ * C|--|  |p+|++|  |p-|
+ *
+ * The floating phase falls through the crossing in steps 1, 3 and 5,
+ * and rises in 2, 4 and 6.
+ */
+const uint8_t bemf_drive[BEMF_STEPS][3] = {
+	{ BEMF_PWM_HIGH, BEMF_FLOAT, BEMF_LOW },
+	{ BEMF_HIGH, BEMF_PWM_LOW, BEMF_FLOAT },
+	{ BEMF_FLOAT, BEMF_LOW, BEMF_PWM_HIGH },
+	{ BEMF_PWM_LOW, BEMF_FLOAT, BEMF_HIGH },
+	{ BEMF_LOW, BEMF_PWM_HIGH, BEMF_FLOAT },
+	{ BEMF_FLOAT, BEMF_HIGH, BEMF_PWM_LOW },
+};
+
+const uint8_t bemf_floating[BEMF_STEPS] = { 1, 2, 0, 1, 2, 0 };
+
+void bemf_init(struct bemf *m, const struct bemf_cfg *cfg)
+{
+	m->cfg = *cfg;
+	m->state = BEMF_STOPPED;
+	m->step = 0;
+	m->duty = 0;
+	m->run_duty = 0;
+	m->interval = 0;
+	m->commutate_at = 0;
+	m->commutations = 0;
+	m->zero_crossings = 0;
+	m->missed = 0;
+	m->restarts = 0;
+	m->scheduled = 0;
+	m->latency_max = 0;
+	m->latency_sum = 0;
+	m->lag_max = 0;
+	m->lag_sum = 0;
+	m->pending = false;
+}
+
+static void align(struct bemf *m, uint32_t now)
+{
+	m->state = BEMF_ALIGN;
+	m->step = 0;
+	m->duty = m->cfg.align_duty;
+	m->state_start = now;
+	m->step_start = now;
+	m->interval = m->cfg.clock_hz / m->cfg.ramp_start;
+	m->pending = false;
+	m->seen = false;
+	m->before = false;
+	m->past = 0;
+	m->last_valid = false;
+}
+
+/*
+ * bemf_start
+ *
+ * Start from standstill, the drive has to be set to bemf_drive[m->step]
+ * and the duty to m->duty.
+ */
+void bemf_start(struct bemf *m, uint32_t now, uint16_t run_duty)
+{
+	m->run_duty = run_duty;
+	align(m, now);
+}
+
+void bemf_stop(struct bemf *m)
+{
+	m->state = BEMF_STOPPED;
+	m->duty = 0;
+	m->pending = false;
+}
+
+/* True on a crossing, its time is in m->zc_t */
+static bool detect(struct bemf *m, uint32_t now, uint16_t phase,
+		   uint16_t vbus)
+{
+	int32_t v = (int32_t)phase - vbus / 2;
+	int32_t a, b;
+	uint32_t lag;
+
+	if (m->seen || (now - m->step_start < m->interval / 4)) {
+		return false;
+	}
+
+	/* Look at it as if it were falling */
+	if (m->step & 1) {
+		v = -v;
+	}
+
+	if (v > 0) {
+		m->prev_t = now;
+		m->prev_v = v;
+		m->before = true;
+		m->past = 0;
+		return false;
+	}
+
+	if (m->past++ == 0) {
+		if (m->before) {
+			a = m->prev_v;
+			b = -v;
+			m->zc_t = m->prev_t +
+				  (uint64_t)(now - m->prev_t) * a / (a + b);
+		} else {
+			/* Crossed during the blanking, as good as we get */
+			m->zc_t = now;
+		}
+	}
+	if (m->past < m->cfg.zc_filter) {
+		return false;
+	}
+
+	m->seen = true;
+	m->zero_crossings++;
+	lag = now - m->zc_t;
+	m->lag_sum += lag;
+	if (lag > m->lag_max) {
+		m->lag_max = lag;
+	}
+	return true;
+}
+
+static enum bemf_action ramp(struct bemf *m, uint32_t now, uint16_t phase,
+			     uint16_t vbus)
+{
+	uint32_t end = m->cfg.ramp_end << 8;
+
+	if (detect(m, now, phase, vbus)) {
+		m->last_zc = m->zc_t;
+		m->last_valid = true;
+	}
+	if (now - m->step_start < m->interval) {
+		return BEMF_NONE;
+	}
+
+	if (m->seen) {
+		m->good++;
+	} else {
+		m->good = 0;
+		m->last_valid = false;
+	}
+
+	m->ramp_rate += (uint64_t)m->cfg.ramp_accel * 256 * m->interval /
+			m->cfg.clock_hz;
+	if (m->ramp_rate > end) {
+		m->ramp_rate = end;
+	}
+
+	if ((m->good >= m->cfg.lock_steps) && (m->ramp_rate == end)) {
+		m->state = BEMF_RUN;
+		m->duty = m->run_duty;
+		m->misses = 0;
+	} else {
+		m->interval = (uint64_t)m->cfg.clock_hz * 256 / m->ramp_rate;
+	}
+	return BEMF_COMMUTATE;
+}
+
+static enum bemf_action run(struct bemf *m, uint32_t now, uint16_t phase,
+			    uint16_t vbus)
+{
+	int32_t step;
+
+	if (m->pending) {
+		return BEMF_NONE;
+	}
+
+	if (detect(m, now, phase, vbus)) {
+		/* Crossing to crossing, or twice the 30 degrees since the last
+		 * commutation if there is no crossing to go from. */
+		if (m->last_valid) {
+			step = m->zc_t - m->last_zc;
+		} else {
+			step = 2 * (m->zc_t - m->step_start);
+		}
+		m->interval += (step - (int32_t)m->interval) / 4;
+		m->last_zc = m->zc_t;
+		m->last_valid = true;
+		m->misses = 0;
+
+		m->commutate_at = m->zc_t + m->interval / 2;
+		m->pending = true;
+		if ((int32_t)(now - m->commutate_at) >= 0) {
+			return BEMF_COMMUTATE;
+		}
+		return BEMF_SCHEDULE;
+	}
+
+	if (now - m->step_start < 2 * m->interval) {
+		return BEMF_NONE;
+	}
+
+	m->missed++;
+	m->last_valid = false;
+	if (++m->misses > m->cfg.miss_limit) {
+		m->restarts++;
+		align(m, now);
+	}
+	return BEMF_COMMUTATE;
+}
+
+/*
+ * bemf_sample
+ *
+ * Once per PWM period, the floating phase and the supply, sampled in
+ * the middle of the on time. The drive only ever changes through
+ * bemf_commutate().
+ */
+enum bemf_action bemf_sample(struct bemf *m, uint32_t now, uint16_t phase,
+			     uint16_t vbus)
+{
+	switch (m->state) {
+	case BEMF_ALIGN:
+		if (now - m->state_start < m->cfg.align_time) {
+			return BEMF_NONE;
+		}
+		m->state = BEMF_RAMP;
+		m->duty = m->cfg.ramp_duty;
+		m->ramp_rate = m->cfg.ramp_start << 8;
+		m->good = 0;
+		return BEMF_COMMUTATE;
+	case BEMF_RAMP:
+		return ramp(m, now, phase, vbus);
+	case BEMF_RUN:
+		return run(m, now, phase, vbus);
+	default:
+		return BEMF_NONE;
+	}
+}
+
+/*
+ * bemf_commutate
+ *
+ * Move on to the next step, or back to step 0 when starting over, the
+ * drive has to follow to bemf_drive[m->step]. When the commutation was
+ * scheduled, how late it came is added to the statistics.
+ */
+void bemf_commutate(struct bemf *m, uint32_t now)
+{
+	uint32_t late;
+
+	if (m->pending) {
+		late = now - m->commutate_at;
+		if ((int32_t)late < 0) {
+			late = 0;
+		}
+		m->scheduled++;
+		m->latency_sum += late;
+		if (late > m->latency_max) {
+			m->latency_max = late;
+		}
+		m->pending = false;
+	}
+
+	if (m->state != BEMF_ALIGN) {
+		m->step = (m->step >= BEMF_STEPS - 1) ? 0 : m->step + 1;
+	}
+	m->commutations++;
+	m->step_start = now;
+	m->seen = false;
+	m->before = false;
+	m->past = 0;
+}
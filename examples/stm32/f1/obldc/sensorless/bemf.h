@@ -0,0 +1,112 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BEMF_H
+#define BEMF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* What a phase does during one commutation step */
+#define BEMF_FLOAT	0	/* both switches off */
+#define BEMF_LOW	1	/* low side on */
+#define BEMF_HIGH	2	/* high side on */
+#define BEMF_PWM_HIGH	3	/* high side switching, low side off */
+#define BEMF_PWM_LOW	4	/* low side switching, high side off */
+
+#define BEMF_STEPS	6
+
+/* Phases A, B and C for each step, and which one floats */
+extern const uint8_t bemf_drive[BEMF_STEPS][3];
+extern const uint8_t bemf_floating[BEMF_STEPS];
+
+enum bemf_state {
+	BEMF_STOPPED,
+	BEMF_ALIGN,		/* parking the rotor on step 0 */
+	BEMF_RAMP,		/* open loop, commutating on time */
+	BEMF_RUN,		/* commutating on the zero crossings */
+};
+
+/* What bemf_sample() wants done */
+enum bemf_action {
+	BEMF_NONE,
+	BEMF_COMMUTATE,		/* now, call bemf_commutate() */
+	BEMF_SCHEDULE,		/* at m->commutate_at */
+};
+
+/*
+ * Times are in counts of a free running clock of clock_hz, voltages in
+ * ADC counts, the phases and the supply through the same divider.
+ */
+struct bemf_cfg {
+	uint32_t clock_hz;
+	uint16_t align_duty;
+	uint32_t align_time;
+	uint16_t ramp_duty;
+	uint32_t ramp_start;	/* steps per second */
+	uint32_t ramp_end;
+	uint32_t ramp_accel;	/* steps per second, per second */
+	uint8_t zc_filter;	/* samples past the crossing to believe it */
+	uint8_t lock_steps;	/* crossings in a row to leave the ramp */
+	uint8_t miss_limit;	/* misses in a row to give up and restart */
+};
+
+struct bemf {
+	struct bemf_cfg cfg;
+	enum bemf_state state;
+	uint8_t step;		/* index into bemf_drive */
+	uint16_t duty;		/* for the PWM phase */
+	uint16_t run_duty;	/* once running on the crossings */
+	uint32_t interval;	/* filtered, clock counts per step */
+	uint32_t commutate_at;	/* when BEMF_SCHEDULE'd */
+
+	/* Statistics */
+	uint32_t commutations;
+	uint32_t zero_crossings;
+	uint32_t missed;	/* steps forced without a crossing */
+	uint32_t restarts;
+	uint32_t scheduled;	/* commutations timed from a crossing */
+	uint32_t latency_max;	/* late commutations, clock counts */
+	uint32_t latency_sum;
+	uint32_t lag_max;	/* crossing to detection, clock counts */
+	uint32_t lag_sum;
+
+	/* Private to bemf.c */
+	uint32_t state_start;
+	uint32_t step_start;
+	uint32_t ramp_rate;	/* steps per second, 24.8 */
+	uint32_t prev_t;	/* last sample before the crossing */
+	int32_t prev_v;
+	bool before;		/* and it is from this step */
+	uint8_t past;		/* samples in a row past the crossing */
+	uint32_t zc_t;		/* interpolated time of the crossing */
+	uint32_t last_zc;
+	bool last_valid;	/* last_zc is from the step before */
+	bool seen;		/* crossing found this step */
+	bool pending;		/* commutation scheduled */
+	uint8_t good;		/* crossings in a row, while ramping */
+	uint8_t misses;		/* in a row */
+};
+
+void bemf_init(struct bemf *m, const struct bemf_cfg *cfg);
+void bemf_start(struct bemf *m, uint32_t now, uint16_t run_duty);
+void bemf_stop(struct bemf *m);
+enum bemf_action bemf_sample(struct bemf *m, uint32_t now, uint16_t phase,
+			     uint16_t vbus);
+void bemf_commutate(struct bemf *m, uint32_t now);
+
+#endif
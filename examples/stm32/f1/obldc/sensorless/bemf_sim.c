@@ -0,0 +1,256 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs bemf.c on the host against a small BLDC motor model, the same one
+ * as in the stm32-h103 pwm_6step example, with synthetic phase voltages:
+ * half the supply plus a trapezoidal back EMF on the floating phase, ADC
+ * noise, and the floating phase stuck at a rail while the current in it
+ * decays after each commutation. Time goes in steps of 1us, the clock
+ * bemf.c is given, and scheduled commutations happen a few us late, as
+ * an interrupt would.
+ *
+ *	cc -O2 -o bemf_sim bemf_sim.c bemf.c -lm
+ *	./bemf_sim [load]
+ *
+ * prints time, state, speed (steps/s) and duty every 50ms, and how far
+ * each commutation timed from a crossing was from where it should have
+ * been. With "load" the motor is braked to a stop for BRAKE_TIME and has
+ * to catch up again without starting over; the angle error leaves out
+ * the brake and RECOVER_TIME after it. Either way the motor has to end
+ * up running on the crossings, with no more missed crossings, restarts,
+ * commutation latency and angle error than the limits below allow.
+ * Exits with 1 if anything fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bemf.h"
+
+#define CLOCK_HZ	1000000
+#define PWM_HZ		20000
+#define PWM_PERIOD	1800
+
+/* Motor */
+#define R		1.0	/* ohm, phase to phase */
+#define L		0.0002	/* henry */
+#define KE		0.01	/* V/(rad/s) and Nm/A */
+#define POLE_PAIRS	4
+#define J		0.000002 /* kg m^2 */
+#define B		0.00001	/* Nm/(rad/s) */
+#define VBUS		12.0
+
+/* Phases and supply divided down to 3.3V at 20V, 12 bit ADC */
+#define ADC_PER_VOLT	(4095.0 / 20.0)
+#define ADC_NOISE	20
+
+/* The brake, with "load" */
+#define BRAKE_START	(2 * CLOCK_HZ)
+#define BRAKE_TIME	(CLOCK_HZ / 20)
+#define BRAKE_LOAD	0.08	/* Nm */
+#define RECOVER_TIME	(CLOCK_HZ / 10)
+
+struct limits {
+	uint32_t missed;
+	uint32_t restarts;
+	uint32_t latency;	/* clock counts */
+	double err_rms;		/* degrees */
+	double err_max;
+};
+
+static const struct limits free_run = { 0, 0, 5, 2, 10 };
+static const struct limits braked_run = { 20, 0, 5, 2, 10 };
+
+struct plant {
+	double i;	/* A */
+	double w;	/* rad/s, mechanical */
+	double theta;	/* rad, electrical */
+	double load;	/* Nm */
+	double demag;	/* s until the floating phase leaves the rail */
+};
+
+static void plant_step(struct plant *p, int step, double duty, double dt)
+{
+	/* Step n puts the field 120 degrees past the start of sector n */
+	double fit = sin((step + 2) * M_PI / 3 - p->theta);
+	double v = duty * VBUS;
+	double e = KE * p->w * fit;
+	double torque;
+
+	p->i += (v - e - R * p->i) / L * dt;
+	if (p->i < 0) {
+		p->i = 0;
+	}
+	torque = KE * p->i * fit - B * p->w - p->load;
+	if ((p->w <= 0) && (torque < 0)) {
+		torque = 0;
+		p->w = 0;
+	}
+	p->w += torque / J * dt;
+	p->theta += p->w * POLE_PAIRS * dt;
+	if (p->demag > 0) {
+		p->demag -= dt;
+	}
+}
+
+/* Flat topped, crossing zero where sin() does */
+static double trapezoid(double a)
+{
+	double s = 2 * sin(a);
+
+	return (s > 1) ? 1 : ((s < -1) ? -1 : s);
+}
+
+/*
+ * The floating phase, in ADC counts. Phase k crosses zero 30 degrees into
+ * the steps it floats in, see the table in bemf.c. While it is still
+ * clamped it sits at the rail past the crossing, which is what makes
+ * the blanking necessary.
+ */
+static uint16_t floating(const struct plant *p, int step)
+{
+	int k = bemf_floating[step];
+	double e = KE / 2 * p->w * trapezoid(p->theta + M_PI / 6 +
+					     k * 2 * M_PI / 3);
+	double v = VBUS / 2 + e;
+	int n;
+
+	if (p->demag > 0) {
+		v = (step & 1) ? VBUS : 0;
+	}
+	n = v * ADC_PER_VOLT + rand() % (2 * ADC_NOISE + 1) - ADC_NOISE;
+	return (n < 0) ? 0 : ((n > 4095) ? 4095 : n);
+}
+
+static const char *state_name[] = { "stop", "align", "ramp", "run" };
+
+int main(int argc, char **argv)
+{
+	struct bemf_cfg cfg = {
+		.clock_hz = CLOCK_HZ,
+		.align_duty = PWM_PERIOD / 10,
+		.align_time = CLOCK_HZ * 3 / 10,
+		.ramp_duty = PWM_PERIOD / 8,
+		.ramp_start = 30,
+		.ramp_end = 800,
+		.ramp_accel = 1000,
+		.zc_filter = 2,
+		.lock_steps = 12,
+		.miss_limit = 6,
+	};
+	static struct bemf m;
+	struct plant p = { 0, 0, 0.3, 0, 0 };
+	bool load = (argc > 1) && (strcmp(argv[1], "load") == 0);
+	const struct limits *lim = load ? &braked_run : &free_run;
+	enum bemf_action a;
+	uint32_t t, due = 0, n = 0;
+	bool scheduled = false, timed;
+	double err, err_sq = 0, err_max = 0, rms = 0;
+	int k, fails = 0;
+
+	bemf_init(&m, &cfg);
+	bemf_start(&m, 0, PWM_PERIOD * 3 / 10);
+
+	printf("#  t   state  speed  duty\n");
+	for (t = 0; t < 3 * CLOCK_HZ; t++) {
+		if (load) {
+			p.load = ((t >= BRAKE_START) &&
+				  (t < BRAKE_START + BRAKE_TIME)) ?
+				 BRAKE_LOAD : 0;
+		}
+
+		a = BEMF_NONE;
+		if (scheduled && (t == due)) {
+			scheduled = false;
+			a = BEMF_COMMUTATE;
+		} else if (t % (CLOCK_HZ / PWM_HZ) == 0) {
+			a = bemf_sample(&m, t, floating(&p, m.step),
+					VBUS * ADC_PER_VOLT);
+			if (a == BEMF_SCHEDULE) {
+				/* Interrupt entry and register writes */
+				due = m.commutate_at + 1 + rand() % 3;
+				scheduled = true;
+				a = BEMF_NONE;
+			}
+		}
+		if (a == BEMF_COMMUTATE) {
+			/* Not the forced ones, nor the last of the ramp */
+			timed = m.pending && (!load || (t < BRAKE_START) ||
+					      (t >= BRAKE_START + BRAKE_TIME +
+						    RECOVER_TIME));
+			scheduled = false;
+			bemf_commutate(&m, t);
+			p.demag = L * p.i / (VBUS / 2);
+			if (timed) {
+				/* Rotor angle past the step's sector */
+				err = remainder(p.theta - m.step * M_PI / 3,
+						2 * M_PI) * 180 / M_PI;
+				err_sq += err * err;
+				if (fabs(err) > err_max) {
+					err_max = fabs(err);
+				}
+				n++;
+			}
+		}
+
+		plant_step(&p, m.step, (double)m.duty / PWM_PERIOD,
+			   1.0 / CLOCK_HZ);
+
+		if (t % (CLOCK_HZ / 20) == 0) {
+			printf("%4.2f %6s %6.0f %5u\n", (double)t / CLOCK_HZ,
+			       state_name[m.state],
+			       p.w * POLE_PAIRS * 6 / (2 * M_PI), m.duty);
+		}
+	}
+
+	printf("# commutations %u, zero crossings %u, missed %u, "
+	       "restarts %u\n", m.commutations, m.zero_crossings, m.missed,
+	       m.restarts);
+	if (m.scheduled != 0) {
+		printf("# latency mean %.2fus max %uus, detection lag mean "
+		       "%.1fus max %uus\n",
+		       (double)m.latency_sum / m.scheduled, m.latency_max,
+		       (double)m.lag_sum / m.zero_crossings, m.lag_max);
+	}
+	if (n != 0) {
+		rms = sqrt(err_sq / n);
+		printf("# commutation angle error rms %.1f max %.1f degrees\n",
+		       rms, err_max);
+	}
+
+	k = m.state != BEMF_RUN;
+	printf("# %s %s at the end\n", k ? "FAIL" : "ok",
+	       state_name[m.state]);
+	fails += k;
+	k = (m.missed > lim->missed) || (m.restarts > lim->restarts);
+	printf("# %s missed %u of %u, restarts %u of %u\n", k ? "FAIL" : "ok",
+	       m.missed, lim->missed, m.restarts, lim->restarts);
+	fails += k;
+	k = m.latency_max > lim->latency;
+	printf("# %s latency %uus of %uus\n", k ? "FAIL" : "ok",
+	       m.latency_max, lim->latency);
+	fails += k;
+	k = (n == 0) || (rms > lim->err_rms) || (err_max > lim->err_max);
+	printf("# %s angle error rms %.1f of %.1f, max %.1f of %.1f "
+	       "degrees\n", k ? "FAIL" : "ok", rms, lim->err_rms, err_max,
+	       lim->err_max);
+	fails += k;
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,457 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/systick.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "bemf.h"
+
+/*
+ * Sensorless BLDC drive on TIM1, the commutation itself is in bemf.c.
+ *
+ * TIM1 runs center aligned at 20kHz as in the stm32-h103 pwm_6step
+ * example. Channel 4 matches in the middle of the on time and starts an
+ * injected conversion of the floating phase and the supply; the ADC
+ * interrupt hands both to bemf_sample(). TIM2 counts microseconds, made
+ * 32 bits wide in clock_now(), and its channel 1 fires the commutations
+ * bemf_sample() schedules 30 degrees after each zero crossing. The ADC
+ * and TIM2 interrupts share a priority so neither cuts into the other.
+ *
+ * Statistics go out on USART1 (remapped, TX on PB6) once a second.
+ */
+
+#define PWM_HZ		20000
+#define PWM_PERIOD	(72000000 / 2 / PWM_HZ)
+
+/* Phase A, B and C and the supply, through dividers; check the board */
+static const uint8_t phase_channel[3] = { 3, 4, 5 };
+#define VBUS_CHANNEL	0
+
+#define RUN_DUTY	(PWM_PERIOD * 3 / 10)
+
+int _write(int file, char *ptr, int len);
+
+static volatile uint32_t system_millis;
+static struct bemf motor;
+
+static const struct bemf_cfg motor_cfg = {
+	.clock_hz = 1000000,
+	.align_duty = PWM_PERIOD / 10,
+	.align_time = 300000,
+	.ramp_duty = PWM_PERIOD / 8,
+	.ramp_start = 30,
+	.ramp_end = 800,
+	.ramp_accel = 1000,
+	.zc_filter = 2,
+	.lock_steps = 12,
+	.miss_limit = 6,
+};
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_8mhz_out_72mhz();
+
+	/* Enable GPIOA, GPIOB and Alternate Function clocks. */
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_AFIO);
+
+	/* 1ms SysTick */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+void sys_tick_handler(void)
+{
+	system_millis++;
+}
+
+static void gpio_setup(void)
+{
+	/* LEDs on PA6 and PA7. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO6 | GPIO7);
+
+	/* Phase and supply voltages. */
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG,
+		      GPIO0 | GPIO3 | GPIO4 | GPIO5);
+}
+
+static void usart_setup(void)
+{
+	rcc_periph_clock_enable(RCC_USART1);
+
+	AFIO_MAPR |= AFIO_MAPR_USART1_REMAP;
+
+	/* Setup GPIO pin GPIO_USART1_RE_TX on GPIO port B for transmit. */
+	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_RE_TX);
+
+	/* Setup UART parameters. */
+	usart_set_baudrate(USART1, 230400);
+	usart_set_databits(USART1, 8);
+	usart_set_stopbits(USART1, USART_STOPBITS_1);
+	usart_set_mode(USART1, USART_MODE_TX);
+	usart_set_parity(USART1, USART_PARITY_NONE);
+	usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
+
+	/* Finally enable the USART. */
+	usart_enable(USART1);
+}
+
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART1, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+static void pwm_setup(void)
+{
+	/* Enable TIM1 clock. */
+	rcc_periph_clock_enable(RCC_TIM1);
+
+	/*
+	 * Set TIM1 channel output pins to
+	 * 'output alternate function push-pull'.
+	 */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
+		      GPIO_TIM1_CH1 | GPIO_TIM1_CH2 | GPIO_TIM1_CH3);
+
+	/*
+	 * Set TIM1 complementary channel output pins to
+	 * 'output alternate function push-pull'.
+	 */
+	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
+		      GPIO_TIM1_CH1N | GPIO_TIM1_CH2N | GPIO_TIM1_CH3N);
+
+	/* Reset TIM1 peripheral. */
+	rcc_periph_reset_pulse(RST_TIM1);
+
+	/* Timer global mode:
+	 * - No divider
+	 * - Alignment center, compare flags while counting down
+	 * - Direction up
+	 */
+	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_CENTER_1, TIM_CR1_DIR_UP);
+
+	timer_set_prescaler(TIM1, 0);
+	timer_set_repetition_counter(TIM1, 1);
+	timer_enable_preload(TIM1);
+	timer_continuous_mode(TIM1);
+	timer_set_period(TIM1, PWM_PERIOD);
+
+	/* Configure break and deadtime. */
+	timer_set_deadtime(TIM1, 10);
+	timer_set_enabled_off_state_in_idle_mode(TIM1);
+	timer_set_enabled_off_state_in_run_mode(TIM1);
+	timer_disable_break(TIM1);
+	timer_set_break_polarity_high(TIM1);
+	timer_disable_break_automatic_output(TIM1);
+	timer_set_break_lock(TIM1, TIM_BDTR_LOCK_OFF);
+
+	/* All three half bridges alike, outputs off until started. */
+	timer_disable_oc_output(TIM1, TIM_OC1);
+	timer_disable_oc_output(TIM1, TIM_OC1N);
+	timer_enable_oc_preload(TIM1, TIM_OC1);
+	timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_PWM1);
+	timer_set_oc_polarity_high(TIM1, TIM_OC1);
+	timer_set_oc_polarity_high(TIM1, TIM_OC1N);
+	timer_set_oc_value(TIM1, TIM_OC1, 0);
+
+	timer_disable_oc_output(TIM1, TIM_OC2);
+	timer_disable_oc_output(TIM1, TIM_OC2N);
+	timer_enable_oc_preload(TIM1, TIM_OC2);
+	timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_PWM1);
+	timer_set_oc_polarity_high(TIM1, TIM_OC2);
+	timer_set_oc_polarity_high(TIM1, TIM_OC2N);
+	timer_set_oc_value(TIM1, TIM_OC2, 0);
+
+	timer_disable_oc_output(TIM1, TIM_OC3);
+	timer_disable_oc_output(TIM1, TIM_OC3N);
+	timer_enable_oc_preload(TIM1, TIM_OC3);
+	timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_PWM1);
+	timer_set_oc_polarity_high(TIM1, TIM_OC3);
+	timer_set_oc_polarity_high(TIM1, TIM_OC3N);
+	timer_set_oc_value(TIM1, TIM_OC3, 0);
+
+	/* OC4, ADC trigger in the middle of the on time. */
+	timer_set_oc_mode(TIM1, TIM_OC4, TIM_OCM_PWM1);
+	timer_set_oc_value(TIM1, TIM_OC4, 1);
+
+	/* New steps are latched all at once by a COM event. */
+	timer_enable_preload_complementry_enable_bits(TIM1);
+
+	timer_enable_break_main_output(TIM1);
+	timer_enable_counter(TIM1);
+}
+
+/* Free running at 1MHz, channel 1 for the commutations. */
+static void clock_timer_setup(void)
+{
+	rcc_periph_clock_enable(RCC_TIM2);
+	rcc_periph_reset_pulse(RST_TIM2);
+
+	timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	/* TIM2 runs at twice the 36MHz APB1 clock. */
+	timer_set_prescaler(TIM2, 72 - 1);
+	timer_set_period(TIM2, 0xffff);
+	timer_set_oc_mode(TIM2, TIM_OC1, TIM_OCM_FROZEN);
+	/* The prescaler only loads on an update, make one now */
+	timer_generate_event(TIM2, TIM_EGR_UG);
+	timer_clear_flag(TIM2, TIM_SR_UIF);
+	timer_enable_counter(TIM2);
+
+	nvic_set_priority(NVIC_TIM2_IRQ, 1 << 4);
+	nvic_enable_irq(NVIC_TIM2_IRQ);
+}
+
+static void adc_setup(void)
+{
+	int i;
+
+	rcc_periph_clock_enable(RCC_ADC1);
+
+	/* Make sure the ADC doesn't run during config. */
+	adc_power_off(ADC1);
+
+	/* Two injected conversions on TIM1 CC4, the sequence is set later. */
+	adc_enable_scan_mode(ADC1);
+	adc_set_single_conversion_mode(ADC1);
+	adc_enable_external_trigger_injected(ADC1, ADC_CR2_JEXTSEL_TIM1_CC4);
+	adc_enable_eoc_interrupt_injected(ADC1);
+	adc_set_right_aligned(ADC1);
+	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_7DOT5CYC);
+
+	adc_power_on(ADC1);
+
+	/* Wait for ADC starting up. */
+	for (i = 0; i < 800000; i++)    /* Wait a bit. */
+		__asm__("nop");
+
+	adc_reset_calibration(ADC1);
+	adc_calibrate(ADC1);
+
+	nvic_set_priority(NVIC_ADC1_2_IRQ, 1 << 4);
+	nvic_enable_irq(NVIC_ADC1_2_IRQ);
+}
+
+/*
+ * Microseconds, 32 bits wide. Called at least once per PWM period from
+ * the interrupts, which is plenty to catch every wrap of the 16 bit
+ * counter.
+ */
+static uint32_t clock_now(void)
+{
+	static uint32_t now;
+	static uint16_t last;
+	uint16_t cnt = timer_get_counter(TIM2);
+
+	now += (uint16_t)(cnt - last);
+	last = cnt;
+	return now;
+}
+
+static void set_duty(uint16_t duty)
+{
+	timer_set_oc_value(TIM1, TIM_OC1, duty);
+	timer_set_oc_value(TIM1, TIM_OC2, duty);
+	timer_set_oc_value(TIM1, TIM_OC3, duty);
+}
+
+/*
+ * One phase, into the preload registers, see the table in bemf.c.
+ * With only the complementary output enabled it follows OCxREF as it
+ * is, so PWM1 switches the low side with the same duty as the high.
+ */
+static void set_phase(enum tim_oc_id oc, enum tim_oc_id ocn, uint8_t drive)
+{
+	switch (drive) {
+	case BEMF_PWM_HIGH:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_PWM1);
+		timer_enable_oc_output(TIM1, oc);
+		timer_disable_oc_output(TIM1, ocn);
+		break;
+	case BEMF_PWM_LOW:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_PWM1);
+		timer_disable_oc_output(TIM1, oc);
+		timer_enable_oc_output(TIM1, ocn);
+		break;
+	case BEMF_HIGH:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_FORCE_HIGH);
+		timer_enable_oc_output(TIM1, oc);
+		timer_enable_oc_output(TIM1, ocn);
+		break;
+	case BEMF_LOW:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_FORCE_LOW);
+		timer_enable_oc_output(TIM1, oc);
+		timer_enable_oc_output(TIM1, ocn);
+		break;
+	default:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_FROZEN);
+		timer_disable_oc_output(TIM1, oc);
+		timer_disable_oc_output(TIM1, ocn);
+		break;
+	}
+}
+
+/* Switch to bemf_drive[motor.step] and sample its floating phase. */
+static void apply_step(void)
+{
+	const uint8_t *drive = bemf_drive[motor.step];
+	uint8_t channels[2];
+
+	set_phase(TIM_OC1, TIM_OC1N, drive[0]);
+	set_phase(TIM_OC2, TIM_OC2N, drive[1]);
+	set_phase(TIM_OC3, TIM_OC3N, drive[2]);
+	/* All three at once. */
+	timer_generate_event(TIM1, TIM_EGR_COMG);
+
+	channels[0] = phase_channel[bemf_floating[motor.step]];
+	channels[1] = VBUS_CHANNEL;
+	adc_set_injected_sequence(ADC1, 2, channels);
+
+	gpio_toggle(GPIOA, GPIO6);
+}
+
+static void commutate(void)
+{
+	bemf_commutate(&motor, clock_now());
+	apply_step();
+}
+
+/* Have TIM2 channel 1 fire at motor.commutate_at. */
+static void schedule(void)
+{
+	uint32_t now = clock_now();
+	uint16_t cnt = timer_get_counter(TIM2);
+
+	/* Too close to be sure the compare doesn't go past first. */
+	if ((int32_t)(motor.commutate_at - now) < 3) {
+		commutate();
+		return;
+	}
+	timer_set_oc_value(TIM2, TIM_OC1, cnt + (motor.commutate_at - now));
+	timer_clear_flag(TIM2, TIM_SR_CC1IF);
+	timer_enable_irq(TIM2, TIM_DIER_CC1IE);
+}
+
+void tim2_isr(void)
+{
+	timer_clear_flag(TIM2, TIM_SR_CC1IF);
+	timer_disable_irq(TIM2, TIM_DIER_CC1IE);
+	commutate();
+}
+
+void adc1_2_isr(void)
+{
+	uint16_t phase, vbus;
+
+	/* Clear Injected End Of Conversion (JEOC) */
+	ADC_SR(ADC1) &= ~ADC_SR_JEOC;
+
+	phase = adc_read_injected(ADC1, 1);
+	vbus = adc_read_injected(ADC1, 2);
+
+	switch (bemf_sample(&motor, clock_now(), phase, vbus)) {
+	case BEMF_COMMUTATE:
+		commutate();
+		break;
+	case BEMF_SCHEDULE:
+		schedule();
+		break;
+	default:
+		break;
+	}
+	set_duty(motor.duty);
+}
+
+static void start(void)
+{
+	cm_disable_interrupts();
+	bemf_start(&motor, clock_now(), RUN_DUTY);
+	apply_step();
+	set_duty(motor.duty);
+	cm_enable_interrupts();
+}
+
+int main(void)
+{
+	struct bemf now, last;
+	uint32_t next, n, zc;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+	bemf_init(&motor, &motor_cfg);
+	clock_timer_setup();
+	adc_setup();
+	pwm_setup();
+
+	printf("Sensorless BLDC\r\n");
+	start();
+
+	last = motor;
+	next = system_millis + 1000;
+	while (1) {
+		while ((int32_t)(system_millis - next) < 0);
+		next += 1000;
+
+		/* Near enough a snapshot for the statistics */
+		now = motor;
+		if (now.state == BEMF_RUN) {
+			gpio_set(GPIOA, GPIO7);
+		} else {
+			gpio_clear(GPIOA, GPIO7);
+		}
+
+		n = now.scheduled - last.scheduled;
+		zc = now.zero_crossings - last.zero_crossings;
+		printf("%lu steps/s, %lu crossings, %lu missed, %lu restarts, ",
+		       now.commutations - last.commutations,
+		       zc, now.missed - last.missed, now.restarts);
+		printf("latency %luus (max %luus), lag %luus (max %luus)\r\n",
+		       n ? (now.latency_sum - last.latency_sum) / n : 0,
+		       now.latency_max,
+		       zc ? (now.lag_sum - last.lag_sum) / zc : 0,
+		       now.lag_max);
+		last = now;
+	}
+
+	return 0;
+}
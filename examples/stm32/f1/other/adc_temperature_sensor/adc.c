@@ -22,6 +22,34 @@
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/adc.h>
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include "tempcal.h"
+
+/*
+ * 4^OVERSAMPLE_BITS conversions per reading, giving 12 + OVERSAMPLE_BITS
+ * bit codes. At 239.5 cycles sample time and a 12MHz ADC clock one
+ * conversion takes 21us, so 256 of them take about 5ms.
+ */
+#define OVERSAMPLE_BITS	4
+#define CODE_BITS	(12 + OVERSAMPLE_BITS)
+
+#define ADC_CHANNEL_TEMP	16
+#define ADC_CHANNEL_VREF	17
+
+/* Last 1K page of the 128K flash, see adc.ld */
+#define CAL_ADDRESS	0x0801fc00
+
+static struct tempcal cal;
+static struct tempcal_point cal_a;
+static bool cal_a_valid;
+
+/*
+ * One command line from the USART interrupt. While line_ready is set
+ * the line belongs to main and further input is dropped.
+ */
+static char line[16];
+static volatile bool line_ready;
 
 static void usart_setup(void)
 {
@@ -32,6 +60,9 @@ static void usart_setup(void)
 	/* Setup GPIO pin GPIO_USART1_TX/GPIO9 on GPIO port A for transmit. */
 	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
 		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_TX);
+	/* And GPIO_USART1_RX/GPIO10 for the calibration commands. */
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT,
+		      GPIO_CNF_INPUT_FLOAT, GPIO_USART1_RX);
 
 	/* Setup UART parameters. */
 	usart_set_baudrate(USART1, 115200);
@@ -41,10 +72,38 @@ static void usart_setup(void)
 	usart_set_parity(USART1, USART_PARITY_NONE);
 	usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
 
+	/* Commands come in by interrupt, the ADC loop is too busy to poll. */
+	usart_enable_rx_interrupt(USART1);
+	nvic_enable_irq(NVIC_USART1_IRQ);
+
 	/* Finally enable the USART. */
 	usart_enable(USART1);
 }
 
+void usart1_isr(void)
+{
+	static unsigned int len;
+	char c;
+
+	if (!usart_get_flag(USART1, USART_SR_RXNE)) {
+		return;
+	}
+	c = usart_recv(USART1);
+	if (line_ready) {
+		return;
+	}
+
+	if ((c == '\r') || (c == '\n')) {
+		if (len > 0) {
+			line[len] = '\0';
+			line_ready = true;
+		}
+		len = 0;
+	} else if (len < sizeof(line) - 1) {
+		line[len++] = c;
+	}
+}
+
 static void gpio_setup(void)
 {
 	/* Enable GPIOB clock. */
@@ -71,9 +130,13 @@ static void adc_setup(void)
 	adc_set_single_conversion_mode(ADC1);
 	adc_disable_external_trigger_regular(ADC1);
 	adc_set_right_aligned(ADC1);
-	/* We want to read the temperature sensor, so we have to enable it. */
+	/*
+	 * We want to read the temperature sensor and VREFINT, this enables
+	 * both. The sensor wants at least 17.1us of sample time, which is
+	 * 239.5 cycles at 12MHz.
+	 */
 	adc_enable_temperature_sensor();
-	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
+	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_239DOT5CYC);
 
 	adc_power_on(ADC1);
 
@@ -85,69 +148,263 @@ static void adc_setup(void)
 	adc_calibrate(ADC1);
 }
 
-static void my_usart_print_int(uint32_t usart, int value)
+/* Oversampled reading of one channel, CODE_BITS wide */
+static uint32_t adc_read_oversampled(uint8_t channel)
+{
+	uint8_t channel_array[1];
+	uint32_t sum = 0;
+	int i;
+
+	channel_array[0] = channel;
+	adc_set_regular_sequence(ADC1, 1, channel_array);
+
+	for (i = 0; i < (1 << (2 * OVERSAMPLE_BITS)); i++) {
+		adc_start_conversion_direct(ADC1);
+		while (!(ADC_SR(ADC1) & ADC_SR_EOC));
+		sum += ADC_DR(ADC1);
+	}
+
+	return tempcal_oversample(sum, OVERSAMPLE_BITS);
+}
+
+/*
+ * Calibration table in flash. Anything that does not check out, like an
+ * erased page, means the datasheet defaults.
+ */
+static void cal_load(void)
+{
+	const struct tempcal *stored = (const struct tempcal *)CAL_ADDRESS;
+
+	if (tempcal_valid(stored)) {
+		cal = *stored;
+	} else {
+		tempcal_defaults(&cal);
+	}
+}
+
+static bool cal_save(void)
+{
+	const uint32_t *src = (const uint32_t *)&cal;
+	uint32_t i;
+	bool ok = true;
+
+	flash_unlock();
+	flash_erase_page(CAL_ADDRESS);
+	if (flash_get_status_flags() != FLASH_SR_EOP) {
+		ok = false;
+	}
+	for (i = 0; ok && (i < sizeof(cal) / 4); i++) {
+		flash_program_word(CAL_ADDRESS + i * 4, src[i]);
+		if (flash_get_status_flags() != FLASH_SR_EOP) {
+			ok = false;
+		}
+	}
+	flash_lock();
+
+	return ok && tempcal_valid((const struct tempcal *)CAL_ADDRESS);
+}
+
+static void print_str(const char *s)
 {
-	int8_t i;
-	uint8_t nr_digits = 0;
-	char buffer[25];
+	while (*s) {
+		usart_send_blocking(USART1, *s++);
+	}
+}
+
+/* value / 10^decimals, with the fraction padded to decimals digits */
+static void print_fixed(int32_t value, int decimals)
+{
+	char buffer[12];
+	int n = 0;
+	uint32_t u;
 
 	if (value < 0) {
-		usart_send(usart, '-');
-		value = value * -1;
+		usart_send_blocking(USART1, '-');
+		u = -(uint32_t)value;
+	} else {
+		u = value;
 	}
 
-	while (value > 0) {
-		buffer[nr_digits++] = "0123456789"[value % 10];
-		value /= 10;
+	do {
+		buffer[n++] = '0' + u % 10;
+		u /= 10;
+		if (n == decimals) {
+			buffer[n++] = '.';
+		}
+	} while ((u > 0) || (n <= decimals + 1 && decimals > 0));
+
+	while (n > 0) {
+		usart_send_blocking(USART1, buffer[--n]);
 	}
+}
 
-	for (i = nr_digits; i >= 0; i--)
-		usart_send(usart, buffer[i]);
+/*
+ * "23.5" or "-5" to hundredths, returns false on anything else. Digits
+ * past the second decimal are dropped.
+ */
+static bool parse_c100(const char *s, int32_t *out)
+{
+	int32_t v = 0;
+	int frac = -1;
+	bool neg = false, digits = false;
+
+	if (*s == '-') {
+		neg = true;
+		s++;
+	}
+	for (; *s; s++) {
+		if ((*s == '.') && (frac < 0)) {
+			frac = 0;
+		} else if ((*s >= '0') && (*s <= '9')) {
+			digits = true;
+			if (frac < 2) {
+				if (v > 1000000) {
+					return false;
+				}
+				v = v * 10 + (*s - '0');
+				if (frac >= 0) {
+					frac++;
+				}
+			}
+		} else {
+			return false;
+		}
+	}
+	if (!digits) {
+		return false;
+	}
+	for (frac = (frac < 0) ? 0 : frac; frac < 2; frac++) {
+		v *= 10;
+	}
+	*out = neg ? -v : v;
+	return true;
+}
+
+static void print_cal(void)
+{
+	print_str("VREFINT ");
+	print_fixed(cal.vrefint_uv, 6);
+	print_str(" V, V25 ");
+	print_fixed(cal.v25_uv, 6);
+	print_str(" V, slope ");
+	print_fixed(cal.slope_uv, 3);
+	print_str(" mV/C\r\n");
+}
+
+static void print_help(void)
+{
+	print_str("Commands, each ended by return:\r\n"
+		  "  a <C>   first calibration point, at <C> degrees\r\n"
+		  "  b <C>   second point, computes and saves V25/slope\r\n"
+		  "  v <mV>  VREFINT against a measured VDDA, saves\r\n"
+		  "  d       back to the datasheet defaults\r\n");
+}
+
+/*
+ * Handle one command line. The sensor and VREFINT codes are the ones
+ * just printed, so the point is taken at what the user last saw.
+ */
+static void command(const char *line, uint32_t code_ts, uint32_t code_vref)
+{
+	struct tempcal_point b;
+	int32_t arg = 0;
+	bool have_arg = (line[0] != '\0') && (line[1] == ' ') &&
+			parse_c100(&line[2], &arg);
+
+	switch (line[0]) {
+	case 'a':
+		if (!have_arg) {
+			break;
+		}
+		cal_a.temp_c100 = arg;
+		cal_a.vsense_uv = tempcal_vsense_uv(&cal, code_ts, code_vref);
+		cal_a_valid = true;
+		print_str("point a taken\r\n");
+		return;
+	case 'b':
+		if (!have_arg) {
+			break;
+		}
+		if (!cal_a_valid) {
+			print_str("take point a first\r\n");
+			return;
+		}
+		b.temp_c100 = arg;
+		b.vsense_uv = tempcal_vsense_uv(&cal, code_ts, code_vref);
+		if (!tempcal_two_point(&cal, &cal_a, &b)) {
+			print_str("points too close or the wrong way round\r\n");
+			return;
+		}
+		cal_a_valid = false;
+		break;
+	case 'v':
+		/* parse_c100 scales by 100, mV * 10 is uV */
+		if (!have_arg || (arg <= 0)) {
+			break;
+		}
+		tempcal_vrefint(&cal, code_vref, CODE_BITS, arg * 10);
+		/* Old points were taken with the old VREFINT */
+		cal_a_valid = false;
+		break;
+	case 'd':
+		tempcal_defaults(&cal);
+		cal_a_valid = false;
+		break;
+	default:
+		print_help();
+		return;
+	}
+
+	if (!have_arg && (line[0] != 'd')) {
+		print_help();
+		return;
+	}
+	print_str(cal_save() ? "saved: " : "flash write failed: ");
+	print_cal();
 }
 
 int main(void)
 {
-	uint8_t channel_array[16];
-	uint16_t temperature;
+	uint32_t code_ts, code_vref;
+	int32_t vsense;
+	int i;
 
 	rcc_clock_setup_in_hse_16mhz_out_72mhz();
 	gpio_setup();
 	usart_setup();
 	adc_setup();
+	cal_load();
 
 	gpio_clear(GPIOB, GPIO7);	/* LED1 on */
 	gpio_set(GPIOB, GPIO6);		/* LED2 off */
 
-	/* Send a message on USART1. */
-	usart_send(USART1, 's');
-	usart_send(USART1, 't');
-	usart_send(USART1, 'm');
-	usart_send(USART1, '\r');
-	usart_send(USART1, '\n');
-
-	/* Select the channel we want to convert. 16=temperature_sensor. */
-	channel_array[0] = 16;
-	adc_set_regular_sequence(ADC1, 1, channel_array);
-
-	/*
-	 * Start the conversion directly (not trigger mode).
-	 */
-	adc_start_conversion_direct(ADC1);
+	print_str("stm32 temperature sensor\r\n");
+	print_cal();
+	print_help();
 
-	/* Wait for end of conversion. */
-	while (!(ADC_SR(ADC1) & ADC_SR_EOC));
+	while (1) {
+		code_ts = adc_read_oversampled(ADC_CHANNEL_TEMP);
+		code_vref = adc_read_oversampled(ADC_CHANNEL_VREF);
+		vsense = tempcal_vsense_uv(&cal, code_ts, code_vref);
 
-	temperature = ADC_DR(ADC1);
+		print_fixed(tempcal_temp_c100(&cal, vsense), 2);
+		print_str(" C, VDDA ");
+		print_fixed(tempcal_vdda_uv(&cal, code_vref, CODE_BITS) / 1000,
+			    3);
+		print_str(" V, sensor ");
+		print_fixed(vsense / 100, 4);
+		print_str(" V\r\n");
 
-	/*
-	 * That's actually not the real temperature - you have to compute it
-	 * as described in the datasheet.
-	 */
-	my_usart_print_int(USART1, temperature);
+		gpio_toggle(GPIOB, GPIO6);	/* LED2 */
 
-	gpio_clear(GPIOB, GPIO6); /* LED2 on */
+		if (line_ready) {
+			command(line, code_ts, code_vref);
+			line_ready = false;
+		}
 
-	while(1); /* Halt. */
+		for (i = 0; i < 2000000; i++)	/* Wait a bit. */
+			__asm__("nop");
+	}
 
 	return 0;
 }
@@ -0,0 +1,144 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tempcal.h"
+
+static uint32_t tempcal_sum(const struct tempcal *cal)
+{
+	return ~(cal->magic + (uint32_t)cal->vrefint_uv +
+		 (uint32_t)cal->v25_uv + (uint32_t)cal->slope_uv);
+}
+
+void tempcal_defaults(struct tempcal *cal)
+{
+	cal->vrefint_uv = TEMPCAL_VREFINT_UV;
+	cal->v25_uv = TEMPCAL_V25_UV;
+	cal->slope_uv = TEMPCAL_SLOPE_UV;
+	tempcal_seal(cal);
+}
+
+/* Mark the table as valid, after changing it */
+void tempcal_seal(struct tempcal *cal)
+{
+	cal->magic = TEMPCAL_MAGIC;
+	cal->check = tempcal_sum(cal);
+}
+
+/* For a table read back from flash, erased flash fails this as well */
+bool tempcal_valid(const struct tempcal *cal)
+{
+	return (cal->magic == TEMPCAL_MAGIC) &&
+	       (cal->check == tempcal_sum(cal)) &&
+	       (cal->vrefint_uv > 0) && (cal->slope_uv > 0);
+}
+
+/*
+ * tempcal_oversample
+ *
+ * sum is 4^extra_bits raw conversions added up. With enough noise on
+ * the input (the sensor has plenty) this gives extra_bits more bits of
+ * resolution, the result is a 12 + extra_bits bit code, rounded.
+ */
+uint32_t tempcal_oversample(uint32_t sum, unsigned extra_bits)
+{
+	if (extra_bits == 0) {
+		return sum;
+	}
+	return (sum + (1UL << (extra_bits - 1))) >> extra_bits;
+}
+
+/*
+ * tempcal_vsense_uv
+ *
+ * The sensor voltage from the sensor and VREFINT codes, which must have
+ * the same resolution. Taking the ratio to VREFINT cancels out VDDA,
+ * which the ADC uses as its reference.
+ */
+int32_t tempcal_vsense_uv(const struct tempcal *cal, uint32_t code_ts,
+			  uint32_t code_vref)
+{
+	if (code_vref == 0) {
+		return 0;
+	}
+	return ((uint64_t)code_ts * (uint32_t)cal->vrefint_uv +
+		code_vref / 2) / code_vref;
+}
+
+/* The supply, for a VREFINT code of the given resolution in bits */
+int32_t tempcal_vdda_uv(const struct tempcal *cal, uint32_t code_vref,
+			unsigned bits)
+{
+	if (code_vref == 0) {
+		return 0;
+	}
+	return ((uint64_t)cal->vrefint_uv << bits) / code_vref;
+}
+
+/* T = 25 + (V25 - Vsense) / slope */
+int32_t tempcal_temp_c100(const struct tempcal *cal, int32_t vsense_uv)
+{
+	int32_t num = (cal->v25_uv - vsense_uv) * 100;
+
+	/* Round to nearest, either way from zero */
+	if (num >= 0) {
+		num += cal->slope_uv / 2;
+	} else {
+		num -= cal->slope_uv / 2;
+	}
+	return 2500 + num / cal->slope_uv;
+}
+
+/*
+ * tempcal_two_point
+ *
+ * Replace V25 and the slope with the line through two measured points.
+ * They should be a good way apart, refuses points less than 5 C apart
+ * or a slope with the wrong sign. VREFINT is left alone, and must not
+ * change between taking the points and using the result.
+ */
+bool tempcal_two_point(struct tempcal *cal, const struct tempcal_point *a,
+		       const struct tempcal_point *b)
+{
+	int32_t dt = b->temp_c100 - a->temp_c100;
+	int32_t dv = a->vsense_uv - b->vsense_uv;
+	int32_t slope;
+
+	if ((dt < 500) && (dt > -500)) {
+		return false;
+	}
+	slope = ((int64_t)dv * 100) / dt;
+	if (slope <= 0) {
+		return false;
+	}
+	cal->slope_uv = slope;
+	cal->v25_uv = a->vsense_uv +
+		      ((int64_t)(a->temp_c100 - 2500) * slope) / 100;
+	tempcal_seal(cal);
+	return true;
+}
+
+/*
+ * tempcal_vrefint
+ *
+ * Measure VREFINT while VDDA is known, e.g. with a meter on the supply.
+ */
+void tempcal_vrefint(struct tempcal *cal, uint32_t code_vref, unsigned bits,
+		     int32_t vdda_uv)
+{
+	cal->vrefint_uv = ((uint64_t)code_vref * (uint32_t)vdda_uv) >> bits;
+	tempcal_seal(cal);
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPCAL_H
+#define TEMPCAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Temperature sensor conversion with integer math only. Voltages are in
+ * uV, temperatures in hundredths of a degree C. Nothing in here touches
+ * the hardware.
+ *
+ * The F1 has no factory calibration in its system memory, so the
+ * defaults are the typical values from the datasheet. A two point
+ * calibration replaces V25 and the slope, and VREFINT can be measured
+ * against a known supply.
+ */
+
+#define TEMPCAL_MAGIC		0x54434131	/* "TCA1" */
+
+/* Datasheet typical values */
+#define TEMPCAL_VREFINT_UV	1200000
+#define TEMPCAL_V25_UV		1430000
+#define TEMPCAL_SLOPE_UV	4300	/* per degree C */
+
+struct tempcal {
+	uint32_t magic;
+	int32_t vrefint_uv;	/* VREFINT */
+	int32_t v25_uv;		/* sensor output at 25 C */
+	int32_t slope_uv;	/* sensor output drop per degree C */
+	uint32_t check;		/* ~(sum of the words above) */
+};
+
+/* One calibration point, temperature and what the sensor said there */
+struct tempcal_point {
+	int32_t temp_c100;
+	int32_t vsense_uv;
+};
+
+void tempcal_defaults(struct tempcal *cal);
+void tempcal_seal(struct tempcal *cal);
+bool tempcal_valid(const struct tempcal *cal);
+
+uint32_t tempcal_oversample(uint32_t sum, unsigned extra_bits);
+int32_t tempcal_vsense_uv(const struct tempcal *cal, uint32_t code_ts,
+			  uint32_t code_vref);
+int32_t tempcal_vdda_uv(const struct tempcal *cal, uint32_t code_vref,
+			unsigned bits);
+int32_t tempcal_temp_c100(const struct tempcal *cal, int32_t vsense_uv);
+bool tempcal_two_point(struct tempcal *cal, const struct tempcal_point *a,
+		       const struct tempcal_point *b);
+void tempcal_vrefint(struct tempcal *cal, uint32_t code_vref, unsigned bits,
+		     int32_t vdda_uv);
+
+#endif
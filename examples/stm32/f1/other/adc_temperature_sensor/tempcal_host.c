@@ -0,0 +1,333 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks tempcal.c on the host:
+ *
+ *	cc -o tempcal_host tempcal_host.c tempcal.c
+ *	./tempcal_host
+ *
+ * A model of the ADC turns a sensor at a given temperature and VREFINT
+ * into noisy 12-bit codes, at several supply voltages, which go through
+ * the same oversampling and conversion as adc.c. The temperature must
+ * come out right to within what the resolution allows, better with more
+ * oversampling, and independent of VDDA. A sensor that is off the
+ * datasheet is then calibrated from two points taken the same way, and
+ * the stored table is checked the way a table read back from flash is.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tempcal.h"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t rnd_state = 99;
+
+static uint32_t rnd(uint32_t n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % n;
+}
+
+/* A sensor, as it really is */
+struct chip {
+	int32_t vrefint_uv;
+	int32_t v25_uv;
+	int32_t slope_uv;
+};
+
+static const struct chip typical = { 1200000, 1430000, 4300 };
+/* near the edges of the datasheet spread */
+static const struct chip odd = { 1180000, 1340000, 4000 };
+
+static int32_t vsense(const struct chip *c, int32_t temp_c100)
+{
+	return c->v25_uv - (int64_t)(temp_c100 - 2500) * c->slope_uv / 100;
+}
+
+/*
+ * One conversion of uv with VDDA as reference, with about a code of
+ * noise (triangular, +-1.5 LSB) before an ideal quantizer, transitions
+ * half way between the codes.
+ */
+static uint32_t convert(int32_t uv, int32_t vdda_uv)
+{
+	int64_t x = (int64_t)uv * 4096 * 1024 / vdda_uv;
+
+	x += (int32_t)(rnd(1537) + rnd(1537)) - 1536 + 512;
+	if (x < 0) {
+		return 0;
+	}
+	x >>= 10;
+	return x > 4095 ? 4095 : x;
+}
+
+/* What adc.c does for a reading */
+static uint32_t reading(int32_t uv, int32_t vdda_uv, unsigned bits)
+{
+	uint32_t i, sum = 0;
+
+	for (i = 0; i < (1U << (2 * bits)); i++) {
+		sum += convert(uv, vdda_uv);
+	}
+	return tempcal_oversample(sum, bits);
+}
+
+static int32_t measure(const struct tempcal *cal, const struct chip *c,
+		       int32_t temp_c100, int32_t vdda_uv, unsigned bits)
+{
+	uint32_t ts = reading(vsense(c, temp_c100), vdda_uv, bits);
+	uint32_t vref = reading(c->vrefint_uv, vdda_uv, bits);
+
+	return tempcal_temp_c100(cal, tempcal_vsense_uv(cal, ts, vref));
+}
+
+static void test_oversample(void)
+{
+	unsigned n;
+
+	check(tempcal_oversample(1234, 0) == 1234, "no extra bits",
+	      tempcal_oversample(1234, 0), 1234);
+	for (n = 1; n <= 6; n++) {
+		uint32_t count = 1U << (2 * n);
+
+		check(tempcal_oversample(count * 4095, n) == 4095U << n,
+		      "full scale", n, tempcal_oversample(count * 4095, n));
+		check(tempcal_oversample(count * 1000, n) == 1000U << n,
+		      "constant", n, tempcal_oversample(count * 1000, n));
+	}
+	/* 100, 100, 100, 101 is 100.25, 200.5 in 13 bits, rounds up */
+	check(tempcal_oversample(401, 1) == 201, "round half up",
+	      tempcal_oversample(401, 1), 201);
+	check(tempcal_oversample(400, 1) == 200, "round down",
+	      tempcal_oversample(400, 1), 200);
+	/* 256 conversions of 1000 and 1001 half and half */
+	check(tempcal_oversample(128 * 1000 + 128 * 1001, 4) == 16008,
+	      "half a code", tempcal_oversample(128 * 2001, 4), 16008);
+
+	/* the noise averages out to 1241.2 codes */
+	n = reading(1000000, 3300000, 4);
+	check(n >= 19857 && n <= 19861, "dithered", n, 19859);
+}
+
+static void test_conversion(void)
+{
+	struct tempcal cal;
+
+	tempcal_defaults(&cal);
+	check(tempcal_temp_c100(&cal, 1430000) == 2500, "at V25",
+	      tempcal_temp_c100(&cal, 1430000), 2500);
+	check(tempcal_temp_c100(&cal, 1430000 - 43000) == 3500, "+10C",
+	      tempcal_temp_c100(&cal, 1430000 - 43000), 3500);
+	check(tempcal_temp_c100(&cal, 1430000 + 279500) == -4000, "-40C",
+	      tempcal_temp_c100(&cal, 1430000 + 279500), -4000);
+	check(tempcal_temp_c100(&cal, 1430000 - 430000) == 12500, "125C",
+	      tempcal_temp_c100(&cal, 1430000 - 430000), 12500);
+	/* 0.49 and 0.51 hundredths, both ways */
+	check(tempcal_temp_c100(&cal, 1430000 - 21) == 2500, "round 0.49",
+	      tempcal_temp_c100(&cal, 1430000 - 21), 2500);
+	check(tempcal_temp_c100(&cal, 1430000 - 22) == 2501, "round 0.51",
+	      tempcal_temp_c100(&cal, 1430000 - 22), 2501);
+	check(tempcal_temp_c100(&cal, 1430000 + 21) == 2500,
+	      "round -0.49", tempcal_temp_c100(&cal, 1430000 + 21), 2500);
+	check(tempcal_temp_c100(&cal, 1430000 + 22) == 2499,
+	      "round -0.51", tempcal_temp_c100(&cal, 1430000 + 22), 2499);
+
+	/* codes straight, VREFINT and the sensor as ratios of 4096 */
+	check(tempcal_vsense_uv(&cal, 1430, 1200) == 1430000, "vsense",
+	      tempcal_vsense_uv(&cal, 1430, 1200), 1430000);
+	check(tempcal_vsense_uv(&cal, 1, 0) == 0, "no vrefint", 0, 0);
+	check(tempcal_vdda_uv(&cal, 1200 << 4, 16) == 4096000, "vdda",
+	      tempcal_vdda_uv(&cal, 1200 << 4, 16), 4096000);
+	check(tempcal_vdda_uv(&cal, 0, 12) == 0, "vdda no vrefint", 0, 0);
+}
+
+/*
+ * The whole way from the sensor to hundredths of a degree, over the
+ * sensor's range and the F1's supply range. The limits are what the
+ * resolution and the noise allow: a code of VDDA / 4096 on both the
+ * sensor and VREFINT is about 0.2C with no oversampling.
+ */
+static void test_pipeline(void)
+{
+	static const int32_t vdda[] = { 2400000, 3000000, 3300000, 3600000 };
+	static const int32_t limit[] = { 60, 25, 8 };
+	static const unsigned bits[] = { 0, 2, 4 };
+	struct tempcal cal;
+	int32_t t, err, worst;
+	unsigned b, v;
+
+	tempcal_defaults(&cal);
+	for (b = 0; b < 3; b++) {
+		worst = 0;
+		for (v = 0; v < 4; v++) {
+			for (t = -4000; t <= 12500; t += 250) {
+				err = measure(&cal, &typical, t, vdda[v],
+					      bits[b]) - t;
+				if (err < 0) {
+					err = -err;
+				}
+				if (err > worst) {
+					worst = err;
+				}
+			}
+		}
+		check(worst <= limit[b], "pipeline", bits[b], worst);
+		printf("%u extra bits: worst error %ld.%02ld C\n", bits[b],
+		       (long)worst / 100, (long)worst % 100);
+	}
+
+	/* VDDA from VREFINT, 16 bit codes */
+	for (v = 0; v < 4; v++) {
+		err = tempcal_vdda_uv(&cal, reading(1200000, vdda[v], 4), 16) -
+		      vdda[v];
+		check(err > -1000 && err < 1000, "vdda from vrefint", vdda[v],
+		      err);
+	}
+}
+
+static void test_two_point(void)
+{
+	struct tempcal cal, before;
+	struct tempcal_point a, b;
+	int32_t t, err, worst = 0;
+
+	/* exact points give back the line */
+	tempcal_defaults(&cal);
+	a.temp_c100 = 1000;
+	a.vsense_uv = vsense(&odd, 1000);
+	b.temp_c100 = 6000;
+	b.vsense_uv = vsense(&odd, 6000);
+	check(tempcal_two_point(&cal, &a, &b), "two point", 0, 0);
+	check(cal.slope_uv == odd.slope_uv && cal.v25_uv == odd.v25_uv,
+	      "line", cal.slope_uv, cal.v25_uv);
+	check(tempcal_valid(&cal), "sealed", 0, 0);
+	check(tempcal_two_point(&cal, &b, &a) &&
+	      cal.slope_uv == odd.slope_uv && cal.v25_uv == odd.v25_uv,
+	      "either order", cal.slope_uv, cal.v25_uv);
+
+	/* refused: too close, or the wrong way round, and left alone */
+	before = cal;
+	b.temp_c100 = 1499;
+	check(!tempcal_two_point(&cal, &a, &b), "too close", 0, 0);
+	b.temp_c100 = 501;
+	check(!tempcal_two_point(&cal, &a, &b), "too close below", 0, 0);
+	b.temp_c100 = 6000;
+	b.vsense_uv = a.vsense_uv + 100000;
+	check(!tempcal_two_point(&cal, &a, &b), "rising", 0, 0);
+	b.vsense_uv = a.vsense_uv;
+	check(!tempcal_two_point(&cal, &a, &b), "flat", 0, 0);
+	check(memcmp(&cal, &before, sizeof(cal)) == 0, "untouched", 0, 0);
+
+	/*
+	 * An odd chip read with the datasheet values is several degrees
+	 * off. Calibrated from two oversampled readings, with VREFINT
+	 * measured at 3.3V first, it is right over the whole range.
+	 */
+	tempcal_defaults(&cal);
+	err = measure(&cal, &odd, 2500, 3300000, 4) - 2500;
+	check(err > 500 || err < -500, "uncalibrated", err, 500);
+
+	tempcal_vrefint(&cal, reading(odd.vrefint_uv, 3300000, 4), 16,
+			3300000);
+	check(cal.vrefint_uv > odd.vrefint_uv - 1000 &&
+	      cal.vrefint_uv < odd.vrefint_uv + 1000, "vrefint",
+	      cal.vrefint_uv, odd.vrefint_uv);
+	check(tempcal_valid(&cal), "vrefint sealed", 0, 0);
+
+	a.temp_c100 = 2150;
+	a.vsense_uv = tempcal_vsense_uv(&cal,
+			reading(vsense(&odd, 2150), 3300000, 4),
+			reading(odd.vrefint_uv, 3300000, 4));
+	b.temp_c100 = 7000;
+	b.vsense_uv = tempcal_vsense_uv(&cal,
+			reading(vsense(&odd, 7000), 3000000, 4),
+			reading(odd.vrefint_uv, 3000000, 4));
+	check(tempcal_two_point(&cal, &a, &b), "calibrated", 0, 0);
+	for (t = -4000; t <= 12500; t += 500) {
+		err = measure(&cal, &odd, t, 3300000, 4) - t;
+		if (err < 0) {
+			err = -err;
+		}
+		if (err > worst) {
+			worst = err;
+		}
+	}
+	check(worst <= 15, "calibrated error", worst, 15);
+	printf("calibrated: worst error %ld.%02ld C\n", (long)worst / 100,
+	       (long)worst % 100);
+}
+
+static void test_valid(void)
+{
+	struct tempcal cal;
+
+	tempcal_defaults(&cal);
+	check(tempcal_valid(&cal), "defaults", 0, 0);
+
+	cal.v25_uv++;
+	check(!tempcal_valid(&cal), "changed", 0, 0);
+	tempcal_seal(&cal);
+	check(tempcal_valid(&cal), "resealed", 0, 0);
+	cal.check ^= 1;
+	check(!tempcal_valid(&cal), "bad check", 0, 0);
+
+	memset(&cal, 0xff, sizeof(cal));
+	check(!tempcal_valid(&cal), "erased flash", 0, 0);
+	memset(&cal, 0, sizeof(cal));
+	check(!tempcal_valid(&cal), "zeros", 0, 0);
+
+	/* sealed, but unusable */
+	tempcal_defaults(&cal);
+	cal.slope_uv = 0;
+	tempcal_seal(&cal);
+	check(!tempcal_valid(&cal), "no slope", 0, 0);
+	tempcal_defaults(&cal);
+	cal.vrefint_uv = -1;
+	tempcal_seal(&cal);
+	check(!tempcal_valid(&cal), "negative vrefint", 0, 0);
+	tempcal_defaults(&cal);
+	cal.magic = 0x54434130;
+	cal.check = ~(cal.magic + (uint32_t)cal.vrefint_uv +
+		      (uint32_t)cal.v25_uv + (uint32_t)cal.slope_uv);
+	check(!tempcal_valid(&cal), "old magic", 0, 0);
+}
+
+int main(void)
+{
+	test_oversample();
+	test_conversion();
+	test_pipeline();
+	test_two_point();
+	test_valid();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Queued I2C master transactions for the STM32F1 I2C peripheral, run
+ * entirely from its event and error interrupts.
+ *
+ * The receive side follows the reference manual closely, because the
+ * point where ACK is cleared and STOP is set depends on how many bytes
+ * are left:
+ *	1 byte	 ACK off before ADDR is cleared, STOP right after, then
+ *		 wait for RXNE
+ *	2 bytes	 POS and ACK on before ADDR is cleared, ACK off after, then
+ *		 wait for BTF (both bytes in), STOP, read twice
+ *	N > 2	 read on RXNE until three are left, then with only BTF
+ *		 interrupts: ACK off and read N-2, then STOP and read the
+ *		 last two
+ * The transmit side writes on TXE and waits for BTF after the last
+ * byte, so the stop or repeated start never cuts it off.
+ *
+ * i2c_queue_tick() ends a transaction that takes longer than the
+ * timeout and has the hardware recover the bus. The interrupts calling
+ * i2c_queue_event() and i2c_queue_tick() must not preempt each other.
+ */
+
+#include <stddef.h>
+
+#include "i2c_queue.h"
+
+enum i2c_queue_state {
+	ST_IDLE,
+	ST_START_W,		/* waiting for SB, then send address+W */
+	ST_ADDR_W,		/* waiting for ADDR */
+	ST_TX,
+	ST_START_R,
+	ST_ADDR_R,
+	ST_RX,
+};
+
+static const struct i2c_queue_ops *ops;
+static struct i2c_xfer *head, *tail;
+static enum i2c_queue_state state;
+static struct i2c_queue_stats stats;
+static uint32_t timeout_ticks;
+static uint32_t ticks;
+static uint32_t started;
+
+static void i2c_queue_begin(struct i2c_xfer *x)
+{
+	x->pos = 0;
+	ops->buf_irq(false);
+	ops->pos(false);
+	state = (x->tx_len != 0) ? ST_START_W : ST_START_R;
+	started = ticks;
+	ops->start();
+}
+
+/* End the transaction at the head of the queue, start the next one. */
+static void i2c_queue_finish(enum i2c_xfer_status status)
+{
+	struct i2c_xfer *x = head;
+
+	ops->buf_irq(false);
+	ops->pos(false);
+	state = ST_IDLE;
+
+	stats.xfers++;
+	if (status == I2C_XFER_NACK) {
+		stats.nacks++;
+	} else if (status == I2C_XFER_BUS_ERROR) {
+		stats.bus_errors++;
+	} else if (status == I2C_XFER_TIMEOUT) {
+		stats.timeouts++;
+	}
+
+	head = x->next;
+	if (head == NULL) {
+		tail = NULL;
+	}
+	x->status = status;
+	if (x->done != NULL) {
+		x->done(x);
+	}
+
+	/* The callback may have submitted something already */
+	if ((head != NULL) && (state == ST_IDLE)) {
+		i2c_queue_begin(head);
+	}
+}
+
+static void i2c_queue_tx(struct i2c_xfer *x, uint32_t ev)
+{
+	if ((ev & I2C_EV_TXE) && (x->pos < x->tx_len)) {
+		ops->write(x->tx_buf[x->pos++]);
+		if (x->pos == x->tx_len) {
+			/* Only BTF from here on */
+			ops->buf_irq(false);
+		}
+	} else if ((ev & I2C_EV_BTF) && (x->pos == x->tx_len)) {
+		if (x->rx_len != 0) {
+			x->pos = 0;
+			state = ST_START_R;
+			ops->start();
+		} else {
+			ops->stop();
+			i2c_queue_finish(I2C_XFER_OK);
+		}
+	}
+}
+
+static void i2c_queue_rx(struct i2c_xfer *x, uint32_t ev)
+{
+	uint16_t left = x->rx_len - x->pos;
+
+	if ((left == 1) && (ev & I2C_EV_RXNE)) {
+		/* STOP has been set already */
+		x->rx_buf[x->pos++] = ops->read();
+		i2c_queue_finish(I2C_XFER_OK);
+	} else if ((left == 2) && (ev & I2C_EV_BTF)) {
+		ops->stop();
+		x->rx_buf[x->pos++] = ops->read();
+		x->rx_buf[x->pos++] = ops->read();
+		i2c_queue_finish(I2C_XFER_OK);
+	} else if ((left == 3) && (ev & I2C_EV_BTF)) {
+		/* N-2 in DR, N-1 in the shift register: NACK the last one */
+		ops->ack(false);
+		x->rx_buf[x->pos++] = ops->read();
+	} else if ((left > 3) && (ev & I2C_EV_RXNE)) {
+		x->rx_buf[x->pos++] = ops->read();
+		if (left - 1 == 3) {
+			ops->buf_irq(false);
+		}
+	}
+}
+
+/*
+ * i2c_queue_event
+ *
+ * Called from both the event and the error interrupt with the pending
+ * flags. The error interrupt must clear the error flags itself.
+ */
+void i2c_queue_event(uint32_t ev)
+{
+	struct i2c_xfer *x = head;
+
+	if ((state == ST_IDLE) || (x == NULL)) {
+		return;
+	}
+
+	if (ev & I2C_EV_AF) {
+		/* Nobody answered, or the slave refused a byte */
+		ops->stop();
+		i2c_queue_finish(I2C_XFER_NACK);
+		return;
+	}
+	if (ev & I2C_EV_ERRORS) {
+		ops->recover();
+		i2c_queue_finish(I2C_XFER_BUS_ERROR);
+		return;
+	}
+
+	switch (state) {
+	case ST_START_W:
+		if (ev & I2C_EV_SB) {
+			ops->write(x->addr << 1);
+			state = ST_ADDR_W;
+		}
+		break;
+	case ST_ADDR_W:
+		if (ev & I2C_EV_ADDR) {
+			ops->clear_addr();
+			/* DR is empty right away, no need to wait for TXE */
+			ops->write(x->tx_buf[x->pos++]);
+			ops->buf_irq(x->pos < x->tx_len);
+			state = ST_TX;
+		}
+		break;
+	case ST_TX:
+		i2c_queue_tx(x, ev);
+		break;
+	case ST_START_R:
+		if (ev & I2C_EV_SB) {
+			ops->pos(x->rx_len == 2);
+			ops->ack(x->rx_len > 1);
+			ops->write((x->addr << 1) | 1);
+			state = ST_ADDR_R;
+		}
+		break;
+	case ST_ADDR_R:
+		if (!(ev & I2C_EV_ADDR)) {
+			break;
+		}
+		ops->clear_addr();
+		if (x->rx_len == 1) {
+			ops->stop();
+			ops->buf_irq(true);
+		} else if (x->rx_len == 2) {
+			ops->ack(false);
+		} else {
+			ops->buf_irq(x->rx_len > 3);
+		}
+		state = ST_RX;
+		break;
+	case ST_RX:
+		i2c_queue_rx(x, ev);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * i2c_queue_tick
+ *
+ * Call at a steady rate, e.g. from SysTick; the timeout passed to
+ * i2c_queue_init() counts these calls.
+ */
+void i2c_queue_tick(void)
+{
+	uint32_t old = ops->lock();
+
+	ticks++;
+	if ((state != ST_IDLE) && (ticks - started > timeout_ticks)) {
+		ops->recover();
+		i2c_queue_finish(I2C_XFER_TIMEOUT);
+	}
+	ops->unlock(old);
+}
+
+void i2c_queue_submit(struct i2c_xfer *xfer)
+{
+	uint32_t old = ops->lock();
+
+	xfer->status = I2C_XFER_PENDING;
+	xfer->next = NULL;
+	if (tail != NULL) {
+		tail->next = xfer;
+	} else {
+		head = xfer;
+	}
+	tail = xfer;
+
+	if (state == ST_IDLE) {
+		i2c_queue_begin(head);
+	}
+	ops->unlock(old);
+}
+
+bool i2c_queue_idle(void)
+{
+	return state == ST_IDLE;
+}
+
+void i2c_queue_get_stats(struct i2c_queue_stats *s)
+{
+	uint32_t old = ops->lock();
+
+	*s = stats;
+	ops->unlock(old);
+}
+
+/*
+ * i2c_queue_init
+ *
+ * The hardware has to be set up already, with the event and error
+ * interrupts enabled.
+ */
+void i2c_queue_init(const struct i2c_queue_ops *o, uint32_t timeout)
+{
+	ops = o;
+	timeout_ticks = timeout;
+	head = tail = NULL;
+	state = ST_IDLE;
+}
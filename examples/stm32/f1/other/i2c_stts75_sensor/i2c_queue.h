@@ -0,0 +1,105 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef I2C_QUEUE_H
+#define I2C_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Events, the same bits as in the STM32F1 I2C_SR1 register, so the
+ * interrupt handlers can pass SR1 straight on.
+ */
+#define I2C_EV_SB		(1 << 0)
+#define I2C_EV_ADDR		(1 << 1)
+#define I2C_EV_BTF		(1 << 2)
+#define I2C_EV_RXNE		(1 << 6)
+#define I2C_EV_TXE		(1 << 7)
+#define I2C_EV_BERR		(1 << 8)
+#define I2C_EV_ARLO		(1 << 9)
+#define I2C_EV_AF		(1 << 10)
+#define I2C_EV_OVR		(1 << 11)
+#define I2C_EV_TIMEOUT		(1 << 14)
+#define I2C_EV_ERRORS		(I2C_EV_BERR | I2C_EV_ARLO | I2C_EV_AF | \
+				 I2C_EV_OVR | I2C_EV_TIMEOUT)
+
+enum i2c_xfer_status {
+	I2C_XFER_OK,
+	I2C_XFER_PENDING,
+	I2C_XFER_NACK,		/* address or data not acknowledged */
+	I2C_XFER_BUS_ERROR,	/* misplaced start/stop, lost arbitration */
+	I2C_XFER_TIMEOUT,
+};
+
+/*
+ * One transaction: tx_len bytes written, then, after a repeated start,
+ * rx_len bytes read. Either length may be zero, but not both.
+ *
+ * The structure belongs to the queue from i2c_queue_submit() until the
+ * done callback, which runs in interrupt context and may submit the
+ * same transaction again.
+ */
+struct i2c_xfer {
+	uint8_t addr;			/* 7-bit */
+	const uint8_t *tx_buf;
+	uint16_t tx_len;
+	uint8_t *rx_buf;
+	uint16_t rx_len;
+	void (*done)(struct i2c_xfer *xfer);	/* may be NULL */
+	void *priv;			/* for the callback */
+	volatile enum i2c_xfer_status status;
+
+	/* Private to i2c_queue.c */
+	struct i2c_xfer *next;
+	uint16_t pos;
+};
+
+/*
+ * What the state machine needs from the hardware. Keeping it behind
+ * this table keeps i2c_queue.c free of register access, so it can be
+ * run against a scripted bus model on the host.
+ */
+struct i2c_queue_ops {
+	void (*start)(void);		/* START or repeated START */
+	void (*stop)(void);
+	void (*write)(uint8_t byte);	/* address or data byte */
+	uint8_t (*read)(void);
+	void (*clear_addr)(void);	/* the SR1 then SR2 read sequence */
+	void (*ack)(bool on);
+	void (*pos)(bool on);		/* CR1 POS, for two byte reads */
+	void (*buf_irq)(bool on);	/* TXE/RXNE interrupts */
+	void (*recover)(void);		/* free the bus, reset the peripheral */
+	uint32_t (*lock)(void);		/* mask interrupts, old state back */
+	void (*unlock)(uint32_t state);
+};
+
+struct i2c_queue_stats {
+	uint32_t xfers;			/* completed, whatever the outcome */
+	uint32_t nacks;
+	uint32_t bus_errors;
+	uint32_t timeouts;
+};
+
+void i2c_queue_init(const struct i2c_queue_ops *ops, uint32_t timeout);
+void i2c_queue_submit(struct i2c_xfer *xfer);
+void i2c_queue_event(uint32_t events);
+void i2c_queue_tick(void);
+bool i2c_queue_idle(void);
+void i2c_queue_get_stats(struct i2c_queue_stats *stats);
+
+#endif
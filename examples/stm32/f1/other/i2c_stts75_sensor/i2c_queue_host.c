@@ -0,0 +1,921 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks i2c_queue.c and stts75.c on the host:
+ *
+ *	cc -o i2c_queue_host i2c_queue_host.c i2c_queue.c stts75.c
+ *	./i2c_queue_host
+ *
+ * A model of the STM32F1 I2C master goes through the ops: START and
+ * STOP wait for the byte on the bus, DR and the shift register are
+ * double buffered, ACK and POS decide the acknowledge of each received
+ * byte the way the reference manual says, and SB, ADDR, TXE, RXNE and
+ * BTF come and go with them. The event interrupt runs whenever an
+ * enabled flag is up, and a handler that leaves one up without the bus
+ * moving on is an interrupt storm. Reading an empty DR, writing a full
+ * one or a byte received after a NACK are mistakes as well. Slaves on
+ * the scripted bus acknowledge or not, take and give bytes, and the
+ * script can make the bus lose arbitration, see a bus error or hang.
+ * Every transaction leaves a trace of what went over the bus:
+ *
+ *	S, Sr, P	start, repeated start, stop
+ *	90		a byte sent, the address byte after a start
+ *	<19		a byte received
+ *	a, n		ack, nack of the byte before
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c_queue.h"
+#include "stts75.h"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static void check_trace(const char *got, const char *want,
+			const char *what)
+{
+	checks++;
+	if (strcmp(got, want) != 0) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s\n  got: %s\n want: %s\n", what, got,
+			       want);
+		}
+	}
+}
+
+static uint32_t rnd_state = 3;
+
+static uint32_t rnd(uint32_t n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 16) % n;
+}
+
+struct slave {
+	uint8_t addr;
+	uint8_t reg[256];
+	uint8_t ptr;
+	int nack_after;		/* data bytes taken before a NACK, or -1 */
+	int taken;
+};
+
+enum phase {
+	PH_IDLE,
+	PH_ADDR,		/* SB up, the address byte goes next */
+	PH_TX,
+	PH_RX,
+	PH_HALT,		/* NACKed or faulted, needs STOP */
+};
+
+static struct periph {
+	int start, stop, ack, pos, buf;
+	int addr_flag;
+	int af, berr, arlo;
+	int dr_full, sh_full;
+	uint8_t dr, sh;
+	int addr_sent;		/* the address byte went into DR */
+	int sent;		/* data bytes sent since ADDR */
+	int ack_next;		/* with POS, the ACK for the byte in progress */
+	int nacked;
+	enum phase phase;
+	struct slave *sel;
+
+	uint32_t steps;
+	uint32_t fault_at;	/* first bus step to fault at, or 0 */
+	int fault_arlo;
+	uint32_t hang_at;	/* bus step the bus hangs at */
+	int latency;		/* bus steps before the interrupt is taken */
+	int spurious;		/* interrupts now and then for nothing */
+	uint32_t calls;		/* ops called, bar lock and unlock */
+	int violations;
+	char trace[4096];
+	struct slave *slaves[4];
+} p;
+
+static void trace(const char *s)
+{
+	if (strlen(p.trace) + strlen(s) + 2 < sizeof(p.trace)) {
+		if (p.trace[0]) {
+			strcat(p.trace, " ");
+		}
+		strcat(p.trace, s);
+	}
+}
+
+static void trace_byte(const char *fmt, uint8_t b)
+{
+	char buf[8];
+
+	snprintf(buf, sizeof(buf), fmt, b);
+	trace(buf);
+}
+
+/* SR1 as the interrupt handlers see it */
+static uint32_t sr1(void)
+{
+	uint32_t ev = 0;
+
+	if (p.phase == PH_ADDR && !p.addr_sent) {
+		ev |= I2C_EV_SB;
+	}
+	if (p.addr_flag) {
+		ev |= I2C_EV_ADDR;
+	}
+	if (p.phase == PH_TX && !p.addr_flag && !p.dr_full) {
+		ev |= I2C_EV_TXE;
+		if (!p.sh_full && p.sent) {
+			ev |= I2C_EV_BTF;
+		}
+	}
+	if (p.dr_full && p.phase != PH_TX) {
+		ev |= I2C_EV_RXNE;
+		if (p.sh_full) {
+			ev |= I2C_EV_BTF;
+		}
+	}
+	if (p.af) {
+		ev |= I2C_EV_AF;
+	}
+	if (p.berr) {
+		ev |= I2C_EV_BERR;
+	}
+	if (p.arlo) {
+		ev |= I2C_EV_ARLO;
+	}
+	return ev;
+}
+
+static int irq_pending(void)
+{
+	uint32_t ev = sr1();
+
+	return (ev & (I2C_EV_SB | I2C_EV_ADDR | I2C_EV_BTF |
+		      I2C_EV_ERRORS)) ||
+	       (p.buf && (ev & (I2C_EV_TXE | I2C_EV_RXNE)));
+}
+
+/* The reference manual asks for BTF before a stop or repeated start */
+static void tx_busy(void)
+{
+	if (p.phase == PH_TX && (p.sh_full || p.dr_full)) {
+		p.violations++;
+	}
+}
+
+static void op_start(void)
+{
+	p.calls++;
+	tx_busy();
+	p.start = 1;
+}
+
+static void op_stop(void)
+{
+	p.calls++;
+	tx_busy();
+	p.stop = 1;
+}
+
+static void op_write(uint8_t byte)
+{
+	p.calls++;
+	if (p.phase == PH_ADDR && !p.addr_sent) {
+		p.dr = byte;
+		p.addr_sent = 1;
+	} else if (p.phase == PH_TX && !p.addr_flag && !p.dr_full) {
+		p.dr = byte;
+		p.dr_full = 1;
+		if (!p.sh_full) {
+			/* straight on into the shift register */
+			p.sh = p.dr;
+			p.sh_full = 1;
+			p.dr_full = 0;
+		}
+	} else {
+		p.violations++;
+	}
+}
+
+static uint8_t op_read(void)
+{
+	uint8_t b = p.dr;
+
+	p.calls++;
+	if (!p.dr_full || p.phase == PH_TX) {
+		p.violations++;
+		return 0xff;
+	}
+	p.dr_full = 0;
+	if (p.sh_full) {
+		p.dr = p.sh;
+		p.dr_full = 1;
+		p.sh_full = 0;
+	}
+	return b;
+}
+
+static void op_clear_addr(void)
+{
+	p.calls++;
+	if (!p.addr_flag) {
+		p.violations++;
+	}
+	p.addr_flag = 0;
+	p.ack_next = p.ack;
+}
+
+static void op_ack(bool on)
+{
+	p.calls++;
+	p.ack = on;
+}
+
+static void op_pos(bool on)
+{
+	p.calls++;
+	p.pos = on;
+}
+
+static void op_buf_irq(bool on)
+{
+	p.calls++;
+	p.buf = on;
+}
+
+/* Clock the bus free and reset the peripheral */
+static void op_recover(void)
+{
+	p.calls++;
+	trace("recover");
+	p.start = p.stop = p.ack = p.pos = p.buf = 0;
+	p.addr_flag = p.af = p.berr = p.arlo = 0;
+	p.dr_full = p.sh_full = 0;
+	p.phase = PH_IDLE;
+}
+
+static int locked;
+
+static uint32_t op_lock(void)
+{
+	return locked++;
+}
+
+static void op_unlock(uint32_t state)
+{
+	locked = state;
+}
+
+static const struct i2c_queue_ops ops = {
+	.start = op_start,
+	.stop = op_stop,
+	.write = op_write,
+	.read = op_read,
+	.clear_addr = op_clear_addr,
+	.ack = op_ack,
+	.pos = op_pos,
+	.buf_irq = op_buf_irq,
+	.recover = op_recover,
+	.lock = op_lock,
+	.unlock = op_unlock,
+};
+
+static struct slave *find(uint8_t addr)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (p.slaves[i] && p.slaves[i]->addr == addr) {
+			return p.slaves[i];
+		}
+	}
+	return NULL;
+}
+
+static void do_stop(void)
+{
+	trace("P");
+	p.stop = 0;
+	p.phase = PH_IDLE;
+	p.sh_full = 0;
+	p.sent = 0;
+}
+
+/* Receive a byte into the shift register, or DR if that is free */
+static void receive(void)
+{
+	uint8_t b = p.sel->reg[p.sel->ptr++];
+	int ack = p.pos ? p.ack_next : p.ack;
+
+	if (ack && p.stop) {
+		/* the slave would hold SDA low for the next byte */
+		p.violations++;
+	}
+	p.ack_next = p.ack;
+	trace_byte("<%02x", b);
+	trace(ack ? "a" : "n");
+	p.nacked = !ack;
+	if (!p.dr_full) {
+		p.dr = b;
+		p.dr_full = 1;
+	} else {
+		p.sh = b;
+		p.sh_full = 1;
+	}
+}
+
+/*
+ * One step of the bus: a start, a stop, a byte either way. Returns 1
+ * for a byte, 2 for anything else, 0 if nothing can happen until the
+ * software does something.
+ */
+static int bus_step(void)
+{
+	struct slave *s;
+
+	if (p.hang_at && p.steps + 1 >= p.hang_at) {
+		return 0;
+	}
+	if (p.fault_at && p.steps + 1 >= p.fault_at &&
+	    p.phase != PH_IDLE && p.phase != PH_HALT) {
+		p.steps++;
+		p.fault_at = 0;
+		trace(p.fault_arlo ? "lost" : "berr");
+		if (p.fault_arlo) {
+			p.arlo = 1;
+		} else {
+			p.berr = 1;
+		}
+		p.phase = PH_HALT;
+		return 2;
+	}
+
+	/*
+	 * Reception goes on by itself until the shift register is full,
+	 * and ends with the byte that is NACKed
+	 */
+	if (p.phase == PH_RX && !p.addr_flag) {
+		if (p.nacked) {
+			if (!p.stop) {
+				return 0;
+			}
+			p.steps++;
+			do_stop();
+			return 2;
+		}
+		if (p.sh_full) {
+			return 0;
+		}
+		p.steps++;
+		receive();
+		if (p.stop) {
+			/* right after the byte that was on the bus */
+			do_stop();
+		}
+		return 1;
+	}
+	if (p.stop && p.phase != PH_ADDR && p.phase != PH_RX &&
+	    !(p.phase == PH_TX && (p.sh_full || p.addr_flag))) {
+		p.steps++;
+		if (p.dr_full) {
+			/* the byte written last never went out */
+			p.violations++;
+			p.dr_full = 0;
+		}
+		do_stop();
+		return 2;
+	}
+	if (p.start && (p.phase == PH_IDLE ||
+			(p.phase == PH_TX && !p.sh_full && !p.dr_full &&
+			 !p.addr_flag))) {
+		p.steps++;
+		trace(p.phase == PH_IDLE ? "S" : "Sr");
+		p.start = 0;
+		p.phase = PH_ADDR;
+		p.addr_sent = 0;
+		p.sent = 0;
+		p.nacked = 0;
+		return 2;
+	}
+
+	switch (p.phase) {
+	case PH_ADDR:
+		if (!p.addr_sent) {
+			return 0;
+		}
+		p.steps++;
+		trace_byte("%02x", p.dr);
+		s = find(p.dr >> 1);
+		if (s == NULL) {
+			trace("n");
+			p.af = 1;
+			p.phase = PH_HALT;
+			return 1;
+		}
+		trace("a");
+		p.sel = s;
+		s->taken = 0;
+		p.addr_flag = 1;
+		p.phase = (p.dr & 1) ? PH_RX : PH_TX;
+		return 1;
+	case PH_TX:
+		if (p.addr_flag || !p.sh_full) {
+			return 0;
+		}
+		p.steps++;
+		trace_byte("%02x", p.sh);
+		p.sh_full = 0;
+		s = p.sel;
+		if (s->nack_after >= 0 && s->taken >= s->nack_after) {
+			trace("n");
+			p.af = 1;
+			p.phase = PH_HALT;
+			/* whatever is in DR goes nowhere */
+			p.dr_full = 0;
+			return 1;
+		}
+		trace("a");
+		if (s->taken++ == 0) {
+			s->ptr = p.sh;
+		} else {
+			s->reg[s->ptr++] = p.sh;
+		}
+		p.sent++;
+		if (p.dr_full) {
+			p.sh = p.dr;
+			p.sh_full = 1;
+			p.dr_full = 0;
+		}
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* The event or error interrupt, whichever the flags call for */
+static void isr(void)
+{
+	uint32_t ev = sr1();
+
+	p.af = p.berr = p.arlo = 0;
+	i2c_queue_event(ev);
+}
+
+/*
+ * Run the bus and the interrupt until both have nothing to do. The
+ * interrupt is taken latency bus steps late, if the bus can go on that
+ * long. A handler that does nothing about the flag it was called for
+ * is called again at once: doing so while a byte goes over the bus is
+ * a storm, and so is the bus not moving at all.
+ */
+static void run(void)
+{
+	int isrs = 0, late = 0, n = 0, idle = 0, step;
+	uint32_t calls;
+
+	while (n++ < 2000) {
+		if (p.spurious && rnd(4) == 0) {
+			isr();
+		}
+		if (irq_pending() && late >= p.latency && isrs < 2) {
+			isrs++;
+			late = 0;
+			calls = p.calls;
+			isr();
+			idle = p.calls == calls && irq_pending();
+			continue;
+		}
+		step = bus_step();
+		if (step) {
+			if (step == 1 && idle) {
+				p.violations++;
+			}
+			isrs = idle = 0;
+			late++;
+			continue;
+		}
+		if (irq_pending()) {
+			if (isrs >= 2) {
+				p.violations++;
+				return;
+			}
+			late = p.latency;
+			continue;
+		}
+		return;
+	}
+	p.violations++;
+}
+
+static struct slave sensor, eeprom;
+static struct i2c_queue_stats base;
+
+static void bus_init(void)
+{
+	uint32_t i;
+
+	memset(&p, 0, sizeof(p));
+	memset(&sensor, 0, sizeof(sensor));
+	memset(&eeprom, 0, sizeof(eeprom));
+	sensor.addr = STTS75_SENSOR0;
+	sensor.nack_after = -1;
+	/* 25.5 C, and the rest of the registers */
+	sensor.reg[0] = 0x19;
+	sensor.reg[1] = 0x80;
+	eeprom.addr = 0x50;
+	eeprom.nack_after = -1;
+	for (i = 0; i < 256; i++) {
+		eeprom.reg[i] = i ^ 0x5a;
+	}
+	p.slaves[0] = &sensor;
+	p.slaves[1] = &eeprom;
+	i2c_queue_init(&ops, 10);
+	i2c_queue_get_stats(&base);
+}
+
+/* The statistics since bus_init(), they are kept over i2c_queue_init() */
+static void stats(struct i2c_queue_stats *st)
+{
+	i2c_queue_get_stats(st);
+	st->xfers -= base.xfers;
+	st->nacks -= base.nacks;
+	st->bus_errors -= base.bus_errors;
+	st->timeouts -= base.timeouts;
+}
+
+static struct i2c_xfer *done_order[16];
+static int done_count;
+
+static void done(struct i2c_xfer *x)
+{
+	if (done_count < 16) {
+		done_order[done_count] = x;
+	}
+	done_count++;
+}
+
+static void xfer_init(struct i2c_xfer *x, uint8_t addr, const uint8_t *tx,
+		      uint16_t tx_len, uint8_t *rx, uint16_t rx_len)
+{
+	memset(x, 0, sizeof(*x));
+	x->addr = addr;
+	x->tx_buf = tx;
+	x->tx_len = tx_len;
+	x->rx_buf = rx;
+	x->rx_len = rx_len;
+	x->done = done;
+}
+
+/* What i2c_stts75_sensor.c does: configure, then read the temperature */
+static void test_stts75(void)
+{
+	struct stts75 s;
+	struct i2c_queue_stats st;
+
+	bus_init();
+	stts75_init(&s, STTS75_SENSOR0);
+	stts75_write_config(&s, 0x04);
+	run();
+	check_trace(p.trace, "S 90 a 01 a 04 a P", "config");
+	check(sensor.reg[1] == 0x04, "config written", sensor.reg[1], 4);
+
+	/* the model has byte registers, the temperature is two */
+	sensor.reg[1] = 0x80;
+	p.trace[0] = 0;
+	stts75_write_temp_os(&s, 0x1a00);
+	stts75_write_temp_hyst(&s, 0x1900);
+	check(stts75_read_temperature(&s), "read queued", 0, 0);
+	check(!stts75_read_temperature(&s), "read still queued", 0, 0);
+	run();
+	check_trace(p.trace, "S 90 a 03 a 1a a 00 a P "
+		    "S 90 a 02 a 19 a 00 a P "
+		    "S 90 a 00 a Sr 91 a <19 a <80 n P", "queued");
+	check(s.temperature == 0x1980 && s.samples == 1 && s.errors == 0,
+	      "temperature", s.temperature, s.samples);
+	check(p.violations == 0 && locked == 0 && i2c_queue_idle(),
+	      "stts75 clean", p.violations, locked);
+
+	/* the second sensor is optional, and NACKs when missing */
+	stts75_init(&s, STTS75_SENSOR1);
+	p.trace[0] = 0;
+	stts75_read_temperature(&s);
+	run();
+	check_trace(p.trace, "S 92 n P", "missing sensor");
+	check(s.errors == 1 && s.samples == 0, "missing errors", s.errors,
+	      s.samples);
+	stats(&st);
+	check(st.xfers == 5 && st.nacks == 1, "stts75 stats", st.xfers,
+	      st.nacks);
+}
+
+/*
+ * Every mix of write and read lengths, covering the one, two and more
+ * byte receive procedures, with guards round the buffer and with the
+ * interrupt taken up to two bus steps late.
+ */
+static void test_lengths(void)
+{
+	uint8_t tx[8], rx[12];
+	struct i2c_xfer x;
+	int t, r, i, bad, lat;
+
+	for (lat = 0; lat <= 2; lat++) {
+		for (t = 0; t <= 4; t++) {
+			for (r = 0; r <= 7; r++) {
+				if (t == 0 && r == 0) {
+					continue;
+				}
+				bus_init();
+				p.latency = lat;
+				done_count = 0;
+				tx[0] = 0x20;
+				for (i = 1; i < 8; i++) {
+					tx[i] = 0xa0 + i;
+				}
+				memset(rx, 0xee, sizeof(rx));
+				eeprom.ptr = 0x20;
+				xfer_init(&x, 0x50, tx, t, rx + 2, r);
+				i2c_queue_submit(&x);
+				run();
+
+				bad = x.status != I2C_XFER_OK ||
+				      done_count != 1 || p.violations != 0 ||
+				      !i2c_queue_idle();
+				for (i = 1; i < t; i++) {
+					bad |= eeprom.reg[0x20 + i - 1] !=
+					       tx[i];
+				}
+				for (i = 0; i < r; i++) {
+					uint8_t at = 0x20 + (t ? t - 1 : 0) +
+						     i;
+					uint8_t want = (t > 1 &&
+						at < 0x20 + t - 1) ?
+						tx[at - 0x20 + 1] : (at ^ 0x5a);
+
+					bad |= rx[2 + i] != want;
+				}
+				bad |= rx[0] != 0xee || rx[1] != 0xee ||
+				       rx[2 + r] != 0xee || rx[3 + r] != 0xee;
+				check(!bad, "lengths", lat * 100 + t * 10 + r,
+				      p.violations);
+			}
+		}
+	}
+
+	/* the last byte is the only one NACKed, whatever the length */
+	bus_init();
+	eeprom.ptr = 0x10;
+	xfer_init(&x, 0x50, NULL, 0, rx, 1);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(p.trace, "S a1 a <4a n P", "read 1");
+	bus_init();
+	eeprom.ptr = 0x10;
+	xfer_init(&x, 0x50, NULL, 0, rx, 2);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(p.trace, "S a1 a <4a a <4b n P", "read 2");
+	bus_init();
+	eeprom.ptr = 0x10;
+	xfer_init(&x, 0x50, NULL, 0, rx, 5);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(p.trace, "S a1 a <4a a <4b a <48 a <49 a <4e n P",
+		    "read 5");
+}
+
+static void test_nack(void)
+{
+	static const uint8_t tx[3] = { 1, 2, 3 };
+	uint8_t rx[2];
+	struct i2c_xfer x;
+	struct i2c_queue_stats st;
+
+	bus_init();
+	xfer_init(&x, 0x33, tx, 1, rx, 1);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(p.trace, "S 66 n P", "address nack");
+	check(x.status == I2C_XFER_NACK, "address nack status", x.status,
+	      I2C_XFER_NACK);
+
+	bus_init();
+	eeprom.nack_after = 1;
+	xfer_init(&x, 0x50, tx, 3, NULL, 0);
+	i2c_queue_submit(&x);
+	run();
+	check_trace(p.trace, "S a0 a 01 a 02 n P", "data nack");
+	check(x.status == I2C_XFER_NACK && p.violations == 0,
+	      "data nack status", x.status, p.violations);
+	stats(&st);
+	check(st.xfers == 1 && st.nacks == 1, "nack stats", st.xfers,
+	      st.nacks);
+}
+
+/*
+ * Arbitration lost and a bus error at every step of a transaction: the
+ * bus is recovered, the transaction fails and the next one is fine.
+ */
+static void test_faults(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t rx[3], temp[2];
+	struct i2c_xfer x, y;
+	struct i2c_queue_stats st;
+	uint32_t at;
+	int f, bad;
+
+	for (f = 0; f < 2; f++) {
+		for (at = 1; at <= 8; at++) {
+			bus_init();
+			done_count = 0;
+			p.fault_at = at;
+			p.fault_arlo = f;
+			xfer_init(&x, 0x50, &reg, 1, rx, 3);
+			xfer_init(&y, STTS75_SENSOR0, &reg, 1, temp, 2);
+			i2c_queue_submit(&x);
+			i2c_queue_submit(&y);
+			run();
+
+			bad = x.status != I2C_XFER_BUS_ERROR ||
+			      y.status != I2C_XFER_OK || temp[0] != 0x19 ||
+			      temp[1] != 0x80 || done_count != 2 ||
+			      done_order[0] != &x || done_order[1] != &y ||
+			      p.violations != 0;
+			check(!bad, f ? "arbitration lost" : "bus error", at,
+			      x.status);
+			check(strstr(p.trace, "recover S 90 a 00 a Sr 91 a "
+				     "<19 a <80 n P") != NULL,
+			      "after the fault", f, at);
+			stats(&st);
+			check(st.bus_errors == 1 && st.xfers == 2,
+			      "fault stats", st.bus_errors, st.xfers);
+		}
+	}
+}
+
+static void test_timeout(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t temp[2];
+	struct i2c_xfer x, y;
+	struct i2c_queue_stats st;
+	int i;
+
+	bus_init();
+	p.hang_at = 4;
+	xfer_init(&x, STTS75_SENSOR0, &reg, 1, temp, 2);
+	xfer_init(&y, STTS75_SENSOR0, &reg, 1, temp, 2);
+	i2c_queue_submit(&x);
+	i2c_queue_submit(&y);
+	run();
+	for (i = 0; i < 10; i++) {
+		i2c_queue_tick();
+	}
+	check(x.status == I2C_XFER_PENDING, "not yet", x.status, i);
+	i2c_queue_tick();
+	check(x.status == I2C_XFER_TIMEOUT, "timed out", x.status, i);
+	check(strstr(p.trace, "recover") != NULL, "timeout recover", 0, 0);
+
+	p.hang_at = 0;
+	run();
+	check(y.status == I2C_XFER_OK && temp[0] == 0x19, "after timeout",
+	      y.status, temp[0]);
+	stats(&st);
+	check(st.timeouts == 1 && st.xfers == 2 && locked == 0,
+	      "timeout stats", st.timeouts, st.xfers);
+	for (i = 0; i < 20; i++) {
+		i2c_queue_tick();
+	}
+	check(y.status == I2C_XFER_OK, "no late timeout", y.status, 0);
+}
+
+static int again;
+
+static void resubmit(struct i2c_xfer *x)
+{
+	if (again-- > 0) {
+		i2c_queue_submit(x);
+	}
+}
+
+static void test_queue(void)
+{
+	static const uint8_t reg = 0;
+	uint8_t temp[2];
+	struct i2c_xfer x;
+	struct i2c_queue_stats st;
+
+	bus_init();
+	again = 4;
+	xfer_init(&x, STTS75_SENSOR0, &reg, 1, temp, 2);
+	x.done = resubmit;
+	i2c_queue_submit(&x);
+	run();
+	stats(&st);
+	check(st.xfers == 5 && i2c_queue_idle() && again == -1 &&
+	      p.violations == 0, "resubmitted", st.xfers, again);
+
+	/* stray events while idle touch nothing */
+	p.trace[0] = 0;
+	i2c_queue_event(I2C_EV_RXNE | I2C_EV_BTF);
+	i2c_queue_event(I2C_EV_BERR);
+	check(p.trace[0] == 0 && !p.start && !p.stop, "idle", p.start,
+	      p.stop);
+}
+
+/*
+ * Random transactions, bus trouble, interrupt latency and interrupts
+ * for nothing. Each must end the way the bus says it should, without a
+ * mistake on the way.
+ */
+static void test_random(void)
+{
+	uint8_t tx[6], rx[10];
+	struct i2c_xfer x;
+	int round, bad = 0, t, r, i;
+	enum i2c_xfer_status want;
+	struct i2c_queue_stats st;
+	uint32_t ok = 0, nack = 0, err = 0;
+
+	bus_init();
+	for (round = 0; round < 20000; round++) {
+		p.fault_at = 0;
+		p.trace[0] = 0;
+		p.latency = rnd(3);
+		p.spurious = rnd(2);
+		eeprom.nack_after = -1;
+		t = rnd(5);
+		r = t ? rnd(8) : 1 + rnd(7);
+		for (i = 0; i < t; i++) {
+			tx[i] = rnd(256);
+		}
+		memset(rx, 0xee, sizeof(rx));
+		xfer_init(&x, rnd(4) ? 0x50 : 0x51, tx, t, rx + 1, r);
+		want = x.addr == 0x50 ? I2C_XFER_OK : I2C_XFER_NACK;
+		if (t > 1 && rnd(4) == 0) {
+			eeprom.nack_after = rnd(t - 1);
+			want = I2C_XFER_NACK;
+		}
+		if (want == I2C_XFER_OK && rnd(8) == 0) {
+			p.fault_at = p.steps + 1 + rnd(t + r + 2);
+			p.fault_arlo = rnd(2);
+			want = I2C_XFER_BUS_ERROR;
+		}
+		i2c_queue_submit(&x);
+		run();
+		bad += x.status != want || rx[0] != 0xee ||
+		       rx[1 + r] != 0xee || p.violations != 0 ||
+		       !i2c_queue_idle();
+		ok += x.status == I2C_XFER_OK;
+		nack += x.status == I2C_XFER_NACK;
+		err += x.status == I2C_XFER_BUS_ERROR;
+	}
+	stats(&st);
+	check(bad == 0, "random", bad, p.violations);
+	check(st.xfers == 20000 && st.nacks == nack && st.bus_errors == err,
+	      "random stats", st.nacks, nack);
+	check(ok > 10000 && nack > 1000 && err > 500, "random exercised",
+	      nack, err);
+}
+
+int main(void)
+{
+	test_stts75();
+	test_lengths();
+	test_nack();
+	test_faults();
+	test_timeout();
+	test_queue();
+	test_random();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -22,8 +22,34 @@
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/i2c.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/cortex.h>
+#include <stdio.h>
+#include <errno.h>
+#include "i2c_queue.h"
 #include "stts75.h"
 
+/* Give up on a transaction after this many ms */
+#define I2C_TIMEOUT_MS		10
+/* Read every sensor this often */
+#define SAMPLE_MS		250
+
+#define NUM_SENSORS		2
+
+int _write(int file, char *ptr, int len);
+
+static volatile uint32_t system_millis;
+
+/*
+ * The second sensor is optional; without it its reads end with a NACK
+ * and only count as errors, the other sensor carries on.
+ */
+static struct stts75 sensors[NUM_SENSORS];
+static const uint8_t sensor_addr[NUM_SENSORS] = {
+	STTS75_SENSOR0, STTS75_SENSOR1,
+};
+
 static void usart_setup(void)
 {
 	/* Enable clocks for GPIO port A (for GPIO_USART1_TX) and USART1. */
@@ -46,6 +72,20 @@ static void usart_setup(void)
 	usart_enable(USART1);
 }
 
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART1, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
 static void gpio_setup(void)
 {
 	/* Enable GPIOB clock. */
@@ -58,12 +98,17 @@ static void gpio_setup(void)
 	              GPIO_CNF_OUTPUT_PUSHPULL, GPIO7);
 }
 
-static void i2c_setup(void)
+static void systick_setup(void)
 {
-	/* Enable clocks for I2C2 and AFIO. */
-	rcc_periph_clock_enable(RCC_I2C2);
-	rcc_periph_clock_enable(RCC_AFIO);
+	/* 72MHz / 8 => 9000000 counts per second, 1ms interrupts */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
 
+static void i2c_config(void)
+{
 	/* Set alternate functions for the SCL and SDA pins of I2C2. */
 	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
 		      GPIO_CNF_OUTPUT_ALTFN_OPENDRAIN,
@@ -98,14 +143,217 @@ static void i2c_setup(void)
 	 */
 	i2c_set_own_7bit_slave_address(I2C2, 0x32);
 
+	/* Event and error interrupts, i2c_queue turns TXE/RXNE on as needed */
+	i2c_enable_interrupt(I2C2, I2C_CR2_ITEVTEN | I2C_CR2_ITERREN);
+
 	/* If everything is configured -> enable the peripheral. */
 	i2c_peripheral_enable(I2C2);
 }
 
+static void i2c_delay(void)
+{
+	int i;
+
+	/* A few us, half an SCL period at well below 100kHz */
+	for (i = 0; i < 100; i++)
+		__asm__("nop");
+}
+
+/*
+ * Bus recovery: a slave that was cut off mid-byte keeps SDA low until it
+ * has clocked out the rest of its byte. Clock SCL by hand until SDA
+ * comes back (nine clocks at most), send a STOP, then reset the I2C
+ * peripheral, which clears a BUSY flag that got stuck along the way.
+ */
+static void i2c_recover(void)
+{
+	int i;
+
+	i2c_peripheral_disable(I2C2);
+
+	gpio_set(GPIOB, GPIO_I2C2_SCL | GPIO_I2C2_SDA);
+	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_OPENDRAIN,
+		      GPIO_I2C2_SCL | GPIO_I2C2_SDA);
+	i2c_delay();
+
+	for (i = 0; (i < 9) && !gpio_get(GPIOB, GPIO_I2C2_SDA); i++) {
+		gpio_clear(GPIOB, GPIO_I2C2_SCL);
+		i2c_delay();
+		gpio_set(GPIOB, GPIO_I2C2_SCL);
+		i2c_delay();
+	}
+
+	/* STOP: SDA goes high while SCL is high */
+	gpio_clear(GPIOB, GPIO_I2C2_SCL);
+	i2c_delay();
+	gpio_clear(GPIOB, GPIO_I2C2_SDA);
+	i2c_delay();
+	gpio_set(GPIOB, GPIO_I2C2_SCL);
+	i2c_delay();
+	gpio_set(GPIOB, GPIO_I2C2_SDA);
+	i2c_delay();
+
+	I2C_CR1(I2C2) |= I2C_CR1_SWRST;
+	I2C_CR1(I2C2) &= ~I2C_CR1_SWRST;
+	i2c_config();
+}
+
+/*
+ * The i2c_queue hardware operations for I2C2.
+ */
+static void i2c_op_start(void)
+{
+	/*
+	 * A STOP requested at the end of the last transaction may not be
+	 * out yet; START would be ignored until it is, which takes a few us.
+	 */
+	while (I2C_CR1(I2C2) & I2C_CR1_STOP);
+	i2c_send_start(I2C2);
+}
+
+static void i2c_op_stop(void)
+{
+	i2c_send_stop(I2C2);
+}
+
+static void i2c_op_write(uint8_t byte)
+{
+	i2c_send_data(I2C2, byte);
+}
+
+static uint8_t i2c_op_read(void)
+{
+	return i2c_get_data(I2C2);
+}
+
+static void i2c_op_clear_addr(void)
+{
+	uint32_t reg32 __attribute__((unused));
+
+	/* SR1 has just been read by the interrupt handler */
+	reg32 = I2C_SR2(I2C2);
+}
+
+static void i2c_op_ack(bool on)
+{
+	if (on) {
+		I2C_CR1(I2C2) |= I2C_CR1_ACK;
+	} else {
+		I2C_CR1(I2C2) &= ~I2C_CR1_ACK;
+	}
+}
+
+static void i2c_op_pos(bool on)
+{
+	if (on) {
+		I2C_CR1(I2C2) |= I2C_CR1_POS;
+	} else {
+		I2C_CR1(I2C2) &= ~I2C_CR1_POS;
+	}
+}
+
+static void i2c_op_buf_irq(bool on)
+{
+	if (on) {
+		i2c_enable_interrupt(I2C2, I2C_CR2_ITBUFEN);
+	} else {
+		i2c_disable_interrupt(I2C2, I2C_CR2_ITBUFEN);
+	}
+}
+
+static uint32_t i2c_op_lock(void)
+{
+	return cm_mask_interrupts(1);
+}
+
+static void i2c_op_unlock(uint32_t state)
+{
+	cm_mask_interrupts(state);
+}
+
+static const struct i2c_queue_ops i2c2_ops = {
+	.start = i2c_op_start,
+	.stop = i2c_op_stop,
+	.write = i2c_op_write,
+	.read = i2c_op_read,
+	.clear_addr = i2c_op_clear_addr,
+	.ack = i2c_op_ack,
+	.pos = i2c_op_pos,
+	.buf_irq = i2c_op_buf_irq,
+	.recover = i2c_recover,
+	.lock = i2c_op_lock,
+	.unlock = i2c_op_unlock,
+};
+
+static void i2c_setup(void)
+{
+	/* Enable clocks for I2C2 and AFIO. */
+	rcc_periph_clock_enable(RCC_I2C2);
+	rcc_periph_clock_enable(RCC_AFIO);
+
+	i2c_config();
+
+	/* Left over from a reset in the middle of a transfer? */
+	if (I2C_SR2(I2C2) & I2C_SR2_BUSY) {
+		i2c_recover();
+	}
+
+	i2c_queue_init(&i2c2_ops, I2C_TIMEOUT_MS);
+
+	/*
+	 * Both I2C interrupts and SysTick stay at the default priority, so
+	 * none of them can preempt the other inside i2c_queue.
+	 */
+	nvic_enable_irq(NVIC_I2C2_EV_IRQ);
+	nvic_enable_irq(NVIC_I2C2_ER_IRQ);
+}
+
+void i2c2_ev_isr(void)
+{
+	i2c_queue_event(I2C_SR1(I2C2));
+}
+
+void i2c2_er_isr(void)
+{
+	uint32_t sr1 = I2C_SR1(I2C2);
+
+	/* The error flags are cleared by writing 0, writing 1 keeps them */
+	I2C_SR1(I2C2) = (uint16_t)~(sr1 & I2C_EV_ERRORS);
+	i2c_queue_event(sr1);
+}
+
+void sys_tick_handler(void)
+{
+	int i;
+
+	system_millis++;
+	i2c_queue_tick();
+
+	if (system_millis % SAMPLE_MS == 0) {
+		for (i = 0; i < NUM_SENSORS; i++) {
+			stts75_read_temperature(&sensors[i]);
+		}
+	}
+}
+
+static void print_temperature(uint16_t raw)
+{
+	/* Two's complement, 1/256 degree per bit */
+	int32_t c100 = (int16_t)raw * 100 / 256;
+
+	if (c100 < 0) {
+		printf("-");
+		c100 = -c100;
+	}
+	printf("%ld.%02ld C", c100 / 100, c100 % 100);
+}
+
 int main(void)
 {
-	int i = 0;
-	uint16_t temperature;
+	struct i2c_queue_stats stats;
+	uint32_t next;
+	int i;
 
 	rcc_clock_setup_in_hse_16mhz_out_72mhz();
 	gpio_setup();
@@ -115,32 +363,42 @@ int main(void)
 	gpio_clear(GPIOB, GPIO7);	/* LED1 on */
 	gpio_set(GPIOB, GPIO6);		/* LED2 off */
 
-	/* Send a message on USART1. */
-	usart_send(USART1, 's');
-	usart_send(USART1, 't');
-	usart_send(USART1, 'm');
-	usart_send(USART1, '\r');
-	usart_send(USART1, '\n');
-
-	stts75_write_config(I2C2, STTS75_SENSOR0);
-	stts75_write_temp_os(I2C2, STTS75_SENSOR0, 0x1a00); /* 26 degrees */
-	stts75_write_temp_hyst(I2C2, STTS75_SENSOR0, 0x1a00);
-	temperature = stts75_read_temperature(I2C2, STTS75_SENSOR0);
-
-	/* Send the temperature as binary over USART1. */
-	for (i = 15; i >= 0; i--) {
-		if (temperature & (1 << i))
-			usart_send(USART1, '1');
-		else
-			usart_send(USART1, '0');
+	printf("stm\r\n");
+
+	/* Reverse polarity, 26 degree Tos and Thyst; only queued here */
+	for (i = 0; i < NUM_SENSORS; i++) {
+		stts75_init(&sensors[i], sensor_addr[i]);
+		stts75_write_config(&sensors[i], 0x4);
+		stts75_write_temp_os(&sensors[i], 0x1a00); /* 26 degrees */
+		stts75_write_temp_hyst(&sensors[i], 0x1a00);
 	}
 
-	usart_send(USART1, '\r');
-	usart_send(USART1, '\n');
+	/* From here on SysTick queues the reads */
+	systick_setup();
+
+	next = system_millis + 1000;
+	while (1) {
+		/* Nothing here waits for the bus */
+		while ((int32_t)(system_millis - next) < 0);
+		next += 1000;
 
-	gpio_clear(GPIOB, GPIO6); /* LED2 on */
+		gpio_toggle(GPIOB, GPIO6);	/* LED2 */
 
-	while (1); /* Halt. */
+		for (i = 0; i < NUM_SENSORS; i++) {
+			printf("0x%02x: ", sensors[i].addr);
+			if (sensors[i].samples != 0) {
+				print_temperature(sensors[i].temperature);
+			} else {
+				printf("--");
+			}
+			printf(", %lu samples, %lu errors\r\n",
+			       sensors[i].samples, sensors[i].errors);
+		}
+		i2c_queue_get_stats(&stats);
+		printf("i2c: %lu xfers, %lu nack, %lu bus errors, "
+		       "%lu timeouts\r\n", stats.xfers, stats.nacks,
+		       stats.bus_errors, stats.timeouts);
+	}
 
 	return 0;
 }
@@ -17,173 +17,105 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <libopencm3/stm32/i2c.h>
+#include <stddef.h>
 #include "stts75.h"
 
-void stts75_write_config(uint32_t i2c, uint8_t sensor)
-{
-	uint32_t reg32 __attribute__((unused));
-
-	/* Send START condition. */
-	i2c_send_start(i2c);
-
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(i2c) & I2C_SR1_SB)
-		& (I2C_SR2(i2c) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
-
-	/* Send destination address. */
-	i2c_send_7bit_address(i2c, sensor, I2C_WRITE);
-
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(i2c) & I2C_SR1_ADDR));
-
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(i2c);
+#define STTS75_REG_TEMP		0x0
+#define STTS75_REG_CONF		0x1
+#define STTS75_REG_THYS		0x2
+#define STTS75_REG_TOS		0x3
 
-	/* Sending the data. */
-	i2c_send_data(i2c, 0x1); /* stts75 config register */
-	while (!(I2C_SR1(i2c) & I2C_SR1_BTF)); /* Await ByteTransferedFlag. */
-	/* Polarity reverse - LED glows if temp is below Tos/Thyst. */
-	i2c_send_data(i2c, 0x4);
-	while (!(I2C_SR1(i2c) & (I2C_SR1_BTF | I2C_SR1_TxE)));
-
-	/* Send STOP condition. */
-	i2c_send_stop(i2c);
+static void stts75_xfer_init(struct stts75 *s, struct i2c_xfer *x,
+			     const uint8_t *tx, uint16_t tx_len,
+			     uint8_t *rx, uint16_t rx_len)
+{
+	x->addr = s->addr;
+	x->tx_buf = tx;
+	x->tx_len = tx_len;
+	x->rx_buf = rx;
+	x->rx_len = rx_len;
+	x->done = NULL;
+	x->priv = s;
+	x->status = I2C_XFER_OK;
 }
 
-void stts75_write_temp_os(uint32_t i2c, uint8_t sensor, uint16_t temp_os)
+static void stts75_write_done(struct i2c_xfer *x)
 {
-	uint32_t reg32 __attribute__((unused));
-
-	/* Send START condition. */
-	i2c_send_start(i2c);
-
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(i2c) & I2C_SR1_SB)
-		& (I2C_SR2(i2c) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
-
-	/* Send destination address. */
-	i2c_send_7bit_address(i2c, sensor, I2C_WRITE);
-
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(i2c) & I2C_SR1_ADDR));
+	struct stts75 *s = x->priv;
 
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(i2c);
-
-	/* Sending the data. */
-	i2c_send_data(i2c, 0x3); /* OvertemperatureShutdown register */
-	while (!(I2C_SR1(i2c) & I2C_SR1_BTF));
-	i2c_send_data(i2c, (uint8_t)(temp_os >> 8)); /* MSB */
-	while (!(I2C_SR1(i2c) & I2C_SR1_BTF));
-	i2c_send_data(i2c, (uint8_t)(temp_os & 0xff00)); /* LSB */
-	/* After the last byte we have to wait for TxE too. */
-	while (!(I2C_SR1(i2c) & (I2C_SR1_BTF | I2C_SR1_TxE)));
-
-	/* Send STOP condition. */
-	i2c_send_stop(i2c);
+	if (x->status != I2C_XFER_OK) {
+		s->errors++;
+	}
 }
 
-void stts75_write_temp_hyst(uint32_t i2c, uint8_t sensor, uint16_t temp_hyst)
+static void stts75_temp_done(struct i2c_xfer *x)
 {
-	uint32_t reg32 __attribute__((unused));
-
-	/* Send START condition. */
-	i2c_send_start(i2c);
-
-	/* Waiting for START is send and therefore switched to master mode. */
-	while (!((I2C_SR1(i2c) & I2C_SR1_SB)
-		& (I2C_SR2(i2c) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
-
-	/* Say to what address we want to talk to. */
-	i2c_send_7bit_address(i2c, sensor, I2C_WRITE);
-
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(i2c) & I2C_SR1_ADDR));
-
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(i2c);
-
-	/* Sending the data. */
-	i2c_send_data(i2c, 0x2); /* TemperatureHysteresis register */
-	while (!(I2C_SR1(i2c) & I2C_SR1_BTF));
-	i2c_send_data(i2c, (uint8_t)(temp_hyst >> 8)); /* MSB */
-	while (!(I2C_SR1(i2c) & I2C_SR1_BTF));
-	i2c_send_data(i2c, (uint8_t)(temp_hyst & 0xff00)); /* LSB */
-	/* After the last byte we have to wait for TxE too. */
-	while (!(I2C_SR1(i2c) & (I2C_SR1_BTF | I2C_SR1_TxE)));
-
-	/* Send STOP condition. */
-	i2c_send_stop(i2c);
+	struct stts75 *s = x->priv;
+
+	if (x->status == I2C_XFER_OK) {
+		s->temperature = (s->temp_buf[0] << 8) | s->temp_buf[1];
+		s->samples++;
+	} else {
+		s->errors++;
+	}
 }
 
-uint16_t stts75_read_temperature(uint32_t i2c, uint8_t sensor)
+void stts75_init(struct stts75 *s, uint8_t addr)
 {
-	uint32_t reg32 __attribute__((unused));
-	uint16_t temperature;
-
-	/* Send START condition. */
-	i2c_send_start(i2c);
-
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(i2c) & I2C_SR1_SB)
-		& (I2C_SR2(i2c) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
-
-	/* Say to what address we want to talk to. */
-	/* Yes, WRITE is correct - for selecting register in STTS75. */
-	i2c_send_7bit_address(i2c, sensor, I2C_WRITE);
-
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(i2c) & I2C_SR1_ADDR));
-
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(i2c);
-
-	i2c_send_data(i2c, 0x0); /* temperature register */
-	while (!(I2C_SR1(i2c) & (I2C_SR1_BTF | I2C_SR1_TxE)));
+	s->addr = addr;
+	s->temperature = 0;
+	s->samples = 0;
+	s->errors = 0;
+
+	stts75_xfer_init(s, &s->cfg_xfer, s->cfg_buf, 2, NULL, 0);
+	stts75_xfer_init(s, &s->os_xfer, s->os_buf, 3, NULL, 0);
+	stts75_xfer_init(s, &s->hyst_xfer, s->hyst_buf, 3, NULL, 0);
+	s->cfg_xfer.done = stts75_write_done;
+	s->os_xfer.done = stts75_write_done;
+	s->hyst_xfer.done = stts75_write_done;
 
 	/*
-	 * Now we transferred that we want to ACCESS the temperature register.
-	 * Now we send another START condition (repeated START) and then
-	 * transfer the destination but with flag READ.
+	 * Select the temperature register with a write, then read it after
+	 * a repeated start.
 	 */
+	s->temp_reg = STTS75_REG_TEMP;
+	stts75_xfer_init(s, &s->temp_xfer, &s->temp_reg, 1, s->temp_buf, 2);
+	s->temp_xfer.done = stts75_temp_done;
+}
 
-	/* Send START condition. */
-	i2c_send_start(i2c);
-
-	/* Waiting for START is send and switched to master mode. */
-	while (!((I2C_SR1(i2c) & I2C_SR1_SB)
-		& (I2C_SR2(i2c) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
-
-	/* Say to what address we want to talk to. */
-	i2c_send_7bit_address(i2c, sensor, I2C_READ); 
-
-	/* 2-byte receive is a special case. See datasheet POS bit. */
-	I2C_CR1(i2c) |= (I2C_CR1_POS | I2C_CR1_ACK);
-
-	/* Waiting for address is transferred. */
-	while (!(I2C_SR1(i2c) & I2C_SR1_ADDR));
-
-	/* Cleaning ADDR condition sequence. */
-	reg32 = I2C_SR2(i2c);
-
-	/* Cleaning I2C_SR1_ACK. */
-	I2C_CR1(i2c) &= ~I2C_CR1_ACK;
-
-	/* Now the slave should begin to send us the first byte. Await BTF. */
-	while (!(I2C_SR1(i2c) & I2C_SR1_BTF));
-	temperature = (uint16_t)(I2C_DR(i2c) << 8); /* MSB */
-
-	/*
-	 * Yes they mean it: we have to generate the STOP condition before
-	 * saving the 1st byte.
-	 */
-	I2C_CR1(i2c) |= I2C_CR1_STOP;
+/* The transaction must not be queued already. */
+void stts75_write_config(struct stts75 *s, uint8_t config)
+{
+	s->cfg_buf[0] = STTS75_REG_CONF;
+	s->cfg_buf[1] = config;
+	i2c_queue_submit(&s->cfg_xfer);
+}
 
-	temperature |= I2C_DR(i2c); /* LSB */
+void stts75_write_temp_os(struct stts75 *s, uint16_t temp_os)
+{
+	s->os_buf[0] = STTS75_REG_TOS;
+	s->os_buf[1] = (uint8_t)(temp_os >> 8);		/* MSB */
+	s->os_buf[2] = (uint8_t)(temp_os & 0xff);	/* LSB */
+	i2c_queue_submit(&s->os_xfer);
+}
 
-	/* Original state. */
-	I2C_CR1(i2c) &= ~I2C_CR1_POS;
+void stts75_write_temp_hyst(struct stts75 *s, uint16_t temp_hyst)
+{
+	s->hyst_buf[0] = STTS75_REG_THYS;
+	s->hyst_buf[1] = (uint8_t)(temp_hyst >> 8);	/* MSB */
+	s->hyst_buf[2] = (uint8_t)(temp_hyst & 0xff);	/* LSB */
+	i2c_queue_submit(&s->hyst_xfer);
+}
 
-	return temperature;
+/*
+ * Queue a temperature read, unless the last one is still in the queue.
+ * The result shows up in s->temperature once it completes.
+ */
+bool stts75_read_temperature(struct stts75 *s)
+{
+	if (s->temp_xfer.status == I2C_XFER_PENDING) {
+		return false;
+	}
+	i2c_queue_submit(&s->temp_xfer);
+	return true;
 }
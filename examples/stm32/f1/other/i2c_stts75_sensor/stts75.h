@@ -21,6 +21,9 @@
 #define STTS75_H
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "i2c_queue.h"
 
 #define STTS75_SENSOR0		0x48
 #define STTS75_SENSOR1		0x49
@@ -31,9 +34,27 @@
 #define STTS75_SENSOR6		0x4e
 #define STTS75_SENSOR7		0x4f
 
-void stts75_write_config(uint32_t i2c, uint8_t sensor);
-void stts75_write_temp_os(uint32_t i2c, uint8_t sensor, uint16_t temp_os);
-void stts75_write_temp_hyst(uint32_t i2c, uint8_t sensor, uint16_t temp_hyst);
-uint16_t stts75_read_temperature(uint32_t i2c, uint8_t sensor);
+/*
+ * One sensor. Every register access is a transaction on the I2C queue,
+ * the functions below only submit it and return. Each kind has its own
+ * transaction and buffer, so a write and a read can be queued at once.
+ */
+struct stts75 {
+	uint8_t addr;
+	struct i2c_xfer cfg_xfer, os_xfer, hyst_xfer, temp_xfer;
+	uint8_t cfg_buf[2], os_buf[3], hyst_buf[3];
+	uint8_t temp_reg, temp_buf[2];
+
+	/* Updated from the I2C interrupt */
+	volatile uint16_t temperature;	/* raw, degrees C * 256 */
+	volatile uint32_t samples;
+	volatile uint32_t errors;
+};
+
+void stts75_init(struct stts75 *s, uint8_t addr);
+void stts75_write_config(struct stts75 *s, uint8_t config);
+void stts75_write_temp_os(struct stts75 *s, uint16_t temp_os);
+void stts75_write_temp_hyst(struct stts75 *s, uint16_t temp_hyst);
+bool stts75_read_temperature(struct stts75 *s);
 
 #endif
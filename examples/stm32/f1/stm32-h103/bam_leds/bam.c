@@ -0,0 +1,163 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bit angle modulation for up to 16 pins per port, without any hardware
+ * access so bam_host.c can check and time it on a PC.
+ *
+ * A frame has one slot per brightness bit, slot n lasting tick << n
+ * timer counts, and a pin is on in slot n if bit n of its level is set,
+ * so it is on for level ticks out of (1 << bits) - 1. Each slot is one
+ * BSRR word per port, which sets the pins that are on and resets the
+ * rest in one write, so a DMA channel per port can play the frames with
+ * no help from the CPU, while another one changes the timer period
+ * along with the slots.
+ *
+ * The DMA buffers hold two frames. bam_refill() recompiles the one that
+ * is not playing when the levels have changed since it was last done.
+ */
+
+#include "bam.h"
+
+void bam_init(struct bam *b, int bits, uint16_t tick)
+{
+	int s;
+
+	b->bits = bits;
+	b->tick = tick;
+	b->ports = 0;
+	b->gen = 0;
+	b->half_gen[0] = 0;
+	b->half_gen[1] = 0;
+
+	/*
+	 * The period is preloaded, it takes effect at the update after the
+	 * one that writes it, and the DMA writes it at the update that
+	 * starts a slot. So each slot carries the period for the one after
+	 * next. The first two are for the timer setup, see bam_slot_arr().
+	 */
+	for (s = 0; s < 2 * bits; s++) {
+		b->arr[s] = bam_slot_arr(b, s + 2);
+	}
+}
+
+/* TIMx_ARR for slot, tick << n counts for bit n */
+uint16_t bam_slot_arr(const struct bam *b, int slot)
+{
+	return (b->tick << (slot % b->bits)) - 1;
+}
+
+/* Returns the port number, all pins off */
+int bam_add_port(struct bam *b, uint16_t mask, uint16_t invert)
+{
+	int p = b->ports++;
+	int i;
+
+	b->mask[p] = mask;
+	b->invert[p] = invert;
+	for (i = 0; i < BAM_PINS; i++) {
+		b->level[p][i] = 0;
+	}
+	b->gen++;
+	return p;
+}
+
+/* Level 0 is off, (1 << bits) - 1 fully on */
+void bam_set(struct bam *b, int port, int pin, uint16_t level)
+{
+	uint16_t max = (1 << b->bits) - 1;
+
+	b->level[port][pin] = (level > max) ? max : level;
+	b->gen++;
+}
+
+/*
+ * bam_refill
+ *
+ * Half 0 or 1 of the DMA buffers has finished playing. Recompile it if
+ * the levels changed, returns 1 if it did.
+ */
+int bam_refill(struct bam *b, int half)
+{
+	uint32_t gen = b->gen;
+	int p;
+
+	if (b->half_gen[half] == gen) {
+		return 0;
+	}
+	for (p = 0; p < b->ports; p++) {
+		bam_compile(b->mask[p], b->invert[p], b->level[p], b->bits,
+			    &b->bsrr[p][half * b->bits]);
+	}
+	b->half_gen[half] = gen;
+	return 1;
+}
+
+/*
+ * bam_compile
+ *
+ * The BSRR words for bits slots of one port. Bit n of every pin's level
+ * makes up the word for slot n, which is transposing a 16x16 matrix of
+ * bits: swap the off diagonal 8x8 blocks, then the 4x4 blocks inside
+ * those, and so on, each swap done 16 or 32 bits at a time.
+ */
+void bam_compile(uint16_t mask, uint16_t invert, const uint16_t *level,
+		 int bits, uint32_t *bsrr)
+{
+	uint32_t a[BAM_PINS];
+	uint32_t m = 0x00ff, t;
+	int j, k;
+
+	for (k = 0; k < BAM_PINS; k++) {
+		a[k] = level[k];
+	}
+
+	for (j = 8; j != 0; j >>= 1, m ^= m << j) {
+		for (k = 0; k < BAM_PINS; k++) {
+			if (k & j) {
+				continue;
+			}
+			t = ((a[k] >> j) ^ a[k + j]) & m;
+			a[k + j] ^= t;
+			a[k] ^= t << j;
+		}
+	}
+
+	for (k = 0; k < bits; k++) {
+		t = (a[k] ^ invert) & 0xffff;
+		bsrr[k] = (t & mask) | ((~t & mask) << 16);
+	}
+}
+
+/* The same, a pin and a bit at a time, to check bam_compile() against */
+void bam_compile_ref(uint16_t mask, uint16_t invert, const uint16_t *level,
+		     int bits, uint32_t *bsrr)
+{
+	uint32_t on;
+	int n, i;
+
+	for (n = 0; n < bits; n++) {
+		bsrr[n] = 0;
+		for (i = 0; i < BAM_PINS; i++) {
+			if (!(mask & (1 << i))) {
+				continue;
+			}
+			on = ((level[i] >> n) ^ (invert >> i)) & 1;
+			bsrr[n] |= on ? (1 << i) : (1 << (i + 16));
+		}
+	}
+}
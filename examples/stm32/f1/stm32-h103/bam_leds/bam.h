@@ -0,0 +1,62 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAM_H
+#define BAM_H
+
+#include <stdint.h>
+
+#define BAM_PINS	16
+#define BAM_PORTS	3
+#define BAM_MAX_BITS	12
+
+/* Two frames, the DMA plays one while the other is refilled */
+#define BAM_SLOTS	(2 * BAM_MAX_BITS)
+
+struct bam {
+	int bits;
+	uint16_t tick;			/* counts in the shortest slot */
+	int ports;
+	uint16_t mask[BAM_PORTS];	/* pins driven */
+	uint16_t invert[BAM_PORTS];	/* pins that are on when low */
+	uint16_t level[BAM_PORTS][BAM_PINS];
+
+	/*
+	 * What the DMA channels play, 2 * bits words each, over and over:
+	 * a BSRR word per port and slot, and TIMx_ARR, two slots ahead, see
+	 * bam.c.
+	 */
+	uint32_t bsrr[BAM_PORTS][BAM_SLOTS];
+	uint16_t arr[BAM_SLOTS];
+
+	/* Private to bam.c */
+	uint32_t gen;			/* bumped on every level change */
+	uint32_t half_gen[2];		/* gen each half was built from */
+};
+
+void bam_init(struct bam *b, int bits, uint16_t tick);
+int bam_add_port(struct bam *b, uint16_t mask, uint16_t invert);
+void bam_set(struct bam *b, int port, int pin, uint16_t level);
+int bam_refill(struct bam *b, int half);
+uint16_t bam_slot_arr(const struct bam *b, int slot);
+
+void bam_compile(uint16_t mask, uint16_t invert, const uint16_t *level,
+		 int bits, uint32_t *bsrr);
+void bam_compile_ref(uint16_t mask, uint16_t invert, const uint16_t *level,
+		     int bits, uint32_t *bsrr);
+
+#endif
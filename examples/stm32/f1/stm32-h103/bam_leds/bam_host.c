@@ -0,0 +1,243 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks and times bam.c on the host:
+ *
+ *	cc -O2 -o bam_host bam_host.c bam.c
+ *	./bam_host
+ *
+ * bam_compile() has to give the same words as bam_compile_ref() for any
+ * levels, pins and bit depth. Then the DMA buffers are played through a
+ * model of the timer, preloaded period and all, and every pin has to be
+ * on for exactly level ticks per frame, also after levels change and the
+ * halves are refilled. Last, both compilers are timed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bam.h"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static void random_levels(uint16_t *level, int bits)
+{
+	int i;
+
+	for (i = 0; i < BAM_PINS; i++) {
+		level[i] = rand() & ((1 << bits) - 1);
+	}
+}
+
+static void test_compile(void)
+{
+	uint16_t level[BAM_PINS], mask, invert;
+	uint32_t a[BAM_MAX_BITS], b[BAM_MAX_BITS];
+	int bits, n, k;
+
+	for (n = 0; n < 100000; n++) {
+		bits = 1 + n % BAM_MAX_BITS;
+		mask = (n & 1) ? 0xffff : rand();
+		invert = (n & 2) ? 0 : rand();
+		random_levels(level, bits);
+		if (n % 7 == 0) {
+			/* All off or all on */
+			for (k = 0; k < BAM_PINS; k++) {
+				level[k] = (n & 8) ? (1 << bits) - 1 : 0;
+			}
+		}
+		bam_compile(mask, invert, level, bits, a);
+		bam_compile_ref(mask, invert, level, bits, b);
+		for (k = 0; k < bits; k++) {
+			check(a[k] == b[k], "compile", n, k);
+		}
+	}
+}
+
+/*
+ * The timer and the DMA channels, slot by slot: the BSRR words go out at
+ * the start of each slot, and at the end the preloaded period moves to
+ * the counter and the next one is written to the preload.
+ */
+struct player {
+	uint32_t odr[BAM_PORTS];
+	uint32_t period, preload;	/* ARR as loaded, and preloaded */
+	int pos;			/* in the DMA buffers */
+	uint32_t on[BAM_PORTS][BAM_PINS];
+	uint32_t ticks;
+};
+
+static void player_init(struct player *pl, const struct bam *b)
+{
+	int p;
+
+	for (p = 0; p < BAM_PORTS; p++) {
+		pl->odr[p] = 0;
+	}
+	pl->period = bam_slot_arr(b, 0);
+	pl->preload = bam_slot_arr(b, 1);
+	pl->pos = 0;
+}
+
+static void player_frame(struct player *pl, const struct bam *b)
+{
+	uint32_t w;
+	int s, p, i;
+
+	for (p = 0; p < b->ports; p++) {
+		for (i = 0; i < BAM_PINS; i++) {
+			pl->on[p][i] = 0;
+		}
+	}
+	pl->ticks = 0;
+
+	for (s = 0; s < b->bits; s++) {
+		for (p = 0; p < b->ports; p++) {
+			w = b->bsrr[p][pl->pos];
+			pl->odr[p] = (pl->odr[p] & ~(w >> 16)) | (w & 0xffff);
+			for (i = 0; i < BAM_PINS; i++) {
+				if ((pl->odr[p] ^ b->invert[p]) & (1 << i)) {
+					pl->on[p][i] += pl->period + 1;
+				}
+			}
+		}
+		pl->ticks += pl->period + 1;
+		pl->period = pl->preload;
+		pl->preload = b->arr[pl->pos];
+		pl->pos = (pl->pos + 1) % (2 * b->bits);
+	}
+}
+
+static void check_frame(const struct player *pl, const struct bam *b)
+{
+	uint32_t want;
+	int p, i;
+
+	check(pl->ticks == b->tick * ((1u << b->bits) - 1), "frame length",
+	      pl->ticks, b->bits);
+	for (p = 0; p < b->ports; p++) {
+		for (i = 0; i < BAM_PINS; i++) {
+			if (!(b->mask[p] & (1 << i))) {
+				continue;
+			}
+			want = b->level[p][i] * b->tick;
+			check(pl->on[p][i] == want, "on time", want,
+			      pl->on[p][i]);
+		}
+	}
+}
+
+static void test_play(int bits)
+{
+	static struct bam b;
+	struct player pl;
+	int f, p, i;
+
+	bam_init(&b, bits, 3);
+	bam_add_port(&b, 0xffff, 0x1000);
+	bam_add_port(&b, 0x3fff, 0);
+	bam_add_port(&b, 0x00f0, 0x00ff);
+	player_init(&pl, &b);
+
+	for (f = 0; f < 200; f++) {
+		/* New levels now and then, refilled like the interrupt does */
+		if (f % 10 == 0) {
+			for (p = 0; p < b.ports; p++) {
+				for (i = 0; i < BAM_PINS; i++) {
+					bam_set(&b, p, i, rand());
+				}
+			}
+			if (f == 0) {
+				bam_refill(&b, 0);
+			}
+		}
+		/* The other half is refilled while this one plays */
+		bam_refill(&b, (pl.pos == 0) ? 1 : 0);
+		player_frame(&pl, &b);
+		/* Levels are only sure to show a frame after they changed */
+		if (f % 10 != 0) {
+			check_frame(&pl, &b);
+		}
+		bam_refill(&b, (pl.pos == 0) ? 1 : 0);
+	}
+}
+
+static double seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(int bits)
+{
+	static uint16_t level[64][BAM_PINS];
+	uint32_t out[BAM_MAX_BITS], sink = 0;
+	double t0, fast, ref;
+	int n, runs = 2000000;
+
+	for (n = 0; n < 64; n++) {
+		random_levels(level[n], bits);
+	}
+
+	t0 = seconds();
+	for (n = 0; n < runs; n++) {
+		bam_compile(0xffff, 0, level[n & 63], bits, out);
+		sink += out[n % bits];
+	}
+	fast = (seconds() - t0) / runs;
+
+	t0 = seconds();
+	for (n = 0; n < runs; n++) {
+		bam_compile_ref(0xffff, 0, level[n & 63], bits, out);
+		sink += out[n % bits];
+	}
+	ref = (seconds() - t0) / runs;
+
+	printf("%2d bits: transpose %5.1fns, reference %6.1fns per port "
+	       "(%u)\n", bits, fast * 1e9, ref * 1e9, sink & 1);
+}
+
+int main(void)
+{
+	int bits;
+
+	test_compile();
+	for (bits = 1; bits <= BAM_MAX_BITS; bits++) {
+		test_play(bits);
+	}
+	printf("%d checks, %d failed\n", checks, failed);
+
+	bench(8);
+	bench(10);
+	bench(12);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/dwt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "bam.h"
+
+/*
+ * 30 LEDs with 10 bit brightness on all of port B and PC0..PC13,
+ * including the board LED on PC12, by bit angle modulation, see bam.c.
+ *
+ * TIM2 counts at 9MHz, and three DMA channels follow it:
+ *  - update, DMA1 channel 2: the next period into TIM2_ARR
+ *  - CC1, DMA1 channel 5: the slot's word into GPIOB_BSRR
+ *  - CC3, DMA1 channel 1: the slot's word into GPIOC_BSRR
+ * CC1 and CC3 match one count into every slot. Channel 5 interrupts
+ * when either half of the buffers has played out, to refill it if the
+ * levels changed. That is all the CPU has to do for the LEDs.
+ */
+
+#define CPU_HZ		72000000
+#define TIM_HZ		9000000
+#define BAM_BITS	10
+#define FRAME_HZ	100
+#define BAM_TICK	(TIM_HZ / FRAME_HZ / ((1 << BAM_BITS) - 1))
+
+int _write(int file, char *ptr, int len);
+
+static struct bam leds;
+static int port_b, port_c;
+
+static volatile uint32_t system_millis;
+static volatile uint32_t frames, refills, isr_cycles;
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_8mhz_out_72mhz();
+
+	/* Enable GPIOA, GPIOB, GPIOC and Alternate Function clocks. */
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_GPIOC);
+	rcc_periph_clock_enable(RCC_AFIO);
+
+	rcc_periph_clock_enable(RCC_USART2);
+	rcc_periph_clock_enable(RCC_TIM2);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	dwt_enable_cycle_counter();
+
+	/* 1ms SysTick */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+void sys_tick_handler(void)
+{
+	system_millis++;
+}
+
+static void gpio_setup(void)
+{
+	/* Keep SWD, give PB3 and PB4 up from JTAG. */
+	AFIO_MAPR |= AFIO_MAPR_SWJ_CFG_JTAG_OFF_SW_ON;
+
+	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO_ALL);
+
+	/* PC14 and PC15 are the 32kHz crystal. */
+	gpio_set_mode(GPIOC, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_PUSHPULL, 0x3fff);
+}
+
+static void usart_setup(void)
+{
+	/* Setup GPIO pin GPIO_USART2_TX. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+
+	/* Setup UART parameters. */
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_mode(USART2, USART_MODE_TX);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+
+	/* Finally enable the USART. */
+	usart_enable(USART2);
+}
+
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART2, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+static void dma_play(uint32_t channel, uint32_t dest, void *src,
+		     uint32_t size)
+{
+	dma_channel_reset(DMA1, channel);
+	dma_set_peripheral_address(DMA1, channel, dest);
+	dma_set_memory_address(DMA1, channel, (uint32_t)src);
+	dma_set_number_of_data(DMA1, channel, 2 * leds.bits);
+	dma_set_read_from_memory(DMA1, channel);
+	dma_enable_memory_increment_mode(DMA1, channel);
+	if (size == 32) {
+		dma_set_peripheral_size(DMA1, channel, DMA_CCR_PSIZE_32BIT);
+		dma_set_memory_size(DMA1, channel, DMA_CCR_MSIZE_32BIT);
+	} else {
+		dma_set_peripheral_size(DMA1, channel, DMA_CCR_PSIZE_16BIT);
+		dma_set_memory_size(DMA1, channel, DMA_CCR_MSIZE_16BIT);
+	}
+	dma_enable_circular_mode(DMA1, channel);
+	dma_set_priority(DMA1, channel, DMA_CCR_PL_VERY_HIGH);
+}
+
+static void bam_setup(void)
+{
+	bam_init(&leds, BAM_BITS, BAM_TICK);
+	port_b = bam_add_port(&leds, 0xffff, 0);
+	/* The board LED is on when PC12 is low. */
+	port_c = bam_add_port(&leds, 0x3fff, GPIO12);
+	bam_refill(&leds, 0);
+	bam_refill(&leds, 1);
+
+	dma_play(DMA_CHANNEL2, (uint32_t)&TIM2_ARR, leds.arr, 16);
+	dma_play(DMA_CHANNEL5, (uint32_t)&GPIOB_BSRR, leds.bsrr[port_b],
+		 32);
+	dma_play(DMA_CHANNEL1, (uint32_t)&GPIOC_BSRR, leds.bsrr[port_c],
+		 32);
+
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL5);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+
+	dma_enable_channel(DMA1, DMA_CHANNEL2);
+	dma_enable_channel(DMA1, DMA_CHANNEL5);
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+
+	timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_set_prescaler(TIM2, CPU_HZ / TIM_HZ - 1);
+	timer_set_oc_value(TIM2, TIM_OC1, 1);
+	timer_set_oc_value(TIM2, TIM_OC3, 1);
+
+	/*
+	 * Slot 0 straight into the counter's period, slot 1 into the
+	 * preload; the DMA carries on from slot 2 at the first update.
+	 */
+	timer_disable_preload(TIM2);
+	timer_set_period(TIM2, bam_slot_arr(&leds, 0));
+	timer_enable_preload(TIM2);
+	timer_set_period(TIM2, bam_slot_arr(&leds, 1));
+
+	timer_enable_irq(TIM2, TIM_DIER_UDE | TIM_DIER_CC1DE |
+			       TIM_DIER_CC3DE);
+	timer_enable_counter(TIM2);
+}
+
+void dma1_channel5_isr(void)
+{
+	uint32_t start = dwt_read_cycle_counter();
+
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL5, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL5, DMA_HTIF);
+		refills += bam_refill(&leds, 0);
+	}
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL5, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL5, DMA_TCIF);
+		refills += bam_refill(&leds, 1);
+	}
+	frames++;
+
+	isr_cycles += dwt_read_cycle_counter() - start;
+}
+
+/* Cycles per port for both compilers */
+static void bench(void)
+{
+	uint16_t level[BAM_PINS];
+	uint32_t out[BAM_MAX_BITS], start, fast, ref;
+	int i;
+
+	for (i = 0; i < BAM_PINS; i++) {
+		level[i] = rand() & ((1 << BAM_BITS) - 1);
+	}
+
+	start = dwt_read_cycle_counter();
+	for (i = 0; i < 1000; i++) {
+		bam_compile(0xffff, 0, level, BAM_BITS, out);
+	}
+	fast = (dwt_read_cycle_counter() - start) / 1000;
+
+	start = dwt_read_cycle_counter();
+	for (i = 0; i < 1000; i++) {
+		bam_compile_ref(0xffff, 0, level, BAM_BITS, out);
+	}
+	ref = (dwt_read_cycle_counter() - start) / 1000;
+
+	printf("%d bit compile: %lu cycles per port, "
+	       "%lu one bit at a time\r\n", BAM_BITS, fast, ref);
+}
+
+/* A wave running along the LEDs, brighter the closer to its crest */
+static void animate(uint32_t t)
+{
+	uint32_t x, tri;
+	int i;
+
+	for (i = 0; i < 30; i++) {
+		x = (t * 8 + i * 64) & 1023;
+		tri = (x < 512) ? x : 1023 - x;
+		if (i < 16) {
+			bam_set(&leds, port_b, i, tri * tri / 255);
+		} else {
+			bam_set(&leds, port_c, i - 16, tri * tri / 255);
+		}
+	}
+}
+
+int main(void)
+{
+	uint32_t next, stats, cycles;
+	uint32_t last_frames = 0, last_refills = 0, last_cycles = 0;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+
+	printf("BAM LEDs, %d bits, %d frames/s\r\n", BAM_BITS,
+	       TIM_HZ / (BAM_TICK * ((1 << BAM_BITS) - 1)));
+	bench();
+
+	bam_setup();
+
+	next = system_millis;
+	stats = system_millis + 1000;
+	while (1) {
+		while ((int32_t)(system_millis - next) < 0);
+		next += 20;
+		animate(next / 20);
+
+		if ((int32_t)(system_millis - stats) >= 0) {
+			stats += 1000;
+			cycles = isr_cycles - last_cycles;
+			printf("%lu half frames/s, %lu refills, "
+			       "%lu.%02lu%% CPU\r\n",
+			       frames - last_frames, refills - last_refills,
+			       cycles / (CPU_HZ / 100),
+			       cycles / (CPU_HZ / 10000) % 100);
+			last_frames = frames;
+			last_refills = refills;
+			last_cycles += cycles;
+		}
+	}
+
+	return 0;
+}
@@ -22,54 +22,87 @@
  * strips. These strips use the LPD6803 controller. You may be able to
  * find the datasheet here:
  * http://www.adafruit.com/datasheets/LPD6803.pdf
+ *
+ * The strip is driven by SPI2 (SCLK on PB13, MOSI on PB15) fed by DMA,
+ * the frames per second go out on USART1 at 230400 baud.
  */
 
-#include <stdlib.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <stdio.h>
+#include <errno.h>
 
-#define SPI_BANK GPIOB
-#define SCLK_PIN GPIO13
-#define MOSI_PIN GPIO15
+#include "lpd6803.h"
 
-#define SMALL_DELAY_VALUE 0
+/* The length of the strip, the pattern goes round this many LEDs */
+#define STRIP_LEDS 50
 
-#define COLOR_COUNT 50
+/*
+ * The LEDs in a frame, set in the Makefile. Frames are this long however
+ * short the strip is, the cells past its end are off and fall off the
+ * last LED. Each takes two bytes of RAM.
+ */
+#ifndef FRAME_LEDS
+#define FRAME_LEDS 1024
+#endif
 
-#define SCLK(VAL)				\
-	if (VAL) {				\
-		gpio_set(SPI_BANK, SCLK_PIN);	\
-	} else {				\
-		gpio_clear(SPI_BANK, SCLK_PIN);	\
-	}
+#if STRIP_LEDS > FRAME_LEDS
+#error "The frame must cover the strip"
+#endif
 
-#define MOSI(VAL)				\
-	if (VAL) {				\
-		gpio_set(SPI_BANK, MOSI_PIN);	\
-	} else {				\
-		gpio_clear(SPI_BANK, MOSI_PIN);	\
-	}
+/* SPI2 runs from the 36MHz APB1 clock */
+#define SPI_BITRATE (36000000 / 8)
 
-#define SMALL_DELAY() {				\
-		int j;				\
-		for (j = 0; j < SMALL_DELAY_VALUE; j++)	\
-			__asm__("nop");		\
-	}
+/* Move the pattern one LED along this often */
+#define STEP_MS 20
+
+#define FRAME_BITS ((LPD6803_START_WORDS + FRAME_LEDS + \
+		     LPD6803_END_WORDS(FRAME_LEDS)) * 16)
+
+int _write(int file, char *ptr, int len);
+
+/*
+ * The packed cells, the first STRIP_LEDS are a circular buffer and LED 0
+ * shows cells[first]. The DMA sends them straight from here, so
+ * animating only changes first.
+ */
+static uint16_t cells[FRAME_LEDS];
+static volatile int first;
+
+/* Frame in flight, owned by the DMA interrupt */
+static struct lpd6803_seg segs[LPD6803_MAX_SEGS];
+static int seg_count, seg_next;
+static uint16_t zero_word;
 
-struct color {
-	uint8_t r;
-	uint8_t g;
-	uint8_t b;
-};
+static volatile uint32_t frames;
+static volatile uint32_t system_millis;
 
 /* Set STM32 to 72 MHz. */
 static void clock_setup(void)
 {
 	rcc_clock_setup_in_hse_8mhz_out_72mhz();
 
-	/* Enable GPIOB and GPIOC clock. */
-	rcc_periph_clock_enable(RCC_GPIOC);
+	/* Enable GPIOA, GPIOB and GPIOC clock. */
+	rcc_periph_clock_enable(RCC_GPIOA);
 	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_GPIOC);
+
+	/* Enable clocks for AFIO, USART1, SPI2 and DMA1. */
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_USART1);
+	rcc_periph_clock_enable(RCC_SPI2);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	/* 1ms SysTick */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
 }
 
 static void gpio_setup(void)
@@ -78,158 +111,175 @@ static void gpio_setup(void)
 	gpio_set_mode(GPIOC, GPIO_MODE_OUTPUT_50_MHZ,
 		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO12);
 
-	/* Set GPIO13 (in GPIO port B) to 'output push-pull'. */
+	/* SCLK on PB13 and MOSI on PB15, the SPI2 pins. */
 	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
-		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO13);
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
+		      GPIO_SPI2_SCK | GPIO_SPI2_MOSI);
+}
 
-	/* Set GPIO15 (in GPIO port B) to 'output push-pull'. */
-	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ,
-		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO15);
+static void usart_setup(void)
+{
+	/* Setup GPIO pin GPIO_USART1_TX. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_TX);
+
+	/* Setup UART parameters. */
+	usart_set_baudrate(USART1, 230400);
+	usart_set_databits(USART1, 8);
+	usart_set_stopbits(USART1, USART_STOPBITS_1);
+	usart_set_parity(USART1, USART_PARITY_NONE);
+	usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
+	usart_set_mode(USART1, USART_MODE_TX);
+
+	/* Finally enable the USART. */
+	usart_enable(USART1);
 }
 
-static void send_colors(struct color *colors, int count)
+int _write(int file, char *ptr, int len)
 {
-	int i, k;
-
-	/* Initialize SPI pins. */
-	SCLK(0);
-	MOSI(0);
-
-	/* Start frame */
-	for (i = 0; i < 32; i++) {
-		SCLK(1);
-		SMALL_DELAY();
-		SCLK(0);
-		SMALL_DELAY();
-	}
+	int i;
 
-	/* Color cell output */
-	for (k = 0; k < count; k++) {
-		/* Start bit */
-		MOSI(1);
-		SCLK(1);
-		SMALL_DELAY();
-		SCLK(0);
-		SMALL_DELAY();
-
-		/* Blue */
-		for (i = 0; i < 5; i++) {
-			MOSI(((colors[k].b & ((1 << 4) >> i)) != 0));
-			SCLK(1);
-			SMALL_DELAY();
-			SCLK(0);
-			SMALL_DELAY();
-		}
-		/* Red */
-		for (i = 0; i < 5; i++) {
-			MOSI(((colors[k].r & ((1 << 4) >> i)) != 0));
-			SCLK(1);
-			SMALL_DELAY();
-			SCLK(0);
-			SMALL_DELAY();
-		}
-		/* Green */
-		for (i = 0; i < 5; i++) {
-			MOSI(((colors[k].g & ((1 << 4) >> i)) != 0));
-			SCLK(1);
-			SMALL_DELAY();
-			SCLK(0);
-			SMALL_DELAY();
-		}
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART1, ptr[i]);
+		return i;
 	}
 
-	/* End frame */
-	MOSI(0);
-	for (k = 0; k < count; k++) {
-		SCLK(1);
-		SMALL_DELAY();
-		SCLK(0);
-		SMALL_DELAY();
-	}
+	errno = EIO;
+	return -1;
 }
 
-static void reset_colors(struct color *colors, int count)
+static void spi_setup(void)
 {
-	int i;
+	spi_reset(SPI2);
+
+	/*
+	 * The strip samples data on the rising clock edge, like the bit
+	 * banging code did: clock idle low, first edge, MSB first. Whole
+	 * cells are 16 bits.
+	 */
+	spi_init_master(SPI2, SPI_CR1_BAUDRATE_FPCLK_DIV_8,
+			SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+			SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_16BIT,
+			SPI_CR1_MSBFIRST);
+
+	/* Nothing comes back, only drive MOSI */
+	spi_set_bidirectional_transmit_only_mode(SPI2);
+	spi_enable_software_slave_management(SPI2);
+	spi_set_nss_high(SPI2);
+
+	spi_enable_tx_dma(SPI2);
+	spi_enable(SPI2);
+}
+
+static void dma_setup(void)
+{
+	/* SPI2 TX is on DMA1 channel 5 */
+	dma_channel_reset(DMA1, DMA_CHANNEL5);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL5, (uint32_t)&SPI2_DR);
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL5);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL5, DMA_CCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL5, DMA_CCR_MSIZE_16BIT);
+	dma_set_priority(DMA1, DMA_CHANNEL5, DMA_CCR_PL_HIGH);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+
+	nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+}
 
-	for (i = 0; i < count; i++) {
-		colors[i].r = 0;
-		colors[i].g = 0;
-		colors[i].b = 0;
+static void strip_seg_start(const struct lpd6803_seg *s)
+{
+	dma_disable_channel(DMA1, DMA_CHANNEL5);
+	if (s->buf != NULL) {
+		dma_set_memory_address(DMA1, DMA_CHANNEL5, (uint32_t)s->buf);
+		dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL5);
+	} else {
+		dma_set_memory_address(DMA1, DMA_CHANNEL5,
+				       (uint32_t)&zero_word);
+		dma_disable_memory_increment_mode(DMA1, DMA_CHANNEL5);
 	}
+	dma_set_number_of_data(DMA1, DMA_CHANNEL5, s->len);
+	dma_enable_channel(DMA1, DMA_CHANNEL5);
 }
 
-static void init_colors(struct color *colors, int count)
+static void strip_frame_start(void)
 {
-	colors[0].r = 0x1F;
-	colors[0].g = 0;
-	colors[0].b = 0;
-	colors[1].r = 0;
-	colors[1].g = 0x1F;
-	colors[1].b = 0;
-	colors[2].r = 0;
-	colors[2].g = 0;
-	colors[2].b = 0x1F;
-
-	count = count;
+	seg_count = lpd6803_segments(segs, cells, FRAME_LEDS, STRIP_LEDS,
+				     first);
+	seg_next = 0;
+	strip_seg_start(&segs[seg_next++]);
 }
 
-static void step_colors(struct color *colors, int count)
+/*
+ * One segment sent. The SPI clock pauses while the next one is set up,
+ * which the strip doesn't mind. Frames follow each other back to back.
+ */
+void dma1_channel5_isr(void)
 {
-	int i;
-	struct color tmp_color1;
-	struct color tmp_color2;
-
-#if 0
-	/* Random blinking. */
-	for (i = 0; i < count; i++) {
-		colors[i].r = rand() & 0x01;
-		colors[i].g = rand() & 0x01;
-		colors[i].b = rand() & 0x01;
+	if (!dma_get_interrupt_flag(DMA1, DMA_CHANNEL5, DMA_TCIF)) {
+		return;
 	}
-#endif
+	dma_clear_interrupt_flags(DMA1, DMA_CHANNEL5, DMA_TCIF);
 
-	/* Generate next colors. */
-	tmp_color1.r = colors[0].r;
-	tmp_color1.g = colors[0].g;
-	tmp_color1.b = colors[0].b;
-	colors[0].r = colors[count - 1].r;
-	colors[0].g = colors[count - 1].g;
-	colors[0].b = colors[count - 1].b;
-	for (i = 1; i < count; i++) {
-		tmp_color2.r = colors[i].r;
-		tmp_color2.g = colors[i].g;
-		tmp_color2.b = colors[i].b;
-		colors[i].r = tmp_color1.r;
-		colors[i].g = tmp_color1.g;
-		colors[i].b = tmp_color1.b;
-		tmp_color1.r = tmp_color2.r;
-		tmp_color1.g = tmp_color2.g;
-		tmp_color1.b = tmp_color2.b;
+	if (seg_next < seg_count) {
+		strip_seg_start(&segs[seg_next++]);
+	} else {
+		frames++;
+		strip_frame_start();
 	}
 }
 
-int main(void)
+void sys_tick_handler(void)
+{
+	system_millis++;
+
+	/* Every LED takes the color of the one before it */
+	if (system_millis % STEP_MS == 0) {
+		first = (first == 0) ? STRIP_LEDS - 1 : first - 1;
+	}
+}
+
+static void init_colors(void)
 {
+	static const struct color pattern[3] = {
+		{ .r = 0x1F, .g = 0, .b = 0 },
+		{ .r = 0, .g = 0x1F, .b = 0 },
+		{ .r = 0, .g = 0, .b = 0x1F },
+	};
+	static const struct color off = { 0, 0, 0 };
 	int i;
 
-	struct color colors[COLOR_COUNT];
+	lpd6803_pack(cells, pattern, 3);
+	for (i = 3; i < FRAME_LEDS; i++) {
+		cells[i] = lpd6803_cell(&off);
+	}
+}
+
+int main(void)
+{
+	uint32_t next, last = 0, now;
 
 	clock_setup();
 	gpio_setup();
+	usart_setup();
+	spi_setup();
+	dma_setup();
 
-	reset_colors(colors, COLOR_COUNT);
-	init_colors(colors, COLOR_COUNT);
+	init_colors();
+	strip_frame_start();
 
-	while (1) {
-		gpio_toggle(GPIOC, GPIO12);	/* LED on/off */
+	printf("%d LED strip, %d LED frames, %d bits per frame at %d bit/s\r\n",
+	       STRIP_LEDS, FRAME_LEDS, FRAME_BITS, SPI_BITRATE);
 
-		send_colors(colors, COLOR_COUNT);
+	next = system_millis + 1000;
+	while (1) {
+		while ((int32_t)(system_millis - next) < 0);
+		next += 1000;
 
-		step_colors(colors, COLOR_COUNT);
+		gpio_toggle(GPIOC, GPIO12);	/* LED on/off */
 
-		for (i = 0; i < 1000000; i++)	/* Wait a bit. */
-			__asm__("nop");
+		now = frames;
+		printf("%lu frames/s\r\n", now - last);
+		last = now;
 	}
 
 	return 0;
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include "lpd6803.h"
+
+/* Only the low 5 bits of each color are used. */
+uint16_t lpd6803_cell(const struct color *c)
+{
+	return 0x8000 | ((c->b & 0x1f) << 10) | ((c->r & 0x1f) << 5) |
+	       (c->g & 0x1f);
+}
+
+void lpd6803_pack(uint16_t *cells, const struct color *colors, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		cells[i] = lpd6803_cell(&colors[i]);
+	}
+}
+
+/*
+ * lpd6803_segments
+ *
+ * Split a frame of count LEDs into DMA transfers. The first strip cells
+ * are a circular buffer and the first LED shows cells[first], so moving
+ * a pattern along the strip only changes first, nothing gets copied.
+ * The cells from strip to count follow as they are. Returns the number
+ * of segments, at most LPD6803_MAX_SEGS.
+ */
+int lpd6803_segments(struct lpd6803_seg *seg, const uint16_t *cells,
+		     int count, int strip, int first)
+{
+	int n = 0;
+
+	seg[n].buf = NULL;
+	seg[n++].len = LPD6803_START_WORDS;
+
+	seg[n].buf = &cells[first];
+	seg[n++].len = strip - first;
+	if (first != 0) {
+		seg[n].buf = cells;
+		seg[n++].len = first;
+	}
+	if (count > strip) {
+		seg[n].buf = &cells[strip];
+		seg[n++].len = count - strip;
+	}
+
+	seg[n].buf = NULL;
+	seg[n++].len = LPD6803_END_WORDS(count);
+
+	return n;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LPD6803_H
+#define LPD6803_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * LPD6803 frames as 16 bit SPI words, MSB first:
+ *	start	32 zero bits
+ *	cells	one word per LED: a 1 start bit, then 5 bits each of
+ *		blue, red and green
+ *	end	one zero bit per LED, rounded up to whole words
+ * This is bit for bit what the old bit banging code sent, plus up to 15
+ * extra zero clocks at the end.
+ */
+#define LPD6803_START_WORDS	2
+#define LPD6803_END_WORDS(n)	(((n) + 15) / 16)
+
+struct color {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+};
+
+/*
+ * A piece of a frame for one DMA transfer. NULL buf means len zero
+ * words, sent from a single zero without memory increment.
+ */
+struct lpd6803_seg {
+	const uint16_t *buf;
+	uint16_t len;
+};
+
+#define LPD6803_MAX_SEGS	5
+
+uint16_t lpd6803_cell(const struct color *c);
+void lpd6803_pack(uint16_t *cells, const struct color *colors, int count);
+int lpd6803_segments(struct lpd6803_seg *seg, const uint16_t *cells,
+		     int count, int strip, int first);
+
+#endif
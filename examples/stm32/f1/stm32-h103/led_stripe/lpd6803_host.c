@@ -0,0 +1,265 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks lpd6803.c on the host:
+ *
+ *	cc -o lpd6803_host lpd6803_host.c lpd6803.c
+ *	./lpd6803_host
+ *
+ * The bits the SPI sends for a frame, the segments taken in order with
+ * a NULL buffer standing for zero words, are compared with the bits
+ * the old bit banging send_colors() clocked out for the same colors:
+ * the same bit for bit, then at most 15 zero clocks more. This is done
+ * for every rotation of the strip, so the wrap-around segments are
+ * covered, with the rotation moved along the way the old step_colors()
+ * moved the colors, and for frames longer than the strip, whose cells
+ * past the strip stay where they are.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lpd6803.h"
+
+#define MAX_LEDS	1024
+#define MAX_BITS	((LPD6803_START_WORDS + MAX_LEDS + \
+			  LPD6803_END_WORDS(MAX_LEDS)) * 16)
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/* MOSI as the strip samples it, on every rising SCLK edge */
+static uint8_t bits[MAX_BITS];
+static int nbits;
+
+static void clock_out(int mosi)
+{
+	bits[nbits++] = mosi;
+}
+
+/* The old send_colors(), with the pins replaced by clock_out() */
+static void send_colors(struct color *colors, int count)
+{
+	int i, k;
+
+	for (i = 0; i < 32; i++) {
+		clock_out(0);
+	}
+	for (k = 0; k < count; k++) {
+		clock_out(1);
+		for (i = 0; i < 5; i++) {
+			clock_out((colors[k].b & ((1 << 4) >> i)) != 0);
+		}
+		for (i = 0; i < 5; i++) {
+			clock_out((colors[k].r & ((1 << 4) >> i)) != 0);
+		}
+		for (i = 0; i < 5; i++) {
+			clock_out((colors[k].g & ((1 << 4) >> i)) != 0);
+		}
+	}
+	for (k = 0; k < count; k++) {
+		clock_out(0);
+	}
+}
+
+/* The old step_colors(): every LED takes the color of the one before */
+static void step_colors(struct color *colors, int count)
+{
+	struct color last = colors[count - 1];
+
+	memmove(&colors[1], &colors[0], (count - 1) * sizeof(colors[0]));
+	colors[0] = last;
+}
+
+/* What SPI2 sends for the segments, 16 bit words MSB first */
+static int spi_bits(uint8_t *out, const struct lpd6803_seg *seg, int n)
+{
+	int s, w, b, len = 0;
+	uint16_t word;
+
+	for (s = 0; s < n; s++) {
+		for (w = 0; w < seg[s].len; w++) {
+			word = seg[s].buf != NULL ? seg[s].buf[w] : 0;
+			for (b = 15; b >= 0; b--) {
+				out[len++] = (word >> b) & 1;
+			}
+		}
+	}
+	return len;
+}
+
+/*
+ * One frame: the segments must be at most LPD6803_MAX_SEGS, none of
+ * them empty, the LED cells inside cells[], and send what the bit
+ * banging did.
+ */
+static int frame_ok(struct color *colors, const uint16_t *cells, int count,
+		    int strip, int first)
+{
+	struct lpd6803_seg seg[LPD6803_MAX_SEGS + 1];
+	static uint8_t out[MAX_BITS];
+	int n, s, len, i;
+
+	n = lpd6803_segments(seg, cells, count, strip, first);
+	if (n < 3 || n > LPD6803_MAX_SEGS) {
+		return 0;
+	}
+	for (s = 0; s < n; s++) {
+		if (seg[s].len == 0) {
+			return 0;
+		}
+		if (seg[s].buf != NULL && (seg[s].buf < cells ||
+		    seg[s].buf + seg[s].len > cells + count)) {
+			return 0;
+		}
+	}
+
+	nbits = 0;
+	send_colors(colors, count);
+	len = spi_bits(out, seg, n);
+	if (len < nbits || len - nbits > 15 || len % 16 != 0 ||
+	    memcmp(out, bits, nbits) != 0) {
+		return 0;
+	}
+	for (i = nbits; i < len; i++) {
+		if (out[i] != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Single cells, every bit of every color on its own */
+static void test_cells(void)
+{
+	struct color c;
+	int bit, which;
+	uint16_t want;
+
+	for (which = 0; which < 3; which++) {
+		for (bit = 0; bit < 8; bit++) {
+			memset(&c, 0, sizeof(c));
+			if (which == 0) {
+				c.b = 1 << bit;
+			} else if (which == 1) {
+				c.r = 1 << bit;
+			} else {
+				c.g = 1 << bit;
+			}
+			want = bit < 5 ? 0x8000 | 1 << (bit + 10 - which * 5) :
+			       0x8000;
+			check(lpd6803_cell(&c) == want, "cell",
+			      which * 8 + bit, lpd6803_cell(&c));
+		}
+	}
+}
+
+/*
+ * Every strip length up to 64, in a frame as long as the strip and in
+ * one up to 20 LEDs longer, random colors with all eight bits set at
+ * random, every rotation, moved along like the old code did it.
+ */
+static void test_frames(void)
+{
+	struct color colors[MAX_LEDS], packed[MAX_LEDS];
+	uint16_t cells[MAX_LEDS];
+	int strip, count, i, first, step, bad;
+
+	for (strip = 1; strip <= 64; strip++) {
+		count = strip + ((strip & 1) ? lcg() % 21 : 0);
+		for (i = 0; i < count; i++) {
+			colors[i].r = lcg();
+			colors[i].g = lcg();
+			colors[i].b = lcg();
+		}
+		memcpy(packed, colors, count * sizeof(colors[0]));
+		lpd6803_pack(cells, packed, count);
+
+		bad = 0;
+		first = 0;
+		for (step = 0; step < 2 * strip + 3; step++) {
+			bad += !frame_ok(colors, cells, count, strip, first);
+			step_colors(colors, strip);
+			/* sys_tick_handler() in led_stripe.c */
+			first = (first == 0) ? strip - 1 : first - 1;
+		}
+		check(bad == 0, "frames", strip, count);
+	}
+}
+
+/*
+ * The 50 LED strip and the pattern led_stripe.c starts with, in a frame
+ * of 1024 LEDs, and in one of only the strip.
+ */
+static void test_strip(int frame)
+{
+	static const struct color pattern[3] = {
+		{ .r = 0x1F, .g = 0, .b = 0 },
+		{ .r = 0, .g = 0x1F, .b = 0 },
+		{ .r = 0, .g = 0, .b = 0x1F },
+	};
+	static struct color colors[MAX_LEDS];
+	static uint16_t cells[MAX_LEDS];
+	int i, first = 0, bad = 0;
+
+	memset(colors, 0, sizeof(colors));
+	memcpy(colors, pattern, sizeof(pattern));
+	lpd6803_pack(cells, colors, frame);
+	for (i = 0; i < 200; i++) {
+		bad += !frame_ok(colors, cells, frame, 50, first);
+		step_colors(colors, 50);
+		first = (first == 0) ? 49 : first - 1;
+	}
+	check(bad == 0, "strip", frame, bad);
+
+	nbits = 0;
+	send_colors(colors, frame);
+	check(nbits == 32 + frame * 16 + frame, "old frame bits", nbits,
+	      frame);
+	check((LPD6803_START_WORDS + frame + LPD6803_END_WORDS(frame)) * 16 -
+	      nbits < 16, "new frame bits", nbits, frame);
+}
+
+int main(void)
+{
+	test_cells();
+	test_frames();
+	test_strip(1024);
+	test_strip(50);
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Six step BLDC control, without any hardware access so the same code
+ * runs against the motor model in bldc_sim.c.
+ *
+ * bldc_tick() runs once per PWM period. It picks the commutation step,
+ * from the hall sensors through a lookup table, or on a timer from the
+ * wanted speed, and says when the drive has to change. It measures the
+ * speed over the last six steps, one electrical turn, which evens out
+ * hall sensors that aren't quite 60 degrees apart, and every loop_div
+ * ticks runs a PI loop from speed error to duty. bldc_current() takes
+ * the current sample, and drops the duty to zero until the next speed
+ * loop run if it is over the limit.
+ */
+
+#include "bldc.h"
+
+/*
+ * PWM on the high side of the phase going up, and on the low side of
+ * the one going down, see pwm_6step.c:
+ *
+ *  | 1| 2| 3| 4| 5| 6|
+ * -+--+--+--+--+--+--+
+ * A|p+|++|  |p-|--|  |
+ * B|  |p-|--|  |p+|++|
+ * C|--|  |p+|++|  |p-|
+ */
+const uint8_t bldc_drive[BLDC_STEPS][3] = {
+	{ BLDC_PWM_HIGH, BLDC_FLOAT, BLDC_LOW },
+	{ BLDC_HIGH, BLDC_PWM_LOW, BLDC_FLOAT },
+	{ BLDC_FLOAT, BLDC_LOW, BLDC_PWM_HIGH },
+	{ BLDC_PWM_LOW, BLDC_FLOAT, BLDC_HIGH },
+	{ BLDC_LOW, BLDC_PWM_HIGH, BLDC_FLOAT },
+	{ BLDC_FLOAT, BLDC_HIGH, BLDC_PWM_LOW },
+};
+
+void bldc_init(struct bldc *m, const struct bldc_cfg *cfg)
+{
+	int i;
+
+	m->cfg = *cfg;
+	/* Whatever the first step is, it has to be set up */
+	m->step = BLDC_NO_STEP;
+	m->duty = 0;
+	m->target = 0;
+	m->speed = 0;
+	m->commutations = 0;
+	m->hall_errors = 0;
+	m->overcurrent = 0;
+	m->current = 0;
+	m->integ = 0;
+	m->ticks = 0;
+	for (i = 0; i < BLDC_STEPS; i++) {
+		m->interval[i] = 0;
+	}
+	m->interval_sum = 0;
+	m->interval_pos = 0;
+	m->loop_count = 0;
+}
+
+void bldc_set_speed(struct bldc *m, uint32_t steps_per_s)
+{
+	m->target = steps_per_s;
+	if (steps_per_s == 0) {
+		m->duty = 0;
+		m->integ = 0;
+	}
+}
+
+static void measure(struct bldc *m)
+{
+	m->interval_sum -= m->interval[m->interval_pos];
+	m->interval[m->interval_pos] = m->ticks;
+	m->interval_sum += m->ticks;
+	m->interval_pos = (m->interval_pos + 1) % BLDC_STEPS;
+	m->ticks = 0;
+	m->commutations++;
+}
+
+/* Steps per second: the last turn, or less if the current step drags on */
+static uint32_t speed(const struct bldc *m)
+{
+	uint32_t s = 0;
+
+	if (m->interval_sum != 0) {
+		s = (uint64_t)m->cfg.pwm_hz * BLDC_STEPS / m->interval_sum;
+	}
+	if ((m->ticks != 0) && (m->cfg.pwm_hz / m->ticks < s)) {
+		s = m->cfg.pwm_hz / m->ticks;
+	}
+	return s;
+}
+
+static void speed_loop(struct bldc *m)
+{
+	int32_t err, out;
+	int32_t lo = (int32_t)m->cfg.duty_min << 16;
+	int32_t hi = (int32_t)m->cfg.duty_max << 16;
+
+	err = (int32_t)m->target - (int32_t)m->speed;
+
+	/*
+	 * Clamping the integrator keeps it from winding up. So does not
+	 * letting it run down while no current flows: the motor is then
+	 * coasting faster than the duty drives it, less duty changes
+	 * nothing, and it would only end up far below what the new speed
+	 * needs by the time the motor gets there.
+	 */
+	if ((err > 0) || (m->current > m->cfg.current_limit / 64)) {
+		m->integ += m->cfg.ki * err;
+	}
+	if (m->integ < lo) {
+		m->integ = lo;
+	} else if (m->integ > hi) {
+		m->integ = hi;
+	}
+
+	out = (m->cfg.kp * err + m->integ) >> 16;
+	if (out < m->cfg.duty_min) {
+		out = m->cfg.duty_min;
+	} else if (out > m->cfg.duty_max) {
+		out = m->cfg.duty_max;
+	}
+	m->duty = out;
+}
+
+/*
+ * bldc_tick
+ *
+ * Once per PWM period, with the hall sensor code (bit 0 = sensor A) if
+ * there are any. True when the drive has to change to bldc_drive[step].
+ * The duty to use is in m->duty either way.
+ */
+bool bldc_tick(struct bldc *m, uint8_t hall)
+{
+	bool commutate = false;
+	uint8_t step;
+
+	m->ticks++;
+
+	if (m->cfg.hall) {
+		step = m->cfg.hall_step[hall & 7];
+		if (step >= BLDC_STEPS) {
+			m->hall_errors++;
+		} else if (step != m->step) {
+			/* The first step says nothing about the speed */
+			if (m->step != BLDC_NO_STEP) {
+				measure(m);
+			}
+			m->step = step;
+			m->ticks = 0;
+			commutate = true;
+		}
+		m->speed = speed(m);
+	} else if ((m->target != 0) &&
+		   (m->ticks >= m->cfg.pwm_hz / m->target)) {
+		m->step = (m->step >= BLDC_STEPS - 1) ? 0 : m->step + 1;
+		measure(m);
+		commutate = true;
+		m->speed = m->target;
+	}
+
+	if (m->target == 0) {
+		m->duty = 0;
+	} else if (!m->cfg.hall) {
+		m->duty = m->cfg.open_duty;
+	} else if (++m->loop_count >= m->cfg.loop_div) {
+		m->loop_count = 0;
+		speed_loop(m);
+	}
+
+	return commutate;
+}
+
+/*
+ * bldc_current
+ *
+ * A current sample, from the middle of the on time. Over the limit the
+ * duty goes to zero until the next speed loop run, and the integrator
+ * backs off a little.
+ */
+void bldc_current(struct bldc *m, uint16_t sample)
+{
+	m->current = sample;
+	if (sample > m->cfg.current_limit) {
+		m->overcurrent++;
+		m->duty = 0;
+		m->integ -= m->integ / 8;
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLDC_H
+#define BLDC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* What a phase does during one commutation step */
+#define BLDC_FLOAT	0	/* both switches off */
+#define BLDC_LOW	1	/* low side on */
+#define BLDC_HIGH	2	/* high side on */
+#define BLDC_PWM_HIGH	3	/* high side switching, low side off */
+#define BLDC_PWM_LOW	4	/* low side switching, high side off */
+
+#define BLDC_STEPS	6
+#define BLDC_NO_STEP	0xff
+
+/* Phases A, B and C for each step */
+extern const uint8_t bldc_drive[BLDC_STEPS][3];
+
+struct bldc_cfg {
+	uint32_t pwm_hz;	/* bldc_tick() calls per second */
+	uint16_t duty_max;	/* full on, the timer period */
+	uint16_t duty_min;	/* least the speed loop drives with */
+	uint16_t loop_div;	/* speed loop every loop_div ticks */
+	int32_t kp, ki;		/* duty per step/s of error, 16.16 */
+	uint16_t current_limit;	/* ADC counts */
+	bool hall;		/* commutate on the hall sensors, else on time */
+	uint8_t hall_step[8];	/* hall code to step, BLDC_NO_STEP if invalid */
+	uint16_t open_duty;	/* duty when commutating on time */
+};
+
+struct bldc {
+	struct bldc_cfg cfg;
+	uint8_t step;		/* index into bldc_drive */
+	uint16_t duty;		/* for all three compare registers */
+	uint32_t target;	/* steps per second */
+	uint32_t speed;		/* measured, steps per second */
+
+	/* Statistics */
+	uint32_t commutations;
+	uint32_t hall_errors;	/* codes 0 and 7, or whatever the table says */
+	uint32_t overcurrent;	/* samples over the limit */
+	uint16_t current;	/* last sample */
+
+	/* Private to bldc.c */
+	int32_t integ;		/* 16.16 */
+	uint32_t ticks;		/* since the last commutation */
+	uint32_t interval[BLDC_STEPS];
+	uint32_t interval_sum;
+	uint8_t interval_pos;
+	uint16_t loop_count;
+};
+
+void bldc_init(struct bldc *m, const struct bldc_cfg *cfg);
+void bldc_set_speed(struct bldc *m, uint32_t steps_per_s);
+bool bldc_tick(struct bldc *m, uint8_t hall);
+void bldc_current(struct bldc *m, uint16_t sample);
+
+#endif
@@ -0,0 +1,240 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Closed loop simulation of bldc.c on the host, against a simple model
+ * of a small BLDC motor: phase to phase resistance and inductance, back
+ * EMF and torque proportional to speed and current, inertia, friction
+ * and a load torque. Torque and back EMF go with the sine of the angle
+ * between the field of the drive step and the rotor, so commutating at
+ * the wrong time costs torque, or brakes. The hall sensors are derived
+ * from the rotor position.
+ *
+ *	cc -O2 -o bldc_sim bldc_sim.c bldc.c -lm
+ *	./bldc_sim [timed]
+ *
+ * prints time, target and measured speed (steps/s), the model's own
+ * speed, duty and current every 20ms while the target and the load
+ * change. After each change the model's speed has to settle within 2%
+ * of the target in the time the table below gives, without going past
+ * it, or dipping under the load, by more than the table allows, and
+ * the rotor must never fall more than MAX_SLIP steps behind or ahead of
+ * the commutations. Exits with 1 if anything fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "bldc.h"
+
+#define PWM_HZ		20000
+#define SUBSTEPS	10	/* model steps per PWM period */
+
+/* Motor */
+#define R		1.0	/* ohm, phase to phase */
+#define L		0.0002	/* henry */
+#define KE		0.01	/* V/(rad/s) and Nm/A */
+#define POLE_PAIRS	4
+#define J		0.000002 /* kg m^2 */
+#define B		0.00001	/* Nm/(rad/s) */
+#define VBUS		12.0
+
+/* Current sense: ADC counts per amp */
+#define ADC_PER_AMP	200.0
+
+/* Hall code for each 60 degree sector, and the reverse as a table */
+static const uint8_t sector_hall[6] = { 1, 3, 2, 6, 4, 5 };
+
+/* What happens when, and how well the speed has to follow */
+struct change {
+	double t;		/* s */
+	uint32_t target;	/* steps/s */
+	double load;		/* Nm */
+	double settle;		/* s, to within SETTLE_BAND, 0 = any */
+	double peak;		/* past the target, as part of it */
+};
+
+#define SETTLE_BAND	0.02
+#define MAX_SLIP	3	/* steps, past 180 degrees torque reverses */
+#define RUN_TIME	2.5	/* s */
+
+static const struct change hall_run[] = {
+	{ 0.0,  1000, 0,     0.3,  0.10 },
+	{ 0.5,  3000, 0,     0.1,  0.05 },
+	{ 1.0,  3000, 0.005, 0.1,  0.10 },	/* the dip */
+	{ 1.25, 3000, 0,     0.1,  0.10 },
+	{ 1.5,  500,  0,     0.6,  0.05 },	/* coasting down */
+};
+
+/*
+ * On time the rotor swings about the commutation like a stepper, and
+ * only has to keep up with it
+ */
+static const struct change timed_run[] = {
+	{ 0.0,  200,  0,     0,    0 },
+	{ 0.5,  400,  0,     0,    0 },
+	{ 1.0,  400,  0.005, 0,    0 },
+	{ 1.25, 400,  0,     0,    0 },
+	{ 1.5,  200,  0,     0,    0 },
+};
+
+#define CHANGES		5
+
+struct plant {
+	double i;	/* A */
+	double w;	/* rad/s, mechanical */
+	double theta;	/* rad, electrical */
+	double load;	/* Nm */
+};
+
+static int sector(const struct plant *p)
+{
+	double e = fmod(p->theta, 2 * M_PI);
+
+	if (e < 0) {
+		e += 2 * M_PI;
+	}
+	return (int)(e / (M_PI / 3)) % 6;
+}
+
+static void plant_step(struct plant *p, int step, double duty, double dt)
+{
+	/* Step n puts the field 120 degrees past the start of sector n */
+	double fit = sin((step + 2) * M_PI / 3 - p->theta);
+	double v = duty * VBUS;
+	double e = KE * p->w * fit;
+	double torque;
+
+	p->i += (v - e - R * p->i) / L * dt;
+	/* The freewheeling diodes don't let the current reverse */
+	if (p->i < 0) {
+		p->i = 0;
+	}
+	torque = KE * p->i * fit - B * p->w - p->load;
+	if ((p->w <= 0) && (torque < 0)) {
+		torque = 0;
+		p->w = 0;
+	}
+	p->w += torque / J * dt;
+	p->theta += p->w * POLE_PAIRS * dt;
+}
+
+/* Which way the speed goes after change c, if it goes too far */
+static int direction(const struct change *run, int c)
+{
+	if (c == 0) {
+		return 1;
+	}
+	if (run[c].target != run[c - 1].target) {
+		return (run[c].target > run[c - 1].target) ? 1 : -1;
+	}
+	return (run[c].load > run[c - 1].load) ? -1 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct bldc_cfg cfg = {
+		.pwm_hz = PWM_HZ,
+		.duty_max = 1800,
+		.duty_min = 20,
+		.loop_div = 20,
+		.kp = 0.2 * 65536,
+		.ki = 0.02 * 65536,
+		.current_limit = 4 * ADC_PER_AMP,
+		.hall = true,
+		.open_duty = 400,
+	};
+	static struct bldc m;
+	struct plant p = { 0, 0, 0.3, 0 };
+	const struct change *run = hall_run;
+	double t, real, err, slip, peak[CHANGES], settled[CHANGES];
+	double max_slip = 0;
+	int tick, k, c = -1, fails = 0;
+
+	memset(cfg.hall_step, BLDC_NO_STEP, sizeof(cfg.hall_step));
+	for (k = 0; k < 6; k++) {
+		cfg.hall_step[sector_hall[k]] = k;
+	}
+	if ((argc > 1) && (strcmp(argv[1], "timed") == 0)) {
+		cfg.hall = false;
+		run = timed_run;
+	}
+	bldc_init(&m, &cfg);
+
+	printf("#  t    target speed   real  duty current\n");
+	for (tick = 0; tick < RUN_TIME * PWM_HZ; tick++) {
+		t = (double)tick / PWM_HZ;
+
+		/* Speed steps, and a load that comes and goes */
+		if ((c < CHANGES - 1) && (t >= run[c + 1].t)) {
+			c++;
+			if ((c == 0) || (run[c].target != run[c - 1].target)) {
+				bldc_set_speed(&m, run[c].target);
+			}
+			p.load = run[c].load;
+			peak[c] = 0;
+			settled[c] = 0;
+		}
+
+		bldc_tick(&m, sector_hall[sector(&p)]);
+		for (k = 0; k < SUBSTEPS; k++) {
+			plant_step(&p, m.step, (double)m.duty / cfg.duty_max,
+				   1.0 / PWM_HZ / SUBSTEPS);
+		}
+		/* Sampled at the middle of the on time, when there is one */
+		if (m.duty != 0) {
+			bldc_current(&m, p.i * ADC_PER_AMP);
+		}
+
+		real = p.w * POLE_PAIRS * 6 / (2 * M_PI);
+		err = (real - run[c].target) / run[c].target;
+		if (err * direction(run, c) > peak[c]) {
+			peak[c] = err * direction(run, c);
+		}
+		if (fabs(err) > SETTLE_BAND) {
+			settled[c] = t + 1.0 / PWM_HZ - run[c].t;
+		}
+		/* From where it started, and before the first commutation */
+		slip = (p.theta - 0.3) / (M_PI / 3) - m.commutations;
+		if (fabs(slip) > max_slip) {
+			max_slip = fabs(slip);
+		}
+
+		if (tick % (PWM_HZ / 50) == 0) {
+			printf("%5.2f %6u %6u %6.0f %5u %6.2f\n", t, m.target,
+			       m.speed, real, m.duty, p.i);
+		}
+	}
+	printf("# commutations %u, hall errors %u, overcurrent %u\n",
+	       m.commutations, m.hall_errors, m.overcurrent);
+
+	for (c = 0; c < CHANGES; c++) {
+		k = (run[c].settle != 0) && ((settled[c] > run[c].settle) ||
+					     (peak[c] > run[c].peak));
+		printf("# %s %4.2fs to %u steps/s, %.0fmNm: settled in "
+		       "%.3fs, %.1f%% past\n", (run[c].settle == 0) ? "--" :
+		       k ? "FAIL" : "ok", run[c].t, run[c].target,
+		       run[c].load * 1000, settled[c], peak[c] * 100);
+		fails += k;
+	}
+	k = max_slip > MAX_SLIP;
+	printf("# %s rotor at most %.1f steps off the commutations\n",
+	       k ? "FAIL" : "ok", max_slip);
+	fails += k;
+	return fails ? 1 : 0;
+}
@@ -20,14 +20,59 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/adc.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/exti.h>
 
+#include "bldc.h"
+
+/*
+ * Six step BLDC drive on TIM1, the control itself is in bldc.c.
+ *
+ * TIM1 counts up and down (center aligned), so the on time of all three
+ * phases is centered on the counter reaching zero. Once per PWM period
+ * the update interrupt reads the hall sensors and runs bldc_tick(); on
+ * a new step the output modes and enables are written to their preload
+ * registers and a COM event latches them all at once. The duty goes to
+ * the preloaded compare registers and takes effect on the next update.
+ *
+ * Channel 4 matches just before zero while counting down, in the middle
+ * of the on time, and starts an injected conversion of the current
+ * sense on PC0 there; the ADC interrupt hands it to bldc_current().
+ *
+ * The button cycles through a few speeds, starting from stopped.
+ */
+
+/* Commutate on the hall sensors on PC6..PC8, else open loop on time */
+#define HALL_SENSORS	true
+
+#define PWM_HZ		20000
+#define PWM_PERIOD	(72000000 / 2 / PWM_HZ)
+
 #define FALLING 0
 #define RISING 1
 
 uint16_t exti_direction = FALLING;
 
+static struct bldc motor;
+
+/* Steps per second for each button press */
+static const uint32_t speeds[] = { 0, 500, 1000, 2000, 3000 };
+
+static const struct bldc_cfg motor_cfg = {
+	.pwm_hz = PWM_HZ,
+	.duty_max = PWM_PERIOD * 9 / 10,
+	.duty_min = PWM_PERIOD / 100,
+	.loop_div = PWM_HZ / 1000,	/* 1kHz speed loop */
+	.kp = 0.2 * 65536,
+	.ki = 0.02 * 65536,
+	.current_limit = 3000,
+	.hall = HALL_SENSORS,
+	/* Hall codes 1, 3, 2, 6, 4, 5 in turn; adjust for the motor */
+	.hall_step = { BLDC_NO_STEP, 0, 2, 1, 4, 5, 3, BLDC_NO_STEP },
+	.open_duty = PWM_PERIOD / 5,
+};
+
 static void clock_setup(void)
 {
 	rcc_clock_setup_in_hse_8mhz_out_72mhz();
@@ -41,6 +86,14 @@ static void gpio_setup(void)
 	/* Set GPIO12 (in GPIO port C) to 'output push-pull'. */
 	gpio_set_mode(GPIOC, GPIO_MODE_OUTPUT_50_MHZ,
 		      GPIO_CNF_OUTPUT_PUSHPULL, GPIO12);
+
+	/* Hall sensors, open collector, pulled up. */
+	gpio_set(GPIOC, GPIO6 | GPIO7 | GPIO8);
+	gpio_set_mode(GPIOC, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN,
+		      GPIO6 | GPIO7 | GPIO8);
+
+	/* Current sense. */
+	gpio_set_mode(GPIOC, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG, GPIO0);
 }
 
 static void exti_setup(void)
@@ -66,15 +119,17 @@ static void exti_setup(void)
 
 void exti0_isr(void)
 {
+	static unsigned int speed;
+
 	exti_reset_request(EXTI0);
 
 	if (exti_direction == FALLING) {
-		// gpio_toggle(GPIOA, GPIO12);
 		exti_direction = RISING;
 		exti_set_trigger(EXTI0, EXTI_TRIGGER_RISING);
 	} else {
-		// gpio_toggle(GPIOA, GPIO12);
-		timer_generate_event(TIM1, TIM_EGR_COMG);
+		/* Released: next speed. */
+		speed = (speed + 1) % (sizeof(speeds) / sizeof(speeds[0]));
+		bldc_set_speed(&motor, speeds[speed]);
 		exti_direction = FALLING;
 		exti_set_trigger(EXTI0, EXTI_TRIGGER_FALLING);
 	}
@@ -106,25 +161,25 @@ static void tim_setup(void)
 		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL,
 		      GPIO_TIM1_CH1N | GPIO_TIM1_CH2N | GPIO_TIM1_CH3N);
 
-	/* Enable TIM1 commutation interrupt. */
-	nvic_enable_irq(NVIC_TIM1_TRG_COM_IRQ);
+	/* Enable TIM1 update interrupt. */
+	nvic_enable_irq(NVIC_TIM1_UP_IRQ);
 
 	/* Reset TIM1 peripheral. */
 	rcc_periph_reset_pulse(RST_TIM1);
 
 	/* Timer global mode:
 	 * - No divider
-	 * - Alignment edge
+	 * - Alignment center, compare flags while counting down
 	 * - Direction up
 	 */
 	timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT,
-		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+		       TIM_CR1_CMS_CENTER_1, TIM_CR1_DIR_UP);
 
 	/* Reset prescaler value. */
 	timer_set_prescaler(TIM1, 0);
 
-	/* Reset repetition counter value. */
-	timer_set_repetition_counter(TIM1, 0);
+	/* One update per period, not at both ends. */
+	timer_set_repetition_counter(TIM1, 1);
 
 	/* Enable preload. */
 	timer_enable_preload(TIM1);
@@ -132,8 +187,8 @@ static void tim_setup(void)
 	/* Continuous mode. */
 	timer_continuous_mode(TIM1);
 
-	/* Period (32kHz). */
-	timer_set_period(TIM1, 72000000 / 32000);
+	/* Period (20kHz, counting up and down). */
+	timer_set_period(TIM1, PWM_PERIOD);
 
 	/* Configure break and deadtime. */
 	timer_set_deadtime(TIM1, 10);
@@ -164,12 +219,8 @@ static void tim_setup(void)
 	timer_set_oc_polarity_high(TIM1, TIM_OC1N);
 	timer_set_oc_idle_state_set(TIM1, TIM_OC1N);
 
-	/* Set the capture compare value for OC1. */
-	timer_set_oc_value(TIM1, TIM_OC1, 100);
-
-	/* Reenable outputs. */
-	timer_enable_oc_output(TIM1, TIM_OC1);
-	timer_enable_oc_output(TIM1, TIM_OC1N);
+	/* Nothing until the motor is told to go. */
+	timer_set_oc_value(TIM1, TIM_OC1, 0);
 
 	/* -- OC2 and OC2N configuration -- */
 
@@ -191,12 +242,8 @@ static void tim_setup(void)
 	timer_set_oc_polarity_high(TIM1, TIM_OC2N);
 	timer_set_oc_idle_state_set(TIM1, TIM_OC2N);
 
-	/* Set the capture compare value for OC1. */
-	timer_set_oc_value(TIM1, TIM_OC2, 100);
-
-	/* Reenable outputs. */
-	timer_enable_oc_output(TIM1, TIM_OC2);
-	timer_enable_oc_output(TIM1, TIM_OC2N);
+	/* Nothing until the motor is told to go. */
+	timer_set_oc_value(TIM1, TIM_OC2, 0);
 
 	/* -- OC3 and OC3N configuration -- */
 
@@ -218,12 +265,13 @@ static void tim_setup(void)
 	timer_set_oc_polarity_high(TIM1, TIM_OC3N);
 	timer_set_oc_idle_state_set(TIM1, TIM_OC3N);
 
-	/* Set the capture compare value for OC3. */
-	timer_set_oc_value(TIM1, TIM_OC3, 100);
+	/* Nothing until the motor is told to go. */
+	timer_set_oc_value(TIM1, TIM_OC3, 0);
 
-	/* Reenable outputs. */
-	timer_enable_oc_output(TIM1, TIM_OC3);
-	timer_enable_oc_output(TIM1, TIM_OC3N);
+	/* -- OC4, ADC trigger in the middle of the on time -- */
+
+	timer_set_oc_mode(TIM1, TIM_OC4, TIM_OCM_PWM1);
+	timer_set_oc_value(TIM1, TIM_OC4, 1);
 
 	/* ---- */
 
@@ -242,154 +290,122 @@ static void tim_setup(void)
 	/* Counter enable. */
 	timer_enable_counter(TIM1);
 
-	/* Enable commutation interrupt. */
-	timer_enable_irq(TIM1, TIM_DIER_COMIE);
+	/* Enable update interrupt. */
+	timer_enable_irq(TIM1, TIM_DIER_UIE);
 }
 
-void tim1_trg_com_isr(void)
+static void adc_setup(void)
 {
-	static int step = 0;
-
-	/* Clear the COM trigger interrupt flag. */
-	timer_clear_flag(TIM1, TIM_SR_COMIF);
+	uint8_t channels[1] = { 10 };
+	int i;
 
-	/*
-	 * A simplified and inefficient implementation of PWM On
-	 * scheme. Look at the implementation in Open-BLDC on
-	 * http://open-bldc.org for the proper implementation. This
-	 * one only serves as an example.
-	 *
-	 * Table of the PWM scheme zone configurations when driving:
-	 * @verbatim
-	 *  | 1| 2| 3| 4| 5| 6|
-	 * -+--+--+--+--+--+--+
-	 * A|p+|++|  |p-|--|  |
-	 * -+--+--+--+--+--+--+
-	 * B|  |p-|--|  |p+|++|
-	 * -+--+--+--+--+--+--+
-	 * C|--|  |p+|++|  |p-|
-	 * -+--+--+--+--+--+--+
-	 *  |  |  |  |  |  |  '- 360 Deg
-	 *  |  |  |  |  |  '---- 300 Deg
-	 *  |  |  |  |  '------- 240 Deg
-	 *  |  |  |  '---------- 180 Deg
-	 *  |  |  '------------- 120 Deg
-	 *  |  '----------------  60 Deg
-	 *  '-------------------   0 Deg
-	 *
-	 * Legend:
-	 * p+: PWM on the high side
-	 * p-: PWM on the low side
-	 * --: Low side on
-	 * ++: High side on
-	 *   : Floating/NC
-	 * @endverbatim
-	 */
-	switch (step) {
-	case 0: /* A PWM HIGH, B OFF, C LOW */
-		timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_PWM1);
-		timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_FROZEN);
-		timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_FORCE_LOW);
+	rcc_periph_clock_enable(RCC_ADC1);
 
-		timer_enable_oc_output(TIM1, TIM_OC1);
-		timer_disable_oc_output(TIM1, TIM_OC1N);
+	/* Make sure the ADC doesn't run during config. */
+	adc_power_off(ADC1);
 
-		timer_disable_oc_output(TIM1, TIM_OC2);
-		timer_disable_oc_output(TIM1, TIM_OC2N);
+	/* One injected conversion of channel 10 (PC0) on TIM1 CC4. */
+	adc_set_single_conversion_mode(ADC1);
+	adc_enable_external_trigger_injected(ADC1, ADC_CR2_JEXTSEL_TIM1_CC4);
+	adc_enable_eoc_interrupt_injected(ADC1);
+	adc_set_right_aligned(ADC1);
+	adc_set_sample_time(ADC1, 10, ADC_SMPR_SMP_7DOT5CYC);
+	adc_set_injected_sequence(ADC1, 1, channels);
 
-		timer_enable_oc_output(TIM1, TIM_OC3);
-		timer_enable_oc_output(TIM1, TIM_OC3N);
+	adc_power_on(ADC1);
 
-		step++;
-		break;
-	case 1: /* A HIGH, B PWM LOW, C OFF */
-		timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_FORCE_HIGH);
-		timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_PWM1);
-		timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_FROZEN);
+	/* Wait for ADC starting up. */
+	for (i = 0; i < 800000; i++)    /* Wait a bit. */
+		__asm__("nop");
 
-		timer_enable_oc_output(TIM1, TIM_OC1);
-		timer_enable_oc_output(TIM1, TIM_OC1N);
+	adc_reset_calibration(ADC1);
+	adc_calibrate(ADC1);
 
-		timer_disable_oc_output(TIM1, TIM_OC2);
-		timer_enable_oc_output(TIM1, TIM_OC2N);
+	nvic_enable_irq(NVIC_ADC1_2_IRQ);
+}
 
-		timer_disable_oc_output(TIM1, TIM_OC3);
-		timer_disable_oc_output(TIM1, TIM_OC3N);
+static void set_duty(uint16_t duty)
+{
+	timer_set_oc_value(TIM1, TIM_OC1, duty);
+	timer_set_oc_value(TIM1, TIM_OC2, duty);
+	timer_set_oc_value(TIM1, TIM_OC3, duty);
+}
 
-		step++;
+/*
+ * One phase, into the preload registers, see the table in bldc.c.
+ * With only the complementary output enabled it follows OCxREF as it
+ * is, so PWM1 switches the low side with the same duty as the high.
+ */
+static void set_phase(enum tim_oc_id oc, enum tim_oc_id ocn, uint8_t drive)
+{
+	switch (drive) {
+	case BLDC_PWM_HIGH:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_PWM1);
+		timer_enable_oc_output(TIM1, oc);
+		timer_disable_oc_output(TIM1, ocn);
 		break;
-	case 2: /* A OFF, B LOW, C PWM HIGH */
-		timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_FROZEN);
-		timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_FORCE_LOW);
-		timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_PWM1);
-
-		timer_disable_oc_output(TIM1, TIM_OC1);
-		timer_disable_oc_output(TIM1, TIM_OC1N);
-
-		timer_enable_oc_output(TIM1, TIM_OC2);
-		timer_enable_oc_output(TIM1, TIM_OC2N);
-
-		timer_enable_oc_output(TIM1, TIM_OC3);
-		timer_disable_oc_output(TIM1, TIM_OC3N);
-
-		step++;
+	case BLDC_PWM_LOW:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_PWM1);
+		timer_disable_oc_output(TIM1, oc);
+		timer_enable_oc_output(TIM1, ocn);
 		break;
-	case 3: /* A PWM LOW, B OFF, C HIGH */
-		timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_PWM1);
-		timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_FROZEN);
-		timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_FORCE_HIGH);
-
-		timer_disable_oc_output(TIM1, TIM_OC1);
-		timer_enable_oc_output(TIM1, TIM_OC1N);
-
-		timer_disable_oc_output(TIM1, TIM_OC2);
-		timer_disable_oc_output(TIM1, TIM_OC2N);
-
-		timer_enable_oc_output(TIM1, TIM_OC3);
-		timer_enable_oc_output(TIM1, TIM_OC3N);
-
-		step++;
+	case BLDC_HIGH:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_FORCE_HIGH);
+		timer_enable_oc_output(TIM1, oc);
+		timer_enable_oc_output(TIM1, ocn);
 		break;
-	case 4: /* A LOW, B PWM HIGH, C OFF */
-		timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_FORCE_LOW);
-		timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_PWM1);
-		timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_FROZEN);
-
-		timer_enable_oc_output(TIM1, TIM_OC1);
-		timer_enable_oc_output(TIM1, TIM_OC1N);
-
-		timer_enable_oc_output(TIM1, TIM_OC2);
-		timer_disable_oc_output(TIM1, TIM_OC2N);
-
-		timer_disable_oc_output(TIM1, TIM_OC3);
-		timer_disable_oc_output(TIM1, TIM_OC3N);
-
-		step++;
+	case BLDC_LOW:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_FORCE_LOW);
+		timer_enable_oc_output(TIM1, oc);
+		timer_enable_oc_output(TIM1, ocn);
 		break;
-	case 5: /* A OFF, B HIGH, C PWM LOW */
-		timer_set_oc_mode(TIM1, TIM_OC1, TIM_OCM_FROZEN);
-		timer_set_oc_mode(TIM1, TIM_OC2, TIM_OCM_FORCE_HIGH);
-		timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_PWM1);
-
-		timer_disable_oc_output(TIM1, TIM_OC1);
-		timer_disable_oc_output(TIM1, TIM_OC1N);
+	default:
+		timer_set_oc_mode(TIM1, oc, TIM_OCM_FROZEN);
+		timer_disable_oc_output(TIM1, oc);
+		timer_disable_oc_output(TIM1, ocn);
+		break;
+	}
+}
 
-		timer_enable_oc_output(TIM1, TIM_OC2);
-		timer_enable_oc_output(TIM1, TIM_OC2N);
+void tim1_up_isr(void)
+{
+	const uint8_t *drive;
+	uint8_t hall;
+
+	/* Clear the update interrupt flag. */
+	timer_clear_flag(TIM1, TIM_SR_UIF);
+
+	hall = (gpio_port_read(GPIOC) >> 6) & 7;
+	if (bldc_tick(&motor, hall)) {
+		drive = bldc_drive[motor.step];
+		set_phase(TIM_OC1, TIM_OC1N, drive[0]);
+		set_phase(TIM_OC2, TIM_OC2N, drive[1]);
+		set_phase(TIM_OC3, TIM_OC3N, drive[2]);
+		/* All three at once. */
+		timer_generate_event(TIM1, TIM_EGR_COMG);
+		gpio_toggle(GPIOC, GPIO12);
+	}
+	set_duty(motor.duty);
+}
 
-		timer_disable_oc_output(TIM1, TIM_OC3);
-		timer_enable_oc_output(TIM1, TIM_OC3N);
+/* Same priority as the update interrupt, so neither cuts into the other */
+void adc1_2_isr(void)
+{
+	/* Clear Injected End Of Conversion (JEOC) */
+	ADC_SR(ADC1) &= ~ADC_SR_JEOC;
 
-		step = 0;
-		break;
+	bldc_current(&motor, adc_read_injected(ADC1, 1));
+	if (motor.duty == 0) {
+		set_duty(0);
 	}
-	gpio_toggle(GPIOC, GPIO12);
 }
 
 int main(void)
 {
 	clock_setup();
 	gpio_setup();
+	bldc_init(&motor, &motor_cfg);
+	adc_setup();
 	tim_setup();
 	exti_setup();
 
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * One period as the timer captures it in PWM input mode: CCR1 and CCR2,
+ * read by one DMA burst at each rising edge. The counter restarts on
+ * that edge, so both are counts since the rising edge before.
+ */
+struct capture_sample {
+	uint32_t period;
+	uint32_t high;
+};
+
+/* Everything captured with one prescaler, over any number of blocks */
+struct capture_stats {
+	uint32_t div;			/* prescaler + 1 */
+	uint32_t n;			/* periods */
+	uint32_t dropped;		/* samples that can not be right */
+	uint32_t min, max;		/* shortest and longest period */
+	uint64_t sum, high_sum;
+	/* Deviations from the first period, for the standard deviation */
+	uint32_t ref;
+	int64_t dev_sum;
+	uint64_t dev_sq;		/* saturates rather than wraps */
+	/* Largest change from one period to the next */
+	uint32_t last;
+	uint32_t c2c_max;
+};
+
+struct capture_range {
+	uint32_t top;			/* largest count the timer holds */
+	uint32_t max_div;
+	uint32_t div;
+};
+
+void capture_clear(struct capture_stats *s, uint32_t div);
+void capture_block(struct capture_stats *s, const struct capture_sample *buf,
+		   int n);
+
+uint64_t capture_freq_mhz(const struct capture_stats *s, uint32_t clk_hz);
+uint32_t capture_duty(const struct capture_stats *s);
+uint64_t capture_jitter(const struct capture_stats *s);
+uint64_t capture_ps(uint64_t counts256, uint32_t div, uint32_t clk_hz);
+
+void capture_range_init(struct capture_range *r, uint32_t top,
+			uint32_t max_div);
+bool capture_autorange(struct capture_range *r, const struct capture_stats *s,
+		       uint32_t overflows);
+
+#endif
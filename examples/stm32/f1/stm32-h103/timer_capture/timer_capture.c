@@ -0,0 +1,381 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/systick.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "capture.h"
+
+/*
+ * Frequency, duty cycle and jitter of the signal on PB6, once a second
+ * on USART2.
+ *
+ * TIM4 runs in PWM input mode: CC1 captures the rising edges and CC2 the
+ * falling ones, both from TI1, and every rising edge also restarts the
+ * counter. So at each rising edge CCR1 holds the period just ended and
+ * CCR2 its high time, and the CC1 DMA request reads both through
+ * TIM4_DMAR into a circular buffer, on DMA1 channel 1. The CPU only looks
+ * at the buffer when half of it is full, and once a second for whatever
+ * is there, so there is no interrupt per edge.
+ *
+ * The only other interrupt is the counter wrapping before an edge came,
+ * which means the prescaler is too small. Auto-ranging picks a bigger
+ * one then, and a smaller one when the periods only use a little of the
+ * counter, see capture.c.
+ *
+ * TIM3 makes a test signal on PA6 that steps through a few frequencies.
+ * Put a wire from PA6 to PB6 to measure it.
+ */
+
+#define HALF		256	/* samples per half of the buffer */
+#define REPORT_MS	1000
+
+int _write(int file, char *ptr, int len);
+
+static struct capture_sample samples[2 * HALF];
+static volatile int done;	/* samples already taken */
+static volatile int discard;	/* after a prescaler change */
+static struct capture_stats meas;
+static struct capture_range range;
+static uint32_t tim_clk;
+
+static volatile uint32_t system_millis;
+static volatile uint32_t overflows, lost;
+
+static const struct {
+	uint32_t hz;
+	uint32_t duty;		/* percent */
+} test_signal[] = {
+	{ 1000000, 25 },
+	{ 10000, 50 },
+	{ 440, 10 },
+	{ 7, 90 },
+};
+
+static void clock_setup(void)
+{
+	rcc_clock_setup_in_hse_8mhz_out_72mhz();
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_USART2);
+	rcc_periph_clock_enable(RCC_TIM3);
+	rcc_periph_clock_enable(RCC_TIM4);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	/* TIM3 and TIM4 are on APB1, at twice its frequency. */
+	tim_clk = rcc_apb1_frequency * 2;
+
+	/* 1ms SysTick */
+	systick_set_clocksource(STK_CSR_CLKSOURCE_AHB_DIV8);
+	systick_set_reload(8999);
+	systick_interrupt_enable();
+	systick_counter_enable();
+}
+
+void sys_tick_handler(void)
+{
+	system_millis++;
+}
+
+static void gpio_setup(void)
+{
+	/* TIM3_CH1, the test signal */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_TIM3_CH1);
+
+	/* TIM4_CH1, the input */
+	gpio_set_mode(GPIOB, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT,
+		      GPIO_TIM4_CH1);
+}
+
+static void usart_setup(void)
+{
+	/* Setup GPIO pin GPIO_USART2_TX. */
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ,
+		      GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART2_TX);
+
+	/* Setup UART parameters. */
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_mode(USART2, USART_MODE_TX);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+
+	/* Finally enable the USART. */
+	usart_enable(USART2);
+}
+
+int _write(int file, char *ptr, int len)
+{
+	int i;
+
+	if (file == 1) {
+		for (i = 0; i < len; i++)
+			usart_send_blocking(USART2, ptr[i]);
+		return i;
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+/* PWM at hz on PA6, with the prescaler that gives the finest steps */
+static void test_signal_set(uint32_t hz, uint32_t duty)
+{
+	uint32_t cycles = tim_clk / hz;
+	uint32_t psc = (cycles - 1) / 65536;
+	uint32_t arr = cycles / (psc + 1) - 1;
+
+	timer_set_prescaler(TIM3, psc);
+	timer_set_period(TIM3, arr);
+	timer_set_oc_value(TIM3, TIM_OC1, (arr + 1) * duty / 100);
+	timer_generate_event(TIM3, TIM_EGR_UG);
+}
+
+static void test_signal_setup(void)
+{
+	timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_set_oc_mode(TIM3, TIM_OC1, TIM_OCM_PWM1);
+	timer_enable_oc_preload(TIM3, TIM_OC1);
+	timer_enable_preload(TIM3);
+	timer_enable_oc_output(TIM3, TIM_OC1);
+	test_signal_set(test_signal[0].hz, test_signal[0].duty);
+	timer_enable_counter(TIM3);
+}
+
+static void capture_setup(void)
+{
+	capture_range_init(&range, 0xffff, 65536);
+	capture_clear(&meas, range.div);
+
+	/* Two words per edge, CCR1 and CCR2, zero extended to 32 bits */
+	dma_channel_reset(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1,
+				   (uint32_t)&TIM4_DMAR);
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, (uint32_t)samples);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1, 2 * 2 * HALF);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_32BIT);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+	dma_set_priority(DMA1, DMA_CHANNEL1, DMA_CCR_PL_VERY_HIGH);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL1);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+
+	rcc_periph_reset_pulse(RST_TIM4);
+	timer_set_prescaler(TIM4, range.div - 1);
+	timer_set_period(TIM4, range.top);
+
+	/* IC1 rising and IC2 falling, both from TI1 */
+	timer_ic_set_input(TIM4, TIM_IC1, TIM_IC_IN_TI1);
+	timer_ic_set_polarity(TIM4, TIM_IC1, TIM_IC_RISING);
+	timer_ic_set_input(TIM4, TIM_IC2, TIM_IC_IN_TI1);
+	timer_ic_set_polarity(TIM4, TIM_IC2, TIM_IC_FALLING);
+
+	/* Restart the counter on every rising edge. */
+	timer_slave_set_trigger(TIM4, TIM_SMCR_TS_TI1FP1);
+	timer_slave_set_mode(TIM4, TIM_SMCR_SMS_RM);
+
+	/* Only a wrap of the counter is an update interrupt, not a restart. */
+	timer_update_on_overflow(TIM4);
+
+	/* DMA burst of two, from CCR1 (word 13) on */
+	TIM4_DCR = (1 << 8) | 13;
+
+	timer_ic_enable(TIM4, TIM_IC1);
+	timer_ic_enable(TIM4, TIM_IC2);
+	timer_enable_irq(TIM4, TIM_DIER_CC1DE | TIM_DIER_UIE);
+	nvic_enable_irq(NVIC_TIM4_IRQ);
+	timer_enable_counter(TIM4);
+}
+
+void tim4_isr(void)
+{
+	if (timer_get_flag(TIM4, TIM_SR_UIF)) {
+		timer_clear_flag(TIM4, TIM_SR_UIF);
+		overflows++;
+	}
+}
+
+/* Fold samples[done] up to samples[upto] into the statistics. */
+static void take(int upto)
+{
+	int from = done;
+
+	if (upto <= from) {
+		return;
+	}
+	if (discard) {
+		discard--;
+		from++;
+	}
+	capture_block(&meas, samples + from, upto - from);
+	done = upto % (2 * HALF);
+}
+
+void dma1_channel1_isr(void)
+{
+	/* CCR1 was captured again before the DMA read it. */
+	if (timer_get_flag(TIM4, TIM_SR_CC1OF)) {
+		timer_clear_flag(TIM4, TIM_SR_CC1OF);
+		lost++;
+	}
+
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_HTIF);
+		take(HALF);
+	}
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF);
+		take(2 * HALF);
+	}
+}
+
+/*
+ * The statistics so far, with what the DMA has written since the last
+ * half buffer interrupt, and start again with the prescaler that the
+ * auto-ranging wants next.
+ */
+static void snapshot(struct capture_stats *s, uint32_t overflowed)
+{
+	uint32_t left;
+
+	nvic_disable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+
+	/* Whole samples only; past the end the interrupt is due anyway. */
+	left = DMA1_CNDTR1;
+	take((4 * HALF - left) / 2);
+
+	*s = meas;
+	if (capture_autorange(&range, s, overflowed)) {
+		timer_set_prescaler(TIM4, range.div - 1);
+		/* The period that loads the prescaler was counted with both. */
+		discard = 1;
+	}
+	capture_clear(&meas, range.div);
+
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+}
+
+/* Picoseconds as microseconds with three decimals */
+static void print_us(const char *what, uint64_t ps)
+{
+	printf("%s%lu.%03luus", what, (uint32_t)(ps / 1000000),
+	       (uint32_t)(ps / 1000 % 1000));
+}
+
+static void report(const struct capture_stats *s, uint32_t overflowed)
+{
+	uint64_t mhz, jitter;
+
+	if (overflowed && s->n == 0) {
+		if (range.div == range.max_div) {
+			printf("no signal\r\n");
+		} else {
+			printf("ranging, /%lu\r\n", range.div);
+		}
+		return;
+	}
+	if (s->n == 0) {
+		printf("waiting for edges, /%lu\r\n", s->div);
+		return;
+	}
+
+	mhz = capture_freq_mhz(s, tim_clk);
+	jitter = capture_jitter(s);
+	printf("%lu.%03luHz", (uint32_t)(mhz / 1000), (uint32_t)(mhz % 1000));
+	print_us(", period ", capture_ps(s->sum * 256 / s->n,
+					s->div, tim_clk));
+	print_us(" (", capture_ps((uint64_t)s->min << 8, s->div, tim_clk));
+	print_us(" to ", capture_ps((uint64_t)s->max << 8, s->div, tim_clk));
+	printf("), duty %lu.%02lu%%", capture_duty(s) / 100,
+	       capture_duty(s) % 100);
+	if (jitter == UINT64_MAX) {
+		printf(", jitter off the scale");
+	} else {
+		print_us(", jitter ", capture_ps(jitter, s->div, tim_clk));
+		printf(" rms");
+	}
+	print_us(", ", capture_ps((uint64_t)s->c2c_max << 8, s->div,
+				  tim_clk));
+	printf(" c2c, %lu periods, /%lu", s->n, s->div);
+	if (s->dropped) {
+		printf(", %lu dropped", s->dropped);
+	}
+	if (overflowed) {
+		printf(", out of range");
+	}
+	printf("\r\n");
+}
+
+int main(void)
+{
+	struct capture_stats s;
+	uint32_t next, seen = 0, lost_seen = 0, overflowed;
+	unsigned sig = 0, secs = 0;
+
+	clock_setup();
+	gpio_setup();
+	usart_setup();
+	test_signal_setup();
+	capture_setup();
+
+	printf("Input capture on PB6, test signal on PA6\r\n");
+
+	next = system_millis + REPORT_MS;
+	while (1) {
+		while ((int32_t)(system_millis - next) < 0);
+		next += REPORT_MS;
+
+		overflowed = overflows - seen;
+		seen += overflowed;
+		snapshot(&s, overflowed);
+		report(&s, overflowed);
+
+		if (lost != lost_seen) {
+			printf("DMA fell behind %lu times\r\n",
+			       lost - lost_seen);
+			lost_seen = lost;
+		}
+
+		/* A new test signal every ten seconds */
+		if (++secs == 10) {
+			secs = 0;
+			sig = (sig + 1) % (sizeof(test_signal) /
+					   sizeof(test_signal[0]));
+			test_signal_set(test_signal[sig].hz,
+					test_signal[sig].duty);
+			printf("Test signal %luHz, %lu%%\r\n",
+			       test_signal[sig].hz, test_signal[sig].duty);
+		}
+	}
+
+	return 0;
+}
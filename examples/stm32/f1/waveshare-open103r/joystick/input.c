@@ -0,0 +1,184 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Debounced buttons, as events in a queue. No hardware access, so
+ * input_host.c can play recorded switch bounce through it on a PC.
+ *
+ * The GPIO edge interrupt of a pin calls input_edge() with the time from
+ * a free running timer, and that is all it does. input_tick() runs from
+ * a timer every millisecond or so, but only while it returns true: a pin
+ * counts as settled once it has been quiet for the debounce time, and
+ * the level the tick reads then is the one that counts. Whatever came
+ * before it, bounce or a short spike, is ignored. Held pins keep the
+ * tick going for their long press and repeat events. With nothing
+ * pressed and nothing bouncing, neither runs at all.
+ *
+ * input_edge() and input_tick() must not interrupt each other; give the
+ * edge and tick interrupts the same priority. The queue has one writer,
+ * input_tick(), and one reader, input_get(), so that can run anywhere.
+ */
+
+#include "input.h"
+
+enum {
+	PIN_UP,
+	PIN_DOWN,		/* waiting for the long press */
+	PIN_HELD,		/* repeating, or just down */
+};
+
+void input_init(struct input *in, uint32_t debounce)
+{
+	in->debounce = debounce;
+	in->pins = 0;
+	in->head = 0;
+	in->tail = 0;
+	in->lost = 0;
+}
+
+/*
+ * input_add
+ *
+ * A new pin, released. After long_press ticks held it sends a long
+ * press, then a repeat every repeat ticks for as long as it stays down.
+ * Returns its number, for input_edge() and the pressed mask.
+ */
+int input_add(struct input *in, uint32_t long_press, uint32_t repeat)
+{
+	struct input_pin *p;
+
+	if (in->pins == INPUT_PINS) {
+		return -1;
+	}
+	p = &in->pin[in->pins];
+	p->long_press = long_press;
+	p->repeat = repeat;
+	p->unsettled = false;
+	p->first_edge = 0;
+	p->last_edge = 0;
+	p->state = PIN_UP;
+	p->pressed_at = 0;
+	p->due = 0;
+	p->repeats = 0;
+	return in->pins++;
+}
+
+/* An edge on pin, either way, seen at now. */
+void input_edge(struct input *in, int pin, uint32_t now)
+{
+	struct input_pin *p = &in->pin[pin];
+
+	if (!p->unsettled) {
+		p->first_edge = now;
+		p->unsettled = true;
+	}
+	p->last_edge = now;
+}
+
+static void push(struct input *in, int pin, uint8_t type, uint32_t time)
+{
+	struct input_pin *p = &in->pin[pin];
+	struct input_event *ev;
+	uint8_t head = in->head;
+
+	if ((uint8_t)(head - in->tail) == INPUT_QUEUE) {
+		in->lost++;
+		return;
+	}
+	ev = &in->queue[head % INPUT_QUEUE];
+	ev->time = time;
+	ev->held = (type == INPUT_PRESS) ? 0 : time - p->pressed_at;
+	ev->repeat = p->repeats;
+	ev->pin = pin;
+	ev->type = type;
+	in->head = head + 1;
+}
+
+/*
+ * input_tick
+ *
+ * Move every pin along, with pressed the raw levels of all of them, a
+ * bit per pin set when it is down. Returns true while a pin is still
+ * bouncing or waiting for its next long press or repeat, which is as
+ * long as the tick needs to keep coming.
+ */
+bool input_tick(struct input *in, uint32_t now, uint32_t pressed)
+{
+	struct input_pin *p;
+	bool busy = false, down;
+	int i;
+
+	for (i = 0; i < in->pins; i++) {
+		p = &in->pin[i];
+		down = (pressed >> i) & 1;
+
+		if (p->unsettled) {
+			if (now - p->last_edge < in->debounce) {
+				busy = true;
+				continue;
+			}
+			p->unsettled = false;
+
+			if (down && p->state == PIN_UP) {
+				p->state = PIN_DOWN;
+				p->pressed_at = p->first_edge;
+				p->due = p->first_edge + p->long_press;
+				p->repeats = 0;
+				push(in, i, INPUT_PRESS, p->first_edge);
+			} else if (!down && p->state != PIN_UP) {
+				p->state = PIN_UP;
+				push(in, i, INPUT_RELEASE, p->first_edge);
+			}
+		}
+
+		if (p->state == PIN_DOWN && p->long_press) {
+			if ((int32_t)(now - p->due) >= 0) {
+				push(in, i, INPUT_LONG, p->due);
+				p->state = PIN_HELD;
+				p->due += p->repeat;
+			}
+			busy = true;
+		}
+		if (p->state == PIN_HELD && p->repeat) {
+			/* At most one a tick, they are not worth a burst. */
+			if ((int32_t)(now - p->due) >= 0) {
+				p->repeats++;
+				push(in, i, INPUT_REPEAT, p->due);
+				p->due += p->repeat;
+				if ((int32_t)(now - p->due) >= 0) {
+					p->due = now + p->repeat;
+				}
+			}
+			busy = true;
+		}
+	}
+
+	return busy;
+}
+
+/* The oldest event, if there is one. */
+bool input_get(struct input *in, struct input_event *ev)
+{
+	uint8_t tail = in->tail;
+
+	if (tail == in->head) {
+		return false;
+	}
+	*ev = in->queue[tail % INPUT_QUEUE];
+	in->tail = tail + 1;
+	return true;
+}
@@ -0,0 +1,291 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks input.c on the host:
+ *
+ *	cc -o input_host input_host.c input.c
+ *	./input_host
+ *
+ * Edge traces shaped like real contact bounce, in microseconds, are
+ * played through it with a 1ms tick: a clean tactile switch, a worn one
+ * that chatters for 15ms, a joystick contact that bounces on release as
+ * well, and a short spike. Each has to come out as exactly the events it
+ * should, stamped with the first edge, whether the tick runs all the
+ * time or only while input_tick() asks for it, and across the timer
+ * wrapping.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "input.h"
+
+#define TICK		1000
+#define DEBOUNCE	5000
+#define LONG_PRESS	1000000
+#define REPEAT		200000
+#define NEVER		UINT32_MAX
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+struct edge {
+	uint8_t pin;
+	uint8_t down;
+	uint32_t t;
+};
+
+/* Press at 0, release at 300ms */
+static const struct edge tactile[] = {
+	{ 0, 1, 0 }, { 0, 0, 40 }, { 0, 1, 95 }, { 0, 0, 180 },
+	{ 0, 1, 210 }, { 0, 0, 600 }, { 0, 1, 640 },
+	{ 0, 0, 300000 }, { 0, 1, 300030 }, { 0, 0, 300090 },
+};
+
+/* Press at 0 chattering for 15ms, gaps up to 4ms; release at 120ms */
+static const struct edge worn[] = {
+	{ 0, 1, 0 }, { 0, 0, 700 }, { 0, 1, 1500 }, { 0, 0, 2100 },
+	{ 0, 1, 6000 }, { 0, 0, 6300 }, { 0, 1, 9800 }, { 0, 0, 10100 },
+	{ 0, 1, 14000 }, { 0, 0, 14200 }, { 0, 1, 15000 },
+	{ 0, 0, 120000 }, { 0, 1, 121500 }, { 0, 0, 123000 },
+	{ 0, 1, 126000 }, { 0, 0, 126400 },
+};
+
+/* Two joystick contacts, overlapping, both bouncing both ways */
+static const struct edge joystick[] = {
+	{ 1, 1, 1000 }, { 1, 0, 1200 }, { 1, 1, 1900 },
+	{ 2, 1, 50000 }, { 2, 0, 50100 }, { 2, 1, 50150 }, { 2, 0, 52000 },
+	{ 2, 1, 53000 },
+	{ 1, 0, 80000 }, { 1, 1, 80800 }, { 1, 0, 81000 }, { 1, 1, 82000 },
+	{ 1, 0, 82100 },
+	{ 2, 0, 90000 }, { 2, 1, 90010 }, { 2, 0, 90500 },
+};
+
+/* A 300us spike, then a 4ms one */
+static const struct edge spike[] = {
+	{ 0, 1, 10000 }, { 0, 0, 10300 },
+	{ 0, 1, 40000 }, { 0, 0, 44000 },
+};
+
+/* Held for 2.35s */
+static const struct edge held[] = {
+	{ 0, 1, 0 }, { 0, 0, 300 }, { 0, 1, 500 },
+	{ 0, 0, 2350000 }, { 0, 1, 2350200 }, { 0, 0, 2350400 },
+};
+
+#define N(a)	((int)(sizeof(a) / sizeof((a)[0])))
+
+static struct input_event got[64];
+static int ngot, ticks;
+
+/*
+ * Play edges from start for len microseconds. The tick either runs all
+ * the time, or like the firmware: started by an edge, stopped once
+ * input_tick() returns false.
+ */
+static void play(struct input *in, const struct edge *e, int n,
+		 uint32_t start, uint32_t len, bool always)
+{
+	uint32_t pressed = 0, tick = always ? 0 : NEVER, edge;
+	struct input_event ev;
+	int i = 0;
+
+	ngot = 0;
+	ticks = 0;
+	while (1) {
+		edge = (i < n) ? e[i].t : NEVER;
+		if (edge <= tick && edge <= len) {
+			if (e[i].down) {
+				pressed |= 1 << e[i].pin;
+			} else {
+				pressed &= ~(1 << e[i].pin);
+			}
+			input_edge(in, e[i].pin, start + edge);
+			if (tick == NEVER) {
+				tick = edge + TICK;
+			}
+			i++;
+		} else if (tick <= len) {
+			ticks++;
+			if (input_tick(in, start + tick, pressed) || always) {
+				tick += TICK;
+			} else {
+				tick = NEVER;
+			}
+		} else {
+			break;
+		}
+		while (ngot < N(got) && input_get(in, &ev)) {
+			got[ngot++] = ev;
+		}
+	}
+}
+
+static void setup(struct input *in, int pins)
+{
+	int i;
+
+	input_init(in, DEBOUNCE);
+	for (i = 0; i < pins; i++) {
+		input_add(in, (i == 0) ? LONG_PRESS : 0, (i == 0) ? REPEAT : 0);
+	}
+}
+
+static void expect(int i, int pin, int type, uint32_t time, uint32_t held,
+		   const char *what)
+{
+	check(i < ngot, what, i, ngot);
+	if (i >= ngot) {
+		return;
+	}
+	check(got[i].pin == pin && got[i].type == type, what, got[i].pin,
+	      got[i].type);
+	check(got[i].time == time, what, got[i].time, time);
+	check(got[i].held == held, what, got[i].held, held);
+}
+
+static void test_traces(uint32_t start, bool always)
+{
+	struct input in;
+	int i;
+
+	setup(&in, 1);
+	play(&in, tactile, N(tactile), start, 1000000, always);
+	check(ngot == 2, "tactile", ngot, 2);
+	expect(0, 0, INPUT_PRESS, start, 0, "tactile press");
+	expect(1, 0, INPUT_RELEASE, start + 300000, 300000, "tactile up");
+
+	setup(&in, 1);
+	play(&in, worn, N(worn), start, 1000000, always);
+	check(ngot == 2, "worn", ngot, 2);
+	expect(0, 0, INPUT_PRESS, start, 0, "worn press");
+	expect(1, 0, INPUT_RELEASE, start + 120000, 120000, "worn up");
+
+	setup(&in, 3);
+	play(&in, joystick, N(joystick), start, 1000000, always);
+	check(ngot == 4, "joystick", ngot, 4);
+	expect(0, 1, INPUT_PRESS, start + 1000, 0, "joy 1");
+	expect(1, 2, INPUT_PRESS, start + 50000, 0, "joy 2");
+	expect(2, 1, INPUT_RELEASE, start + 80000, 79000, "joy 1 up");
+	expect(3, 2, INPUT_RELEASE, start + 90000, 40000, "joy 2 up");
+
+	setup(&in, 1);
+	play(&in, spike, N(spike), start, 1000000, always);
+	check(ngot == 0, "spike", ngot, 0);
+
+	/* A long press, then a repeat every 200ms until the release */
+	setup(&in, 1);
+	play(&in, held, N(held), start, 3000000, always);
+	check(ngot == 9, "held", ngot, 9);
+	expect(0, 0, INPUT_PRESS, start, 0, "held press");
+	expect(1, 0, INPUT_LONG, start + LONG_PRESS, LONG_PRESS, "long");
+	for (i = 1; i <= 6; i++) {
+		expect(1 + i, 0, INPUT_REPEAT, start + LONG_PRESS + i * REPEAT,
+		       LONG_PRESS + i * REPEAT, "repeat");
+		check(got[1 + i].repeat == i, "repeat count", i,
+		      got[1 + i].repeat);
+	}
+	expect(8, 0, INPUT_RELEASE, start + 2350000, 2350000, "held up");
+	check(in.lost == 0, "lost", in.lost, 0);
+}
+
+/* Ticks only while something is going on */
+static void test_idle(void)
+{
+	struct input in;
+
+	/* The debounce time after each burst, and nothing else */
+	input_init(&in, DEBOUNCE);
+	input_add(&in, 0, 0);
+	play(&in, tactile, N(tactile), 0, 10000000, false);
+	check(ticks <= 2 * (DEBOUNCE / TICK + 2), "idle ticks", ticks, 0);
+
+	input_init(&in, DEBOUNCE);
+	input_add(&in, 0, 0);
+	play(&in, spike, N(spike), 0, 10000000, false);
+	check(ticks <= (300 + 4000) / TICK + 2 * (DEBOUNCE / TICK + 2),
+	      "spike ticks", ticks, 0);
+
+	/* Held with a long press, the tick keeps going until the release */
+	setup(&in, 1);
+	play(&in, tactile, N(tactile), 0, 10000000, false);
+	check(ticks <= 300 + 2 * (DEBOUNCE / TICK + 2), "long ticks", ticks,
+	      300);
+
+	/* And through the repeats */
+	setup(&in, 1);
+	play(&in, held, N(held), 0, 10000000, false);
+	check(ticks <= 2360 + 2 * (DEBOUNCE / TICK + 2), "held ticks",
+	      ticks, 2360);
+	printf("%d ticks in 10s for a 2.35s press\n", ticks);
+}
+
+/* A full queue loses the newest events, and says so */
+static void test_queue(void)
+{
+	struct input in;
+	struct input_event ev;
+	uint32_t t = 0;
+	int i, n = 0;
+
+	input_init(&in, DEBOUNCE);
+	input_add(&in, 0, 0);
+	for (i = 0; i < INPUT_QUEUE + 4; i++) {
+		input_edge(&in, 0, t);
+		t += DEBOUNCE;
+		input_tick(&in, t, (i & 1) ? 0 : 1);
+	}
+	check(in.lost == 4, "queue lost", in.lost, 4);
+	while (input_get(&in, &ev)) {
+		check(ev.type == ((n & 1) ? INPUT_RELEASE : INPUT_PRESS),
+		      "queue order", n, ev.type);
+		check(ev.time == (uint32_t)n * DEBOUNCE, "queue time", n,
+		      ev.time);
+		n++;
+	}
+	check(n == INPUT_QUEUE, "queue", n, INPUT_QUEUE);
+
+	for (i = 0; i < INPUT_PINS; i++) {
+		check(input_add(&in, 0, 0) == ((i < INPUT_PINS - 1) ? i + 1 :
+		      -1), "pins", i, 0);
+	}
+}
+
+int main(void)
+{
+	test_traces(0, true);
+	test_traces(0, false);
+	test_traces(12345, false);
+	test_traces(UINT32_MAX - 500000, true);
+	test_traces(UINT32_MAX - 500000, false);
+	test_idle();
+	test_queue();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -19,8 +19,24 @@
 
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/cortex.h>
 
-/* Joystick definitions */
+#include "input.h"
+
+/*
+ * The joystick goes through input.c. Each of its five pins has its own
+ * EXTI line and interrupt, which only stamps the edge with the time from
+ * TIM2 and starts the tick. The tick is TIM2's channel 1 interrupt, every
+ * millisecond while input_tick() asks for it: it debounces, and queues
+ * press, release, long press and repeat events for the main loop. With
+ * the joystick left alone there are no interrupts but TIM2 wrapping
+ * every 6.5s, and the main loop sleeps unless the LEDs blink.
+ */
+
+/* Joystick definitions, pin n is GPIOn and EXTIn */
 #define JOY_PORT   GPIOA
 #define JOY_STATE  GPIOA_IDR
 #define JOY_LEFT   GPIO0
@@ -29,7 +45,9 @@
 #define JOY_RIGHT  GPIO3
 #define JOY_CENTER GPIO4
 #define JOY_ALL (JOY_LEFT | JOY_UP | JOY_DOWN | JOY_RIGHT | JOY_CENTER)
-#define JOY_DEBOUNCE_TICKS 20000
+#define JOY_EXTI (EXTI0 | EXTI1 | EXTI2 | EXTI3 | EXTI4)
+
+enum { PIN_LEFT, PIN_UP, PIN_DOWN, PIN_RIGHT, PIN_CENTER };
 
 /* LED array definitions */
 #define LED_PORT   GPIOC
@@ -38,11 +56,24 @@
 #define LED3       GPIO11
 #define LED4       GPIO12
 #define LED_ALL    (LED1 | LED2 | LED3 | LED4)
-#define BLINK_TICK 80000
 
-uint16_t joy_state;
+/* TIM2 counts at 10kHz */
+#define CLOCK_HZ   10000
+#define MS(ms)     ((ms) * (CLOCK_HZ / 1000))
+#define TICK       MS(1)
+#define DEBOUNCE   MS(10)
+#define SCROLL_DELAY MS(400)
+#define SCROLL_RATE  MS(120)
+#define CENTER_LONG  MS(1000)
+#define BLINK_SLOW MS(330)
+#define BLINK_FAST MS(80)
+
+struct input joy;
 uint16_t led_state;
 bool led_blinking;
+bool led_fast;
+
+static volatile uint32_t clock_high;
 
 /* Set STM32 to 24 MHz. */
 static void clock_setup(void)
@@ -63,86 +94,235 @@ static void led_setup(void)
 
 static void joystick_setup(void)
 {
-  /* Enable GPIOA clock. */
+  /* Enable GPIOA and AFIO clocks. */
   rcc_periph_clock_enable(RCC_GPIOA);
+  rcc_periph_clock_enable(RCC_AFIO);
   /* Set joystick pins to input. */
   gpio_set_mode(JOY_PORT, GPIO_MODE_INPUT,
 		GPIO_CNF_INPUT_PULL_UPDOWN,
 		JOY_ALL);
   /* Enable all joystick pin pull-up resistors. */
   gpio_set(JOY_PORT, JOY_ALL);
+
+  /* Up and down scroll when held, a long press on center does more. */
+  input_init(&joy, DEBOUNCE);
+  input_add(&joy, 0, 0);
+  input_add(&joy, SCROLL_DELAY, SCROLL_RATE);
+  input_add(&joy, SCROLL_DELAY, SCROLL_RATE);
+  input_add(&joy, 0, 0);
+  input_add(&joy, CENTER_LONG, 0);
+
+  /* Every edge, both ways. */
+  exti_select_source(JOY_EXTI, JOY_PORT);
+  exti_set_trigger(JOY_EXTI, EXTI_TRIGGER_BOTH);
+  exti_enable_request(JOY_EXTI);
+
+  /* The edges and the tick must not interrupt each other. */
+  nvic_set_priority(NVIC_EXTI0_IRQ, 1 << 4);
+  nvic_set_priority(NVIC_EXTI1_IRQ, 1 << 4);
+  nvic_set_priority(NVIC_EXTI2_IRQ, 1 << 4);
+  nvic_set_priority(NVIC_EXTI3_IRQ, 1 << 4);
+  nvic_set_priority(NVIC_EXTI4_IRQ, 1 << 4);
+  nvic_set_priority(NVIC_TIM2_IRQ, 1 << 4);
+  nvic_enable_irq(NVIC_EXTI0_IRQ);
+  nvic_enable_irq(NVIC_EXTI1_IRQ);
+  nvic_enable_irq(NVIC_EXTI2_IRQ);
+  nvic_enable_irq(NVIC_EXTI3_IRQ);
+  nvic_enable_irq(NVIC_EXTI4_IRQ);
+}
+
+static void clock_timer_setup(void)
+{
+  rcc_periph_clock_enable(RCC_TIM2);
+
+  /* APB1 is not divided at 24MHz, so neither is TIM2's clock doubled. */
+  timer_set_prescaler(TIM2, rcc_apb1_frequency / CLOCK_HZ - 1);
+  timer_set_period(TIM2, 0xffff);
+  /*
+   * The prescaler only loads on an update, make one now, and clear its
+   * flag before the interrupt that counts the wraps is on.
+   */
+  timer_generate_event(TIM2, TIM_EGR_UG);
+  timer_clear_flag(TIM2, TIM_SR_UIF);
+  timer_enable_irq(TIM2, TIM_DIER_UIE);
+  nvic_enable_irq(NVIC_TIM2_IRQ);
+  timer_enable_counter(TIM2);
+}
+
+/*
+ * TIM2 made 32 bits wide. Call it with interrupts off, or from an
+ * interrupt of TIM2's priority, so its update interrupt can not run
+ * halfway through; a wrap it has not seen yet is still pending.
+ */
+static uint32_t clock_now(void)
+{
+  uint32_t high = clock_high;
+  uint16_t cnt = timer_get_counter(TIM2);
+
+  if (timer_get_flag(TIM2, TIM_SR_UIF) && cnt < 0x8000) {
+    high += 0x10000;
+  }
+  return high | cnt;
+}
+
+static uint32_t joy_pressed(void)
+{
+  /* Pressed is low, and pin n is bit n. */
+  return (~JOY_STATE) & JOY_ALL;
+}
+
+static void tick_start(void)
+{
+  if (!(TIM_DIER(TIM2) & TIM_DIER_CC1IE)) {
+    timer_set_oc_value(TIM2, TIM_OC1,
+		       (timer_get_counter(TIM2) + TICK) & 0xffff);
+    timer_clear_flag(TIM2, TIM_SR_CC1IF);
+    timer_enable_irq(TIM2, TIM_DIER_CC1IE);
+  }
+}
+
+void tim2_isr(void)
+{
+  if (timer_get_flag(TIM2, TIM_SR_UIF)) {
+    timer_clear_flag(TIM2, TIM_SR_UIF);
+    clock_high += 0x10000;
+  }
+  if (timer_get_flag(TIM2, TIM_SR_CC1IF)) {
+    timer_clear_flag(TIM2, TIM_SR_CC1IF);
+    timer_set_oc_value(TIM2, TIM_OC1, (TIM2_CCR1 + TICK) & 0xffff);
+    if (!input_tick(&joy, clock_now(), joy_pressed())) {
+      timer_disable_irq(TIM2, TIM_DIER_CC1IE);
+    }
+  }
+}
+
+static void joy_edge(int pin)
+{
+  exti_reset_request(1 << pin);
+  input_edge(&joy, pin, clock_now());
+  tick_start();
+}
+
+void exti0_isr(void)
+{
+  joy_edge(PIN_LEFT);
+}
+
+void exti1_isr(void)
+{
+  joy_edge(PIN_UP);
+}
+
+void exti2_isr(void)
+{
+  joy_edge(PIN_DOWN);
+}
+
+void exti3_isr(void)
+{
+  joy_edge(PIN_RIGHT);
+}
+
+void exti4_isr(void)
+{
+  joy_edge(PIN_CENTER);
+}
+
+static void joy_event(const struct input_event *ev)
+{
+  switch (ev->pin) {
+  case PIN_UP:
+    /* On the press, and on and on while held. */
+    if (ev->type == INPUT_RELEASE) {
+      break;
+    }
+    if (led_state == LED_ALL || led_state == 0) {
+      led_state = LED4;
+    } else {
+      led_state >>= 1;
+      if (led_state < LED1) {
+	led_state = LED4;
+      }
+    }
+    break;
+  case PIN_DOWN:
+    if (ev->type == INPUT_RELEASE) {
+      break;
+    }
+    if (led_state == LED_ALL || led_state == 0) {
+      led_state = LED1;
+    } else {
+      led_state <<= 1;
+      if (led_state > LED4 || led_state == 0) {
+	led_state = LED1;
+      }
+    }
+    break;
+  case PIN_LEFT:
+    if (ev->type == INPUT_PRESS) {
+      led_state = LED_ALL;
+    }
+    break;
+  case PIN_RIGHT:
+    if (ev->type == INPUT_PRESS) {
+      led_state = 0;
+    }
+    break;
+  case PIN_CENTER:
+    /* A click toggles blinking, a long press the blink speed. */
+    if (ev->type == INPUT_RELEASE && ev->held < CENTER_LONG) {
+      led_blinking = !led_blinking;
+    } else if (ev->type == INPUT_LONG) {
+      led_fast = !led_fast;
+    }
+    break;
+  }
+}
+
+static void led_update(uint32_t now)
+{
+  uint32_t period = led_fast ? BLINK_FAST : BLINK_SLOW;
+
+  gpio_clear(LED_PORT, LED_ALL & ~led_state);
+  if (led_blinking && (now / period) & 1) {
+    gpio_clear(LED_PORT, led_state);
+  } else {
+    gpio_set(LED_PORT, led_state);
+  }
 }
 
 int main(void)
 {
-  int i = 0;
-  int debounce = 0;
+  struct input_event ev;
+  uint32_t now;
+  bool got;
+
   clock_setup();
   led_setup();
   joystick_setup();
+  clock_timer_setup();
 
-  joy_state = 0;
   led_state = LED1;
   led_blinking = false;
+  led_fast = false;
 
   while (1) {
-
-    /* Set LED state according to joystick state. */
-    joy_state = (~JOY_STATE) & JOY_ALL;
-    if (joy_state != 0 && debounce == 0) {
-      debounce = 1;
-      gpio_clear(LED_PORT, LED_ALL);
-      if (joy_state & JOY_UP) {
-        if (led_state == LED_ALL || led_state == 0) {
-	  led_state = LED4;
-	} else {
-	  led_state >>= 1;
-	  if (led_state < LED1) {
-	    led_state = LED4;
-	  }
-	}
-      } else if (joy_state & JOY_DOWN) {
-	if (led_state == LED_ALL || led_state == 0) {
-	  led_state = LED1;
-	} else {
-	  led_state <<= 1;
-	  if (led_state > LED4 || led_state == 0) {
-	    led_state = LED1;
-	  }
-	}
-      } else if (joy_state & JOY_LEFT) {
-	led_state = LED_ALL;
-      } else if (joy_state & JOY_RIGHT) {
-	led_state = 0;
-      } else if (joy_state & JOY_CENTER) {
-	led_blinking = !led_blinking;
-      }
-    }
-
-    /* Debounce joystick press. */
-    else if (debounce > 0 && debounce < JOY_DEBOUNCE_TICKS) {
-      debounce++;
-    } else if (joy_state == 0 && debounce == JOY_DEBOUNCE_TICKS) {
-      debounce++;
+    /*
+     * Sleep with interrupts off, so an event queued after the check
+     * still wakes it up.
+     */
+    cm_disable_interrupts();
+    now = clock_now();
+    got = input_get(&joy, &ev);
+    if (!got && !led_blinking) {
+      __asm__("wfi");
     }
+    cm_enable_interrupts();
 
-    /* Debounce joystick release. */
-    else if (debounce > JOY_DEBOUNCE_TICKS && debounce < 2*JOY_DEBOUNCE_TICKS) {
-      debounce++;
-    } else if (joy_state == 0 && debounce == 2*JOY_DEBOUNCE_TICKS) {
-      debounce = 0;
+    if (got) {
+      joy_event(&ev);
     }
-
-    /* Update LEDs on the fly rather than wait for blink to complete. */
-    if (i++ < BLINK_TICK || !led_blinking) {
-      gpio_set(LED_PORT, led_state);
-    } else {
-      gpio_clear(LED_PORT, led_state);
-    }
-    if (i > 2*BLINK_TICK) {
-      i = 0;
-    }
-
+    led_update(now);
   }
   return 0;
 }
@@ -24,6 +24,9 @@
 #include <libopencm3/stm32/adc.h>
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "dsp.h"
 
 #define LBLUE GPIOE, GPIO8
 #define LRED GPIOE, GPIO9
@@ -43,6 +46,27 @@
 #define LD8 GPIOE, GPIO14
 #define LD6 GPIOE, GPIO15
 
+/*
+ * Each block of ADC samples goes through a CIC decimator and then a
+ * FIR low pass that decimates by two, 16 to one overall.
+ */
+#define BLOCK		256
+#define CIC_DECIM	8
+#define FIR_DECIM	2
+#define FIR_TAPS	32
+
+/*
+ * Hamming windowed sinc low pass, cut off at 0.22 of the input rate,
+ * Q15 with a DC gain of one. Symmetric, so time reversed already.
+ */
+static const int16_t fir_coeffs[FIR_TAPS] = {
+	29, 60, -17, -135, -38, 273, 223, -420,
+	-632, 447, 1361, -119, -2623, -1212, 5951, 13236,
+	13236, 5951, -1212, -2623, -119, 1361, 447, -632,
+	-420, 223, 273, -38, -135, -17, 60, 29,
+};
+static int16_t fir_state[2 * FIR_TAPS];
+
 
 static void adc_setup(void)
 {
@@ -102,7 +126,14 @@ static void gpio_setup(void)
 		GPIO14 | GPIO15);
 }
 
-static void my_usart_print_int(uint32_t usart, int16_t value)
+static void my_usart_print_string(uint32_t usart, const char *s)
+{
+	while (*s) {
+		usart_send_blocking(usart, *s++);
+	}
+}
+
+static void my_usart_print_int(uint32_t usart, int32_t value)
 {
 	int8_t i;
 	int8_t nr_digits = 0;
@@ -125,34 +156,111 @@ static void my_usart_print_int(uint32_t usart, int16_t value)
 	for (i = nr_digits-1; i >= 0; i--) {
 		usart_send_blocking(usart, buffer[i]);
 	}
-
-	usart_send_blocking(usart, '\r');
-	usart_send_blocking(usart, '\n');
 }
 
 static void clock_setup(void)
 {
 	rcc_clock_setup_hsi(&rcc_hsi_configs[RCC_CLOCK_HSI_64MHZ]);
+	dwt_enable_cycle_counter();
+}
+
+/*
+ * Run the SIMD and the plain C dot product over the same made up data,
+ * check that they agree to the bit and print how many MACs per second
+ * each manages.
+ */
+static void dsp_selftest(void)
+{
+	static int16_t a[BLOCK], b[BLOCK];
+	uint32_t seed = 1, t, c_cycles, simd_cycles;
+	uint32_t r_c = 0, r_simd = 0;
+	int i, off, mismatch = 0;
+
+	for (i = 0; i < BLOCK; i++) {
+		seed = seed * 1103515245 + 12345;
+		a[i] = seed >> 16;
+		seed = seed * 1103515245 + 12345;
+		b[i] = seed >> 16;
+	}
+	/* Odd offsets and lengths to cover unaligned loads and the tail */
+	for (off = 0; off < 4; off++) {
+		if (dsp_dot_q15(a + off, b, BLOCK - 2 * off - 1) !=
+		    dsp_dot_q15_c(a + off, b, BLOCK - 2 * off - 1)) {
+			mismatch++;
+		}
+	}
+
+	t = dwt_read_cycle_counter();
+	for (i = 0; i < 100; i++) {
+		r_c += dsp_dot_q15_c(a, b, BLOCK);
+	}
+	c_cycles = dwt_read_cycle_counter() - t;
+	t = dwt_read_cycle_counter();
+	for (i = 0; i < 100; i++) {
+		r_simd += dsp_dot_q15(a, b, BLOCK);
+	}
+	simd_cycles = dwt_read_cycle_counter() - t;
+	if (r_c != r_simd) {
+		mismatch++;
+	}
+
+	my_usart_print_string(USART2, "dot product: ");
+	my_usart_print_string(USART2, mismatch ? "MISMATCH" : "bit exact");
+	my_usart_print_string(USART2, ", C ");
+	my_usart_print_int(USART2, (uint64_t)100 * BLOCK *
+			   rcc_ahb_frequency / c_cycles / 1000);
+	my_usart_print_string(USART2, " kMAC/s, SIMD ");
+	my_usart_print_int(USART2, (uint64_t)100 * BLOCK *
+			   rcc_ahb_frequency / simd_cycles / 1000);
+	my_usart_print_string(USART2, " kMAC/s\r\n");
 }
 
 
 int main(void)
 {
-	uint16_t temp;
+	int16_t block[BLOCK], cic_out[BLOCK / CIC_DECIM];
+	int16_t fir_out[BLOCK / CIC_DECIM / FIR_DECIM];
+	struct dsp_cic cic;
+	struct dsp_fir fir;
+	struct dsp_stats stats;
+	uint32_t i, n;
 
 	clock_setup();
 	gpio_setup();
 	adc_setup();
 	usart_setup();
 
+	dsp_selftest();
+
+	dsp_cic_init(&cic, CIC_DECIM);
+	dsp_fir_init(&fir, fir_coeffs, fir_state, FIR_TAPS, FIR_DECIM);
+
 	while (1) {
-		adc_start_conversion_regular(ADC1);
-		while (!(adc_eoc(ADC1)));
-		temp=adc_read_regular(ADC1);
- 		gpio_port_write(GPIOE, temp << 4);
-		my_usart_print_int(USART2, temp);
+		/* The 12-bit results become Q15 */
+		for (i = 0; i < BLOCK; i++) {
+			adc_start_conversion_regular(ADC1);
+			while (!(adc_eoc(ADC1)));
+			block[i] = adc_read_regular(ADC1) << 3;
+		}
+
+		dsp_stats_reset(&stats);
+		dsp_stats_update(&stats, block, BLOCK);
+		n = dsp_cic_run(&cic, block, BLOCK, cic_out);
+		n = dsp_fir_run(&fir, cic_out, n, fir_out);
+
+		/* Back to 12 bits for the LEDs and the print out */
+		gpio_port_write(GPIOE, (fir_out[n - 1] >> 3) << 4);
+		my_usart_print_int(USART2, fir_out[n - 1] >> 3);
+		my_usart_print_string(USART2, " mean ");
+		my_usart_print_int(USART2, dsp_stats_mean(&stats) >> 3);
+		my_usart_print_string(USART2, " min ");
+		my_usart_print_int(USART2, stats.min >> 3);
+		my_usart_print_string(USART2, " max ");
+		my_usart_print_int(USART2, stats.max >> 3);
+		my_usart_print_string(USART2, " rms ");
+		my_usart_print_int(USART2, dsp_stats_rms(&stats) >> 3);
+		my_usart_print_string(USART2, "\r\n");
 	}
 
 	return 0;
 }
-
@@ -0,0 +1,243 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "dsp.h"
+
+#if defined(__ARM_FEATURE_DSP) && !defined(DSP_NO_SIMD)
+#define DSP_SIMD
+#endif
+
+static int16_t sat16(int32_t x)
+{
+	if (x > 32767) {
+		return 32767;
+	}
+	if (x < -32768) {
+		return -32768;
+	}
+	return x;
+}
+
+/*
+ * dsp_cic_init
+ *
+ * decim must be a power of two, so the R^N gain can be shifted out, and
+ * no more than 32, see dsp_cic_run().
+ */
+void dsp_cic_init(struct dsp_cic *c, uint32_t decim)
+{
+	int i;
+
+	for (i = 0; i < DSP_CIC_ORDER; i++) {
+		c->integ[i] = 0;
+		c->comb[i] = 0;
+	}
+	c->decim = decim;
+	c->phase = 0;
+	c->shift = 0;
+	while ((1UL << c->shift) < decim) {
+		c->shift++;
+	}
+	c->shift *= DSP_CIC_ORDER;
+}
+
+/*
+ * dsp_cic_run
+ *
+ * Integrators at the input rate, combs at the output rate. They wrap
+ * at 32 bits, which is harmless for a CIC as long as the result fits,
+ * Q15 * R^N needs R <= 32 for order 3. Returns the number of outputs.
+ */
+uint32_t dsp_cic_run(struct dsp_cic *c, const int16_t *in, uint32_t n,
+		     int16_t *out)
+{
+	uint32_t i, nout = 0, x, prev;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		x = (uint32_t)(int32_t)in[i];
+		for (j = 0; j < DSP_CIC_ORDER; j++) {
+			c->integ[j] += x;
+			x = c->integ[j];
+		}
+		if (++c->phase < c->decim) {
+			continue;
+		}
+		c->phase = 0;
+		for (j = 0; j < DSP_CIC_ORDER; j++) {
+			prev = c->comb[j];
+			c->comb[j] = x;
+			x -= prev;
+		}
+		out[nout++] = (int32_t)x >> c->shift;
+	}
+	return nout;
+}
+
+void dsp_fir_init(struct dsp_fir *f, const int16_t *coeffs, int16_t *state,
+		  uint32_t ntaps, uint32_t decim)
+{
+	f->coeffs = coeffs;
+	f->state = state;
+	f->ntaps = ntaps;
+	f->decim = decim;
+	f->idx = 0;
+	f->phase = 0;
+	memset(state, 0, 2 * ntaps * sizeof(state[0]));
+}
+
+/*
+ * dsp_fir_run
+ *
+ * The delay line is kept twice, so the last ntaps inputs are always in
+ * one piece at state + idx, oldest first. Returns the number of outputs.
+ */
+uint32_t dsp_fir_run(struct dsp_fir *f, const int16_t *in, uint32_t n,
+		     int16_t *out)
+{
+	uint32_t i, nout = 0;
+	int32_t acc;
+
+	for (i = 0; i < n; i++) {
+		f->state[f->idx] = in[i];
+		f->state[f->idx + f->ntaps] = in[i];
+		if (++f->idx == f->ntaps) {
+			f->idx = 0;
+		}
+		if (++f->phase < f->decim) {
+			continue;
+		}
+		f->phase = 0;
+		acc = dsp_dot_q15(f->state + f->idx, f->coeffs, f->ntaps);
+		out[nout++] = sat16((acc + (1 << 14)) >> 15);
+	}
+	return nout;
+}
+
+/*
+ * dsp_dot_q15_c
+ *
+ * Portable dot product with the same wrap around as SMLAD.
+ */
+int32_t dsp_dot_q15_c(const int16_t *a, const int16_t *b, uint32_t n)
+{
+	uint32_t acc = 0;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		acc += (uint32_t)((int32_t)a[i] * b[i]);
+	}
+	return (int32_t)acc;
+}
+
+#ifdef DSP_SIMD
+static inline uint32_t smlad(uint32_t x, uint32_t y, uint32_t acc)
+{
+	uint32_t r;
+
+	__asm__("smlad %0, %1, %2, %3"
+		: "=r" (r) : "r" (x), "r" (y), "r" (acc));
+	return r;
+}
+
+/*
+ * Two MACs per SMLAD, four per loop. The halfword pairs are loaded with
+ * memcpy as state + idx is not always word aligned, the M4 does
+ * unaligned word loads just fine.
+ */
+int32_t dsp_dot_q15(const int16_t *a, const int16_t *b, uint32_t n)
+{
+	uint32_t acc = 0, x0, x1, y0, y1;
+
+	while (n >= 4) {
+		memcpy(&x0, a, 4);
+		memcpy(&y0, b, 4);
+		memcpy(&x1, a + 2, 4);
+		memcpy(&y1, b + 2, 4);
+		acc = smlad(x0, y0, acc);
+		acc = smlad(x1, y1, acc);
+		a += 4;
+		b += 4;
+		n -= 4;
+	}
+	while (n--) {
+		acc += (uint32_t)((int32_t)*a++ * *b++);
+	}
+	return (int32_t)acc;
+}
+#else
+int32_t dsp_dot_q15(const int16_t *a, const int16_t *b, uint32_t n)
+{
+	return dsp_dot_q15_c(a, b, n);
+}
+#endif
+
+void dsp_stats_reset(struct dsp_stats *s)
+{
+	s->min = 32767;
+	s->max = -32768;
+	s->sum = 0;
+	s->sumsq = 0;
+	s->count = 0;
+}
+
+void dsp_stats_update(struct dsp_stats *s, const int16_t *in, uint32_t n)
+{
+	uint32_t i;
+	int32_t x;
+
+	for (i = 0; i < n; i++) {
+		x = in[i];
+		if (x < s->min) {
+			s->min = x;
+		}
+		if (x > s->max) {
+			s->max = x;
+		}
+		s->sum += x;
+		s->sumsq += (uint32_t)(x * x);
+	}
+	s->count += n;
+}
+
+int16_t dsp_stats_mean(const struct dsp_stats *s)
+{
+	if (s->count == 0) {
+		return 0;
+	}
+	return s->sum / s->count;
+}
+
+/* Integer square root of the mean square, by bits */
+int16_t dsp_stats_rms(const struct dsp_stats *s)
+{
+	uint64_t ms;
+	uint32_t root = 0, bit;
+
+	if (s->count == 0) {
+		return 0;
+	}
+	ms = s->sumsq / s->count;
+	for (bit = 1 << 15; bit != 0; bit >>= 1) {
+		if ((uint64_t)(root | bit) * (root | bit) <= ms) {
+			root |= bit;
+		}
+	}
+	return sat16(root);
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdint.h>
+
+/*
+ * Fixed point filters for blocks of samples. Samples are Q15, the 12-bit
+ * ADC results shifted up by three.
+ *
+ * The FIR inner loop uses the Cortex-M4 SMLAD instruction when the
+ * compiler says it is there (__ARM_FEATURE_DSP), and plain C otherwise or
+ * when DSP_NO_SIMD is defined. Both give bit for bit the same results,
+ * the accumulator wraps at 32 bits in both.
+ */
+
+#define DSP_CIC_ORDER	3
+
+/* CIC decimator, order DSP_CIC_ORDER with a differential delay of one */
+struct dsp_cic {
+	uint32_t integ[DSP_CIC_ORDER];
+	uint32_t comb[DSP_CIC_ORDER];
+	uint32_t decim;
+	uint32_t phase;
+	unsigned shift;		/* removes the R^N gain */
+};
+
+/*
+ * Decimating FIR. Only every decim-th output is computed, which is what
+ * a polyphase decimator costs, ntaps / decim MACs per input sample.
+ * coeffs are Q15 and in time reversed order, state needs 2 * ntaps
+ * entries.
+ */
+struct dsp_fir {
+	const int16_t *coeffs;
+	int16_t *state;
+	uint32_t ntaps;
+	uint32_t decim;
+	uint32_t idx;
+	uint32_t phase;
+};
+
+struct dsp_stats {
+	int16_t min, max;
+	int64_t sum;
+	uint64_t sumsq;
+	uint32_t count;
+};
+
+void dsp_cic_init(struct dsp_cic *c, uint32_t decim);
+uint32_t dsp_cic_run(struct dsp_cic *c, const int16_t *in, uint32_t n,
+		     int16_t *out);
+
+void dsp_fir_init(struct dsp_fir *f, const int16_t *coeffs, int16_t *state,
+		  uint32_t ntaps, uint32_t decim);
+uint32_t dsp_fir_run(struct dsp_fir *f, const int16_t *in, uint32_t n,
+		     int16_t *out);
+
+int32_t dsp_dot_q15(const int16_t *a, const int16_t *b, uint32_t n);
+int32_t dsp_dot_q15_c(const int16_t *a, const int16_t *b, uint32_t n);
+
+void dsp_stats_reset(struct dsp_stats *s);
+void dsp_stats_update(struct dsp_stats *s, const int16_t *in, uint32_t n);
+int16_t dsp_stats_mean(const struct dsp_stats *s);
+int16_t dsp_stats_rms(const struct dsp_stats *s);
+
+#endif
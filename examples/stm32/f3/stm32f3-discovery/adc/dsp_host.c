@@ -0,0 +1,365 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks dsp.c on the host:
+ *
+ *	cc -O2 -o dsp_host dsp_host.c dsp.c -lm
+ *	./dsp_host
+ *
+ * The host gets the plain C dot product. It is checked against a wide
+ * reference that wraps at 32 bits, and against a model of the SMLAD loop
+ * (the same pairs of halfwords, unaligned loads and tail) that stands in
+ * for the instruction. The CIC and the FIR are checked against direct
+ * convolutions, and the statistics against a straight sum. Last, the MAC/s
+ * of the FIR and of both dot products are printed, for comparison with
+ * what the self test on the board prints.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "dsp.h"
+
+#define BLOCK		256
+#define CIC_DECIM	8
+#define FIR_DECIM	2
+#define FIR_TAPS	32
+
+/* The low pass from adc.c */
+static const int16_t fir_coeffs[FIR_TAPS] = {
+	29, 60, -17, -135, -38, 273, 223, -420,
+	-632, 447, 1361, -119, -2623, -1212, 5951, 13236,
+	13236, 5951, -1212, -2623, -119, 1361, 447, -632,
+	-420, 223, 273, -38, -135, -17, 60, 29,
+};
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t rnd_state = 1;
+
+static int16_t rnd16(void)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return rnd_state >> 16;
+}
+
+/* SMLAD: both signed halfword products added to the accumulator */
+static uint32_t smlad(uint32_t x, uint32_t y, uint32_t acc)
+{
+	int32_t lo = (int16_t)(x & 0xffff) * (int16_t)(y & 0xffff);
+	int32_t hi = (int16_t)(x >> 16) * (int16_t)(y >> 16);
+
+	return acc + (uint32_t)lo + (uint32_t)hi;
+}
+
+/* The SIMD dot product in dsp.c, with the model in place of the asm */
+static int32_t dot_simd(const int16_t *a, const int16_t *b, uint32_t n)
+{
+	uint32_t acc = 0, x0, x1, y0, y1;
+
+	while (n >= 4) {
+		memcpy(&x0, a, 4);
+		memcpy(&y0, b, 4);
+		memcpy(&x1, a + 2, 4);
+		memcpy(&y1, b + 2, 4);
+		acc = smlad(x0, y0, acc);
+		acc = smlad(x1, y1, acc);
+		a += 4;
+		b += 4;
+		n -= 4;
+	}
+	while (n--) {
+		acc += (uint32_t)((int32_t)*a++ * *b++);
+	}
+	return (int32_t)acc;
+}
+
+/* 64-bit sum, wrapped to 32 bits at the end */
+static int32_t dot_ref(const int16_t *a, const int16_t *b, uint32_t n)
+{
+	int64_t acc = 0;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		acc += (int32_t)a[i] * b[i];
+	}
+	return (int32_t)(uint32_t)acc;
+}
+
+static void test_dot(void)
+{
+	static int16_t a[BLOCK + 4], b[BLOCK + 4];
+	uint32_t i, n, off, bad_c = 0, bad_simd = 0;
+	int32_t r;
+
+	for (i = 0; i < BLOCK + 4; i++) {
+		a[i] = rnd16();
+		b[i] = rnd16();
+	}
+	/* every length and alignment, as the FIR's state + idx gives */
+	for (off = 0; off < 4; off++) {
+		for (n = 0; n <= BLOCK; n++) {
+			r = dot_ref(a + off, b, n);
+			bad_c += dsp_dot_q15(a + off, b, n) != r;
+			bad_c += dsp_dot_q15_c(a + off, b, n) != r;
+			bad_simd += dot_simd(a + off, b, n) != r;
+		}
+	}
+	check(bad_c == 0, "dot C", bad_c, 0);
+	check(bad_simd == 0, "dot SIMD model", bad_simd, 0);
+
+	/* full scale, where the accumulator wraps more than once */
+	for (i = 0; i < BLOCK; i++) {
+		a[i] = -32768;
+		b[i] = (i & 1) ? -32768 : 32767;
+	}
+	r = dot_ref(a, b, BLOCK);
+	check(dsp_dot_q15_c(a, b, BLOCK) == r, "wrap C",
+	      dsp_dot_q15_c(a, b, BLOCK), r);
+	check(dot_simd(a, b, BLOCK) == r, "wrap SIMD model",
+	      dot_simd(a, b, BLOCK), r);
+}
+
+/*
+ * A CIC of order N decimating by R is N moving sums of length R, taken
+ * every R-th sample, shifted down by N log2 R.
+ */
+static void test_cic(uint32_t decim, uint32_t len, uint32_t step)
+{
+	static int16_t in[4096], out[4096];
+	static int64_t s[DSP_CIC_ORDER + 1][4096];
+	struct dsp_cic c;
+	uint32_t i, k, n = 0, nout, bad = 0;
+	unsigned shift = 0;
+	int j;
+
+	for (i = 0; i < len; i++) {
+		in[i] = rnd16();
+		s[0][i] = in[i];
+	}
+	for (j = 1; j <= DSP_CIC_ORDER; j++) {
+		for (i = 0; i < len; i++) {
+			s[j][i] = 0;
+			for (k = 0; k < decim && k <= i; k++) {
+				s[j][i] += s[j - 1][i - k];
+			}
+		}
+	}
+	while ((1U << shift) < decim) {
+		shift++;
+	}
+
+	/* fed in pieces of step, which must not matter */
+	dsp_cic_init(&c, decim);
+	for (i = 0; i < len; i += step) {
+		n += dsp_cic_run(&c, in + i, len - i < step ? len - i : step,
+				 out + n);
+	}
+	nout = len / decim;
+	check(n == nout, "cic outputs", n, nout);
+	for (i = 0; i < nout; i++) {
+		int64_t x = s[DSP_CIC_ORDER][(i + 1) * decim - 1];
+
+		if (out[i] != (int16_t)(x >> (shift * DSP_CIC_ORDER))) {
+			bad++;
+		}
+	}
+	check(bad == 0, "cic", decim * 1000 + step, bad);
+
+	/* DC comes through at unity gain once the filter is full */
+	for (i = 0; i < len; i++) {
+		in[i] = -12345;
+	}
+	dsp_cic_init(&c, decim);
+	n = dsp_cic_run(&c, in, len, out);
+	check(out[n - 1] == -12345, "cic dc", decim, out[n - 1]);
+}
+
+static void test_fir(uint32_t len, uint32_t step)
+{
+	static int16_t in[4096], out[4096], state[2 * FIR_TAPS];
+	struct dsp_fir f;
+	uint32_t i, k, n = 0, bad = 0;
+	int32_t acc, y;
+
+	for (i = 0; i < len; i++) {
+		in[i] = rnd16();
+	}
+	dsp_fir_init(&f, fir_coeffs, state, FIR_TAPS, FIR_DECIM);
+	for (i = 0; i < len; i += step) {
+		n += dsp_fir_run(&f, in + i, len - i < step ? len - i : step,
+				 out + n);
+	}
+	check(n == len / FIR_DECIM, "fir outputs", n, len / FIR_DECIM);
+
+	/* output i is taken after input (i + 1) * decim - 1 */
+	for (i = 0; i < n; i++) {
+		int32_t last = (i + 1) * FIR_DECIM - 1;
+
+		acc = 0;
+		for (k = 0; k < FIR_TAPS; k++) {
+			int32_t t = last - FIR_TAPS + 1 + k;
+
+			if (t >= 0) {
+				acc += (int32_t)in[t] * fir_coeffs[k];
+			}
+		}
+		y = (acc + (1 << 14)) >> 15;
+		if (y > 32767) {
+			y = 32767;
+		}
+		if (y < -32768) {
+			y = -32768;
+		}
+		if (out[i] != y) {
+			bad++;
+		}
+	}
+	check(bad == 0, "fir", step, bad);
+}
+
+static void test_stats(void)
+{
+	static int16_t in[3000];
+	struct dsp_stats s;
+	int64_t sum = 0;
+	uint64_t sumsq = 0;
+	int16_t min = 32767, max = -32768;
+	uint32_t i, rms;
+
+	dsp_stats_reset(&s);
+	check(dsp_stats_mean(&s) == 0 && dsp_stats_rms(&s) == 0,
+	      "stats empty", dsp_stats_mean(&s), dsp_stats_rms(&s));
+
+	for (i = 0; i < 3000; i++) {
+		in[i] = rnd16();
+		sum += in[i];
+		sumsq += (int64_t)in[i] * in[i];
+		if (in[i] < min) {
+			min = in[i];
+		}
+		if (in[i] > max) {
+			max = in[i];
+		}
+	}
+	dsp_stats_update(&s, in, 1000);
+	dsp_stats_update(&s, in + 1000, 2000);
+	check(s.min == min && s.max == max, "stats min max", s.min, s.max);
+	check(dsp_stats_mean(&s) == sum / 3000, "stats mean",
+	      dsp_stats_mean(&s), (long)(sum / 3000));
+	rms = (uint32_t)sqrt((double)(sumsq / 3000));
+	check((uint32_t)dsp_stats_rms(&s) == rms, "stats rms",
+	      dsp_stats_rms(&s), rms);
+
+	/* full scale square wave, where x * x no longer fits an int16 */
+	for (i = 0; i < 100; i++) {
+		in[i] = (i & 1) ? 32767 : -32768;
+	}
+	dsp_stats_reset(&s);
+	dsp_stats_update(&s, in, 100);
+	check(dsp_stats_rms(&s) == 32767, "stats rms full scale",
+	      dsp_stats_rms(&s), 32767);
+	check(dsp_stats_mean(&s) == 0, "stats mean full scale",
+	      dsp_stats_mean(&s), 0);
+}
+
+static double mac_rate(int32_t (*dot)(const int16_t *, const int16_t *,
+				      uint32_t), const int16_t *a,
+		       const int16_t *b, int32_t *sink)
+{
+	clock_t t = clock();
+	uint32_t i, rounds = 0;
+
+	do {
+		for (i = 0; i < 1000; i++) {
+			*sink += dot(a, b, BLOCK);
+		}
+		rounds++;
+	} while (clock() - t < CLOCKS_PER_SEC / 4);
+	return (double)rounds * 1000 * BLOCK * CLOCKS_PER_SEC /
+		(clock() - t);
+}
+
+static void bench(void)
+{
+	static int16_t a[BLOCK], b[BLOCK], out[BLOCK],
+		state[2 * FIR_TAPS];
+	struct dsp_fir f;
+	uint32_t i, rounds = 0;
+	int32_t sink = 0;
+	clock_t t;
+
+	for (i = 0; i < BLOCK; i++) {
+		a[i] = rnd16();
+		b[i] = rnd16();
+	}
+	printf("dot product: %.0f MMAC/s C, %.0f MMAC/s SIMD model\n",
+	       mac_rate(dsp_dot_q15_c, a, b, &sink) / 1e6,
+	       mac_rate(dot_simd, a, b, &sink) / 1e6);
+
+	dsp_fir_init(&f, fir_coeffs, state, FIR_TAPS, FIR_DECIM);
+	t = clock();
+	do {
+		for (i = 0; i < 1000; i++) {
+			sink += dsp_fir_run(&f, a, BLOCK, out);
+		}
+		rounds++;
+	} while (clock() - t < CLOCKS_PER_SEC / 4);
+	printf("fir: %.0f MMAC/s (%u taps, decimating by %u)\n",
+	       (double)rounds * 1000 * BLOCK / FIR_DECIM * FIR_TAPS *
+	       CLOCKS_PER_SEC / (clock() - t) / 1e6, FIR_TAPS, FIR_DECIM);
+	if (sink == 42) {
+		printf("\n");
+	}
+}
+
+int main(void)
+{
+	uint32_t d;
+
+	test_dot();
+	/* up to the largest decimation that fits for order 3 */
+	for (d = 1; d <= 32; d *= 2) {
+		test_cic(d, 4096, 1);
+		test_cic(d, 4096, BLOCK);
+		test_cic(d, 4000, 77);
+	}
+	test_fir(4096, 1);
+	test_fir(4096, BLOCK);
+	test_fir(4001, 33);
+	test_stats();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	if (!failed) {
+		bench();
+	}
+	return failed ? 1 : 0;
+}
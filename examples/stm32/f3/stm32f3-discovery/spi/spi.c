@@ -24,6 +24,9 @@
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/spi.h>
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "l3gd20.h"
 
 #define LBLUE GPIOE, GPIO8
 #define LRED GPIOE, GPIO9
@@ -63,7 +66,8 @@ static void spi_setup(void)
 
 	//spi initialization;
 	spi_set_master_mode(SPI1);
-	spi_set_baudrate_prescaler(SPI1, SPI_CR1_BR_FPCLK_DIV_64);
+	/* 64MHz / 8 = 8MHz, the L3GD20 allows up to 10MHz */
+	spi_set_baudrate_prescaler(SPI1, SPI_CR1_BR_FPCLK_DIV_8);
 	spi_set_clock_polarity_0(SPI1);
 	spi_set_clock_phase_0(SPI1);
 	spi_set_full_duplex_mode(SPI1);
@@ -131,9 +135,13 @@ static void my_usart_print_int(uint32_t usart, int32_t value)
 	for (i = nr_digits-1; i >= 0; i--) {
 		usart_send_blocking(usart, buffer[i]);
 	}
+}
 
-	usart_send_blocking(usart, '\r');
-	usart_send_blocking(usart, '\n');
+static void my_usart_print_string(uint32_t usart, const char *s)
+{
+	while (*s != '\0') {
+		usart_send_blocking(usart, *s++);
+	}
 }
 
 static void clock_setup(void)
@@ -141,94 +149,52 @@ static void clock_setup(void)
 	rcc_clock_setup_hsi(&rcc_hsi_configs[RCC_CLOCK_HSI_64MHZ]);
 }
 
-#define GYR_RNW			(1 << 7) /* Write when zero */
-#define GYR_MNS			(1 << 6) /* Multiple reads when 1 */
-#define GYR_WHO_AM_I		0x0F
-#define GYR_OUT_TEMP		0x26
-#define GYR_STATUS_REG		0x27
-#define GYR_CTRL_REG1		0x20
-#define GYR_CTRL_REG1_PD	(1 << 3)
-#define GYR_CTRL_REG1_XEN	(1 << 1)
-#define GYR_CTRL_REG1_YEN	(1 << 0)
-#define GYR_CTRL_REG1_ZEN	(1 << 2)
-#define GYR_CTRL_REG1_BW_SHIFT	4
-#define GYR_CTRL_REG4		0x23
-#define GYR_CTRL_REG4_FS_SHIFT	4
-
-#define GYR_OUT_X_L		0x28
-#define GYR_OUT_X_H		0x29
-
 int main(void)
 {
-	uint8_t temp;
-	int16_t gyr_x;
+	struct l3gd20_sample sample = { 0, { 0, 0, 0 }, 0, 0 };
+	struct l3gd20_stats stats, last = { 0, 0, 0 };
+	uint32_t next;
+
 	clock_setup();
 	gpio_setup();
 	usart_setup();
 	spi_setup();
-
-	gpio_clear(GPIOE, GPIO3);
-	spi_send8(SPI1, GYR_CTRL_REG1);
-	spi_read8(SPI1);
-	spi_send8(SPI1, GYR_CTRL_REG1_PD | GYR_CTRL_REG1_XEN |
-			GYR_CTRL_REG1_YEN | GYR_CTRL_REG1_ZEN |
-			(3 << GYR_CTRL_REG1_BW_SHIFT));
-	spi_read8(SPI1);
-	gpio_set(GPIOE, GPIO3);
-
-	gpio_clear(GPIOE, GPIO3);
-	spi_send8(SPI1, GYR_CTRL_REG4);
-	spi_read8(SPI1);
-	spi_send8(SPI1, (1 << GYR_CTRL_REG4_FS_SHIFT));
-	spi_read8(SPI1);
-	gpio_set(GPIOE, GPIO3);
-
+	l3gd20_setup();
+
+	/*
+	 * Samples arrive at 760Hz, far more than we could print at 115200
+	 * baud. Drain them all and print the newest one, plus the sample
+	 * rate and losses, four times a second.
+	 */
+	next = dwt_read_cycle_counter() + rcc_ahb_frequency / 4;
 	while (1) {
-
-		gpio_clear(GPIOE, GPIO3);
-		spi_send8(SPI1, GYR_WHO_AM_I | GYR_RNW);
-		spi_read8(SPI1);
-		spi_send8(SPI1, 0);
-		temp=spi_read8(SPI1);
-		my_usart_print_int(USART2, (temp));
-		gpio_set(GPIOE, GPIO3);
-
-		gpio_clear(GPIOE, GPIO3);
-		spi_send8(SPI1, GYR_STATUS_REG | GYR_RNW);
-		spi_read8(SPI1);
-		spi_send8(SPI1, 0);
-		temp=spi_read8(SPI1);
-		my_usart_print_int(USART2, (temp));
-		gpio_set(GPIOE, GPIO3);
-
-		gpio_clear(GPIOE, GPIO3);
-		spi_send8(SPI1, GYR_OUT_TEMP | GYR_RNW);
-		spi_read8(SPI1);
-		spi_send8(SPI1, 0);
-		temp=spi_read8(SPI1);
-		my_usart_print_int(USART2, (temp));
-		gpio_set(GPIOE, GPIO3);
-
-		gpio_clear(GPIOE, GPIO3);
-		spi_send8(SPI1, GYR_OUT_X_L | GYR_RNW);
-		spi_read8(SPI1);
-		spi_send8(SPI1, 0);
-		gyr_x=spi_read8(SPI1);
-		gpio_set(GPIOE, GPIO3);
-
-		gpio_clear(GPIOE, GPIO3);
-		spi_send8(SPI1, GYR_OUT_X_H | GYR_RNW);
-		spi_read8(SPI1);
-		spi_send8(SPI1, 0);
-		gyr_x|=spi_read8(SPI1) << 8;
-		my_usart_print_int(USART2, (gyr_x));
-		gpio_set(GPIOE, GPIO3);
-
-		int i;
-		for (i = 0; i < 80000; i++)    /* Wait a bit. */
-			__asm__("nop");
+		while (l3gd20_get(&sample)) {
+			gpio_toggle(LD3);
+		}
+
+		if ((int32_t)(dwt_read_cycle_counter() - next) < 0) {
+			continue;
+		}
+		next += rcc_ahb_frequency / 4;
+
+		l3gd20_get_stats(&stats);
+		my_usart_print_string(USART2, "x ");
+		my_usart_print_int(USART2, sample.rate[0]);
+		my_usart_print_string(USART2, " y ");
+		my_usart_print_int(USART2, sample.rate[1]);
+		my_usart_print_string(USART2, " z ");
+		my_usart_print_int(USART2, sample.rate[2]);
+		my_usart_print_string(USART2, " temp ");
+		my_usart_print_int(USART2, sample.temp);
+		my_usart_print_string(USART2, " | ");
+		my_usart_print_int(USART2, 4 * (stats.samples - last.samples));
+		my_usart_print_string(USART2, " samples/s, dropped ");
+		my_usart_print_int(USART2, stats.dropped);
+		my_usart_print_string(USART2, ", overruns ");
+		my_usart_print_int(USART2, stats.overruns);
+		my_usart_print_string(USART2, "\r\n");
+		last = stats;
 	}
 
 	return 0;
 }
-
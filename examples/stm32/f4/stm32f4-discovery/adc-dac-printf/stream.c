@@ -0,0 +1,104 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "stream.h"
+
+void stream_init(struct stream *s, uint16_t *in, uint16_t *out,
+		 uint32_t block, stream_process_cb process, void *priv,
+		 stream_clock clock)
+{
+	s->in = in;
+	s->out = out;
+	s->block = block;
+	s->process = process;
+	s->priv = priv;
+	s->clock = clock;
+	s->in_events = 0;
+	s->out_events = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->stats.latency_min = 0xffffffff;
+}
+
+/*
+ * stream_input_done
+ *
+ * Call from the input DMA half and full transfer interrupt, the halves
+ * take turns so there is no need to say which. Processes the block that
+ * just came in, straight from the interrupt.
+ */
+void stream_input_done(struct stream *s)
+{
+	uint32_t k = s->in_events++;
+	uint32_t now = s->clock();
+	uint32_t off = (k & 1) * s->block;
+
+	s->in_time[k % 4] = now;
+	if (k > 0) {
+		s->stats.period = now - s->in_time[(k - 1) % 4];
+	}
+
+	s->process(s->in + off, s->out + off, s->block, s->priv);
+
+	s->stats.proc_last = s->clock() - now;
+	if (s->stats.proc_last > s->stats.proc_max) {
+		s->stats.proc_max = s->stats.proc_last;
+	}
+	s->stats.blocks++;
+}
+
+/*
+ * stream_output_started
+ *
+ * Call from the output DMA half and full transfer interrupt. Output
+ * event e is the output starting on the half that holds input block
+ * e - 1, so that block must have been processed by now. It started
+ * coming in at input event e - 2.
+ */
+void stream_output_started(struct stream *s)
+{
+	uint32_t e = s->out_events++;
+	uint32_t now = s->clock();
+	uint32_t lat;
+
+	if (e < 1) {
+		return;
+	}
+	if (s->stats.blocks < e) {
+		s->stats.late++;
+		return;
+	}
+	if (e < 2) {
+		return;
+	}
+
+	lat = now - s->in_time[(e - 2) % 4];
+	s->stats.latency_last = lat;
+	if (lat < s->stats.latency_min) {
+		s->stats.latency_min = lat;
+	}
+	if (lat > s->stats.latency_max) {
+		s->stats.latency_max = lat;
+	}
+}
+
+/* Copy of the statistics, call with the DMA interrupts masked. */
+void stream_get_stats(struct stream *s, struct stream_stats *stats)
+{
+	*stats = s->stats;
+}
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+
+/*
+ * Block scheduler for an ADC -> processing -> DAC path where both sides
+ * run from the same timer with circular DMA over two half buffers each.
+ *
+ * Input block k is captured into in half k % 2, processed into out half
+ * k % 2, and played while input block k + 2 is captured. That leaves one
+ * block period to process it, and puts the output two blocks behind the
+ * input. Nothing in here touches the hardware, the caller passes in the
+ * DMA events and a cycle counter.
+ */
+
+typedef void (*stream_process_cb)(const uint16_t *in, uint16_t *out,
+				  uint32_t n, void *priv);
+typedef uint32_t (*stream_clock)(void);
+
+struct stream_stats {
+	uint32_t blocks;	/* input blocks processed */
+	uint32_t late;		/* output halves played before being written */
+	uint32_t period;	/* cycles per block, measured */
+	uint32_t proc_last;	/* cycles the callback took */
+	uint32_t proc_max;
+	uint32_t latency_last;	/* first sample in to first sample out */
+	uint32_t latency_min;
+	uint32_t latency_max;
+};
+
+struct stream {
+	uint16_t *in;		/* 2 * block samples each */
+	uint16_t *out;
+	uint32_t block;
+	stream_process_cb process;
+	void *priv;
+	stream_clock clock;
+
+	uint32_t in_events;	/* input halves completed */
+	uint32_t out_events;	/* output halves started */
+	uint32_t in_time[4];	/* when input events happened, by number */
+	struct stream_stats stats;
+};
+
+void stream_init(struct stream *s, uint16_t *in, uint16_t *out,
+		 uint32_t block, stream_process_cb process, void *priv,
+		 stream_clock clock);
+void stream_input_done(struct stream *s);
+void stream_output_started(struct stream *s);
+void stream_get_stats(struct stream *s, struct stream_stats *stats);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks stream.c on the host:
+ *
+ *	cc -o stream_host stream_host.c stream.c
+ *	./stream_host
+ *
+ * Simulates what adc-dac-printf.c sets up, cycle by cycle: one timer
+ * clocks both the ADC and the DAC, their DMA streams run circularly over
+ * two halves each and the input interrupt runs the processing, which the
+ * higher priority output interrupt can cut into. The DAC output must be
+ * the ADC input, halved and exactly 2 * BLOCK + 1 samples later, for as
+ * long as the processing fits, and the latency, period and processing
+ * time must come out as the scheduler reports them. When the processing
+ * does not fit, every output half played before it was written must be
+ * counted as late.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stream.h"
+
+#define BLOCK		32
+#define TICK		3500	/* 168MHz / 48kHz */
+#define ADC_LAT		120	/* trigger to the sample in memory */
+#define OUT_COST	40	/* the output interrupt */
+#define SAMPLES		(BLOCK * 2000)
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t rnd_state = 7;
+
+static uint32_t rnd(uint32_t n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 16) % n;
+}
+
+/*
+ * The hardware: the tick counter, the next ADC write, what the DAC holds
+ * and what it put out, and the DMA half and full flags of each side.
+ * Levels are 0 for the main loop, 1 in the input and 2 in the output
+ * interrupt.
+ */
+static struct sim {
+	uint64_t now;
+	uint32_t tick;			/* next timer update */
+	uint32_t conv;			/* next ADC result to land */
+	uint16_t adc_buf[2 * BLOCK];
+	uint16_t dac_buf[2 * BLOCK];
+	uint16_t dhr;
+	uint16_t out[SAMPLES];
+	uint32_t written[2];		/* input block last in each half */
+	int in_ht, in_tc, out_ht, out_tc;
+	uint32_t proc;			/* processing cycles */
+	uint32_t proc_rnd;		/* plus up to this many */
+	int late_slot[SAMPLES / BLOCK];	/* output halves found late */
+	struct stream s;
+} sim;
+
+static uint16_t input(uint32_t j)
+{
+	return (j * 7919 + 13) & 0xfff;
+}
+
+static uint32_t sim_clock(void)
+{
+	return (uint32_t)sim.now;
+}
+
+static void run_until(uint64_t end, int level);
+
+static void out_isr(void)
+{
+	uint32_t late = sim.s.stats.late;
+	uint32_t e = sim.s.out_events;
+
+	stream_output_started(&sim.s);
+	/* event e starts the half that plays output slot e + 1 */
+	if (sim.s.stats.late != late && e + 1 < SAMPLES / BLOCK) {
+		sim.late_slot[e + 1] = 1;
+	}
+	run_until(sim.now + OUT_COST, 2);
+}
+
+static void process(const uint16_t *in, uint16_t *out, uint32_t n,
+		    void *priv)
+{
+	uint16_t tmp[BLOCK];
+	uint32_t i;
+
+	(void)priv;
+	for (i = 0; i < n; i++) {
+		tmp[i] = in[i] / 2;
+	}
+	/* the results show up once the processing time is over */
+	run_until(sim.now + sim.proc + (sim.proc_rnd ? rnd(sim.proc_rnd) : 0),
+		  1);
+	memcpy(out, tmp, sizeof(tmp));
+}
+
+static void dispatch(int level)
+{
+	/* the output interrupt has the higher priority */
+	while (level < 2 && (sim.out_ht || sim.out_tc)) {
+		if (sim.out_ht) {
+			sim.out_ht = 0;
+			out_isr();
+		}
+		if (sim.out_tc) {
+			sim.out_tc = 0;
+			out_isr();
+		}
+	}
+	if (level < 1 && (sim.in_ht || sim.in_tc)) {
+		if (sim.in_ht) {
+			sim.in_ht = 0;
+			stream_input_done(&sim.s);
+		}
+		if (sim.in_tc) {
+			sim.in_tc = 0;
+			stream_input_done(&sim.s);
+		}
+	}
+}
+
+/*
+ * Timer update j: the DAC puts out what it holds and its DMA loads the
+ * next sample. ADC_LAT later the ADC's DMA stores sample j.
+ */
+static void hw_event(void)
+{
+	uint64_t t_tick = (uint64_t)sim.tick * TICK;
+	uint64_t t_conv = (uint64_t)sim.conv * TICK + ADC_LAT;
+	uint32_t j;
+
+	if (t_tick <= t_conv) {
+		j = sim.tick++;
+		sim.now = t_tick;
+		if (j < SAMPLES) {
+			sim.out[j] = sim.dhr;
+		}
+		sim.dhr = sim.dac_buf[j % (2 * BLOCK)];
+		if (j % (2 * BLOCK) == BLOCK - 1) {
+			sim.out_ht = 1;
+		} else if (j % (2 * BLOCK) == 2 * BLOCK - 1) {
+			sim.out_tc = 1;
+		}
+	} else {
+		j = sim.conv++;
+		sim.now = t_conv;
+		sim.adc_buf[j % (2 * BLOCK)] = input(j);
+		if (j % (2 * BLOCK) == BLOCK - 1) {
+			sim.in_ht = 1;
+		} else if (j % (2 * BLOCK) == 2 * BLOCK - 1) {
+			sim.in_tc = 1;
+		}
+	}
+}
+
+static uint64_t next_hw(void)
+{
+	uint64_t t_tick = (uint64_t)sim.tick * TICK;
+	uint64_t t_conv = (uint64_t)sim.conv * TICK + ADC_LAT;
+
+	return t_tick < t_conv ? t_tick : t_conv;
+}
+
+static void run_until(uint64_t end, int level)
+{
+	while (1) {
+		dispatch(level);
+		if (next_hw() > end) {
+			break;
+		}
+		hw_event();
+	}
+	sim.now = end;
+}
+
+static void sim_run(uint32_t proc, uint32_t proc_rnd)
+{
+	memset(&sim, 0, sizeof(sim));
+	sim.proc = proc;
+	sim.proc_rnd = proc_rnd;
+	stream_init(&sim.s, sim.adc_buf, sim.dac_buf, BLOCK, process, NULL,
+		    sim_clock);
+	run_until((uint64_t)SAMPLES * TICK, 0);
+}
+
+/* Output sample j is input j - 2 * BLOCK - 1, halved */
+static uint32_t bad_samples(uint32_t *bad_slots)
+{
+	uint32_t j, bad = 0, slot_bad = 0;
+
+	for (j = 2 * BLOCK + 1; j < SAMPLES; j++) {
+		if (sim.out[j] != input(j - 2 * BLOCK - 1) / 2) {
+			bad++;
+			/* it was read from the DAC buffer one tick before */
+			if (!sim.late_slot[(j - 1) / BLOCK]) {
+				slot_bad++;
+			}
+		}
+	}
+	*bad_slots = slot_bad;
+	return bad;
+}
+
+static void test_fits(uint32_t proc, uint32_t proc_rnd)
+{
+	struct stream_stats st;
+	uint32_t bad, unflagged, lat = 2 * BLOCK * TICK - ADC_LAT;
+
+	sim_run(proc, proc_rnd);
+	stream_get_stats(&sim.s, &st);
+	bad = bad_samples(&unflagged);
+
+	check(bad == 0, "output", proc, bad);
+	check(st.late == 0, "late", proc, st.late);
+	check(st.blocks == SAMPLES / BLOCK, "blocks", st.blocks,
+	      SAMPLES / BLOCK);
+	check(st.period == BLOCK * TICK, "period", st.period, BLOCK * TICK);
+	/* the output interrupt can be held off by itself only */
+	check(st.latency_min >= lat && st.latency_max <= lat + OUT_COST,
+	      "latency", st.latency_min, st.latency_max);
+	/* the processing, plus the output interrupts cutting in */
+	check(st.proc_max >= proc && st.proc_max <= proc + proc_rnd +
+	      2 * OUT_COST, "processing time", proc, st.proc_max);
+}
+
+static void test_late(uint32_t proc, uint32_t proc_rnd)
+{
+	struct stream_stats st;
+	uint32_t bad, unflagged;
+
+	sim_run(proc, proc_rnd);
+	stream_get_stats(&sim.s, &st);
+	bad = bad_samples(&unflagged);
+
+	check(bad > 0 && st.late > 0, "too slow", bad, st.late);
+	check(unflagged == 0, "late counted", proc, unflagged);
+	printf("%u + %u cycles: %u of %u blocks late, %u samples wrong\n",
+	       (unsigned)proc, (unsigned)proc_rnd, (unsigned)st.late,
+	       (unsigned)st.blocks, (unsigned)bad);
+}
+
+int main(void)
+{
+	/* one block period is BLOCK * TICK = 112000 cycles */
+	test_fits(100, 0);
+	test_fits(50000, 0);
+	test_fits(60000, 40000);
+	test_fits(110000, 0);
+	test_late(115000, 0);
+	test_late(90000, 40000);
+	test_late(150000, 0);
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
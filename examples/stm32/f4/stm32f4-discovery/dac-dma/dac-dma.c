@@ -20,15 +20,39 @@
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/dac.h>
 #include <libopencm3/stm32/dma.h>
 
-/* Timer 2 count period, 16 microseconds for a 72MHz APB2 clock */
-#define PERIOD 1152
+#include "wavegen.h"
+
+/* TIM2 is on the 42MHz APB1, timers there run at twice that */
+#define TIM2_CLOCK	84000000
+#define SAMPLE_RATE	100000
+
+/* Samples per DMA half buffer, refilled while the other half plays */
+#define HALF		128
 
 /* Globals */
-uint8_t waveform[256];
+uint16_t dac_buf[2 * HALF];
+uint16_t arbitrary[WAVEGEN_TABLE_SIZE];
+struct wavegen gen;
+uint32_t sample_rate;
+
+/* What the user button steps through */
+static const struct {
+	const char *name;
+	const uint16_t *table;
+	uint32_t freq;
+} presets[] = {
+	{ "sine", wavegen_sine, 1000 },
+	{ "square", wavegen_square, 1000 },
+	{ "triangle", wavegen_triangle, 500 },
+	{ "arbitrary", arbitrary, 390 },
+	{ "sine", wavegen_sine, 5000 },
+};
+#define NPRESETS	(sizeof(presets) / sizeof(presets[0]))
 
 /*--------------------------------------------------------------------*/
 static void clock_setup(void)
@@ -47,11 +71,57 @@ static void gpio_setup(void)
 	gpio_set_output_options(GPIOC, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO1);
 	/* Set PA4 for DAC channel 1 to analogue, ignoring drive mode. */
 	gpio_mode_setup(GPIOA, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, GPIO4);
+	/* User button on PA0 */
+	gpio_mode_setup(GPIOA, GPIO_MODE_INPUT, GPIO_PUPD_NONE, GPIO0);
+	/* USART2 TX on PA2 */
+	gpio_mode_setup(GPIOA, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO2);
+	gpio_set_af(GPIOA, GPIO_AF7, GPIO2);
 }
 
 /*--------------------------------------------------------------------*/
-static void timer_setup(void)
+static void usart_setup(void)
+{
+	rcc_periph_clock_enable(RCC_USART2);
+	usart_set_baudrate(USART2, 115200);
+	usart_set_databits(USART2, 8);
+	usart_set_stopbits(USART2, USART_STOPBITS_1);
+	usart_set_mode(USART2, USART_MODE_TX);
+	usart_set_parity(USART2, USART_PARITY_NONE);
+	usart_set_flow_control(USART2, USART_FLOWCONTROL_NONE);
+	usart_enable(USART2);
+}
+
+static void print(const char *s)
+{
+	while (*s) {
+		usart_send_blocking(USART2, *s++);
+	}
+}
+
+static void print_uint(uint32_t value)
 {
+	char buf[10];
+	int n = 0;
+
+	do {
+		buf[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (n) {
+		usart_send_blocking(USART2, buf[--n]);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+/*
+ * TIM2 update events clock the DAC, one per sample. Returns the sample
+ * rate the period really gives, which is what the tuning words must be
+ * worked out from.
+ */
+static uint32_t timer_setup(uint32_t rate)
+{
+	uint32_t period = (TIM2_CLOCK + rate / 2) / rate;
+
 	/* Enable TIM2 clock. */
 	rcc_periph_clock_enable(RCC_TIM2);
 	rcc_periph_reset_pulse(RST_TIM2);
@@ -59,19 +129,13 @@ static void timer_setup(void)
 	timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT,
 		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
 	timer_continuous_mode(TIM2);
-	timer_set_period(TIM2, PERIOD);
-	timer_disable_oc_output(TIM2, TIM_OC2 | TIM_OC3 | TIM_OC4);
-	timer_enable_oc_output(TIM2, TIM_OC1);
-	timer_disable_oc_clear(TIM2, TIM_OC1);
-	timer_disable_oc_preload(TIM2, TIM_OC1);
-	timer_set_oc_slow_mode(TIM2, TIM_OC1);
-	timer_set_oc_mode(TIM2, TIM_OC1, TIM_OCM_TOGGLE);
-	timer_set_oc_value(TIM2, TIM_OC1, 500);
+	timer_set_period(TIM2, period - 1);
 	timer_disable_preload(TIM2);
-	/* Set the timer trigger output (for the DAC) to the channel 1 output
-	   compare */
-	timer_set_master_mode(TIM2, TIM_CR2_MMS_COMPARE_OC1REF);
+	/* Set the timer trigger output (for the DAC) to the update event */
+	timer_set_master_mode(TIM2, TIM_CR2_MMS_UPDATE);
 	timer_enable_counter(TIM2);
+
+	return TIM2_CLOCK / period;
 }
 
 /*--------------------------------------------------------------------*/
@@ -82,19 +146,20 @@ static void dma_setup(void)
 	rcc_periph_clock_enable(RCC_DMA1);
 	nvic_enable_irq(NVIC_DMA1_STREAM5_IRQ);
 	dma_stream_reset(DMA1, DMA_STREAM5);
-	dma_set_priority(DMA1, DMA_STREAM5, DMA_SxCR_PL_LOW);
-	dma_set_memory_size(DMA1, DMA_STREAM5, DMA_SxCR_MSIZE_8BIT);
-	dma_set_peripheral_size(DMA1, DMA_STREAM5, DMA_SxCR_PSIZE_8BIT);
+	dma_set_priority(DMA1, DMA_STREAM5, DMA_SxCR_PL_HIGH);
+	dma_set_memory_size(DMA1, DMA_STREAM5, DMA_SxCR_MSIZE_16BIT);
+	dma_set_peripheral_size(DMA1, DMA_STREAM5, DMA_SxCR_PSIZE_16BIT);
 	dma_enable_memory_increment_mode(DMA1, DMA_STREAM5);
 	dma_enable_circular_mode(DMA1, DMA_STREAM5);
 	dma_set_transfer_mode(DMA1, DMA_STREAM5,
 				DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
-	/* The register to target is the DAC1 8-bit right justified data
+	/* The register to target is the DAC1 12-bit right justified data
 	   register */
-	dma_set_peripheral_address(DMA1, DMA_STREAM5, (uint32_t) &DAC_DHR8R1);
-	/* The array v[] is filled with the waveform data to be output */
-	dma_set_memory_address(DMA1, DMA_STREAM5, (uint32_t) waveform);
-	dma_set_number_of_data(DMA1, DMA_STREAM5, 256);
+	dma_set_peripheral_address(DMA1, DMA_STREAM5, (uint32_t) &DAC_DHR12R1);
+	/* Both halves of dac_buf are refilled by the generator in turn */
+	dma_set_memory_address(DMA1, DMA_STREAM5, (uint32_t) dac_buf);
+	dma_set_number_of_data(DMA1, DMA_STREAM5, 2 * HALF);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_STREAM5);
 	dma_enable_transfer_complete_interrupt(DMA1, DMA_STREAM5);
 	dma_channel_select(DMA1, DMA_STREAM5, DMA_SxCR_CHSEL_7);
 	dma_enable_stream(DMA1, DMA_STREAM5);
@@ -114,23 +179,52 @@ static void dac_setup(void)
 }
 
 /*--------------------------------------------------------------------*/
-/* The ISR simply provides a test output for a CRO trigger */
+/*
+ * Refill whichever half the DMA has just finished with. PC1 still
+ * toggles once per buffer as a CRO trigger.
+ */
 
 void dma1_stream5_isr(void)
 {
+	if (dma_get_interrupt_flag(DMA1, DMA_STREAM5, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_STREAM5, DMA_HTIF);
+		wavegen_fill(&gen, dac_buf, HALF);
+	}
 	if (dma_get_interrupt_flag(DMA1, DMA_STREAM5, DMA_TCIF)) {
 		dma_clear_interrupt_flags(DMA1, DMA_STREAM5, DMA_TCIF);
+		wavegen_fill(&gen, dac_buf + HALF, HALF);
 		/* Toggle PC1 just to keep aware of activity and frequency. */
 		gpio_toggle(GPIOC, GPIO1);
 	}
 }
 
+/*--------------------------------------------------------------------*/
+/* Switch to a preset and say what the output frequency really is */
+static void select_preset(uint32_t p)
+{
+	uint32_t tuning, mhz;
+
+	tuning = wavegen_tuning(presets[p].freq, sample_rate);
+	wavegen_set(&gen, presets[p].table, tuning);
+
+	mhz = ((uint64_t)tuning * sample_rate * 1000) >> 32;
+	print(presets[p].name);
+	print(" ");
+	print_uint(mhz / 1000);
+	print(".");
+	print_uint(mhz / 100 % 10);
+	print_uint(mhz / 10 % 10);
+	print_uint(mhz % 10);
+	print(" Hz\r\n");
+}
+
 /*--------------------------------------------------------------------*/
 int main(void)
 {
-	/* Fill the array with funky waveform data */
-	/* This is for dual channel 8-bit right aligned */
+	/* Fill the arbitrary table with funky waveform data */
 	uint16_t i, x;
+	uint32_t p = 0, held = 0;
+
 	for (i = 0; i < 256; i++) {
 		if (i < 10) {
 			x = 10;
@@ -143,15 +237,38 @@ int main(void)
 		} else {
 			x = 10;
 		}
-		waveform[i] = x;
+		arbitrary[i] = x << 4;
 	}
+	wavegen_make_tables();
+
 	clock_setup();
 	gpio_setup();
-	timer_setup();
+	usart_setup();
+	sample_rate = timer_setup(SAMPLE_RATE);
+
+	print("DAC sample rate ");
+	print_uint(sample_rate);
+	print(" Hz\r\n");
+
+	/* Start silent at mid scale, the first preset comes in cleanly */
+	wavegen_init(&gen, wavegen_sine, 0);
+	wavegen_fill(&gen, dac_buf, 2 * HALF);
+	select_preset(p);
+
 	dma_setup();
 	dac_setup();
 
-	while (1);
+	/* The user button steps through the presets */
+	while (1) {
+		if (gpio_get(GPIOA, GPIO0)) {
+			if (++held == 100000) {
+				p = (p + 1) % NPRESETS;
+				select_preset(p);
+			}
+		} else {
+			held = 0;
+		}
+	}
 
 	return 0;
 }
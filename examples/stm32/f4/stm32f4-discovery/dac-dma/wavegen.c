@@ -0,0 +1,148 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wavegen.h"
+
+/* One cycle, mid scale rising at index 0 like the other tables */
+const uint16_t wavegen_sine[WAVEGEN_TABLE_SIZE] = {
+	2048, 2098, 2148, 2198, 2248, 2298, 2348, 2398,
+	2447, 2496, 2545, 2594, 2642, 2690, 2737, 2784,
+	2831, 2877, 2923, 2968, 3013, 3057, 3100, 3143,
+	3185, 3226, 3267, 3307, 3346, 3385, 3423, 3459,
+	3495, 3530, 3565, 3598, 3630, 3662, 3692, 3722,
+	3750, 3777, 3804, 3829, 3853, 3876, 3898, 3919,
+	3939, 3958, 3975, 3992, 4007, 4021, 4034, 4045,
+	4056, 4065, 4073, 4080, 4085, 4089, 4093, 4094,
+	4095, 4094, 4093, 4089, 4085, 4080, 4073, 4065,
+	4056, 4045, 4034, 4021, 4007, 3992, 3975, 3958,
+	3939, 3919, 3898, 3876, 3853, 3829, 3804, 3777,
+	3750, 3722, 3692, 3662, 3630, 3598, 3565, 3530,
+	3495, 3459, 3423, 3385, 3346, 3307, 3267, 3226,
+	3185, 3143, 3100, 3057, 3013, 2968, 2923, 2877,
+	2831, 2784, 2737, 2690, 2642, 2594, 2545, 2496,
+	2447, 2398, 2348, 2298, 2248, 2198, 2148, 2098,
+	2048, 1997, 1947, 1897, 1847, 1797, 1747, 1697,
+	1648, 1599, 1550, 1501, 1453, 1405, 1358, 1311,
+	1264, 1218, 1172, 1127, 1082, 1038, 995, 952,
+	910, 869, 828, 788, 749, 710, 672, 636,
+	600, 565, 530, 497, 465, 433, 403, 373,
+	345, 318, 291, 266, 242, 219, 197, 176,
+	156, 137, 120, 103, 88, 74, 61, 50,
+	39, 30, 22, 15, 10, 6, 2, 1,
+	0, 1, 2, 6, 10, 15, 22, 30,
+	39, 50, 61, 74, 88, 103, 120, 137,
+	156, 176, 197, 219, 242, 266, 291, 318,
+	345, 373, 403, 433, 465, 497, 530, 565,
+	600, 636, 672, 710, 749, 788, 828, 869,
+	910, 952, 995, 1038, 1082, 1127, 1172, 1218,
+	1264, 1311, 1358, 1405, 1453, 1501, 1550, 1599,
+	1648, 1697, 1747, 1797, 1847, 1897, 1947, 1997,
+};
+
+uint16_t wavegen_square[WAVEGEN_TABLE_SIZE];
+uint16_t wavegen_triangle[WAVEGEN_TABLE_SIZE];
+
+void wavegen_make_tables(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < WAVEGEN_TABLE_SIZE; i++) {
+		wavegen_square[i] = (i < WAVEGEN_TABLE_SIZE / 2) ? 4095 : 0;
+		/* Up from mid scale to the top, down to 0 and back up */
+		if (i < 64) {
+			wavegen_triangle[i] = 2048 + i * 32;
+		} else if (i < 192) {
+			wavegen_triangle[i] = 4095 - (i - 64) * 32;
+		} else {
+			wavegen_triangle[i] = (i - 192) * 32;
+		}
+	}
+}
+
+/*
+ * wavegen_tuning
+ *
+ * The tuning word for freq at sample_rate, freq * 2^32 / sample_rate
+ * rounded. The frequency actually produced is
+ * tuning * sample_rate / 2^32.
+ */
+uint32_t wavegen_tuning(uint32_t freq, uint32_t sample_rate)
+{
+	return (((uint64_t)freq << 32) + sample_rate / 2) / sample_rate;
+}
+
+void wavegen_init(struct wavegen *g, const uint16_t *table, uint32_t tuning)
+{
+	g->table = table;
+	g->tuning = tuning;
+	g->phase = 0;
+	g->pending = 0;
+}
+
+/*
+ * wavegen_set
+ *
+ * Switch to another table or frequency, called from outside the refill
+ * interrupt. The switch waits until the phase accumulator wraps, so the
+ * output never mixes part of a cycle of one waveform with another. A
+ * second call before that simply replaces the first. With a tuning word
+ * of zero the generator is stopped and switches right away.
+ */
+void wavegen_set(struct wavegen *g, const uint16_t *table, uint32_t tuning)
+{
+	g->pending = 0;
+	g->next_table = table;
+	g->next_tuning = tuning;
+	g->pending = 1;
+}
+
+/*
+ * wavegen_fill
+ *
+ * Write the next n samples, called from the DMA half and full transfer
+ * interrupts for the half that just went out.
+ */
+void wavegen_fill(struct wavegen *g, uint16_t *out, uint32_t n)
+{
+	const uint16_t *table = g->table;
+	uint32_t tuning = g->tuning;
+	uint32_t phase = g->phase;
+	uint32_t i, prev;
+
+	if ((tuning == 0) && g->pending) {
+		table = g->next_table;
+		tuning = g->next_tuning;
+		phase = 0;
+		g->pending = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		out[i] = table[phase >> 24];
+		prev = phase;
+		phase += tuning;
+		if ((phase < prev) && g->pending) {
+			/* The cycle is over, start the new one from zero */
+			table = g->next_table;
+			tuning = g->next_tuning;
+			phase = 0;
+			g->pending = 0;
+		}
+	}
+	g->table = table;
+	g->tuning = tuning;
+	g->phase = phase;
+}
@@ -0,0 +1,52 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAVEGEN_H
+#define WAVEGEN_H
+
+#include <stdint.h>
+
+/*
+ * Direct digital synthesis from 256 entry, 12-bit tables. A 32-bit phase
+ * accumulator advances by the tuning word every sample and its top eight
+ * bits index the table. Nothing in here touches the hardware.
+ */
+
+#define WAVEGEN_TABLE_SIZE	256
+
+extern const uint16_t wavegen_sine[WAVEGEN_TABLE_SIZE];
+extern uint16_t wavegen_square[WAVEGEN_TABLE_SIZE];
+extern uint16_t wavegen_triangle[WAVEGEN_TABLE_SIZE];
+
+struct wavegen {
+	const uint16_t *table;
+	uint32_t tuning;
+	uint32_t phase;
+	/* Set by wavegen_set(), taken over at the start of the next cycle */
+	const uint16_t * volatile next_table;
+	volatile uint32_t next_tuning;
+	volatile uint32_t pending;
+};
+
+void wavegen_make_tables(void);
+uint32_t wavegen_tuning(uint32_t freq, uint32_t sample_rate);
+void wavegen_init(struct wavegen *g, const uint16_t *table,
+		  uint32_t tuning);
+void wavegen_set(struct wavegen *g, const uint16_t *table, uint32_t tuning);
+void wavegen_fill(struct wavegen *g, uint16_t *out, uint32_t n);
+
+#endif
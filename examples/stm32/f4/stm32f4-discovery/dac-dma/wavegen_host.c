@@ -0,0 +1,295 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks wavegen.c on the host:
+ *
+ *	cc -o wavegen_host wavegen_host.c wavegen.c -lm
+ *	./wavegen_host
+ *
+ * The tables are checked against the functions they sample, and the
+ * output of wavegen_fill() against a separate 64-bit phase reference for
+ * the presets of dac-dma.c, whatever the block size. The sine output must
+ * stay within the phase truncation error of a true sine at the requested
+ * frequency, and its zero crossings must give that frequency. Switches
+ * must wait for the end of a cycle and start the new waveform from the
+ * beginning of its table.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "wavegen.h"
+
+#define SAMPLE_RATE	100000
+#define LEN		200000
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint16_t out[LEN];
+
+static void test_tables(void)
+{
+	uint32_t i, bad = 0;
+	double s;
+
+	for (i = 0; i < WAVEGEN_TABLE_SIZE; i++) {
+		s = 2047.5 + 2047.5 * sin(2 * M_PI * i / WAVEGEN_TABLE_SIZE);
+		if (fabs(wavegen_sine[i] - s) > 0.5) {
+			bad++;
+		}
+	}
+	check(bad == 0, "sine table", bad, 0);
+
+	bad = 0;
+	for (i = 0; i < WAVEGEN_TABLE_SIZE; i++) {
+		/* a triangle through mid scale, top at 64, bottom at 192 */
+		s = i < 64 ? 2048 + i * 32.0 :
+			i < 192 ? 4095 - (i - 64) * 32.0 : (i - 192) * 32.0;
+		if (wavegen_triangle[i] != s || wavegen_triangle[i] > 4095) {
+			bad++;
+		}
+		if (wavegen_square[i] != (i < 128 ? 4095 : 0)) {
+			bad++;
+		}
+	}
+	check(bad == 0, "square and triangle tables", bad, 0);
+}
+
+/* The tuning word must be the nearest to the frequency */
+static void test_tuning(void)
+{
+	uint32_t f, t, bad = 0;
+	double exact;
+
+	for (f = 1; f < SAMPLE_RATE / 2; f = f * 3 / 2 + 1) {
+		t = wavegen_tuning(f, SAMPLE_RATE);
+		exact = (double)f * 4294967296.0 / SAMPLE_RATE;
+		if (fabs(t - exact) > 0.5) {
+			bad++;
+		}
+	}
+	check(bad == 0, "tuning", bad, 0);
+	check(wavegen_tuning(0, SAMPLE_RATE) == 0, "tuning 0", 0, 0);
+}
+
+/* Fill LEN samples n at a time */
+static void fill(struct wavegen *g, uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0; i < LEN; i += n) {
+		wavegen_fill(g, out + i, LEN - i < n ? LEN - i : n);
+	}
+}
+
+static void test_stream(const uint16_t *table, uint32_t freq,
+			const char *name)
+{
+	static const uint32_t blocks[] = { 1, 7, 128, LEN };
+	struct wavegen g;
+	uint32_t tuning = wavegen_tuning(freq, SAMPLE_RATE);
+	uint32_t b, i, bad, up = 0, first = 0, last = 0;
+	uint64_t phase;
+	double err, max_err = 0;
+
+	for (b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+		wavegen_init(&g, table, tuning);
+		fill(&g, blocks[b]);
+		bad = 0;
+		for (i = 0; i < LEN; i++) {
+			phase = ((uint64_t)i * tuning) & 0xffffffff;
+			if (out[i] != table[phase >> 24]) {
+				bad++;
+			}
+		}
+		check(bad == 0, name, freq, blocks[b]);
+	}
+	if (table != wavegen_sine) {
+		return;
+	}
+
+	/*
+	 * The phase is cut to eight bits, so a sample can be off the true
+	 * sine by up to one table step on the steepest part.
+	 */
+	for (i = 0; i < LEN; i++) {
+		err = fabs(out[i] - (2047.5 + 2047.5 *
+			   sin(2 * M_PI * freq * (double)i / SAMPLE_RATE)));
+		if (err > max_err) {
+			max_err = err;
+		}
+	}
+	check(max_err < 2047.5 * 2 * M_PI / WAVEGEN_TABLE_SIZE + 1,
+	      "sine error", (long)max_err, freq);
+
+	/* rising crossings of mid scale, the first and last of them */
+	for (i = 1; i < LEN; i++) {
+		if (out[i - 1] < 2048 && out[i] >= 2048) {
+			if (!up++) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+	err = (double)(up - 1) * SAMPLE_RATE / (last - first);
+	check(fabs(err - freq) < freq * 1e-3, "sine frequency", (long)err,
+	      freq);
+}
+
+/* Fill samples [from, to) of out, n at a time */
+static void fill_range(struct wavegen *g, uint32_t from, uint32_t to,
+		       uint32_t n)
+{
+	while (from < to) {
+		if (n > to - from) {
+			n = to - from;
+		}
+		wavegen_fill(g, out + from, n);
+		from += n;
+	}
+}
+
+/*
+ * A switch made before sample at: the old waveform goes on to the end of
+ * its cycle, and the sample after the wrap is the first of the new one,
+ * from phase zero.
+ */
+static void test_switch(const uint16_t *from, uint32_t f_from,
+			const uint16_t *to, uint32_t f_to, uint32_t at,
+			uint32_t block)
+{
+	struct wavegen g;
+	uint32_t tuning = wavegen_tuning(f_from, SAMPLE_RATE);
+	uint32_t t_to = wavegen_tuning(f_to, SAMPLE_RATE);
+	uint32_t i, bad = 0, switched = 0;
+	uint64_t phase = 0;
+	const uint16_t *table = from;
+
+	wavegen_init(&g, from, tuning);
+	fill_range(&g, 0, at, block);
+	wavegen_set(&g, to, t_to);
+	fill_range(&g, at, LEN, block);
+
+	for (i = 0; i < LEN; i++) {
+		if (out[i] != table[phase >> 24]) {
+			bad++;
+		}
+		phase += tuning;
+		if (i >= at && !switched && (phase >> 32)) {
+			table = to;
+			tuning = t_to;
+			phase = 0;
+			switched = i + 1;
+		}
+		phase &= 0xffffffff;
+	}
+	check(bad == 0, "switch", f_from * 1000 + at, bad);
+	/* at the first wrap after at, so within one cycle of the old */
+	check(switched > at && switched <= at + SAMPLE_RATE / f_from + 1,
+	      "switch point", at, switched);
+}
+
+/* A second switch before the first was taken replaces it */
+static void test_replace(void)
+{
+	struct wavegen g;
+	uint32_t t = wavegen_tuning(1000, SAMPLE_RATE);
+	uint32_t i, bad = 0;
+
+	wavegen_init(&g, wavegen_sine, t);
+	wavegen_fill(&g, out, 10);
+	wavegen_set(&g, wavegen_square, t);
+	wavegen_fill(&g, out + 10, 10);
+	wavegen_set(&g, wavegen_triangle, t);
+	wavegen_fill(&g, out + 20, 81);
+
+	/* 100 samples a cycle, the square never shows */
+	for (i = 0; i < 100; i++) {
+		bad += out[i] != wavegen_sine[(uint32_t)(i * t) >> 24];
+	}
+	check(bad == 0, "old to the end", bad, 0);
+	check(out[100] == wavegen_triangle[0], "replaced", out[100],
+	      wavegen_triangle[0]);
+	check(g.table == wavegen_triangle && !g.pending, "replaced state",
+	      g.pending, 0);
+}
+
+/* Started silent, the first switch comes in at once */
+static void test_silent(void)
+{
+	struct wavegen g;
+	uint32_t i, bad = 0;
+
+	wavegen_init(&g, wavegen_sine, 0);
+	wavegen_fill(&g, out, 256);
+	for (i = 0; i < 256; i++) {
+		bad += out[i] != 2048;
+	}
+	check(bad == 0, "silent at mid scale", bad, 0);
+	wavegen_set(&g, wavegen_triangle, wavegen_tuning(500, SAMPLE_RATE));
+	wavegen_fill(&g, out, 256);
+	check(out[0] == wavegen_triangle[0] && out[100] ==
+	      wavegen_triangle[(uint32_t)(100ULL *
+			       wavegen_tuning(500, SAMPLE_RATE)) >> 24],
+	      "silent switch", out[0], out[100]);
+}
+
+int main(void)
+{
+	static const uint32_t at[] = { 1, 50, 99, 100, 101, 12345 };
+	uint32_t i;
+
+	wavegen_make_tables();
+	test_tables();
+	test_tuning();
+
+	/* the presets of dac-dma.c */
+	test_stream(wavegen_sine, 1000, "sine 1000");
+	test_stream(wavegen_square, 1000, "square 1000");
+	test_stream(wavegen_triangle, 500, "triangle 500");
+	test_stream(wavegen_sine, 5000, "sine 5000");
+	test_stream(wavegen_sine, 7, "sine 7");
+	test_stream(wavegen_sine, 33333, "sine 33333");
+
+	for (i = 0; i < sizeof(at) / sizeof(at[0]); i++) {
+		test_switch(wavegen_sine, 1000, wavegen_square, 1000, at[i],
+			    128);
+		test_switch(wavegen_square, 1000, wavegen_triangle, 500,
+			    at[i], 7);
+		test_switch(wavegen_triangle, 500, wavegen_sine, 5000, at[i],
+			    1);
+		test_switch(wavegen_sine, 5000, wavegen_sine, 1000, at[i],
+			    128);
+	}
+	test_replace();
+	test_silent();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
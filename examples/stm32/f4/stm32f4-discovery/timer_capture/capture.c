@@ -0,0 +1,253 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Period, duty cycle and jitter from input capture blocks, and the
+ * prescaler to capture them with. No hardware access, so capture_host.c
+ * can check it on a PC.
+ *
+ * The DMA leaves a period and a high time for every cycle of the input
+ * in a buffer, and capture_block() folds whatever part of it has filled
+ * since the last call into the statistics: a handful of instructions
+ * per period, so signals up to what the DMA can keep up with can be
+ * measured without an interrupt per edge.
+ */
+
+#include "capture.h"
+
+void capture_clear(struct capture_stats *s, uint32_t div)
+{
+	s->div = div;
+	s->n = 0;
+	s->dropped = 0;
+	s->min = 0;
+	s->max = 0;
+	s->sum = 0;
+	s->high_sum = 0;
+	s->ref = 0;
+	s->dev_sum = 0;
+	s->dev_sq = 0;
+	s->last = 0;
+	s->c2c_max = 0;
+}
+
+/*
+ * capture_block
+ *
+ * Add n samples. The squared deviations are taken from the first period
+ * seen, not from the mean, so blocks of any size add up to the same
+ * result as one big block. They stay well inside 64 bits as long as the
+ * counter does not go past 24 bits; a signal wild enough to fill them
+ * anyway saturates the sum rather than wrapping it.
+ */
+void capture_block(struct capture_stats *s, const struct capture_sample *buf,
+		   int n)
+{
+	uint32_t count = s->n, min = s->min, max = s->max;
+	uint32_t last = s->last, c2c_max = s->c2c_max, ref = s->ref;
+	uint64_t sum = s->sum, high_sum = s->high_sum, dev_sq = s->dev_sq;
+	uint64_t sq;
+	int64_t dev_sum = s->dev_sum, d;
+	uint32_t p, c;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		p = buf[i].period;
+
+		/*
+		 * No period is 0 counts, and no high time is longer than
+		 * its period: the counter wrapped, or the DMA fell behind.
+		 */
+		if (p == 0 || buf[i].high > p) {
+			s->dropped++;
+			continue;
+		}
+
+		if (count == 0) {
+			ref = min = max = last = p;
+		}
+		if (p < min) {
+			min = p;
+		}
+		if (p > max) {
+			max = p;
+		}
+		sum += p;
+		high_sum += buf[i].high;
+
+		d = (int64_t)p - ref;
+		dev_sum += d;
+		sq = (d < 0) ? (uint64_t)-d : (uint64_t)d;
+		sq *= sq;
+		dev_sq = (dev_sq + sq < dev_sq) ? UINT64_MAX : dev_sq + sq;
+
+		c = (p > last) ? p - last : last - p;
+		if (c > c2c_max) {
+			c2c_max = c;
+		}
+		last = p;
+		count++;
+	}
+
+	s->n = count;
+	s->min = min;
+	s->max = max;
+	s->last = last;
+	s->c2c_max = c2c_max;
+	s->ref = ref;
+	s->sum = sum;
+	s->high_sum = high_sum;
+	s->dev_sum = dev_sum;
+	s->dev_sq = dev_sq;
+}
+
+/* Mean frequency in millihertz, from the timer's input clock */
+uint64_t capture_freq_mhz(const struct capture_stats *s, uint32_t clk_hz)
+{
+	if (s->sum == 0) {
+		return 0;
+	}
+	return (uint64_t)clk_hz * 1000 * s->n / (s->sum * s->div);
+}
+
+/* Duty cycle in hundredths of a percent */
+uint32_t capture_duty(const struct capture_stats *s)
+{
+	if (s->sum == 0) {
+		return 0;
+	}
+	return s->high_sum * 10000 / s->sum;
+}
+
+static uint64_t isqrt(uint64_t x)
+{
+	uint64_t r = 0, bit = 1ULL << 62;
+
+	while (bit > x) {
+		bit >>= 2;
+	}
+	while (bit) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+/*
+ * capture_jitter
+ *
+ * Standard deviation of the period, in 1/256 counts. With q the integer
+ * part of the mean deviation and r what is left over, the squared
+ * deviations from the mean are
+ *
+ *	sum(d^2) - q * (sum(d) + r) - r^2 / n
+ *
+ * which needs nothing bigger than sum(d^2) itself.
+ */
+uint64_t capture_jitter(const struct capture_stats *s)
+{
+	int64_t q, r;
+	uint64_t sq, m;
+
+	if (s->n == 0) {
+		return 0;
+	}
+	if (s->dev_sq == UINT64_MAX) {
+		return UINT64_MAX;
+	}
+
+	q = s->dev_sum / (int64_t)s->n;
+	r = s->dev_sum - q * (int64_t)s->n;
+	m = (uint64_t)(q * (s->dev_sum + r)) +
+	    (uint64_t)(r * r) / s->n;
+	sq = (s->dev_sq > m) ? s->dev_sq - m : 0;
+
+	if (sq < (1ULL << 48)) {
+		return isqrt((sq << 16) / s->n);
+	}
+	return isqrt(sq / s->n) << 8;
+}
+
+/*
+ * capture_ps
+ *
+ * Counts, in 1/256, to picoseconds. That is counts256 * div * 10^12 /
+ * 256 / clk_hz, split into whole and part seconds so no step overflows.
+ */
+uint64_t capture_ps(uint64_t counts256, uint32_t div, uint32_t clk_hz)
+{
+	const uint64_t k = 1000000000000ULL / 256;
+	uint64_t c = counts256 * div;
+
+	return c / clk_hz * k + c % clk_hz * k / clk_hz;
+}
+
+void capture_range_init(struct capture_range *r, uint32_t top,
+			uint32_t max_div)
+{
+	r->top = top;
+	r->max_div = max_div;
+	r->div = 1;
+}
+
+/*
+ * capture_autorange
+ *
+ * Pick the prescaler for what comes next. If the counter wrapped before
+ * an edge came, the signal is slower than the range: divide by four more
+ * and look again. Otherwise, once the longest period is past three
+ * quarters of the counter, or below an eighth of it with a prescaler
+ * that could come down, move it to half way. The gap between those
+ * keeps the prescaler from hopping about with the signal's own wander.
+ *
+ * Stats from another prescaler than the current one are ignored. Returns
+ * true if r->div changed.
+ */
+bool capture_autorange(struct capture_range *r, const struct capture_stats *s,
+		       uint32_t overflows)
+{
+	uint64_t div;
+
+	if (overflows) {
+		div = (uint64_t)r->div * 4;
+	} else if (s->n == 0 || s->div != r->div) {
+		return false;
+	} else if (s->max > r->top / 4 * 3 ||
+		   (s->max < r->top / 8 && r->div > 1)) {
+		div = ((uint64_t)s->max * r->div + r->top / 2 - 1) /
+		      (r->top / 2);
+	} else {
+		return false;
+	}
+
+	if (div < 1) {
+		div = 1;
+	}
+	if (div > r->max_div) {
+		div = r->max_div;
+	}
+	if (div == r->div) {
+		return false;
+	}
+	r->div = div;
+	return true;
+}
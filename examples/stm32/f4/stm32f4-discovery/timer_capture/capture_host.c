@@ -0,0 +1,286 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks capture.c on the host:
+ *
+ *	cc -o capture_host capture_host.c capture.c -lm
+ *	./capture_host
+ *
+ * The statistics are compared with the same figures worked out in
+ * doubles, for steady, jittery and drifting signals cut into blocks of
+ * every size; and the auto-ranging is run against a model of the timer
+ * for periods from a few counts to minutes, to see it settle in range,
+ * quickly, and then stay put.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "capture.h"
+
+#define CLK_HZ		72000000
+#define SAMPLES		5000
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+static uint32_t seed = 1;
+
+static uint32_t lcg(void)
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+/* Roughly normal, mean 0 and standard deviation 1 */
+static double noise(void)
+{
+	double x = 0;
+	int i;
+
+	for (i = 0; i < 12; i++) {
+		x += (lcg() & 0xffff) / 65536.0;
+	}
+	return x - 6;
+}
+
+static struct capture_sample buf[SAMPLES];
+
+static void make(double period, double sigma, double drift, double duty,
+		 uint32_t top)
+{
+	double p;
+	int i;
+
+	for (i = 0; i < SAMPLES; i++) {
+		p = period + drift * i + sigma * noise();
+		if (p < 1) {
+			p = 1;
+		}
+		if (p > top) {
+			p = top;
+		}
+		buf[i].period = lround(p);
+		buf[i].high = buf[i].period * duty;
+	}
+}
+
+/* Everything capture.c works out, the slow way */
+static void compare(const char *what, int block, uint32_t div)
+{
+	struct capture_stats s;
+	double sum = 0, high = 0, sq = 0, mean, sd, want;
+	uint32_t min = UINT32_MAX, max = 0, c2c = 0;
+	int i, n;
+
+	capture_clear(&s, div);
+	for (i = 0; i < SAMPLES; i += n) {
+		n = (block > 0) ? block : 1 + (int)(lcg() % 300);
+		if (n > SAMPLES - i) {
+			n = SAMPLES - i;
+		}
+		capture_block(&s, buf + i, n);
+	}
+
+	for (i = 0; i < SAMPLES; i++) {
+		sum += buf[i].period;
+		high += buf[i].high;
+		if (buf[i].period < min) {
+			min = buf[i].period;
+		}
+		if (buf[i].period > max) {
+			max = buf[i].period;
+		}
+		if (i > 0 && abs((int)buf[i].period - (int)buf[i - 1].period) >
+		    (int)c2c) {
+			c2c = abs((int)buf[i].period - (int)buf[i - 1].period);
+		}
+	}
+	mean = sum / SAMPLES;
+	for (i = 0; i < SAMPLES; i++) {
+		sq += (buf[i].period - mean) * (buf[i].period - mean);
+	}
+	sd = sqrt(sq / SAMPLES);
+
+	check(s.n == SAMPLES && s.dropped == 0, what, s.n, s.dropped);
+	check(s.min == min && s.max == max, what, s.min, s.max);
+	check(s.c2c_max == c2c, what, s.c2c_max, c2c);
+
+	want = 1000.0 * CLK_HZ / div / mean;
+	check(fabs(capture_freq_mhz(&s, CLK_HZ) - want) <= 1, what,
+	      capture_freq_mhz(&s, CLK_HZ), want);
+	want = 10000 * high / sum;
+	check(fabs(capture_duty(&s) - want) <= 1, what, capture_duty(&s),
+	      want);
+	want = sd * 256;
+	check(fabs(capture_jitter(&s) - want) <= 1 + want / 10000, what,
+	      capture_jitter(&s), want);
+	want = sd * div * 1e12 / CLK_HZ;
+	check(fabs(capture_ps(capture_jitter(&s), div, CLK_HZ) - want) <=
+	      1e12 / CLK_HZ * div / 256 + want / 10000, what,
+	      capture_ps(capture_jitter(&s), div, CLK_HZ), want);
+}
+
+static void test_stats(void)
+{
+	static const int blocks[] = { 1, 7, 256, SAMPLES, 0 };
+	struct capture_stats s;
+	unsigned b;
+
+	for (b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+		make(1000, 0, 0, 0.25, 0xffff);
+		compare("steady", blocks[b], 1);
+		make(72, 0.4, 0, 0.5, 0xffff);
+		compare("fast", blocks[b], 1);
+		make(40000, 30, 0, 0.1, 0xffff);
+		compare("jitter", blocks[b], 3);
+		make(20000, 5, 2, 0.9, 0xffff);
+		compare("drift", blocks[b], 157);
+		make(8000000, 2000, 0, 0.5, 0xffffff);
+		compare("24 bit", blocks[b], 65536);
+	}
+
+	/* A steady signal has no jitter at all */
+	make(1000, 0, 0, 0.25, 0xffff);
+	capture_clear(&s, 1);
+	capture_block(&s, buf, SAMPLES);
+	check(capture_jitter(&s) == 0, "no jitter", capture_jitter(&s), 0);
+	check(capture_duty(&s) == 2500, "duty", capture_duty(&s), 2500);
+	check(capture_freq_mhz(&s, CLK_HZ) == 72000000, "freq",
+	      capture_freq_mhz(&s, CLK_HZ), 72000000);
+
+	/* Nonsense is counted and left out */
+	buf[10].period = 0;
+	buf[20].high = buf[20].period + 1;
+	capture_clear(&s, 1);
+	capture_block(&s, buf, 100);
+	check(s.n == 98 && s.dropped == 2, "dropped", s.n, s.dropped);
+	check(capture_jitter(&s) == 0, "dropped jitter", capture_jitter(&s),
+	      0);
+
+	/* Nothing at all */
+	capture_clear(&s, 1);
+	check(capture_freq_mhz(&s, CLK_HZ) == 0 && capture_duty(&s) == 0 &&
+	      capture_jitter(&s) == 0, "empty", 0, 0);
+
+	/* Far beyond 24 bits saturates rather than wrapping */
+	buf[0].period = 1;
+	buf[1].period = 0xffffffff;
+	buf[0].high = buf[1].high = 0;
+	capture_clear(&s, 1);
+	capture_block(&s, buf, 2);
+	capture_block(&s, buf + 1, 1);
+	capture_block(&s, buf + 1, 1);
+	capture_block(&s, buf + 1, 1);
+	check(capture_jitter(&s) == UINT64_MAX, "saturate", 0, 0);
+}
+
+/*
+ * The timer in PWM input mode: periods past the top wrap the counter
+ * instead of being captured. Returns the steps it took to settle.
+ */
+static int settle(struct capture_range *r, double cycles, double wander)
+{
+	struct capture_stats s;
+	double counts;
+	uint32_t overflows;
+	int step, i, changes = 0, last = 0;
+
+	capture_range_init(r, r->top, r->max_div);
+	for (step = 0; step < 40; step++) {
+		capture_clear(&s, r->div);
+		overflows = 0;
+		for (i = 0; i < 64; i++) {
+			counts = cycles * (1 + wander * noise()) / r->div;
+			if (counts > r->top) {
+				overflows++;
+				continue;
+			}
+			buf[i].period = (counts < 1) ? 1 : lround(counts);
+			buf[i].high = buf[i].period / 2;
+			capture_block(&s, buf + i, 1);
+		}
+		if (capture_autorange(r, &s, overflows)) {
+			changes++;
+			last = step + 1;
+		}
+	}
+	check(changes <= 8, "changes", cycles, changes);
+	return last;
+}
+
+static void test_range(uint32_t top)
+{
+	struct capture_range r = { .top = top, .max_div = 65536 };
+	double cycles, counts;
+	int steps, worst = 0;
+
+	for (cycles = 10; cycles < 1e11; cycles *= 1.07) {
+		steps = settle(&r, cycles, 0.01);
+		if (steps > worst) {
+			worst = steps;
+		}
+		counts = cycles / r.div;
+		if (cycles > (double)top * r.max_div) {
+			/* Slower than the slowest range: as slow as it goes */
+			check(r.div == r.max_div, "slowest", cycles, r.div);
+		} else if (r.div == 1) {
+			check(counts <= top * 0.75, "fast", cycles, counts);
+		} else if (r.div == r.max_div) {
+			check(counts >= top / 8.0, "slow", cycles, counts);
+		} else {
+			check(counts >= top / 8.0 && counts <= top * 0.8,
+			      "in range", cycles, counts);
+		}
+	}
+	check(worst <= 10, "settle", top, worst);
+	printf("top %#lx: settles within %d blocks\n", (long)top, worst);
+
+	/* Stats from before a change count for nothing */
+	{
+		struct capture_stats s;
+
+		capture_range_init(&r, top, 65536);
+		capture_clear(&s, 4);
+		buf[0].period = top;
+		buf[0].high = 0;
+		capture_block(&s, buf, 1);
+		check(!capture_autorange(&r, &s, 0), "stale", r.div, 4);
+	}
+}
+
+int main(void)
+{
+	test_stats();
+	test_range(0xffff);
+	test_range(0xffffff);
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -25,6 +25,11 @@
 #include <libopencm3/stm32/desig.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
+
+#include "input.h"
 
 /*
  * All references in this file come from Universal Serial Bus Device Class
@@ -345,19 +350,78 @@ static void button_send_event(usbd_device *usbd_dev, int pressed)
 	while (usbd_ep_write_packet(usbd_dev, 0x81, buf, sizeof(buf)) == 0);
 }
 
+/*
+ * The button goes through input.c. EXTI0 stamps each edge on PA0 with
+ * TIM2's count, 32 bits at 10kHz, and starts a 1ms tick on TIM2's
+ * channel 1 that debounces the edges into press and release events. The
+ * tick stops again once the button has settled, so between presses the
+ * button costs no time at all.
+ */
+#define CLOCK_HZ	10000
+#define TICK		(CLOCK_HZ / 1000)
+#define DEBOUNCE	(10 * TICK)
+
+static struct input button;
+
+static void button_setup(void)
+{
+	rcc_periph_clock_enable(RCC_SYSCFG);
+	rcc_periph_clock_enable(RCC_TIM2);
+
+	input_init(&button, DEBOUNCE);
+	input_add(&button, 0, 0);
+
+	/* TIM2 is on APB1, and runs at twice its frequency. */
+	timer_set_prescaler(TIM2, rcc_apb1_frequency * 2 / CLOCK_HZ - 1);
+	timer_set_period(TIM2, 0xffffffff);
+	/* The prescaler only loads on an update, make one now */
+	timer_generate_event(TIM2, TIM_EGR_UG);
+	timer_clear_flag(TIM2, TIM_SR_UIF);
+	timer_enable_counter(TIM2);
+
+	exti_select_source(EXTI0, GPIOA);
+	exti_set_trigger(EXTI0, EXTI_TRIGGER_BOTH);
+	exti_enable_request(EXTI0);
+
+	/* The edges and the tick must not interrupt each other. */
+	nvic_set_priority(NVIC_EXTI0_IRQ, 1 << 4);
+	nvic_set_priority(NVIC_TIM2_IRQ, 1 << 4);
+	nvic_enable_irq(NVIC_EXTI0_IRQ);
+	nvic_enable_irq(NVIC_TIM2_IRQ);
+}
+
+void exti0_isr(void)
+{
+	exti_reset_request(EXTI0);
+	input_edge(&button, 0, timer_get_counter(TIM2));
+
+	if (!(TIM_DIER(TIM2) & TIM_DIER_CC1IE)) {
+		timer_set_oc_value(TIM2, TIM_OC1,
+				   timer_get_counter(TIM2) + TICK);
+		timer_clear_flag(TIM2, TIM_SR_CC1IF);
+		timer_enable_irq(TIM2, TIM_DIER_CC1IE);
+	}
+}
+
+void tim2_isr(void)
+{
+	if (timer_get_flag(TIM2, TIM_SR_CC1IF)) {
+		timer_clear_flag(TIM2, TIM_SR_CC1IF);
+		timer_set_oc_value(TIM2, TIM_OC1, TIM2_CCR1 + TICK);
+		/* The button is down when PA0 is high. */
+		if (!input_tick(&button, timer_get_counter(TIM2),
+				GPIOA_IDR & 1)) {
+			timer_disable_irq(TIM2, TIM_DIER_CC1IE);
+		}
+	}
+}
+
 static void button_poll(usbd_device *usbd_dev)
 {
-	static uint32_t button_state = 0;
+	struct input_event ev;
 
-	/* This is a simple shift based debounce. It's simplistic because
-	 * although this implements debounce adequately it does not have any
-	 * noise suppression. It is also very wide (32-bits) because it can
-	 * be polled in a very tight loop (no debounce timer).
-	 */
-	uint32_t old_button_state = button_state;
-	button_state = (button_state << 1) | (GPIOA_IDR & 1);
-	if ((0 == button_state) != (0 == old_button_state)) {
-		button_send_event(usbd_dev, !!button_state);
+	while (input_get(&button, &ev)) {
+		button_send_event(usbd_dev, ev.type == INPUT_PRESS);
 	}
 }
 
@@ -378,6 +442,7 @@ int main(void)
 
 	/* Button pin */
 	gpio_mode_setup(GPIOA, GPIO_MODE_INPUT, GPIO_PUPD_NONE, GPIO0);
+	button_setup();
 
 	usbd_dev = usbd_init(&otgfs_usb_driver, &dev, &config,
 			usb_strings, 3,
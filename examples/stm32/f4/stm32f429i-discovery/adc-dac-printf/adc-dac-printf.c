@@ -22,17 +22,37 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
 #include <libopencm3/stm32/adc.h>
 #include <libopencm3/stm32/dac.h>
+#include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/usart.h>
 
+#include "stream.h"
+
 #define LED_DISCO_GREEN_PORT GPIOG
 #define LED_DISCO_GREEN_PIN GPIO13
 
 #define USART_CONSOLE USART1
 
+/* TIM2 is on the 42MHz APB1, timers there run at twice that */
+#define TIM2_CLOCK	84000000
+#define SAMPLE_RATE	48000
+
+/*
+ * Samples per block. The output is two blocks behind the input and each
+ * block has one block period to be processed in, so smaller blocks mean
+ * less latency but more interrupts.
+ */
+#define BLOCK		32
+
+static uint16_t adc_buf[2 * BLOCK];
+static uint16_t dac_buf[2 * BLOCK];
+static struct stream stream;
+
 int _write(int file, char *ptr, int len);
 
 static void clock_setup(void)
@@ -48,6 +68,13 @@ static void clock_setup(void)
 
 	/* And ADC*/
 	rcc_periph_clock_enable(RCC_ADC1);
+
+	/* The timer that paces both, and the DMA for each */
+	rcc_periph_clock_enable(RCC_TIM2);
+	rcc_periph_clock_enable(RCC_DMA1);
+	rcc_periph_clock_enable(RCC_DMA2);
+
+	dwt_enable_cycle_counter();
 }
 
 static void usart_setup(void)
@@ -94,17 +121,62 @@ int _write(int file, char *ptr, int len)
 	return -1;
 }
 
+/*
+ * TIM2 update events start every ADC conversion and load every DAC
+ * sample, so both sides run in lock step. Returns the real sample rate.
+ */
+static uint32_t timer_setup(uint32_t rate)
+{
+	uint32_t period = (TIM2_CLOCK + rate / 2) / rate;
+
+	rcc_periph_reset_pulse(RST_TIM2);
+	timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT,
+		       TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_set_period(TIM2, period - 1);
+	timer_set_master_mode(TIM2, TIM_CR2_MMS_UPDATE);
+
+	return TIM2_CLOCK / period;
+}
+
 static void adc_setup(void)
 {
+	uint8_t channel_array[1] = { 0 };
+
 	gpio_mode_setup(GPIOA, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, GPIO0);
-	gpio_mode_setup(GPIOA, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, GPIO1);
 
 	adc_power_off(ADC1);
 	adc_disable_scan_mode(ADC1);
+	adc_set_single_conversion_mode(ADC1);
 	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_3CYC);
+	adc_set_regular_sequence(ADC1, 1, channel_array);
+	adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM2_TRGO,
+					    ADC_CR2_EXTEN_RISING_EDGE);
+	/* Keep requesting DMA after the first round of the buffer */
+	adc_set_dma_continue(ADC1);
+	adc_enable_dma(ADC1);
 
 	adc_power_on(ADC1);
 
+	/* ADC1 is on DMA2 Stream 0 Channel 0 */
+	dma_stream_reset(DMA2, DMA_STREAM0);
+	dma_channel_select(DMA2, DMA_STREAM0, DMA_SxCR_CHSEL_0);
+	dma_set_peripheral_address(DMA2, DMA_STREAM0, (uint32_t) &ADC_DR(ADC1));
+	dma_set_memory_address(DMA2, DMA_STREAM0, (uint32_t) adc_buf);
+	dma_set_number_of_data(DMA2, DMA_STREAM0, 2 * BLOCK);
+	dma_set_transfer_mode(DMA2, DMA_STREAM0,
+			      DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+	dma_enable_memory_increment_mode(DMA2, DMA_STREAM0);
+	dma_set_peripheral_size(DMA2, DMA_STREAM0, DMA_SxCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA2, DMA_STREAM0, DMA_SxCR_MSIZE_16BIT);
+	dma_set_priority(DMA2, DMA_STREAM0, DMA_SxCR_PL_HIGH);
+	dma_enable_circular_mode(DMA2, DMA_STREAM0);
+	dma_enable_half_transfer_interrupt(DMA2, DMA_STREAM0);
+	dma_enable_transfer_complete_interrupt(DMA2, DMA_STREAM0);
+	dma_enable_stream(DMA2, DMA_STREAM0);
+
+	/* Processing runs in here, let the output interrupt cut in */
+	nvic_set_priority(NVIC_DMA2_STREAM0_IRQ, 0x80);
+	nvic_enable_irq(NVIC_DMA2_STREAM0_IRQ);
 }
 
 static void dac_setup(void)
@@ -112,50 +184,136 @@ static void dac_setup(void)
 	gpio_mode_setup(GPIOA, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, GPIO5);
 	dac_disable(CHANNEL_2);
 	dac_disable_waveform_generation(CHANNEL_2);
+	dac_set_trigger_source(DAC_CR_TSEL2_T2);
+	dac_trigger_enable(CHANNEL_2);
+	dac_dma_enable(CHANNEL_2);
 	dac_enable(CHANNEL_2);
-	dac_set_trigger_source(DAC_CR_TSEL2_SW);
+
+	/* DAC channel 2 is on DMA1 Stream 6 Channel 7 */
+	dma_stream_reset(DMA1, DMA_STREAM6);
+	dma_channel_select(DMA1, DMA_STREAM6, DMA_SxCR_CHSEL_7);
+	dma_set_peripheral_address(DMA1, DMA_STREAM6, (uint32_t) &DAC_DHR12R2);
+	dma_set_memory_address(DMA1, DMA_STREAM6, (uint32_t) dac_buf);
+	dma_set_number_of_data(DMA1, DMA_STREAM6, 2 * BLOCK);
+	dma_set_transfer_mode(DMA1, DMA_STREAM6,
+			      DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+	dma_enable_memory_increment_mode(DMA1, DMA_STREAM6);
+	dma_set_peripheral_size(DMA1, DMA_STREAM6, DMA_SxCR_PSIZE_16BIT);
+	dma_set_memory_size(DMA1, DMA_STREAM6, DMA_SxCR_MSIZE_16BIT);
+	dma_set_priority(DMA1, DMA_STREAM6, DMA_SxCR_PL_HIGH);
+	dma_enable_circular_mode(DMA1, DMA_STREAM6);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_STREAM6);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_STREAM6);
+	dma_enable_stream(DMA1, DMA_STREAM6);
+
+	/* Only takes a time stamp, so it may interrupt the processing */
+	nvic_set_priority(NVIC_DMA1_STREAM6_IRQ, 0x40);
+	nvic_enable_irq(NVIC_DMA1_STREAM6_IRQ);
 }
 
-static uint16_t read_adc_naiive(uint8_t channel)
+/* Input half done */
+void dma2_stream0_isr(void)
 {
-	uint8_t channel_array[16];
-	channel_array[0] = channel;
-	adc_set_regular_sequence(ADC1, 1, channel_array);
-	adc_start_conversion_regular(ADC1);
-	while (!adc_eoc(ADC1));
-	uint16_t reg16 = adc_read_regular(ADC1);
-	return reg16;
+	if (dma_get_interrupt_flag(DMA2, DMA_STREAM0, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA2, DMA_STREAM0, DMA_HTIF);
+		stream_input_done(&stream);
+	}
+	if (dma_get_interrupt_flag(DMA2, DMA_STREAM0, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA2, DMA_STREAM0, DMA_TCIF);
+		stream_input_done(&stream);
+	}
+}
+
+/* Output half started */
+void dma1_stream6_isr(void)
+{
+	if (dma_get_interrupt_flag(DMA1, DMA_STREAM6, DMA_HTIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_STREAM6, DMA_HTIF);
+		stream_output_started(&stream);
+	}
+	if (dma_get_interrupt_flag(DMA1, DMA_STREAM6, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_STREAM6, DMA_TCIF);
+		stream_output_started(&stream);
+	}
+}
+
+/*
+ * The processing, as before the DAC gets half of what the ADC read. Runs
+ * from the input DMA interrupt.
+ */
+static void process(const uint16_t *in, uint16_t *out, uint32_t n,
+		    void *priv)
+{
+	uint32_t i;
+
+	(void)priv;
+	for (i = 0; i < n; i++) {
+		out[i] = in[i] / 2;
+	}
+}
+
+static uint32_t cycles(void)
+{
+	return dwt_read_cycle_counter();
+}
+
+static uint32_t cycles_to_us(uint32_t c)
+{
+	return c / (rcc_ahb_frequency / 1000000);
 }
 
 int main(void)
 {
+	struct stream_stats st;
+	uint32_t rate, last_blocks = 0, headroom;
 	int i;
-	int j = 0;
+
 	clock_setup();
 	usart_setup();
 	printf("hi guys!\n");
-	adc_setup();
-	dac_setup();
 
 	/* green led for ticking */
 	gpio_mode_setup(LED_DISCO_GREEN_PORT, GPIO_MODE_OUTPUT, GPIO_PUPD_NONE,
 			LED_DISCO_GREEN_PIN);
 
-	while (1) {
-		uint16_t input_adc0 = read_adc_naiive(0);
-		uint16_t target = input_adc0 / 2;
-		dac_load_data_buffer_single(target, RIGHT12, CHANNEL_2);
-		dac_software_trigger(CHANNEL_2);
-		uint16_t input_adc1 = read_adc_naiive(1);
-		printf("tick: %d: adc0= %u, target adc1=%d, adc1=%d\n",
-			j++, input_adc0, target, input_adc1);
+	stream_init(&stream, adc_buf, dac_buf, BLOCK, process, NULL, cycles);
+	rate = timer_setup(SAMPLE_RATE);
+	adc_setup();
+	dac_setup();
 
-		/* LED on/off */
-		gpio_toggle(LED_DISCO_GREEN_PORT, LED_DISCO_GREEN_PIN);
+	printf("%lu samples/s, blocks of %d, expect %lu us latency\n",
+	       rate, BLOCK, 2 * BLOCK * 1000000 / rate);
+
+	/* Both DMA streams are armed, go */
+	timer_enable_counter(TIM2);
 
-		for (i = 0; i < 1000000; i++) { /* Wait a bit. */
+	while (1) {
+		for (i = 0; i < 16800000; i++) { /* Wait a bit. */
 			__asm__("NOP");
 		}
+
+		nvic_disable_irq(NVIC_DMA2_STREAM0_IRQ);
+		nvic_disable_irq(NVIC_DMA1_STREAM6_IRQ);
+		stream_get_stats(&stream, &st);
+		nvic_enable_irq(NVIC_DMA1_STREAM6_IRQ);
+		nvic_enable_irq(NVIC_DMA2_STREAM0_IRQ);
+
+		headroom = 0;
+		if (st.proc_max < st.period) {
+			headroom = 100 - 100 * st.proc_max / st.period;
+		}
+		printf("blocks %lu (+%lu), latency %lu us (%lu..%lu), "
+		       "processing %lu us (max %lu, headroom %lu%%), late %lu\n",
+		       st.blocks, st.blocks - last_blocks,
+		       cycles_to_us(st.latency_last),
+		       cycles_to_us(st.latency_min),
+		       cycles_to_us(st.latency_max),
+		       cycles_to_us(st.proc_last), cycles_to_us(st.proc_max),
+		       headroom, st.late);
+		last_blocks = st.blocks;
+
+		/* LED on/off */
+		gpio_toggle(LED_DISCO_GREEN_PORT, LED_DISCO_GREEN_PIN);
 	}
 
 	return 0;
@@ -0,0 +1,224 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * L3GD20 gyro on SPI5, CS on PC1 and data ready (INT2) on PA2.
+ *
+ * The data ready edge starts a burst read of all outputs in one chip
+ * select cycle, clocked by DMA2 stream 4 (tx) into stream 3 (rx), both
+ * on channel 2 which is where SPI5 is mapped on the F42x. The
+ * rx complete interrupt decodes the burst into a sample FIFO that the
+ * main loop reads at its own pace. The CPU only runs two short
+ * interrupts per sample.
+ */
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "l3gd20.h"
+
+/* Must be a power of two */
+#define SAMPLE_FIFO	32
+
+#define DMA_ALL_FLAGS	(DMA_TCIF | DMA_HTIF | DMA_TEIF | DMA_DMEIF | DMA_FEIF)
+
+static const uint8_t burst_tx[L3GD20_BURST_LEN] = {
+	GYR_OUT_TEMP | GYR_RNW | GYR_MNS,
+};
+static uint8_t burst_rx[L3GD20_BURST_LEN];
+static volatile bool busy;
+static uint32_t burst_time;
+
+static struct l3gd20_sample fifo[SAMPLE_FIFO];
+static volatile uint32_t fifo_head, fifo_tail;
+static struct l3gd20_stats stats;
+
+static void l3gd20_write(uint8_t reg, uint8_t value)
+{
+	gpio_clear(GPIOC, GPIO1);
+	spi_send(SPI5, reg);
+	(void) spi_read(SPI5);
+	spi_send(SPI5, value);
+	(void) spi_read(SPI5);
+	gpio_set(GPIOC, GPIO1);
+}
+
+/* Start a burst read, unless one is already running. */
+static void l3gd20_kick(void)
+{
+	if (busy) {
+		return;
+	}
+	busy = true;
+	burst_time = dwt_read_cycle_counter();
+
+	gpio_clear(GPIOC, GPIO1);
+	dma_set_number_of_data(DMA2, DMA_STREAM3, L3GD20_BURST_LEN);
+	dma_set_number_of_data(DMA2, DMA_STREAM4, L3GD20_BURST_LEN);
+	dma_enable_stream(DMA2, DMA_STREAM3);
+	dma_enable_stream(DMA2, DMA_STREAM4);
+}
+
+/* Data ready */
+void exti2_isr(void)
+{
+	exti_reset_request(EXTI2);
+	l3gd20_kick();
+}
+
+/* Burst received */
+void dma2_stream3_isr(void)
+{
+	uint32_t head = fifo_head;
+
+	if (!dma_get_interrupt_flag(DMA2, DMA_STREAM3, DMA_TCIF)) {
+		return;
+	}
+	/*
+	 * Both streams disable themselves when done, but all their flags
+	 * must be clear before they can be enabled again.
+	 */
+	dma_clear_interrupt_flags(DMA2, DMA_STREAM3, DMA_ALL_FLAGS);
+	dma_clear_interrupt_flags(DMA2, DMA_STREAM4, DMA_ALL_FLAGS);
+	gpio_set(GPIOC, GPIO1);
+
+	stats.samples++;
+	if (burst_rx[2] & GYR_STATUS_ZYXOR) {
+		stats.overruns++;
+	}
+	if (head - fifo_tail < SAMPLE_FIFO) {
+		l3gd20_decode(burst_rx, burst_time, &fifo[head % SAMPLE_FIFO]);
+		fifo_head = head + 1;
+	} else {
+		stats.dropped++;
+	}
+	busy = false;
+
+	/*
+	 * If new data arrived while we were reading, the edge came while
+	 * we were busy and DRDY is simply still high.
+	 */
+	if (gpio_get(GPIOA, GPIO2)) {
+		l3gd20_kick();
+	}
+}
+
+static void l3gd20_dma_setup(void)
+{
+	rcc_periph_clock_enable(RCC_DMA2);
+
+	/* SPI5 RX on DMA2 Stream 3 Channel 2 */
+	dma_stream_reset(DMA2, DMA_STREAM3);
+	dma_channel_select(DMA2, DMA_STREAM3, DMA_SxCR_CHSEL_2);
+	dma_set_peripheral_address(DMA2, DMA_STREAM3, (uint32_t)&SPI5_DR);
+	dma_set_memory_address(DMA2, DMA_STREAM3, (uint32_t)burst_rx);
+	dma_set_transfer_mode(DMA2, DMA_STREAM3,
+			      DMA_SxCR_DIR_PERIPHERAL_TO_MEM);
+	dma_enable_memory_increment_mode(DMA2, DMA_STREAM3);
+	dma_set_peripheral_size(DMA2, DMA_STREAM3, DMA_SxCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA2, DMA_STREAM3, DMA_SxCR_MSIZE_8BIT);
+	dma_set_priority(DMA2, DMA_STREAM3, DMA_SxCR_PL_VERY_HIGH);
+	dma_enable_transfer_complete_interrupt(DMA2, DMA_STREAM3);
+
+	/* SPI5 TX on DMA2 Stream 4 Channel 2, the address then zeroes */
+	dma_stream_reset(DMA2, DMA_STREAM4);
+	dma_channel_select(DMA2, DMA_STREAM4, DMA_SxCR_CHSEL_2);
+	dma_set_peripheral_address(DMA2, DMA_STREAM4, (uint32_t)&SPI5_DR);
+	dma_set_memory_address(DMA2, DMA_STREAM4, (uint32_t)burst_tx);
+	dma_set_transfer_mode(DMA2, DMA_STREAM4,
+			      DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+	dma_enable_memory_increment_mode(DMA2, DMA_STREAM4);
+	dma_set_peripheral_size(DMA2, DMA_STREAM4, DMA_SxCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA2, DMA_STREAM4, DMA_SxCR_MSIZE_8BIT);
+	dma_set_priority(DMA2, DMA_STREAM4, DMA_SxCR_PL_HIGH);
+
+	nvic_enable_irq(NVIC_DMA2_STREAM3_IRQ);
+
+	spi_enable_rx_dma(SPI5);
+	spi_enable_tx_dma(SPI5);
+}
+
+static void l3gd20_exti_setup(void)
+{
+	rcc_periph_clock_enable(RCC_SYSCFG);
+
+	gpio_mode_setup(GPIOA, GPIO_MODE_INPUT, GPIO_PUPD_NONE, GPIO2);
+	exti_select_source(EXTI2, GPIOA);
+	exti_set_trigger(EXTI2, EXTI_TRIGGER_RISING);
+	exti_enable_request(EXTI2);
+}
+
+/*
+ * l3gd20_setup
+ *
+ * Expects SPI5 and the CS pin to be set up already. Configures the chip
+ * for 760Hz output and data ready on INT2, then hands over to DMA.
+ */
+void l3gd20_setup(void)
+{
+	dwt_enable_cycle_counter();
+
+	/* Polled writes, before the DMA takes over the SPI */
+	l3gd20_write(GYR_CTRL_REG1, GYR_CTRL_REG1_PD | GYR_CTRL_REG1_XEN |
+		     GYR_CTRL_REG1_YEN | GYR_CTRL_REG1_ZEN |
+		     (3 << GYR_CTRL_REG1_BW_SHIFT) |
+		     (3 << GYR_CTRL_REG1_DR_SHIFT));
+	l3gd20_write(GYR_CTRL_REG3, GYR_CTRL_REG3_I2_DRDY);
+	l3gd20_write(GYR_CTRL_REG4, (1 << GYR_CTRL_REG4_FS_SHIFT));
+
+	l3gd20_dma_setup();
+	l3gd20_exti_setup();
+
+	/*
+	 * DRDY may already be high, then there won't be an edge. Check
+	 * before the EXTI interrupt can race us, an edge in the meantime
+	 * stays pending.
+	 */
+	if (gpio_get(GPIOA, GPIO2)) {
+		l3gd20_kick();
+	}
+	nvic_enable_irq(NVIC_EXTI2_IRQ);
+}
+
+/*
+ * l3gd20_get
+ *
+ * Take the oldest sample from the FIFO, returns false if it is empty.
+ */
+bool l3gd20_get(struct l3gd20_sample *sample)
+{
+	uint32_t tail = fifo_tail;
+
+	if (tail == fifo_head) {
+		return false;
+	}
+	*sample = fifo[tail % SAMPLE_FIFO];
+	fifo_tail = tail + 1;
+	return true;
+}
+
+void l3gd20_get_stats(struct l3gd20_stats *out)
+{
+	nvic_disable_irq(NVIC_DMA2_STREAM3_IRQ);
+	*out = stats;
+	nvic_enable_irq(NVIC_DMA2_STREAM3_IRQ);
+}
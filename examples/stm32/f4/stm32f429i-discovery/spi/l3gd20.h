@@ -0,0 +1,72 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef L3GD20_H
+#define L3GD20_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GYR_RNW			(1 << 7) /* Write when zero */
+#define GYR_MNS			(1 << 6) /* Multiple reads when 1 */
+#define GYR_WHO_AM_I		0x0F
+#define GYR_OUT_TEMP		0x26
+#define GYR_STATUS_REG		0x27
+#define GYR_STATUS_ZYXDA	(1 << 3)
+#define GYR_STATUS_ZYXOR	(1 << 7)
+#define GYR_CTRL_REG1		0x20
+#define GYR_CTRL_REG1_PD	(1 << 3)
+#define GYR_CTRL_REG1_XEN	(1 << 1)
+#define GYR_CTRL_REG1_YEN	(1 << 0)
+#define GYR_CTRL_REG1_ZEN	(1 << 2)
+#define GYR_CTRL_REG1_BW_SHIFT	4
+#define GYR_CTRL_REG1_DR_SHIFT	6
+#define GYR_CTRL_REG3		0x22
+#define GYR_CTRL_REG3_I2_DRDY	(1 << 3)
+#define GYR_CTRL_REG4		0x23
+#define GYR_CTRL_REG4_FS_SHIFT	4
+
+#define GYR_OUT_X_L		0x28
+#define GYR_OUT_X_H		0x29
+
+/*
+ * One burst read starts at OUT_TEMP and auto increments through STATUS
+ * and the six output registers, the first byte clocked in is garbage
+ * from while the address went out.
+ */
+#define L3GD20_BURST_LEN	9
+
+struct l3gd20_sample {
+	uint32_t time;		/* DWT cycle count at data ready */
+	int16_t rate[3];	/* X, Y, Z raw */
+	int8_t temp;		/* OUT_TEMP raw */
+	uint8_t status;
+};
+
+struct l3gd20_stats {
+	uint32_t samples;	/* bursts read */
+	uint32_t dropped;	/* samples lost to a full FIFO */
+	uint32_t overruns;	/* the chip overwrote unread data */
+};
+
+void l3gd20_setup(void);
+bool l3gd20_get(struct l3gd20_sample *sample);
+void l3gd20_get_stats(struct l3gd20_stats *stats);
+void l3gd20_decode(const uint8_t *burst, uint32_t time,
+		   struct l3gd20_sample *sample);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Burst decoding, apart from l3gd20.c so l3gd20_host.c can check it on
+ * a PC.
+ */
+
+#include "l3gd20.h"
+
+/*
+ * l3gd20_decode
+ *
+ * Turn a raw burst into a sample, the outputs are little endian.
+ */
+void l3gd20_decode(const uint8_t *burst, uint32_t time,
+		   struct l3gd20_sample *sample)
+{
+	int i;
+
+	sample->time = time;
+	sample->temp = (int8_t)burst[1];
+	sample->status = burst[2];
+	for (i = 0; i < 3; i++) {
+		sample->rate[i] = (int16_t)(burst[3 + 2 * i] |
+					    (burst[4 + 2 * i] << 8));
+	}
+}
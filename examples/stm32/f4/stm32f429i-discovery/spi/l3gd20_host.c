@@ -0,0 +1,143 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks l3gd20_decode.c on the host:
+ *
+ *	cc -o l3gd20_host l3gd20_host.c l3gd20_decode.c
+ *	./l3gd20_host
+ *
+ * A model of the L3GD20 register file answers the burst command the
+ * way the chip does: nothing useful while the address byte goes out,
+ * then one register per byte, auto incrementing from OUT_TEMP when MS
+ * is set. Every output value of every axis, every temperature and
+ * status byte has to come back out of the decoded sample, with the
+ * sign and byte order right.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "l3gd20.h"
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+/* The chip: 0x00-0x3f, OUT_TEMP 0x26 through OUT_Z_H 0x2d */
+static uint8_t regs[0x40];
+
+/* Clock len bytes of tx through the chip with one chip select cycle */
+static void chip_burst(const uint8_t *tx, uint8_t *rx, int len)
+{
+	uint8_t addr = tx[0] & 0x3f;
+	int i;
+
+	check(tx[0] & GYR_RNW, "burst is a read", tx[0], 0);
+	rx[0] = 0xff;
+	for (i = 1; i < len; i++) {
+		rx[i] = regs[addr];
+		if (tx[0] & GYR_MNS) {
+			addr = (addr + 1) & 0x3f;
+		}
+	}
+}
+
+static void set_rates(int16_t x, int16_t y, int16_t z)
+{
+	int16_t v[3] = { x, y, z };
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		regs[GYR_OUT_X_L + 2 * i] = (uint16_t)v[i] & 0xff;
+		regs[GYR_OUT_X_H + 2 * i] = (uint16_t)v[i] >> 8;
+	}
+}
+
+static void read_sample(struct l3gd20_sample *s, uint32_t time)
+{
+	const uint8_t tx[L3GD20_BURST_LEN] = {
+		GYR_OUT_TEMP | GYR_RNW | GYR_MNS,
+	};
+	uint8_t rx[L3GD20_BURST_LEN];
+
+	chip_burst(tx, rx, L3GD20_BURST_LEN);
+	memset(s, 0x5a, sizeof(*s));
+	l3gd20_decode(rx, time, s);
+}
+
+int main(void)
+{
+	struct l3gd20_sample s;
+	int32_t v;
+	int i;
+
+	/* the burst covers OUT_TEMP up to OUT_Z_H and nothing more */
+	check(L3GD20_BURST_LEN == 1 + (GYR_OUT_X_L + 6 - GYR_OUT_TEMP),
+	      "burst length", L3GD20_BURST_LEN, 0);
+	check(GYR_STATUS_REG == GYR_OUT_TEMP + 1, "status follows temp", 0,
+	      0);
+	check(GYR_OUT_X_L == GYR_STATUS_REG + 1, "outputs follow status", 0,
+	      0);
+
+	/* every value on every axis, the others moving the other way */
+	for (v = -32768; v <= 32767; v++) {
+		set_rates(v, -v - 1, v ^ 0x5555);
+		read_sample(&s, v);
+		check(s.rate[0] == v, "x", s.rate[0], v);
+		check(s.rate[1] == -v - 1, "y", s.rate[1], -v - 1);
+		check(s.rate[2] == (int16_t)(v ^ 0x5555), "z", s.rate[2],
+		      (int16_t)(v ^ 0x5555));
+		check(s.time == (uint32_t)v, "time", s.time, v);
+	}
+
+	/* temperature is signed, status kept as is */
+	for (i = 0; i < 256; i++) {
+		regs[GYR_OUT_TEMP] = i;
+		regs[GYR_STATUS_REG] = 255 - i;
+		read_sample(&s, 0);
+		check(s.temp == (int8_t)i, "temp", s.temp, (int8_t)i);
+		check(s.status == 255 - i, "status", s.status, 255 - i);
+	}
+
+	/* without MS the chip would send OUT_TEMP over and over */
+	{
+		const uint8_t tx[L3GD20_BURST_LEN] = {
+			GYR_OUT_TEMP | GYR_RNW,
+		};
+		uint8_t rx[L3GD20_BURST_LEN];
+
+		regs[GYR_OUT_TEMP] = 0x12;
+		set_rates(0x3456, 0, 0);
+		chip_burst(tx, rx, L3GD20_BURST_LEN);
+		l3gd20_decode(rx, 0, &s);
+		check(s.rate[0] == 0x1212, "single register read", s.rate[0],
+		      0x1212);
+	}
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
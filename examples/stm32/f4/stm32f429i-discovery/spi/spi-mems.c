@@ -27,13 +27,13 @@
 #include <libopencm3/stm32/spi.h>
 #include "clock.h"
 #include "console.h"
+#include "l3gd20.h"
 
 /*
  * Functions defined for accessing the SPI port 8 bits at a time
  */
 uint16_t read_reg(int reg);
 void write_reg(uint8_t reg, uint8_t value);
-uint8_t read_xyz(int16_t vecs[3]);
 void spi_init(void);
 
 /*
@@ -127,35 +127,6 @@ read_reg(int reg)
 	return d2;
 }
 
-/*
- * uint8_t status = read_xyz(int16_t [])
- *
- * This function exploits the fact that you can do a read +
- * auto increment of the SPI registers. It starts at the
- * address of the X register and reads 6 bytes.
- *
- * Then the status register is read and returned.
- */
-uint8_t
-read_xyz(int16_t vecs[3])
-{
-	uint8_t	 buf[7];
-	int		 i;
-
-	gpio_clear(GPIOC, GPIO1); /* CS* select */
-	spi_send(SPI5, 0xc0 | 0x28);
-	(void) spi_read(SPI5);
-	for (i = 0; i < 6; i++) {
-		spi_send(SPI5, 0);
-		buf[i] = spi_read(SPI5);
-	}
-	gpio_set(GPIOC, GPIO1); /* CS* deselect */
-	vecs[0] = (buf[1] << 8 | buf[0]);
-	vecs[1] = (buf[3] << 8 | buf[2]);
-	vecs[3] = (buf[5] << 8 | buf[4]);
-	return read_reg(0x27); /* Status register */
-}
-
 /*
  * void write_reg(uint8_t register, uint8_t value)
  *
@@ -217,20 +188,28 @@ char *axes[] = { "X: ", "Y: ", "Z: " };
  * This then is the actual bit of example. It initializes the
  * SPI port, and then shows a continuous display of values on
  * the console once you start it. Typing ^C will reset it.
+ *
+ * The gyro produces 760 samples a second, far more than the
+ * console can show. The driver reads each one with a single DMA
+ * burst when the chip signals data ready, so here we just empty
+ * its FIFO and show the newest sample ten times a second.
  */
 int main(void)
 {
-	int16_t vecs[3];
+	struct l3gd20_sample sample = { 0, { 0, 0, 0 }, 0, 0 };
+	struct l3gd20_stats stats, last;
 	int16_t baseline[3];
 	int tmp, i;
 	int count;
-	uint32_t cr_tmp;
+	uint32_t cr_tmp, next;
 
 	clock_setup();
 	console_setup(115200);
 
 	/* Enable the GPIO ports whose pins we are using */
-	rcc_periph_clock_enable(RCC_GPIOF | RCC_GPIOC);
+	rcc_periph_clock_enable(RCC_GPIOF);
+	rcc_periph_clock_enable(RCC_GPIOC);
+	rcc_periph_clock_enable(RCC_GPIOA);
 
 	gpio_mode_setup(GPIOF, GPIO_MODE_AF, GPIO_PUPD_PULLDOWN,
 			GPIO7 | GPIO8 | GPIO9);
@@ -262,47 +241,53 @@ int main(void)
 	console_puts("MEMS demo (new version):\n");
 	console_puts("Press a key to read the registers\n");
 	console_getc(1);
-	tmp = read_reg(0xf);
-	if (tmp != 0xD4) {
+	tmp = read_reg(GYR_WHO_AM_I);
+	if ((tmp & 0xff) != 0xD4) {
 		console_puts("Maybe this isn't a Gyroscope.\n");
 	}
-	/*
-	 * These parameters are sort of random, clearly I need
-	 * set something. Based on the app note I reset the 'baseline'
-	 * values after 100 samples. But don't see a lot of change
-	 * when I move the board around. Z doesn't move at all but the
-	 * temperature reading is correct and the ID code returned is
-	 * as expected so the SPI code at least is working.
-	 */
-	write_reg(0x20, 0xcf);  /* Normal mode */
-	write_reg(0x21, 0x07);  /* standard filters */
-	write_reg(0x23, 0xb0);  /* 250 dps */
-	tmp = (int) read_reg(0x26);
-	console_puts("Temperature: ");
-	print_decimal(tmp);
-	console_puts(" C\n");
+
+	/* From here on the SPI port belongs to the DMA */
+	l3gd20_setup();
 
 	count = 0;
+	l3gd20_get_stats(&last);
+	next = mtime() + 100;
 	while (1) {
-		tmp = read_xyz(vecs);
+		while (l3gd20_get(&sample)) {
+			/* After a second at rest, take that as zero */
+			if (count == 760) {
+				for (i = 0; i < 3; i++) {
+					baseline[i] = sample.rate[i];
+				}
+			}
+			if (count <= 760) {
+				count++;
+			}
+		}
+
+		if ((int32_t)(mtime() - next) < 0) {
+			continue;
+		}
+		next += 100;
+
+		l3gd20_get_stats(&stats);
 		for (i = 0; i < 3; i++) {
 			int pad;
 			console_puts(axes[i]);
-			tmp = vecs[i] - baseline[i];
+			tmp = sample.rate[i] - baseline[i];
 			pad = print_decimal(tmp);
-			pad = 15 - pad;
+			pad = 10 - pad;
 			while (pad--) {
 				console_puts(" ");
 			}
 		}
-		console_putc('\r');
-		if (count == 100) {
-			baseline[0] = vecs[0];
-			baseline[1] = vecs[1];
-			baseline[2] = vecs[2];
-		} else {
-			count++;
-		}
-		msleep(100);
+		console_puts("T: ");
+		print_decimal(sample.temp);
+		console_puts("  ");
+		print_decimal(10 * (stats.samples - last.samples));
+		console_puts("/s lost: ");
+		print_decimal(stats.dropped + stats.overruns);
+		console_puts("   \r");
+		last = stats;
 	}
 }
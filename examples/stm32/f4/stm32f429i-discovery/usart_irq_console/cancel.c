@@ -0,0 +1,105 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The ^C state machine of the console, with no hardware access so
+ * cancel_host.c can run it on a PC.
+ *
+ * Cancellation works in two stages:
+ *
+ * The first ^C only sets a flag. Long running commands are expected
+ * to poll it (which is just a load of a volatile) and return to the
+ * command loop on their own. This is always safe since the command
+ * decides where it stops.
+ *
+ * If a second ^C arrives before the command loop has acknowledged the
+ * first one, the command is not listening, and the receive interrupt
+ * is told to pend PendSV. PendSV runs at the lowest priority, so when
+ * it is taken every other handler has finished and the frame on the
+ * stack is the one stacked by thread mode. cancel_frame() rewrites its
+ * return address, and the exception return drops into thread mode
+ * there.
+ */
+
+#include "cancel.h"
+
+void cancel_init(struct cancel *c)
+{
+	c->armed = false;
+	c->req = false;
+	c->stamp = 0;
+	c->latency_max = 0;
+}
+
+/*
+ * cancel_rx
+ *
+ * Every received character goes through here, from the receive
+ * interrupt, with the cycle count it came in at.
+ */
+enum cancel_action cancel_rx(struct cancel *c, char ch, uint32_t now)
+{
+	if (ch != CANCEL_CHAR) {
+		return CANCEL_NONE;
+	}
+	if (!c->req) {
+		c->stamp = now;
+		c->req = true;
+		return CANCEL_FLAGGED;
+	}
+	/* nobody is listening, unwind */
+	return CANCEL_UNWIND;
+}
+
+/*
+ * cancel_ack
+ *
+ * Called by the command loop once it is back in control. Clears the
+ * request and returns true, with how long it took to get there, if
+ * there was one.
+ */
+bool cancel_ack(struct cancel *c, uint32_t now, uint32_t *latency)
+{
+	if (!c->req) {
+		return false;
+	}
+	*latency = now - c->stamp;
+	if (*latency > c->latency_max) {
+		c->latency_max = *latency;
+	}
+	c->req = false;
+	return true;
+}
+
+/*
+ * cancel_frame
+ *
+ * Point the stacked exception frame (R0-R3, R12, LR, PC, xPSR) at pc.
+ * The IT/ICI bits in the stacked xPSR belong to the code we interrupted
+ * so they are cleared, only the Thumb bit and the stack alignment
+ * marker (bit 9) are kept so the unstacking stays balanced. Leaves the
+ * frame alone, and returns false, unless the command loop is armed.
+ */
+bool cancel_frame(const struct cancel *c, uint32_t *frame, uint32_t pc)
+{
+	if (!c->armed) {
+		return false;
+	}
+	frame[6] = pc;
+	frame[7] = (frame[7] & (1 << 9)) | (1 << 24);
+	return true;
+}
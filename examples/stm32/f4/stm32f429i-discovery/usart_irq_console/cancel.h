@@ -0,0 +1,44 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CANCEL_CHAR	'\003'
+
+enum cancel_action {
+	CANCEL_NONE,		/* not a ^C, queue the character */
+	CANCEL_FLAGGED,		/* first ^C, the command should notice */
+	CANCEL_UNWIND,		/* ^C again before the ack, pend PendSV */
+};
+
+struct cancel {
+	volatile bool armed;	/* the command loop can be unwound to */
+	volatile bool req;	/* ^C seen, not yet acknowledged */
+	volatile uint32_t stamp;	/* cycle count at the first ^C */
+	uint32_t latency_max;	/* worst case ^C to prompt */
+};
+
+void cancel_init(struct cancel *c);
+enum cancel_action cancel_rx(struct cancel *c, char ch, uint32_t now);
+bool cancel_ack(struct cancel *c, uint32_t now, uint32_t *latency);
+bool cancel_frame(const struct cancel *c, uint32_t *frame, uint32_t pc);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks cancel.c on the host:
+ *
+ *	cc -o cancel_host cancel_host.c cancel.c
+ *	./cancel_host
+ *
+ * Plays the receive interrupt and the command loop against each other:
+ * a command that polls and stops on the first ^C, one that ignores it
+ * and gets unwound by the second, ^C typed at the prompt, and PendSV
+ * being taken before the command loop is armed. The unwind is checked
+ * on a stacked frame, including the alignment marker and the IT bits of
+ * the interrupted code.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cancel.h"
+
+#define TRAMPOLINE	0x08000401
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+/*
+ * What the console sees of a run: characters that were queued, how
+ * often PendSV was pended, and what the last ack reported.
+ */
+struct run {
+	struct cancel c;
+	int queued;
+	int pended;
+	int acked;
+	uint32_t latency;
+};
+
+static void rx(struct run *r, char ch, uint32_t now)
+{
+	switch (cancel_rx(&r->c, ch, now)) {
+	case CANCEL_NONE:
+		r->queued++;
+		break;
+	case CANCEL_UNWIND:
+		r->pended++;
+		break;
+	case CANCEL_FLAGGED:
+		break;
+	}
+}
+
+static void ack(struct run *r, uint32_t now)
+{
+	if (cancel_ack(&r->c, now, &r->latency)) {
+		r->acked++;
+	}
+}
+
+static void start(struct run *r)
+{
+	memset(r, 0, sizeof(*r));
+	cancel_init(&r->c);
+	r->c.armed = true;
+}
+
+static void test_polling(void)
+{
+	struct run r;
+
+	start(&r);
+	rx(&r, 'c', 100);
+	rx(&r, '\r', 200);
+	check(r.queued == 2 && !r.c.req, "plain chars", r.queued, r.c.req);
+
+	/* the command notices the flag and returns to the loop */
+	rx(&r, CANCEL_CHAR, 1000);
+	check(r.c.req && r.pended == 0, "first ^C flags", r.c.req,
+	      r.pended);
+	check(r.queued == 2, "^C not queued", r.queued, 2);
+	ack(&r, 1700);
+	check(r.acked == 1 && r.latency == 700, "ack latency", r.acked,
+	      r.latency);
+	check(!r.c.req, "ack clears", r.c.req, 0);
+
+	/* nothing to ack the second time round */
+	ack(&r, 2000);
+	check(r.acked == 1, "idle ack", r.acked, 1);
+
+	/* once acked, the next ^C is a first ^C again */
+	rx(&r, CANCEL_CHAR, 5000);
+	check(r.pended == 0 && r.c.req, "^C after ack", r.pended, r.c.req);
+	ack(&r, 5300);
+	check(r.latency == 300 && r.c.latency_max == 700, "max kept",
+	      r.latency, r.c.latency_max);
+}
+
+static void test_unwind(void)
+{
+	struct run r;
+	int i;
+
+	start(&r);
+	rx(&r, CANCEL_CHAR, 1000);
+	/* the command is deaf, the user keeps hitting ^C */
+	for (i = 0; i < 3; i++) {
+		rx(&r, CANCEL_CHAR, 2000 + i);
+		check(r.pended == i + 1, "second ^C pends", r.pended, i + 1);
+	}
+	/* the stamp stays at the first ^C, that is what the user saw */
+	check(r.c.stamp == 1000, "stamp", r.c.stamp, 1000);
+	ack(&r, 9000);
+	check(r.latency == 8000 && r.c.latency_max == 8000, "unwind latency",
+	      r.latency, r.c.latency_max);
+	check(r.queued == 0, "nothing queued", r.queued, 0);
+}
+
+static void test_wrap(void)
+{
+	struct run r;
+
+	start(&r);
+	rx(&r, CANCEL_CHAR, UINT32_MAX - 99);
+	ack(&r, 400);
+	check(r.latency == 500, "cycle counter wrap", r.latency, 500);
+}
+
+static void test_frame(void)
+{
+	struct cancel c;
+	uint32_t frame[8];
+	int i;
+
+	cancel_init(&c);
+	for (i = 0; i < 8; i++) {
+		frame[i] = 0x1000 + i;
+	}
+	/* not armed yet, PendSV must leave the frame alone */
+	frame[6] = 0x08001234;
+	frame[7] = 0x0600fe00;
+	check(!cancel_frame(&c, frame, TRAMPOLINE), "unarmed", 0, 0);
+	check(frame[6] == 0x08001234 && frame[7] == 0x0600fe00,
+	      "unarmed frame", frame[6], frame[7]);
+
+	c.armed = true;
+	/* interrupted inside an IT block, on a realigned stack */
+	check(cancel_frame(&c, frame, TRAMPOLINE), "armed", 0, 0);
+	check(frame[6] == TRAMPOLINE, "pc", frame[6], TRAMPOLINE);
+	check(frame[7] == ((1 << 24) | (1 << 9)), "xpsr aligned", frame[7],
+	      (1 << 24) | (1 << 9));
+	for (i = 0; i < 6; i++) {
+		check(frame[i] == 0x1000 + (uint32_t)i, "regs kept", i,
+		      frame[i]);
+	}
+
+	/* no realignment, and a flags-only xPSR */
+	frame[7] = 0xf1000000;
+	cancel_frame(&c, frame, TRAMPOLINE);
+	check(frame[7] == (1 << 24), "xpsr", frame[7], 1 << 24);
+}
+
+int main(void)
+{
+	test_polling();
+	test_unwind();
+	test_wrap();
+	test_frame();
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
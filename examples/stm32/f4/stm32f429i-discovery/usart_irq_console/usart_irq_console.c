@@ -27,6 +27,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <setjmp.h>
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
@@ -35,7 +36,9 @@
 #include <libopencm3/stm32/iwdg.h>
 #include <libopencm3/cm3/scb.h>
 #include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
 #include "clock.h"
+#include "cancel.h"
 
 
 /*
@@ -59,31 +62,102 @@
 void console_putc(char c);
 char console_getc(int wait);
 void console_puts(char *s);
+void console_putu(uint32_t n);
 int console_gets(char *s, int len);
 
-/* this is for fun, if you type ^C to this example it will reset */
-#define RESET_ON_CTRLC
+/* this is for fun, if you type ^C to this example it cancels whatever
+ * command is running and returns to the prompt
+ */
+#define CANCEL_ON_CTRLC
+
+#ifdef CANCEL_ON_CTRLC
+
+bool console_cancelled(void);
+void console_cancel_ack(void);
+void pend_sv_handler(void) __attribute__((naked));
+void console_unwind_frame(uint32_t *frame);
+
+/*
+ * The ^C state machine itself is in cancel.c, see there for how the
+ * two stage cancellation works. What is left here is the glue: the
+ * cycle counter, the setjmp context and the PendSV handler which takes
+ * a second ^C back to the command loop through
+ * console_abort_trampoline().
+ */
+static jmp_buf cancel_jmp;		/* command loop context */
+static struct cancel console_cancel;
+
+/*
+ * bool console_cancelled(void)
+ *
+ * Cheap enough to call from the inner loop of any long running
+ * command.
+ */
+bool console_cancelled(void)
+{
+	return console_cancel.req;
+}
+
+/*
+ * console_cancel_ack(void)
+ *
+ * Called by the command loop once it is back in control, clears the
+ * request and reports how long it took to get there.
+ */
+void console_cancel_ack(void)
+{
+	uint32_t latency;
 
-#ifdef RESET_ON_CTRLC
+	if (!cancel_ack(&console_cancel, dwt_read_cycle_counter(),
+			&latency)) {
+		return;
+	}
 
-/* Jump buffer for setjmp/longjmp */
-jmp_buf	jump_buf;
+	console_puts("\n^C: cancelled after ");
+	console_putu(latency / (rcc_ahb_frequency / 1000000));
+	console_puts("us (worst case ");
+	console_putu(console_cancel.latency_max / (rcc_ahb_frequency / 1000000));
+	console_puts("us)\n");
+}
 
-static void do_the_nasty(void);
 /*
- * do_the_nasty
+ * console_abort_trampoline
  *
- * This is a hack to implement the equivalent of a signal interrupt
- * in a system without signals or a kernel or scheduler. Basically
- * when the console_getc() function reads a '^C' character, it munges
- * the return address of the interrupt to here, and then this function
- * does a longjump to the last place we did a setjmp.
+ * Thread mode landing point for the PendSV unwind. We never return
+ * from here.
  */
-static void do_the_nasty(void)
+static void console_abort_trampoline(void)
 {
-	longjmp(jump_buf, 1);
+	longjmp(cancel_jmp, 1);
 	while (1);
 }
+
+/*
+ * console_unwind_frame(uint32_t *frame)
+ *
+ * Point the frame PendSV was entered with at the trampoline.
+ */
+void console_unwind_frame(uint32_t *frame)
+{
+	cancel_frame(&console_cancel, frame,
+		     (uint32_t) &console_abort_trampoline);
+}
+
+/*
+ * PendSV handler, locate the frame that was stacked on entry (bit 2
+ * of EXC_RETURN tells us which stack it is on) and hand it to the C
+ * code. Naked, so the compiler doesn't push anything on top of it.
+ */
+void pend_sv_handler(void)
+{
+	__asm__ volatile (
+		"tst lr, #4\n"
+		"ite eq\n"
+		"mrseq r0, msp\n"
+		"mrsne r0, psp\n"
+		"b console_unwind_frame\n"
+	);
+}
 #endif
 
 /* This is a ring buffer to holding characters as they are typed
@@ -117,27 +191,23 @@ void usart1_isr(void)
 		reg = USART_SR(CONSOLE_UART);
 		if (reg & USART_SR_RXNE) {
 			recv_buf[recv_ndx_nxt] = USART_DR(CONSOLE_UART);
-#ifdef RESET_ON_CTRLC
-			/* Check for "reset" */
-			if (recv_buf[recv_ndx_nxt] == '\003') {
-				/* reset the system volatile definition of
-				 * return address on the stack to insure it
-				 * gets stored, changed to point to the
-				 * trampoline function (do_the_nasty) which is
-				 * required because we need to return of an
-				 * interrupt to get the internal value of the
-				 * LR register reset and put the processor back
-				 * into "Thread" mode from "Handler" mode.
-				 *
-				 * See the PM0214 Programming Manual for Cortex
-				 * M, pg 42, to see the format of the Cortex M4
-				 * stack after an interrupt or exception has
-				 * occurred.
+#ifdef CANCEL_ON_CTRLC
+			/* Check for "cancel", the ^C itself is not queued */
+			switch (cancel_rx(&console_cancel,
+					  recv_buf[recv_ndx_nxt],
+					  dwt_read_cycle_counter())) {
+			case CANCEL_NONE:
+				break;
+			case CANCEL_UNWIND:
+				/*
+				 * ICSR is write-one-to-set, a read-modify-
+				 * write could also write back a set
+				 * PENDSTSET and pend a spurious SysTick.
 				 */
-				volatile uint32_t *ret = (&reg) + 7;
-
-				*ret = (uint32_t) &do_the_nasty;
-				return;
+				SCB_ICSR = SCB_ICSR_PENDSVSET;
+				continue;
+			case CANCEL_FLAGGED:
+				continue;
 			}
 #endif
 			/* Check for "overrun" */
@@ -173,13 +243,20 @@ void console_putc(char c)
  * otherwise return 0 if called and no character was available.
  *
  * The implementation is a bit different however, now it looks
- * in the ring buffer to see if a character has arrived.
+ * in the ring buffer to see if a character has arrived. A ^C
+ * also ends the wait, returning 0.
  */
 char console_getc(int wait)
 {
 	char		c = 0;
 
-	while ((wait != 0) && (recv_ndx_cur == recv_ndx_nxt));
+	while ((wait != 0) && (recv_ndx_cur == recv_ndx_nxt)) {
+#ifdef CANCEL_ON_CTRLC
+		if (console_cancelled()) {
+			return 0;
+		}
+#endif
+	}
 	if (recv_ndx_cur != recv_ndx_nxt) {
 		c = recv_buf[recv_ndx_cur];
 		recv_ndx_cur = (recv_ndx_cur + 1) % RECV_BUF_SIZE;
@@ -206,12 +283,32 @@ void console_puts(char *s)
 	}
 }
 
+/*
+ * void console_putu(uint32_t n)
+ *
+ * Send an unsigned number to the console in decimal.
+ */
+void console_putu(uint32_t n)
+{
+	char buf[11];
+	int i = 0;
+
+	do {
+		buf[i++] = (n % 10) + '0';
+		n /= 10;
+	} while (n != 0);
+	while (i > 0) {
+		console_putc(buf[--i]);
+	}
+}
+
 /*
  * int console_gets(char *s, int len)
  *
  * Wait for a string to be entered on the console, limited
  * support for editing characters (back space and delete)
- * end when a <CR> character is received.
+ * end when a <CR> character is received, or the input is
+ * cancelled with ^C in which case nothing is returned.
  */
 int console_gets(char *s, int len)
 {
@@ -221,6 +318,12 @@ int console_gets(char *s, int len)
 	*t = '\000';
 	/* read until a <CR> is received */
 	while ((c = console_getc(1)) != '\r') {
+#ifdef CANCEL_ON_CTRLC
+		if (console_cancelled()) {
+			*s = '\000';
+			return 0;
+		}
+#endif
 		if ((c == '\010') || (c == '\127')) {
 			if (t > s) {
 				/* send ^H ^H to erase previous character */
@@ -241,6 +344,7 @@ int console_gets(char *s, int len)
 }
 
 void countdown(void);
+void hog(void);
 
 /*
  * countdown
@@ -250,12 +354,18 @@ void countdown(void);
  * This provides an example function which is constantly
  * printing for 20 seconds and not looking for typed characters.
  * however with the interrupt driven receieve queue you can type
- * ^C while it is counting down and it will be interrupted.
+ * ^C while it is counting down and it will stop at the next
+ * step.
  */
 void countdown(void)
 {
 	int i = 200;
 	while (i-- > 0) {
+#ifdef CANCEL_ON_CTRLC
+		if (console_cancelled()) {
+			return;
+		}
+#endif
 		console_puts("Countdown: ");
 		console_putc((i / 600) + '0');
 		console_putc(':');
@@ -268,6 +378,20 @@ void countdown(void)
 	}
 }
 
+/*
+ * hog
+ *
+ * Spin forever without ever checking for ^C, the only way out of
+ * here is the forced unwind on the second ^C.
+ */
+void hog(void)
+{
+	console_puts("Spinning, press ^C twice to get out\n");
+	while (1) {
+		__asm__("nop");
+	}
+}
+
 /*
  * Set up the GPIO subsystem with an "Alternate Function"
  * on some of the pins, in this case connected to a
@@ -277,7 +401,6 @@ int main(void)
 {
 	char buf[128];
 	int	len;
-	bool pmask;
 
 	clock_setup(); /* initialize our clock */
 
@@ -324,23 +447,41 @@ int main(void)
 	 * simple application to run on it.
 	 */
 	console_puts("\nUART Demonstration Application\n");
-#ifdef RESET_ON_CTRLC
-	console_puts("Press ^C at any time to reset system.\n");
-	pmask = cm_mask_interrupts(0);
-	cm_mask_interrupts(pmask);
-	if (setjmp(jump_buf)) {
-		console_puts("\nInterrupt received! Restarting from the top\n");
+#ifdef CANCEL_ON_CTRLC
+	console_puts("Press ^C to cancel a command, twice if it won't stop.\n");
+	cancel_init(&console_cancel);
+	dwt_enable_cycle_counter();
+	/* PendSV must only run once all other handlers are done */
+	nvic_set_priority(NVIC_PENDSV_IRQ, 0xff);
+	if (setjmp(cancel_jmp)) {
+		console_puts("\nCommand unwound");
 	}
+	console_cancel.armed = true;
 #endif
 	while (1) {
+#ifdef CANCEL_ON_CTRLC
+		console_cancel_ack();
+#endif
 		console_puts("Enter a string: ");
 		len = console_gets(buf, 128);
+#ifdef CANCEL_ON_CTRLC
+		if (console_cancelled()) {
+			continue;
+		}
+#endif
 		if (len) {
 			if (buf[0] == 'c') {
 				console_puts("\n");
 				countdown();	/* long running thing (20
 						   seconds) */
+			} else if (buf[0] == 'h') {
+				hog();
+			}
+#ifdef CANCEL_ON_CTRLC
+			if (console_cancelled()) {
+				continue;
 			}
+#endif
 			console_puts("\nYou entered : '");
 			console_puts(buf);
 			console_puts("'\n");
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define INPUT_PINS	16
+#define INPUT_QUEUE	16	/* power of two */
+
+enum input_type {
+	INPUT_PRESS,
+	INPUT_RELEASE,
+	INPUT_LONG,		/* held for the long press time */
+	INPUT_REPEAT,		/* and every repeat time after that */
+};
+
+/* Times are ticks of the free running timer the edges are stamped with */
+struct input_event {
+	uint32_t time;		/* the first edge, or when it fell due */
+	uint32_t held;		/* since the press */
+	uint16_t repeat;	/* repeats so far */
+	uint8_t pin;
+	uint8_t type;
+};
+
+struct input_pin {
+	uint32_t long_press;	/* 0 for no long press and no repeats */
+	uint32_t repeat;	/* 0 for no repeats */
+
+	bool unsettled;		/* edges since it last settled */
+	uint32_t first_edge, last_edge;
+
+	uint8_t state;
+	uint32_t pressed_at;
+	uint32_t due;		/* next long press or repeat */
+	uint16_t repeats;
+};
+
+struct input {
+	uint32_t debounce;	/* quiet time before a level counts */
+	int pins;
+	struct input_pin pin[INPUT_PINS];
+
+	struct input_event queue[INPUT_QUEUE];
+	volatile uint8_t head, tail;
+	uint32_t lost;		/* events the queue had no room for */
+};
+
+void input_init(struct input *in, uint32_t debounce);
+int input_add(struct input *in, uint32_t long_press, uint32_t repeat);
+void input_edge(struct input *in, int pin, uint32_t now);
+bool input_tick(struct input *in, uint32_t now, uint32_t pressed);
+bool input_get(struct input *in, struct input_event *ev);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The echo itself, the UART is behind struct echo_uart_ops so
+ * echo_host.c can run this against a model of the FIFOs.
+ */
+
+#include "echo.h"
+
+void echo_init(struct echo *e, const struct echo_uart_ops *ops)
+{
+	e->ops = ops;
+	e->head = e->tail = 0;
+	e->max = 0;
+}
+
+/*
+ * Move as much as possible from the buffer to the TX FIFO. The TX
+ * interrupt is only needed while the buffer has something left over.
+ * It is edge triggered, on the FIFO level dropping through the trigger,
+ * which is fine since anything left over means the FIFO is full.
+ */
+static void echo_flush(struct echo *e)
+{
+	while ((e->tail != e->head) && !e->ops->tx_full()) {
+		e->ops->send(e->buf[e->tail % ECHO_BUF_SIZE]);
+		e->tail++;
+	}
+	e->ops->tx_irq(e->tail != e->head);
+}
+
+/*
+ * echo_irq
+ *
+ * Called from the UART interrupt, whatever the cause. Drains the whole
+ * RX FIFO and echoes it as one block. If the buffer is full what is
+ * left stays in the RX FIFO until the next interrupt.
+ */
+void echo_irq(struct echo *e)
+{
+	while (!e->ops->rx_empty() &&
+	       (e->head - e->tail < ECHO_BUF_SIZE)) {
+		e->buf[e->head % ECHO_BUF_SIZE] = e->ops->recv();
+		e->head++;
+	}
+	if (e->head - e->tail > e->max) {
+		e->max = e->head - e->tail;
+	}
+	echo_flush(e);
+}
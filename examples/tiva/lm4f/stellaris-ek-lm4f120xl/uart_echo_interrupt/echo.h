@@ -0,0 +1,50 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ECHO_H
+#define ECHO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Must be a power of two */
+#define ECHO_BUF_SIZE		64
+
+/* The parts of the UART the echo needs */
+struct echo_uart_ops {
+	bool (*rx_empty)(void);
+	uint8_t (*recv)(void);
+	bool (*tx_full)(void);
+	void (*send)(uint8_t c);
+	void (*tx_irq)(bool on);	/* TX FIFO below its trigger level */
+};
+
+/*
+ * Characters waiting for room in the TX FIFO. The UART interrupt is the
+ * only user, so no locking is needed.
+ */
+struct echo {
+	const struct echo_uart_ops *ops;
+	uint8_t buf[ECHO_BUF_SIZE];
+	uint32_t head, tail;
+	uint32_t max;			/* most ever waiting in buf */
+};
+
+void echo_init(struct echo *e, const struct echo_uart_ops *ops);
+void echo_irq(struct echo *e);
+
+#endif
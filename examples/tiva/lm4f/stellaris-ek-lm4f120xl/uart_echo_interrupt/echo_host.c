@@ -0,0 +1,258 @@
+/*
+ * This file is part of the libopencm3 project.
+ *
+ * This library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks echo.c on the host:
+ *
+ *	cc -o echo_host echo_host.c echo.c
+ *	./echo_host
+ *
+ * A model of the LM4F UART with its 16 byte FIFOs steps one bit time at
+ * a time. The RX interrupt is raised when the RX FIFO fills up to its
+ * half full trigger, the receive timeout once the line has been quiet
+ * for 32 bit times with something in the FIFO, and the TX interrupt
+ * when the TX FIFO drains through 1/8 full, all of them edge triggered
+ * as on the real part. The host sends single characters, long
+ * bursts, and bursts into a transmitter that is held off for a while,
+ * and everything has to come back once, in order, with nothing lost in
+ * the RX FIFO and the TX interrupt left off at the end.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "echo.h"
+
+#define FIFO		16
+#define RX_TRIG		(FIFO / 2)
+#define TX_TRIG		(FIFO / 8)
+#define RT_BITS		32
+#define BYTE_BITS	10
+
+#define MAX_BYTES	8192
+
+static int checks, failed;
+
+static void check(int ok, const char *what, long a, long b)
+{
+	checks++;
+	if (!ok) {
+		failed++;
+		if (failed <= 20) {
+			printf("FAIL %s (%ld, %ld)\n", what, a, b);
+		}
+	}
+}
+
+struct fifo {
+	uint8_t data[FIFO];
+	int head, tail;
+};
+
+static int fifo_len(const struct fifo *f)
+{
+	return f->head - f->tail;
+}
+
+static struct uart {
+	struct fifo rx, tx;
+	bool rx_flag, rt_flag, tx_flag;
+	bool tx_irq;
+	int quiet;		/* bit times since the last RX byte */
+	int shift;		/* bit times left on the byte going out */
+	int overruns;
+	int irqs;
+	uint8_t out[MAX_BYTES];
+	int nout;
+} u;
+
+static bool m_rx_empty(void)
+{
+	return fifo_len(&u.rx) == 0;
+}
+
+static uint8_t m_recv(void)
+{
+	return u.rx.data[u.rx.tail++ % FIFO];
+}
+
+static bool m_tx_full(void)
+{
+	return fifo_len(&u.tx) == FIFO;
+}
+
+static void m_send(uint8_t c)
+{
+	check(fifo_len(&u.tx) < FIFO, "send into full TX FIFO", 0, 0);
+	u.tx.data[u.tx.head++ % FIFO] = c;
+}
+
+static void m_tx_irq(bool on)
+{
+	u.tx_irq = on;
+}
+
+static const struct echo_uart_ops ops = {
+	m_rx_empty, m_recv, m_tx_full, m_send, m_tx_irq
+};
+
+static struct echo e;
+
+/* A byte is in from the line */
+static void rx_byte(uint8_t c)
+{
+	if (fifo_len(&u.rx) == FIFO) {
+		u.overruns++;
+		return;
+	}
+	u.rx.data[u.rx.head++ % FIFO] = c;
+	if (fifo_len(&u.rx) == RX_TRIG) {
+		u.rx_flag = true;
+	}
+	u.quiet = 0;
+}
+
+/*
+ * One bit time: shift out, raise what should be raised and run the
+ * interrupt if anything is pending. With hold the transmitter is held
+ * off, as by flow control on the other end.
+ */
+static void bit(bool hold)
+{
+	int before = fifo_len(&u.tx);
+
+	if (!hold) {
+		if ((u.shift == 0) && (fifo_len(&u.tx) != 0)) {
+			u.out[u.nout++ % MAX_BYTES] =
+				u.tx.data[u.tx.tail++ % FIFO];
+			u.shift = BYTE_BITS;
+		}
+		if (u.shift != 0) {
+			u.shift--;
+		}
+	}
+	if ((before > TX_TRIG) && (fifo_len(&u.tx) <= TX_TRIG)) {
+		u.tx_flag = true;
+	}
+	if ((++u.quiet == RT_BITS) && (fifo_len(&u.rx) != 0)) {
+		u.rt_flag = true;
+	}
+	if (u.rx_flag || u.rt_flag || (u.tx_flag && u.tx_irq)) {
+		/* uart0_isr() clears all three, then hands over */
+		u.rx_flag = u.rt_flag = u.tx_flag = false;
+		u.irqs++;
+		echo_irq(&e);
+	}
+}
+
+static void reset(void)
+{
+	memset(&u, 0, sizeof(u));
+	echo_init(&e, &ops);
+}
+
+/*
+ * Send in bytes starting at every gap bit times (BYTE_BITS is back to
+ * back), with the transmitter held off between hold_from and hold_to,
+ * then let the line run until it is quiet.
+ */
+static void run(const char *what, int n, int gap, int hold_from,
+		int hold_to)
+{
+	uint8_t in[MAX_BYTES];
+	int i, t, next = 0;
+
+	reset();
+	for (i = 0; i < n; i++) {
+		in[i] = i * 13 + 5;
+	}
+	for (t = 0, i = 0; (i < n) || (t < next + 40 * BYTE_BITS); t++) {
+		if ((i < n) && (t == next)) {
+			rx_byte(in[i++]);
+			next = t + gap;
+		}
+		bit((t >= hold_from) && (t < hold_to));
+	}
+	/* and wait for everything to leave */
+	for (i = 0; i < 100 * BYTE_BITS; i++) {
+		bit(false);
+	}
+
+	check(u.overruns == 0, what, u.overruns, 0);
+	check(u.nout == n, what, u.nout, n);
+	check(memcmp(u.out, in, n) == 0, what, 0, 0);
+	check(!u.tx_irq, what, u.tx_irq, 0);
+	check(e.head == e.tail, what, e.head, e.tail);
+	check(fifo_len(&u.rx) == 0, what, fifo_len(&u.rx), 0);
+}
+
+int main(void)
+{
+	/* one character, only the receive timeout sees it */
+	run("single", 1, BYTE_BITS, 0, 0);
+	check(u.irqs == 1, "single irqs", u.irqs, 1);
+
+	/* typed, well apart */
+	run("typed", 20, 200, 0, 0);
+	check(u.irqs == 20, "typed irqs", u.irqs, 20);
+
+	/* less than the trigger, then quiet */
+	run("short burst", RX_TRIG - 1, BYTE_BITS, 0, 0);
+	check(u.irqs == 1, "short burst irqs", u.irqs, 1);
+
+	/* back to back, the FIFO trigger does the work */
+	run("burst", 4000, BYTE_BITS, 0, 0);
+	check(u.irqs <= 4000 / RX_TRIG + 2, "burst irqs", u.irqs,
+	      4000 / RX_TRIG);
+	check(e.max <= FIFO, "burst buffered", e.max, FIFO);
+
+	/* held off, the buffer and the TX interrupt take the slack */
+	run("held", 200, BYTE_BITS, 300, 300 + 40 * BYTE_BITS);
+	check(e.max > FIFO, "held buffered", e.max, FIFO);
+
+	/*
+	 * Held off for longer than the buffer and both FIFOs can cover:
+	 * the RX FIFO is left alone while the buffer is full and
+	 * overruns, but what does come back is in order.
+	 */
+	reset();
+	{
+		int t, i = 0;
+
+		for (t = 0; t < 200 * BYTE_BITS; t++) {
+			if ((t % BYTE_BITS) == 0) {
+				rx_byte(i++);
+			}
+			bit(t < 150 * BYTE_BITS);
+		}
+		for (t = 0; t < 200 * BYTE_BITS; t++) {
+			bit(false);
+		}
+		check(e.max == ECHO_BUF_SIZE, "long hold buffered", e.max,
+		      ECHO_BUF_SIZE);
+		check(u.overruns + u.nout == i, "long hold conserved",
+		      u.overruns + u.nout, i);
+		check(u.overruns > 0, "long hold overruns", u.overruns, 0);
+		for (t = 0; t < ECHO_BUF_SIZE + FIFO; t++) {
+			check(u.out[t] == t, "long hold order", u.out[t], t);
+		}
+		check(!u.tx_irq, "long hold tx irq", u.tx_irq, 0);
+	}
+
+	printf("%d checks, %d failed\n", checks, failed);
+	return failed ? 1 : 0;
+}
@@ -19,11 +19,86 @@
  */
 
 #include <libopencm3/lm4f/systemcontrol.h>
+#include <libopencm3/lm4f/rcc.h>
 #include <libopencm3/lm4f/gpio.h>
 #include <libopencm3/lm4f/uart.h>
 #include <libopencm3/lm4f/nvic.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
 
-static void uart_setup(void)
+#include "echo.h"
+
+#define PLL_DIV_80MHZ		5
+
+static struct echo echo;
+
+static const uint32_t std_bauds[] = {
+	9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600,
+	1000000, 1500000, 2000000, 3000000, 0
+};
+
+/*
+ * Clock setup:
+ * Take the main crystal oscillator at 16MHz, run it through the PLL, and divide
+ * the 400MHz PLL clock to get a system clock of 80MHz. The UART runs from it
+ * as well, which allows baud rates up to 5Mbaud.
+ */
+static void clock_setup(void)
+{
+	rcc_sysclk_config(OSCSRC_MOSC, XTAL_16M, PLL_DIV_80MHZ);
+	dwt_enable_cycle_counter();
+}
+
+/*
+ * Autobaud:
+ * The host sends 'U' (0x55), which on the wire is a start bit followed by
+ * alternating bits, so falling edges arrive exactly two bit times apart.
+ * With PA0 still a plain GPIO input, poll it with interrupts off and
+ * timestamp five falling edges with the DWT cycle counter, which spans
+ * eight bit times. Polling costs only a few cycles per sample, so this
+ * still works at a few Mbaud where an edge interrupt would not keep up.
+ *
+ * Returns the baud rate, snapped to a standard rate if one is within 4%,
+ * or 0 if the edges were not evenly spaced (the host sent something else).
+ */
+static uint32_t autobaud_measure(void)
+{
+	uint32_t t[5], bits8, bit, baud, i, d;
+
+	gpio_mode_setup(GPIOA, GPIO_MODE_INPUT, GPIO_PUPD_PULLUP, GPIO0);
+
+	cm_disable_interrupts();
+	/* Make sure we start in the idle (high) state */
+	while (!gpio_read(GPIOA, GPIO0));
+	for (i = 0; i < 5; i++) {
+		while (gpio_read(GPIOA, GPIO0));
+		t[i] = dwt_read_cycle_counter();
+		while (!gpio_read(GPIOA, GPIO0));
+	}
+	cm_enable_interrupts();
+
+	bits8 = t[4] - t[0];
+	bit = bits8 / 8;
+	/* Every edge to edge gap must be two bit times, +/- half a bit */
+	for (i = 1; i < 5; i++) {
+		d = t[i] - t[i - 1];
+		if ((d < 2 * bit - bit / 2) || (d > 2 * bit + bit / 2)) {
+			return 0;
+		}
+	}
+
+	baud = (8 * rcc_get_system_clock_frequency() + bits8 / 2) / bits8;
+	for (i = 0; std_bauds[i] != 0; i++) {
+		d = (baud > std_bauds[i]) ? baud - std_bauds[i] :
+					    std_bauds[i] - baud;
+		if (d < std_bauds[i] / 25) {
+			return std_bauds[i];
+		}
+	}
+	return baud;
+}
+
+static void uart_setup(uint32_t baud)
 {
 	/* Enable GPIOA in run mode. */
 	periph_clock_enable(RCC_GPIOA);
@@ -36,47 +111,96 @@ static void uart_setup(void)
 	__asm__("nop");
 	/* Disable the UART while we mess with its setings */
 	uart_disable(UART0);
-	/* Configure the UART clock source as precision internal oscillator */
-	uart_clock_from_piosc(UART0);
+	/* Configure the UART clock source as the system clock */
+	uart_clock_from_sysclk(UART0);
 	/* Set communication parameters */
-	uart_set_baudrate(UART0, 921600);
+	uart_set_baudrate(UART0, baud);
 	uart_set_databits(UART0, 8);
 	uart_set_parity(UART0, UART_PARITY_NONE);
 	uart_set_stopbits(UART0, 1);
+	/*
+	 * Use the 16 byte FIFOs, the RX interrupt now fires when the FIFO is
+	 * half full instead of on every character, and TX when it is
+	 * almost empty.
+	 */
+	uart_enable_fifo(UART0);
+	uart_set_fifo_trigger_levels(UART0, UART_FIFO_RX_TRIG_1_2,
+				     UART_FIFO_TX_TRIG_1_8);
 	/* Now that we're done messing with the settings, enable the UART */
 	uart_enable(UART0);
 }
 
 static void uart_irq_setup(void)
 {
-	/* Gimme and RX interrupt */
-	uart_enable_rx_interrupt(UART0);
+	/*
+	 * RX for the FIFO threshold, RT (receive timeout) for anything left
+	 * below the threshold once the line goes quiet for 32 bit times.
+	 */
+	uart_enable_interrupts(UART0, UART_INT_RX | UART_INT_RT);
 	/* Make sure the interrupt is routed through the NVIC */
 	nvic_enable_irq(NVIC_UART0_IRQ);
 }
 
+static bool uart0_rx_empty(void)
+{
+	return uart_is_rx_fifo_empty(UART0);
+}
+
+static uint8_t uart0_recv(void)
+{
+	return uart_recv(UART0);
+}
+
+static bool uart0_tx_full(void)
+{
+	return uart_is_tx_fifo_full(UART0);
+}
+
+static void uart0_send(uint8_t c)
+{
+	uart_send(UART0, c);
+}
+
+static void uart0_tx_irq(bool on)
+{
+	if (on) {
+		uart_enable_interrupts(UART0, UART_INT_TX);
+	} else {
+		uart_disable_interrupts(UART0, UART_INT_TX);
+	}
+}
+
+static const struct echo_uart_ops uart0_ops = {
+	uart0_rx_empty, uart0_recv, uart0_tx_full, uart0_send, uart0_tx_irq
+};
+
 /*
  * uart0_isr is declared as a weak function. When we override it here, the
  * libopencm3 build system takes care that it becomes our UART0 ISR.
  */
 void uart0_isr(void)
 {
-	uint8_t rx;
-	uint32_t irq_clear = 0;
-
-	if (uart_is_interrupt_source(UART0, UART_INT_RX)) {
-		rx = uart_recv(UART0);
-		uart_send(UART0, rx);
-		irq_clear |= UART_INT_RX;
-	}
+	uint32_t irq_clear = UART_INT_RX | UART_INT_RT | UART_INT_TX;
 
 	uart_clear_interrupt_flag(UART0, irq_clear);
+	echo_irq(&echo);
 }
 
 int main(void)
 {
+	uint32_t baud;
+
 	gpio_enable_ahb_aperture();
-	uart_setup();
+	clock_setup();
+	periph_clock_enable(RCC_GPIOA);
+
+	/* Keep trying until the host sends us a clean 'U' */
+	do {
+		baud = autobaud_measure();
+	} while (baud == 0);
+
+	echo_init(&echo, &uart0_ops);
+	uart_setup(baud);
 	uart_irq_setup();
 
 	/*
@@ -42,6 +42,11 @@ static void uart_setup(void)
 	uart_set_databits(UART0, 8);
 	uart_set_parity(UART0, UART_PARITY_NONE);
 	uart_set_stopbits(UART0, 1);
+	/*
+	 * Without the FIFOs there is only a one character holding register,
+	 * so anything arriving while we wait to send would be lost.
+	 */
+	uart_enable_fifo(UART0);
 	/* Now that we're done messing with the settings, enable the UART */
 	uart_enable(UART0);
 